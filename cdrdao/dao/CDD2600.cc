@@ -244,7 +244,7 @@ void CDD2600::abortDao()
 // return: 0: OK
 //         1: scsi command failed
 int CDD2600::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-		       long &lba, const char *buf, long len)
+		       long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
   assert(blockLength_ > 0);
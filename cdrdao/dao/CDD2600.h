@@ -50,7 +50,7 @@ public:
   void abortDao();
 
   int writeData(TrackData::Mode, TrackData::SubChannelMode, long &lba,
-		const char *buf, long len);
+		char *buf, long len);
 
   Toc *readDiskToc(int, const char *);
   Toc *readDisk(int, const char *);
@@ -32,12 +32,15 @@
 
 #include "CdrDriver.h"
 #include "PWSubChannel96.h"
+#include "SubChannelBatch.h"
 #include "Toc.h"
 #include "util.h"
 #include "log.h"
+#include "stats.h"
 #include "CdTextItem.h"
 #include "data.h"
 #include "port.h"
+#include "lec.h"
 
 // all drivers
 #include "CDD2600.h"
@@ -57,6 +60,17 @@
 #include "cdda_interface.h"
 #include "../paranoia/cdda_paranoia.h"
 
+// Alignment of SCSI data buffers. The Linux sg driver transfers data
+// directly from/to user memory only if the buffer satisfies the alignment
+// of the host adapter (up to 2048 bytes for ATAPI and USB).
+#define TRANSFER_ALIGN 4096
+
+// Returns the first aligned address of a buffer that was allocated with
+// 'TRANSFER_ALIGN' additional bytes.
+static unsigned char *alignBuffer(unsigned char *mem)
+{
+  return mem + TRANSFER_ALIGN - ((unsigned long)mem % TRANSFER_ALIGN);
+}
 
 typedef CdrDriver *(*CdrDriverConstructor)(ScsiIf *, unsigned long);
 
@@ -169,6 +183,7 @@ static DriverSelectTable BUILTIN_WRITE_DRIVER_TABLE[] = {
 { "generic-mmc", "AOPEN", "CD-RW-241040", 0, NULL },
 { "generic-mmc", "AOPEN", "CRW9624", 0, NULL },
 { "generic-mmc", "CD-RW", "CDR-2440MB", OPT_MMC_CD_TEXT, NULL },
+{ "generic-mmc", "CDRDAO", "SIMULATED DRIVE", OPT_MMC_CD_TEXT, NULL },
 { "generic-mmc", "CREATIVE", "CD-RW RW1210E", 0, NULL },
 { "generic-mmc", "CREATIVE", "CD-RW RW4424", 0, NULL },
 { "generic-mmc", "CREATIVE", "CD-RW RW8433E", OPT_MMC_CD_TEXT, NULL },
@@ -864,6 +879,7 @@ CdrDriver::CdrDriver(ScsiIf *scsiIf, unsigned long options)
 
   enableBufferUnderRunProtection_ = 1;
   enableWriteSpeedControl_ = 1;
+  enableAdaptiveSpeed_ = 0;
 
   readCapabilities_ = 0; // reading capabilities are determined dynamically
 
@@ -871,6 +887,8 @@ CdrDriver::CdrDriver(ScsiIf *scsiIf, unsigned long options)
 
   fastTocReading_ = false;
   rawDataReading_ = false;
+  lecCorrection_ = true;
+  imageIo_ = ImageWriter::BUFFERED;
   mode2Mixed_ = true;
   subChanReadMode_ = TrackData::SUBCHAN_NONE;
   taoSource_ = 0;
@@ -888,16 +906,37 @@ CdrDriver::CdrDriver(ScsiIf *scsiIf, unsigned long options)
   blockLength_ = 0;
   blocksPerWrite_ = 0;
   zeroBuffer_ = NULL;
+  writeCmdCount_ = 0;
+  writeCmdBytes_ = 0;
   
   userCapacity_ = 0;
   fullBurn_ = false;
 
   scsiMaxDataLen_ = scsiIf_->maxDataLen();
 
-  transferBuffer_ = new unsigned char[scsiMaxDataLen_];
+  // read data lands directly in the buffer shared with the kernel if the
+  // SCSI interface provides one
+  transferBufferMapped_ = (scsiIf_->mappedBuffer() != NULL);
+
+  if (transferBufferMapped_) {
+    transferBufferMem_ = NULL;
+    transferBuffer_ = scsiIf_->mappedBuffer();
+  }
+  else {
+    transferBufferMem_ = new unsigned char[scsiMaxDataLen_ + TRANSFER_ALIGN];
+    transferBuffer_ = alignBuffer(transferBufferMem_);
+  }
 
   maxScannedSubChannels_ = scsiMaxDataLen_ / (AUDIO_BLOCK_LEN + PW_SUBCHANNEL_LEN);
   scannedSubChannels_ = new SubChannel*[maxScannedSubChannels_];
+  subChannelBatch_ = new SubChannelBatch(maxScannedSubChannels_);
+
+  memset(readAheadCmds_, 0, sizeof(readAheadCmds_));
+  readAheadDepth_ = 0;
+  readAheadHead_ = 0;
+  readAheadCount_ = 0;
+  readAheadMisses_ = 0;
+  readAheadEnd_ = 0;
 
   paranoia_ = NULL;
   paranoiaDrive_ = NULL;
@@ -911,11 +950,23 @@ CdrDriver::~CdrDriver()
   delete[] zeroBuffer_;
   zeroBuffer_ = NULL;
 
-  delete[] transferBuffer_;
+  delete[] transferBufferMem_;
+  transferBufferMem_ = NULL;
   transferBuffer_ = NULL;
 
   delete [] scannedSubChannels_;
   scannedSubChannels_ = NULL;
+
+  delete subChannelBatch_;
+  subChannelBatch_ = NULL;
+
+  readAheadDrain();
+
+  for (int i = 0; i < READ_AHEAD_DEPTH; i++) {
+    delete[] readAheadCmds_[i].mem;
+    readAheadCmds_[i].mem = NULL;
+    readAheadCmds_[i].data = NULL;
+  }
 }
 
 // Sets multi session mode. 0: close session, 1: open next session
@@ -1036,10 +1087,241 @@ int CdrDriver::sendCmd(const unsigned char *cmd, int cmdLen,
 		       unsigned char *dataIn, int dataInLen,
 		       int showErrorMsg) const
 {
+  long long start;
+  int ret;
+
+  if (dataInLen > 0 && readAheadDepth_ > 0 &&
+      (cmd[0] == 0x28 || cmd[0] == 0xa8 || cmd[0] == 0xbe || cmd[0] == 0xd8))
+    return readAheadCmd(cmd, cmdLen, dataIn, dataInLen, showErrorMsg);
+
+  // keep the command order, queued READ commands must finish first
+  readAheadDrain();
+
+  if (dataOutLen > 0 && (cmd[0] == 0x2a /* WRITE(10) */ ||
+			 cmd[0] == 0xaa /* WRITE(12) */)) {
+    writeCmdCount_ += 1;
+    writeCmdBytes_ += dataOutLen;
+
+    start = stats_start();
+    ret = scsiIf_->sendCmd(cmd, cmdLen, dataOut, dataOutLen, dataIn,
+			   dataInLen, showErrorMsg);
+    stats_end(STAT_SCSI_WRITE, start, dataOutLen);
+
+    return ret;
+  }
+
+  if (dataInLen > 0 && (cmd[0] == 0x28 /* READ(10) */ ||
+			cmd[0] == 0xa8 /* READ(12) */ ||
+			cmd[0] == 0xbe /* READ CD */ ||
+			cmd[0] == 0xd8 /* READ CD-DA */)) {
+    start = stats_start();
+    ret = scsiIf_->sendCmd(cmd, cmdLen, dataOut, dataOutLen, dataIn,
+			   dataInLen, showErrorMsg);
+    stats_end(STAT_SCSI_READ, start, dataInLen);
+
+    return ret;
+  }
+
   return scsiIf_->sendCmd(cmd, cmdLen, dataOut, dataOutLen, dataIn,
 			  dataInLen, showErrorMsg);
 }
 
+int CdrDriver::submitCmd(const unsigned char *cmd, int cmdLen,
+			 const unsigned char *dataOut, int dataOutLen,
+			 unsigned char *dataIn, int dataInLen, void *tag) const
+{
+  if (dataOutLen > 0 && (cmd[0] == 0x2a /* WRITE(10) */ ||
+			 cmd[0] == 0xaa /* WRITE(12) */)) {
+    writeCmdCount_ += 1;
+    writeCmdBytes_ += dataOutLen;
+  }
+
+  return scsiIf_->submitCmd(cmd, cmdLen, dataOut, dataOutLen, dataIn,
+			    dataInLen, tag);
+}
+
+void CdrDriver::readAhead(long endLba)
+{
+  int i;
+
+  readAheadDrain();
+
+  readAheadDepth_ = scsiIf_->maxPendingCmds();
+  if (readAheadDepth_ > READ_AHEAD_DEPTH)
+    readAheadDepth_ = READ_AHEAD_DEPTH;
+
+  if (endLba == 0)
+    readAheadDepth_ = 0;
+
+  for (i = 0; i < readAheadDepth_; i++) {
+    if (readAheadCmds_[i].mem == NULL) {
+      readAheadCmds_[i].mem = new unsigned char[scsiMaxDataLen_ +
+						TRANSFER_ALIGN];
+      readAheadCmds_[i].data = alignBuffer(readAheadCmds_[i].mem);
+    }
+  }
+
+  readAheadEnd_ = endLba;
+  readAheadMisses_ = 0;
+}
+
+// Serves a READ command from the read-ahead queue if it was predicted
+// correctly, otherwise the queue is discarded and the command is sent
+// synchronously. Afterwards the queue is refilled with the commands that
+// continue the read sequence.
+
+int CdrDriver::readAheadCmd(const unsigned char *cmd, int cmdLen,
+			    unsigned char *dataIn, int dataInLen,
+			    int showErrorMsg) const
+{
+  ReadAheadCmd *r = &readAheadCmds_[readAheadHead_];
+  long long start;
+  void *tag;
+  int ret;
+
+  start = stats_start();
+
+  if (readAheadCount_ > 0 && r->cmdLen == cmdLen &&
+      r->dataLen == dataInLen && memcmp(r->cmd, cmd, cmdLen) == 0) {
+    // only the time spent waiting for the queued command is accounted
+    ret = scsiIf_->reapCmd(&tag, showErrorMsg);
+    readAheadHead_ = (readAheadHead_ + 1) % READ_AHEAD_DEPTH;
+    readAheadCount_--;
+    readAheadMisses_ = 0;
+
+    if (ret == 0)
+      memcpy(dataIn, r->data, dataInLen);
+  }
+  else {
+    if (readAheadCount_ > 0) {
+      readAheadDrain();
+
+      if (++readAheadMisses_ > 4) {
+	// access pattern is not sequential, stop wasting drive time
+	log_message(4, "Disabling read-ahead at LBA %ld.",
+		    (long)((cmd[2] << 24) | (cmd[3] << 16) | (cmd[4] << 8) |
+			   cmd[5]));
+	readAheadDepth_ = 0;
+      }
+    }
+
+    ret = scsiIf_->sendCmd(cmd, cmdLen, NULL, 0, dataIn, dataInLen,
+			   showErrorMsg);
+  }
+
+  stats_end(STAT_SCSI_READ, start, dataInLen);
+
+  // Do not refill after an error: reaping the discarded commands would
+  // overwrite the sense data before the caller could evaluate it.
+  if (ret == 0)
+    readAheadFill(cmd, cmdLen, dataInLen);
+
+  return ret;
+}
+
+// Queues the commands that follow given READ command: same CDB with the
+// LBA advanced by the transfer length. The transfer length is shortened
+// at 'readAheadEnd_'.
+
+void CdrDriver::readAheadFill(const unsigned char *cmd, int cmdLen,
+			      int dataLen) const
+{
+  long lba, len, n;
+  ReadAheadCmd *r;
+
+  if (readAheadCount_ > 0) {
+    r = &readAheadCmds_[(readAheadHead_ + readAheadCount_ - 1) %
+			READ_AHEAD_DEPTH];
+    cmd = r->cmd;
+    dataLen = r->dataLen;
+  }
+
+  if (cmdLen > (int)sizeof(readAheadCmds_[0].cmd) || dataLen > scsiMaxDataLen_)
+    return;
+
+  while (readAheadCount_ < readAheadDepth_) {
+    lba = (long)(int)((cmd[2] << 24) | (cmd[3] << 16) | (cmd[4] << 8) |
+		      cmd[5]);
+
+    switch (cmd[0]) {
+    case 0x28: // READ(10)
+      len = (cmd[7] << 8) | cmd[8];
+      break;
+    case 0xbe: // READ CD
+      len = (cmd[6] << 16) | (cmd[7] << 8) | cmd[8];
+      break;
+    default: // READ(12), READ CD-DA
+      len = (cmd[6] << 24) | (cmd[7] << 16) | (cmd[8] << 8) | cmd[9];
+      break;
+    }
+
+    if (len <= 0 || dataLen % len != 0)
+      return;
+
+    lba += len;
+
+    if (lba >= readAheadEnd_)
+      return;
+
+    n = readAheadEnd_ - lba;
+    if (n > len)
+      n = len;
+
+    r = &readAheadCmds_[(readAheadHead_ + readAheadCount_) % READ_AHEAD_DEPTH];
+
+    memcpy(r->cmd, cmd, cmdLen);
+    r->cmdLen = cmdLen;
+    r->dataLen = dataLen / len * n;
+
+    r->cmd[2] = lba >> 24;
+    r->cmd[3] = lba >> 16;
+    r->cmd[4] = lba >> 8;
+    r->cmd[5] = lba;
+
+    switch (cmd[0]) {
+    case 0x28:
+      r->cmd[7] = n >> 8;
+      r->cmd[8] = n;
+      break;
+    case 0xbe:
+      r->cmd[6] = n >> 16;
+      r->cmd[7] = n >> 8;
+      r->cmd[8] = n;
+      break;
+    default:
+      r->cmd[6] = n >> 24;
+      r->cmd[7] = n >> 16;
+      r->cmd[8] = n >> 8;
+      r->cmd[9] = n;
+      break;
+    }
+
+    if (scsiIf_->submitCmd(r->cmd, cmdLen, NULL, 0, r->data, r->dataLen,
+			   r) != 0) {
+      readAheadDepth_ = 0;
+      return;
+    }
+
+    readAheadCount_++;
+
+    cmd = r->cmd;
+    dataLen = r->dataLen;
+  }
+}
+
+// Waits for all queued READ commands and discards their results.
+
+void CdrDriver::readAheadDrain() const
+{
+  void *tag;
+
+  while (readAheadCount_ > 0) {
+    scsiIf_->reapCmd(&tag, 0);
+    readAheadHead_ = (readAheadHead_ + 1) % READ_AHEAD_DEPTH;
+    readAheadCount_--;
+  }
+}
+
 // checks if unit is ready
 // return: 0: OK
 //         1: scsi command failed
@@ -1223,7 +1505,7 @@ int CdrDriver::blankDisk(BlankingMode)
 // return: 0: OK
 //         1: scsi command failed
 int CdrDriver::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-			 long &lba, const char *buf, long len)
+			 long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
   int writeLen = 0;
@@ -2495,7 +2777,7 @@ int CdrDriver::analyzeTrackScan(TrackData::Mode, int trackNr, long startLba,
 				Msf *index, int *indexCnt, long *pregap,
 				char *isrcCode, unsigned char *ctl)
 {
-  SubChannel **subChannels;
+  const SubChannelBatch *chans;
   int n, i;
   int actIndex = 1;
   long length;
@@ -2522,21 +2804,17 @@ int CdrDriver::analyzeTrackScan(TrackData::Mode, int trackNr, long startLba,
   while (length > 0) {
     n = (length > maxScannedSubChannels_) ? maxScannedSubChannels_ : length;
 
-    if (readSubChannels(TrackData::SUBCHAN_NONE, startLba, n, &subChannels,
-			NULL) != 0 ||
-	subChannels == NULL) {
+    if (readSubChannelBatch(TrackData::SUBCHAN_NONE, startLba, n, &chans,
+			    NULL) != 0 ||
+	chans == NULL) {
       return 1;
     }
 
     for (i = 0; i < n; i++) {
-      SubChannel *chan = subChannels[i];
-      //chan->print();
-
-      if (chan->checkCrc() && chan->checkConsistency()) {
-	if (chan->type() == SubChannel::QMODE1DATA) {
-	  int t = chan->trackNr();
-	  Msf time(chan->min(), chan->sec(), chan->frame()); // track rel time
-	  Msf atime(chan->amin(), chan->asec(), chan->aframe()); // abs time
+      if (chans->ok(i)) {
+	if (chans->type(i) == SubChannel::QMODE1DATA) {
+	  int t = chans->trackNr(i);
+	  Msf time(chans->time(i)); // track rel time
 
 	  if (timeCnt > 74) {
 	    log_message(1, "%s\r", time.str());
@@ -2544,12 +2822,12 @@ int CdrDriver::analyzeTrackScan(TrackData::Mode, int trackNr, long startLba,
 	  }
 
 	  if (t == trackNr && !ctlSet) {
-	    *ctl = chan->ctl();
+	    *ctl = chans->ctl(i);
 	    *ctl |= 0x80;
 	    ctlSet = 1;
 	  }
-	  if (t == trackNr && chan->indexNr() == actIndex + 1) {
-	    actIndex = chan->indexNr();
+	  if (t == trackNr && chans->indexNr(i) == actIndex + 1) {
+	    actIndex = chans->indexNr(i);
 	    log_message(2, "Found index %d at: %s", actIndex, time.str());
 	    if ((*indexCnt) < 98) {
 	      index[*indexCnt] = time;
@@ -2557,7 +2835,7 @@ int CdrDriver::analyzeTrackScan(TrackData::Mode, int trackNr, long startLba,
 	    }
 	  }
 	  else if (t == trackNr + 1) {
-	    if (chan->indexNr() == 0) {
+	    if (chans->indexNr(i) == 0) {
 	      if (pregap != NULL) {
                 // don't use time.lba() to calculate pre-gap length; it would
                 // count one frame too many if the CD counts the pre-gap down
@@ -2565,7 +2843,7 @@ int CdrDriver::analyzeTrackScan(TrackData::Mode, int trackNr, long startLba,
                 // Instead, count number of frames until start of Index 01
                 // See http://sourceforge.net/tracker/?func=detail&aid=604751&group_id=2171&atid=102171
                 // atime starts at 02:00, so subtract it
-		*pregap = endLba - (atime.lba() - 150);
+		*pregap = endLba - (chans->atime(i) - 150);
               }
 	      if (crcErrCnt != 0)
 		log_message(2, "Found %ld Q sub-channels with CRC errors.",
@@ -2575,25 +2853,15 @@ int CdrDriver::analyzeTrackScan(TrackData::Mode, int trackNr, long startLba,
 	    }
 	  }
 	}
-	else if (chan->type() == SubChannel::QMODE3) {
+	else if (chans->type(i) == SubChannel::QMODE3) {
 	  if (!isrcCodeFound && startLba > trackStartLba) {
-	    strcpy(isrcCode, chan->isrc());
+	    chans->isrc(i, isrcCode);
 	    isrcCodeFound = 1;
 	  }
 	}
       }
       else {
 	crcErrCnt++;
-#if 0
-	if (chan->type() == SubChannel::QMODE1DATA) {
-	  log_message(2, "Q sub-channel data at %02d:%02d:%02d failed CRC check - ignored",
-		 chan->min(), chan->sec(), chan->frame());
-	}
-	else {
-	  log_message(2, "Q sub-channel data failed CRC check - ignored.");
-	}
-	chan->print();
-#endif
       }
 
       timeCnt++;
@@ -3646,6 +3914,49 @@ Toc *CdrDriver::buildToc(TrackInfo *trackInfos, long nofTrackInfos,
   return toc;
 }
 
+// Checks the raw sectors of a data track that were read in one burst with
+// the EDC and repairs them with the L-EC data if necessary. The sector
+// type is taken from the mode byte of each sector header.
+// lba: address of first sector
+// buf: 'len' sectors, 'blockLen' bytes apart
+// corrected, uncorrectable: counters that are increased
+static void correctRawSectors(long lba, unsigned char *buf, long len,
+			      long blockLen, long *corrected,
+			      long *uncorrectable)
+{
+  long long t = stats_start();
+  long i;
+
+  for (i = 0; i < len; i++, buf += blockLen) {
+    int type;
+
+    switch (buf[15]) {
+    case 1:
+      type = LEC_MODE1;
+      break;
+    case 2:
+      type = LEC_MODE2_FORM_MIX;
+      break;
+    default:
+      continue;
+    }
+
+    switch (lec_correct_sector(type, buf)) {
+    case 1:
+      log_message(3, "Corrected L-EC error at sector %ld.", lba + i);
+      (*corrected)++;
+      break;
+    case -1:
+      log_message(2, "Uncorrectable L-EC error at sector %ld - ignored.",
+		  lba + i);
+      (*uncorrectable)++;
+      break;
+    }
+  }
+
+  stats_end(STAT_LEC_DECODE, t, len * AUDIO_BLOCK_LEN);
+}
+
 // Reads a complete data track.
 // start: start of data track from TOC
 // end: start of next track from TOC
@@ -3663,9 +3974,12 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
   long blocking;
   long burst;
   long iterationsWithoutError = 0;
-  long n, ret;
+  long n, i;
   long act;
   int foundLECError;
+  long corrected = 0;     // sectors repaired by 'correctRawSectors()'
+  long uncorrectable = 0; // sectors with remaining errors
+  long unreadable = 0;    // sectors replaced by 'SECTOR_ERROR_DATA'
   unsigned char *buf;
   TrackData::Mode mode = TrackData::AUDIO;
 
@@ -3715,7 +4029,11 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
   blocking = scsiMaxDataLen_ / (AUDIO_BLOCK_LEN + PW_SUBCHANNEL_LEN);
   assert(blocking > 0);
 
-  buf = new unsigned char[blocking * blockLen];
+  ImageWriter writer(fd, blocking * blockLen, imageIo_);
+
+  writer.preallocate((long long)totalLen * blockLen);
+
+  readAhead(end);
 
   lba = lastLba = start;
   burst = blocking;
@@ -3728,9 +4046,12 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
 
     foundLECError = 0;
 
+    // read directly into the buffer of the image writer
+    buf = writer.reserve(n * blockLen);
+
     if ((act = readTrackData(mode, subChanReadMode_, lba, n, buf)) == -1) {
       log_message(-2, "Read error while copying data from track.");
-      delete[] buf;
+      readAhead(0);
       return 1;
     }
 
@@ -3753,7 +4074,7 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
       else {
 	log_message(-2, "L-EC error around sector %ld while copying data from track.", lba);
 	log_message(-2, "Use option '--read-raw' to ignore L-EC errors.");
-	delete[] buf;
+	readAhead(0);
 	return 1;
       }
     }
@@ -3762,6 +4083,7 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
       iterationsWithoutError = 0;
 
       log_message(2, "Found L-EC error at sector %ld - ignored.", lba);
+      unreadable++;
 
       // create a dummy sector for the sector with L-EC errors
       Msf m(lba + 150);
@@ -3777,13 +4099,8 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
 
       memcpy(buf + 16, SECTOR_ERROR_DATA, blockLen - 16);
 
-      if ((ret = fullWrite(fd, buf, blockLen)) != blockLen) {
-	if (ret < 0)
-	  log_message(-2, "Writing of data failed: %s", strerror(errno));
-	else
-	  log_message(-2, "Writing of data failed: Disk full");
-	  
-	delete[] buf;
+      if (writer.commit(blockLen) != 0) {
+	readAhead(0);
 	return 1;
       }
 
@@ -3795,16 +4112,14 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
     else {
       iterationsWithoutError++;
 
-      if (act > 0) {
-	if ((ret = fullWrite(fd, buf, blockLen * act)) != blockLen * act) {
-	  if (ret < 0)
-	    log_message(-2, "Writing of data failed: %s", strerror(errno));
-	  else
-	    log_message(-2, "Writing of data failed: Disk full");
-	  
-	  delete[] buf;
-	  return 1;
-	}
+      if (act > 0 && lecCorrection_ &&
+	  (mode == TrackData::MODE1_RAW || mode == TrackData::MODE2_RAW))
+	correctRawSectors(lba, buf, act, blockLen, &corrected,
+			  &uncorrectable);
+
+      if (act > 0 && writer.commit(blockLen * act) != 0) {
+	readAhead(0);
+	return 1;
       }
 
       trackInfo->bytesWritten += blockLen * act;
@@ -3844,53 +4159,62 @@ int CdrDriver::readDataTrack(ReadDiskInfo *info, int fd, long start, long end,
     }
   }
 
+  if (corrected > 0 || uncorrectable > 0 || unreadable > 0)
+    log_message(1, "Track %d: %ld sectors corrected, %ld uncorrectable, "
+		"%ld unreadable.", trackInfo->trackNr, corrected,
+		uncorrectable, unreadable);
+
   // pad remaining blocks with zero data, e.g. for disks written in TAO mode
 
   if (len > 0) {
     log_message(-1, "Padding with %ld zero sectors.", len);
 
-    if (mode == TrackData::MODE1_RAW || mode == TrackData::MODE2_RAW) {
-      memcpy(buf, syncPattern, 12);
+    while (len > 0) {
+      n = (len > blocking) ? blocking : len;
 
-      if (mode == TrackData::MODE1_RAW)
-	buf[15] = 1;
-      else
-	buf[15] = 2;
+      buf = writer.reserve(n * blockLen);
 
-      memset(buf + 16, 0, blockLen - 16);
-    }
-    else {
-      memset(buf, 0, blockLen);
-    }
-    
-    while (len > 0) {
-      if (mode == TrackData::MODE1_RAW || mode == TrackData::MODE2_RAW) {
-	Msf m(lba + 150);
+      for (i = 0; i < n; i++) {
+	unsigned char *sector = buf + i * blockLen;
 
-	buf[12] = SubChannel::bcd(m.min());
-	buf[13] = SubChannel::bcd(m.sec());
-	buf[14] = SubChannel::bcd(m.frac());
+	if (mode == TrackData::MODE1_RAW || mode == TrackData::MODE2_RAW) {
+	  Msf m(lba + i + 150);
+
+	  memcpy(sector, syncPattern, 12);
+	  sector[12] = SubChannel::bcd(m.min());
+	  sector[13] = SubChannel::bcd(m.sec());
+	  sector[14] = SubChannel::bcd(m.frac());
+
+	  if (mode == TrackData::MODE1_RAW)
+	    sector[15] = 1;
+	  else
+	    sector[15] = 2;
+
+	  memset(sector + 16, 0, blockLen - 16);
+	}
+	else {
+	  memset(sector, 0, blockLen);
+	}
       }
 
-      if ((ret = fullWrite(fd, buf, blockLen)) != blockLen) {
-	if (ret < 0)
-	  log_message(-2, "Writing of data failed: %s", strerror(errno));
-	else
-	  log_message(-2, "Writing of data failed: Disk full");
-	  
-	delete[] buf;
+      if (writer.commit(n * blockLen) != 0) {
+	readAhead(0);
 	return 1;
       }
 
-      trackInfo->bytesWritten += blockLen;
-      
-      len--;
-      lba++;
+      trackInfo->bytesWritten += n * blockLen;
+
+      len -= n;
+      lba += n;
     }
   }
 
-  delete[] buf;
-  
+  readAhead(0);
+
+  // wait until the image file is complete
+  if (writer.finish() != 0)
+    return 1;
+
   return 0;
 }
 
@@ -3914,7 +4238,7 @@ static int cmpMcn(const void *p1, const void *p2)
 int CdrDriver::readCatalogScan(char *mcnCode, long startLba, long endLba)
 {
 
-  SubChannel **subChannels;
+  const SubChannelBatch *chans;
   int n, i;
   long length;
   int mcnCodeFound = 0;
@@ -3931,20 +4255,17 @@ int CdrDriver::readCatalogScan(char *mcnCode, long startLba, long endLba)
   while ((length > 0) && (mcnCodeFound < N_ELEM)) {
     n = (length > maxScannedSubChannels_ ? maxScannedSubChannels_ : length);
 
-    if (readSubChannels(TrackData::SUBCHAN_NONE, startLba, n, &subChannels,
-			NULL) != 0 ||
-	subChannels == NULL) {
+    if (readSubChannelBatch(TrackData::SUBCHAN_NONE, startLba, n, &chans,
+			    NULL) != 0 ||
+	chans == NULL) {
       return 1;
     }
 
     for (i = 0; i < n; i++) {
-      SubChannel *chan = subChannels[i];
-      //chan->print();
-
-      if (chan->checkCrc() && chan->checkConsistency()) {
-        if (chan->type() == SubChannel::QMODE2) {
+      if (chans->ok(i)) {
+        if (chans->type(i) == SubChannel::QMODE2) {
           if (mcnCodeFound < N_ELEM) {
-            strcpy(mcn[mcnCodeFound++], chan->catalog());
+            chans->catalog(i, mcn[mcnCodeFound++]);
           }
         }
       }
@@ -4047,12 +4368,12 @@ int CdrDriver::sendBlankCdProgressMsg(int totalProgress)
 long CdrDriver::audioRead(TrackData::SubChannelMode sm, int byteOrder,
 			  Sample *buffer, long startLba, long len)
 {
-  SubChannel **chans;
+  const SubChannelBatch *chans;
   int i;
   int swap;
   long blockLen = AUDIO_BLOCK_LEN + TrackData::subChannelSize(sm);
 
-  if (readSubChannels(sm, startLba, len, &chans, buffer) != 0) {
+  if (readSubChannelBatch(sm, startLba, len, &chans, buffer) != 0) {
     memset(buffer, 0, len * blockLen);
     audioReadError_ = 1;
     return len;
@@ -4065,10 +4386,16 @@ long CdrDriver::audioRead(TrackData::SubChannelMode sm, int byteOrder,
 
   if (swap) {
     unsigned char *b = (unsigned char*)buffer;
-    
-    for (i = 0; i < len; i++) {
-      swapSamples((Sample *)b, SAMPLES_PER_BLOCK);
-      b += blockLen;
+
+    if (blockLen == AUDIO_BLOCK_LEN) {
+      // no sub-channel data, swap all blocks at once
+      swapSamples((Sample *)b, len * SAMPLES_PER_BLOCK);
+    }
+    else {
+      for (i = 0; i < len; i++) {
+	swapSamples((Sample *)b, SAMPLES_PER_BLOCK);
+	b += blockLen;
+      }
     }
   }
 
@@ -4123,20 +4450,17 @@ long CdrDriver::audioRead(TrackData::SubChannelMode sm, int byteOrder,
 
   // analyze sub-channels to find pre-gaps, index marks and ISRC codes
   for (i = 0; i < len; i++) {
-    SubChannel *chan = chans[i];
-    //chan->print();
-    
-    if (chan->checkCrc() && chan->checkConsistency()) {
-      if (chan->type() == SubChannel::QMODE1DATA) {
-	int t = chan->trackNr() - 1;
-	Msf atime = Msf(chan->amin(), chan->asec(), chan->aframe());
+    if (chans->ok(i)) {
+      if (chans->type(i) == SubChannel::QMODE1DATA) {
+	int t = chans->trackNr(i) - 1;
+	Msf atime(chans->atime(i));
 
 	//log_message(0, "LastLba: %ld, ActLba: %ld", audioReadActLba_, atime.lba());
 
 	if (t >= audioReadStartTrack_ && t <= audioReadEndTrack_ &&
 	    atime.lba() > audioReadActLba_ && 
 	    atime.lba() - 150 < audioReadTrackInfo_[t + 1].start) {
-	  Msf time(chan->min(), chan->sec(), chan->frame()); // track rel time
+	  Msf time(chans->time(i)); // track rel time
 
 	  audioReadActLba_ = atime.lba();
 
@@ -4147,10 +4471,10 @@ long CdrDriver::audioRead(TrackData::SubChannelMode sm, int byteOrder,
 	  }
 
 	  if (t == audioReadActTrack_ &&
-	      chan->indexNr() == audioReadActIndex_ + 1) {
+	      chans->indexNr(i) == audioReadActIndex_ + 1) {
 	  
-	    if (chan->indexNr() > 1) {
-	      log_message(2, "Found index %d at: %s", chan->indexNr(),
+	    if (chans->indexNr(i) > 1) {
+	      log_message(2, "Found index %d at: %s", chans->indexNr(i),
 		      time.str());
 	  
 	      if (audioReadTrackInfo_[t].indexCnt < 98) {
@@ -4161,8 +4485,7 @@ long CdrDriver::audioRead(TrackData::SubChannelMode sm, int byteOrder,
 	  }
 	  else if (t == audioReadActTrack_ + 1) {
 	    log_message(1, "Track %d...", t + 1);
-	    //chan->print();
-	    if (chan->indexNr() == 0) {
+	    if (chans->indexNr(i) == 0) {
               // don't use time.lba() to calculate pre-gap length; it would
               // count one frame too many if the CD counts the pre-gap down
               // to 00:00:00 instead of 00:00:01
@@ -4176,15 +4499,14 @@ long CdrDriver::audioRead(TrackData::SubChannelMode sm, int byteOrder,
 	    }
 	  }
 
-	  audioReadActIndex_ = chan->indexNr();
+	  audioReadActIndex_ = chans->indexNr(i);
 	  audioReadActTrack_ = t;
 	}
       }
-      else if (chan->type() == SubChannel::QMODE3) {
+      else if (chans->type(i) == SubChannel::QMODE3) {
 	if (audioReadTrackInfo_[audioReadActTrack_].isrcCode[0] == 0) {
 	  log_message(2, "Found ISRC code.");
-	  strcpy(audioReadTrackInfo_[audioReadActTrack_].isrcCode,
-		 chan->isrc());
+	  chans->isrc(i, audioReadTrackInfo_[audioReadActTrack_].isrcCode);
 	}
       }
     }
@@ -4196,13 +4518,35 @@ long CdrDriver::audioRead(TrackData::SubChannelMode sm, int byteOrder,
   return len;
 }
 
+// Default implementation: decodes the sub-channel objects returned by
+// 'readSubChannels()'.
+int CdrDriver::readSubChannelBatch(TrackData::SubChannelMode sm, long lba,
+				   long len, const SubChannelBatch **batch,
+				   Sample *buf)
+{
+  SubChannel **chans;
+
+  if (readSubChannels(sm, lba, len, &chans, buf) != 0)
+    return 1;
+
+  if (chans == NULL) {
+    *batch = NULL;
+  }
+  else {
+    subChannelBatch_->decode(chans, len);
+    *batch = subChannelBatch_;
+  }
+
+  return 0;
+}
+
 int CdrDriver::readAudioRangeStream(ReadDiskInfo *info, int fd, long start,
 				    long end, int startTrack, int endTrack, 
 				    TrackInfo *trackInfo)
 {
   long startLba = start;
   long endLba = end - 1;
-  long len, ret;
+  long len;
   long blocking, blockLen;
   long lba = startLba;
   unsigned char *buf;
@@ -4211,7 +4555,9 @@ int CdrDriver::readAudioRangeStream(ReadDiskInfo *info, int fd, long start,
   blocking = scsiMaxDataLen_ / blockLen;
   assert(blocking > 0);
   
-  buf = new unsigned char[blocking * blockLen];
+  ImageWriter writer(fd, blocking * blockLen, imageIo_);
+
+  readAhead(end);
 
   audioReadInfo_ = info;
   audioReadTrackInfo_ = trackInfo;
@@ -4226,6 +4572,8 @@ int CdrDriver::readAudioRangeStream(ReadDiskInfo *info, int fd, long start,
 
   len = endLba - startLba + 1;
 
+  writer.preallocate((long long)len * blockLen);
+
   log_message(1, "Track %d...", startTrack + 1);
 
   trackInfo[endTrack].bytesWritten = 0;
@@ -4234,18 +4582,15 @@ int CdrDriver::readAudioRangeStream(ReadDiskInfo *info, int fd, long start,
     long n = len > blocking ? blocking : len;
     long bytesToWrite = n * blockLen;
 
+    buf = writer.reserve(bytesToWrite);
+
     CdrDriver::audioRead(subChanReadMode_, 1/*big endian byte order*/,
 			 (Sample *)buf, lba, n);
 
     lba += n;
 
-    if ((ret = fullWrite(fd, buf, bytesToWrite)) != bytesToWrite) {
-      if (ret < 0)
-	log_message(-2, "Writing of data failed: %s", strerror(errno));
-      else
-	log_message(-2, "Writing of data failed: Disk full");
-
-      delete[] buf;
+    if (writer.commit(bytesToWrite) != 0) {
+      readAhead(0);
       return 1;
     }
 
@@ -4258,7 +4603,11 @@ int CdrDriver::readAudioRangeStream(ReadDiskInfo *info, int fd, long start,
   if (audioReadCrcCount_ != 0)
     log_message(2, "Found %ld Q sub-channels with CRC errors.", audioReadCrcCount_);
 
-  delete[] buf;
+  readAhead(0);
+
+  if (writer.finish() != 0)
+    return 1;
+
   return 0;
 }
 
@@ -4292,8 +4641,9 @@ int CdrDriver::readAudioRangeParanoia(ReadDiskInfo *info, int fd, long start,
 {
   long startLba = start;
   long endLba = end - 1;
-  long len, ret;
+  long len;
   size16 *buf;
+  ImageWriter writer(fd, AUDIO_BLOCK_LEN, imageIo_);
 
   if (paranoia_ == NULL) {
     // first time -> allocate paranoia structure 
@@ -4319,6 +4669,8 @@ int CdrDriver::readAudioRangeParanoia(ReadDiskInfo *info, int fd, long start,
 
   len = endLba - startLba + 1;
 
+  writer.preallocate((long long)len * AUDIO_BLOCK_LEN);
+
   log_message(1, "Track %d...", startTrack + 1);
 
   trackInfo[endTrack].bytesWritten = 0;
@@ -4332,14 +4684,11 @@ int CdrDriver::readAudioRangeParanoia(ReadDiskInfo *info, int fd, long start,
     if (hostByteOrder_ == 0)
       swapSamples((Sample*)buf, SAMPLES_PER_BLOCK);
 
-    if ((ret = fullWrite(fd, buf, AUDIO_BLOCK_LEN)) != AUDIO_BLOCK_LEN) {
-      if (ret < 0)
-	log_message(-2, "Writing of data failed: %s", strerror(errno));
-      else
-	log_message(-2, "Writing of data failed: Disk full");
+    // collect the single blocks for larger writes
+    memcpy(writer.reserve(AUDIO_BLOCK_LEN), buf, AUDIO_BLOCK_LEN);
 
+    if (writer.commit(AUDIO_BLOCK_LEN) != 0)
       return 1;
-    }
 
     trackInfo[endTrack].bytesWritten += AUDIO_BLOCK_LEN;
 
@@ -4350,6 +4699,9 @@ int CdrDriver::readAudioRangeParanoia(ReadDiskInfo *info, int fd, long start,
   if (audioReadCrcCount_ != 0)
     log_message(2, "Found %ld Q sub-channels with CRC errors.", audioReadCrcCount_);
 
+  if (writer.finish() != 0)
+    return 1;
+
   return 0;
 }
 
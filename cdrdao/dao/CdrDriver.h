@@ -25,9 +25,11 @@
 #include "TrackData.h"
 #include "SubChannel.h"
 #include "remote.h"
+#include "ImageWriter.h"
 
 class Toc;
 class Track;
+class SubChannelBatch;
 
 #define OPT_DRV_GET_TOC_GENERIC   0x00010000
 #define OPT_DRV_SWAP_READ_SAMPLES 0x00020000
@@ -189,6 +191,16 @@ public:
   virtual void writeSpeedControl(int s) {
     enableWriteSpeedControl_ = s != 0 ? 1 : 0; }
 
+  // sets/return adaptive speed setting: 1 = the writing speed is lowered
+  // while writing if the FIFO is about to run empty, 0 = disabled
+  virtual int adaptiveSpeed() const { return enableAdaptiveSpeed_; }
+
+  virtual void adaptiveSpeed(int s) { enableAdaptiveSpeed_ = s != 0 ? 1 : 0; }
+
+  // Changes the writing speed while writing is in progress. Returns 0 for
+  // OK or 1 if the speed cannot be changed. Not supported by default.
+  virtual int changeWriteSpeed(int) { return 1; }
+
   // returns 1 if simulation mode, 0 for real writing
   virtual bool simulate() const { return simulate_; }
 
@@ -210,6 +222,14 @@ public:
   virtual bool rawDataReading() const { return rawDataReading_; }
   virtual void rawDataReading(bool f) { rawDataReading_ = f; }
 
+  // Returns/sets flag for correcting raw data sectors with the L-EC data
+  virtual bool lecCorrection() const { return lecCorrection_; }
+  virtual void lecCorrection(bool f) { lecCorrection_ = f; }
+
+  // Returns/sets how the image file of 'readDisk()' is written
+  virtual ImageWriter::Mode imageIo() const { return imageIo_; }
+  virtual void imageIo(ImageWriter::Mode m) { imageIo_ = m; }
+
   // Returns/sets mode2 mixed track reading flag
   virtual bool mode2Mixed() const { return mode2Mixed_; }
   virtual void mode2Mixed(bool f) { mode2Mixed_ = f; }
@@ -320,9 +340,11 @@ public:
   virtual void abortDao() = 0;
 
   // Sends given data to drive. 'lba' should be the current writing address
-  // and will be updated according to the written number of blocks.
+  // and will be updated according to the written number of blocks. 'buf'
+  // holds 'len' blocks of 'blockSize()' bytes, drivers may modify it in
+  // place, e.g. to fill in the sub-channel data.
   virtual int writeData(TrackData::Mode, TrackData::SubChannelMode sm,
-			long &lba, const char *buf, long len);
+			long &lba, char *buf, long len);
 
   // returns mode for main channel data encoding, the value is used by
   // Track::readData()
@@ -331,6 +353,17 @@ public:
   //    are extended by sub header and zero EDC/ECC data
   int encodingMode() const { return encodingMode_; }
 
+  // Returns the number of blocks that are sent with a single SCSI WRITE
+  // command by 'writeData()'. Only valid after 'initDao()' was called,
+  // 0 if unknown.
+  long blocksPerWrite() const { return blocksPerWrite_; }
+
+  // Statistics of the SCSI WRITE commands that were issued since the last
+  // call of 'resetWriteStats()'.
+  long writeCmdCount() const { return writeCmdCount_; }
+  long long writeCmdBytes() const { return writeCmdBytes_; }
+  void resetWriteStats() { writeCmdCount_ = 0; writeCmdBytes_ = 0; }
+
   // disk read commands
   
   // analyzes the CD structure (Q sub-channels) of the inserted CD
@@ -403,8 +436,12 @@ protected:
                         // single SCSI WRITE command
   char *zeroBuffer_; // zeroed buffer for writing zeros
 
+  mutable long writeCmdCount_;      // number of issued SCSI WRITE commands
+  mutable long long writeCmdBytes_; // bytes sent with SCSI WRITE commands
+
   int enableBufferUnderRunProtection_;
   int enableWriteSpeedControl_;
+  int enableAdaptiveSpeed_;
   int speed_;
   int rspeed_;
   bool simulate_;
@@ -412,6 +449,8 @@ protected:
   int encodingMode_; // mode for encoding data sectors
   bool fastTocReading_;
   bool rawDataReading_;
+  bool lecCorrection_;
+  ImageWriter::Mode imageIo_;
   int mode2Mixed_;
   TrackData::SubChannelMode subChanReadMode_;
   int padFirstPregap_; // used by 'read-toc': defines if the first audio 
@@ -429,8 +468,27 @@ protected:
 
   SubChannel **scannedSubChannels_;
   long maxScannedSubChannels_;
+  SubChannelBatch *subChannelBatch_; // filled by 'readSubChannelBatch()'
 
   unsigned char *transferBuffer_;
+  unsigned char *transferBufferMem_; // allocation of 'transferBuffer_'
+  bool transferBufferMapped_; // 'transferBuffer_' is owned by 'scsiIf_'
+
+  // READ commands queued ahead by 'sendCmd()', see 'readAhead()'
+  struct ReadAheadCmd {
+    unsigned char cmd[12];
+    int cmdLen;
+    unsigned char *data; // aligned like 'transferBuffer_'
+    unsigned char *mem;  // allocation of 'data'
+    int dataLen;
+  };
+  enum { READ_AHEAD_DEPTH = 2 };
+  mutable ReadAheadCmd readAheadCmds_[READ_AHEAD_DEPTH];
+  mutable int readAheadDepth_; // 0: read-ahead disabled
+  mutable int readAheadHead_;
+  mutable int readAheadCount_;
+  mutable int readAheadMisses_;
+  long readAheadEnd_; // LBA at which read-ahead stops
 
   // Byte order of audio samples read from the drive, e.g. with 
   // 'readSubChannels()'. 0: little endian, 1: big endian
@@ -450,6 +508,25 @@ protected:
 		      unsigned char *dataIn, int dataInLen,
 		      int showErrorMsg = 1) const;
 
+  // Queues given command with 'ScsiIf::submitCmd()', the result must be
+  // fetched with 'scsiIf_->reapCmd()'.
+  int submitCmd(const unsigned char *cmd, int cmdLen,
+		const unsigned char *dataOut, int dataOutLen,
+		unsigned char *dataIn, int dataInLen, void *tag) const;
+
+  // Enables read-ahead for sequential READ commands sent with 'sendCmd()'
+  // until given LBA is reached: while the caller processes the data of
+  // one command the following commands are already queued. 0 disables
+  // read-ahead. Not available if the SCSI interface cannot queue commands,
+  // e.g. in IO_MMAP mode.
+  void readAhead(long endLba);
+  int readAheadCmd(const unsigned char *cmd, int cmdLen,
+		   unsigned char *dataIn, int dataInLen,
+		   int showErrorMsg) const;
+  void readAheadFill(const unsigned char *cmd, int cmdLen,
+		     int dataLen) const;
+  void readAheadDrain() const;
+
   virtual int getModePage(int pageCode, unsigned char *buf, long bufLen,
 			  unsigned char *modePageHeader,
 			  unsigned char *blockDesc, int showErrorMsg);
@@ -564,10 +641,21 @@ protected:
   // The returned vector contains 'len' pointers to 'SubChannel' objects.
   // Audio data that is usually retrieved with the sub-channels is placed
   // in 'buf' if it is not NULL.
-  // Used by 'analyzeTrackScan()' and 'readAudioRangeParanoia()'.
+  // Used by the default implementation of 'readSubChannelBatch()'.
   virtual int readSubChannels(TrackData::SubChannelMode, long lba, long len,
 			      SubChannel ***, Sample *buf) = 0;
 
+  // Like 'readSubChannels()' but returns the decoded Q sub-channels of all
+  // sectors in 'subChannelBatch_'. '*batch' is set to NULL if the drive
+  // does not provide sub-channel data. The default implementation decodes
+  // the objects returned by 'readSubChannels()', drivers that read the
+  // sub-channels with a single command should decode the transfer buffer
+  // directly.
+  // Used by 'analyzeTrackScan()', 'readCatalogScan()' and 'audioRead()'.
+  virtual int readSubChannelBatch(TrackData::SubChannelMode, long lba,
+				  long len, const SubChannelBatch **batch,
+				  Sample *buf);
+
   // Determines the readable length of a data track and the pre-gap length
   // of the following track. The implementation in the base class should
   // be suitable for all drivers.
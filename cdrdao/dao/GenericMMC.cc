@@ -28,8 +28,10 @@
 #include "port.h"
 #include "Toc.h"
 #include "log.h"
+#include "stats.h"
 #include "PQSubChannel16.h"
 #include "PWSubChannel96.h"
+#include "SubChannelBatch.h"
 #include "CdTextEncoder.h"
 
 
@@ -129,13 +131,10 @@ int GenericMMC::subChannelEncodingMode(TrackData::SubChannelMode sm) const
     break;
 
   case TrackData::SUBCHAN_RW:
-#if 0
     if (options_ & OPT_MMC_NO_RW_PACKED) 
       ret = 1; // have to encode the R-W sub-channel data
     else 
       ret = 0;
-#endif
-    ret = 0;
     break;
 
   case TrackData::SUBCHAN_RW_RAW:
@@ -160,6 +159,23 @@ int GenericMMC::speed(int s)
   return 0;
 }
 
+// changes speed while writing
+// return: 0: OK
+//         1: drive rejected speed
+int GenericMMC::changeWriteSpeed(int s)
+{
+  int oldSpeed = speed_;
+
+  speed_ = s;
+
+  if (selectSpeed() != 0) {
+    speed_ = oldSpeed;
+    return 1;
+  }
+
+  return 0;
+}
+
 int GenericMMC::speed()
 {
   const DriveInfo *di;
@@ -1245,6 +1261,18 @@ void GenericMMC::abortDao()
   cdTextEncoder_ = NULL;
 }
 
+// number of WRITE commands that are queued by 'writeData()'
+#define WRITE_QUEUE_DEPTH 2
+
+// Returns 1 if the drive rejected a WRITE command because its internal
+// buffer is filled.
+static int longWriteInProgress(const unsigned char *sense, int senseLen)
+{
+  // Not Ready, long write in progress
+  return senseLen >= 14 && (sense[2] & 0x0f) == 0x2 && sense[7] >= 6 &&
+    sense[12] == 0x4 && sense[13] == 0x8;
+}
+
 // Writes data to target, the block length depends on the actual writing
 // 'mode'. 'len' is number of blocks to write.
 // 'lba' specifies the next logical block address for writing and is updated
@@ -1252,15 +1280,23 @@ void GenericMMC::abortDao()
 // return: 0: OK
 //         1: scsi command failed
 int GenericMMC::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-			  long &lba, const char *buf, long len)
+			  long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
   int writeLen = 0;
   unsigned char cmd[10];
   long blockLength = blockSize(mode, sm);
+  int depth;
   int retry;
   int ret;
 
+  depth = scsiIf_->maxPendingCmds();
+  if (depth > WRITE_QUEUE_DEPTH)
+    depth = WRITE_QUEUE_DEPTH;
+
+  if (depth > 1 && len > blocksPerWrite_)
+    return writeDataQueued(lba, buf, len, blockLength, depth);
+
 #if 0
   long bufferCapacity;
   int waitForBuffer;
@@ -1334,10 +1370,10 @@ int GenericMMC::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
 
 	// check if drive rejected the command because the internal buffer
 	// is filled
-	if(senseLen >= 14 && (sense[2] & 0x0f) == 0x2 && sense[7] >= 6 &&
-	   sense[12] == 0x4 && sense[13] == 0x8) {
-	  // Not Ready, long write in progress
+	if (longWriteInProgress(sense, senseLen)) {
+	  long long start = stats_start();
 	  mSleep(40);
+	  stats_end(STAT_SCSI_RETRY, start, 0);
           retry = 1;
         }
 	else {
@@ -1360,6 +1396,122 @@ int GenericMMC::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
   return 0;
 }
 
+int GenericMMC::writeDataQueued(long &lba, char *buf, long len,
+				long blockLength, int depth)
+{
+  struct {
+    unsigned char cmd[10];
+    long lba;
+    char *buf;
+    long len;
+  } queue[WRITE_QUEUE_DEPTH], *q;
+  int head = 0;
+  int count = 0;
+  long nextLba = lba;
+  char *nextBuf = buf;
+  long endLba = lba + len;
+  int retry = 0;
+  int error = 0;
+  long long start;
+  void *tag;
+  int ret;
+
+  assert(depth <= WRITE_QUEUE_DEPTH);
+
+  while (nextLba < endLba || count > 0) {
+    // keep the queue filled
+    while (!retry && !error && nextLba < endLba && count < depth) {
+      q = &queue[(head + count) % WRITE_QUEUE_DEPTH];
+
+      q->lba = nextLba;
+      q->buf = nextBuf;
+      q->len = endLba - nextLba;
+      if (q->len > blocksPerWrite_)
+	q->len = blocksPerWrite_;
+
+      memset(q->cmd, 0, 10);
+      q->cmd[0] = 0x2a; // WRITE1
+      q->cmd[2] = q->lba >> 24;
+      q->cmd[3] = q->lba >> 16;
+      q->cmd[4] = q->lba >> 8;
+      q->cmd[5] = q->lba;
+      q->cmd[7] = q->len >> 8;
+      q->cmd[8] = q->len & 0xff;
+
+      if (submitCmd(q->cmd, 10, (unsigned char *)q->buf,
+		    q->len * blockLength, NULL, 0, q) != 0) {
+	error = 1;
+	break;
+      }
+
+      count++;
+      nextLba += q->len;
+      nextBuf += q->len * blockLength;
+    }
+
+    if (count == 0)
+      break;
+
+    q = &queue[head];
+
+    start = stats_start();
+    ret = scsiIf_->reapCmd(&tag, 0);
+    stats_end(STAT_SCSI_WRITE, start, q->len * blockLength);
+
+    head = (head + 1) % WRITE_QUEUE_DEPTH;
+    count--;
+
+    if (ret == 0) {
+      if (retry || error) {
+	// data behind a rejected block was accepted, the written data is
+	// out of sequence
+	log_message(-2, "Write command at LBA %ld succeeded after failure.",
+		    q->lba);
+	error = 1;
+      }
+      else {
+	lba = q->lba + q->len;
+      }
+    }
+    else if (!retry && !error) {
+      const unsigned char *sense;
+      int senseLen;
+
+      sense = scsiIf_->getSense(senseLen);
+
+      if (ret == 2 && longWriteInProgress(sense, senseLen)) {
+	// the queued commands will be rejected, too, restart with this
+	// one when all are reaped
+	retry = 1;
+	nextLba = q->lba;
+	nextBuf = q->buf;
+      }
+      else {
+	if (ret == 2)
+	  scsiIf_->printError();
+	error = 1;
+      }
+    }
+
+    if (error && count == 0)
+      break;
+
+    if (retry && count == 0) {
+      start = stats_start();
+      mSleep(40);
+      stats_end(STAT_SCSI_RETRY, start, 0);
+      retry = 0;
+    }
+  }
+
+  if (error) {
+    log_message(-2, "Write data failed.");
+    return 1;
+  }
+
+  return 0;
+}
+
 int GenericMMC::writeCdTextLeadIn()
 {
   unsigned char cmd[10];
@@ -1430,10 +1582,10 @@ int GenericMMC::writeCdTextLeadIn()
 
 	// check if drive rejected the command because the internal buffer
 	// is filled
-	if(senseLen >= 14 && (sense[2] & 0x0f) == 0x2 && sense[7] >= 6 &&
-	   sense[12] == 0x4 && sense[13] == 0x8) {
-	  // Not Ready, long write in progress
+	if (longWriteInProgress(sense, senseLen)) {
+	  long long start = stats_start();
 	  mSleep(40);
+	  stats_end(STAT_SCSI_RETRY, start, 0);
           retry = 1;
         }
 	else {
@@ -1710,15 +1862,22 @@ int GenericMMC::analyzeTrack(TrackData::Mode mode, int trackNr, long startLba,
   return ret;
 }
 
-int GenericMMC::readSubChannels(TrackData::SubChannelMode sm,
-				long lba, long len, SubChannel ***chans,
-				Sample *audioData)
+// Reads 'len' sectors starting at 'lba' with sub-channel data into
+// 'transferBuffer_' and copies the audio data to 'audioData' if it is not
+// NULL. '*subChanMode' is set to the 'CDR_READ_CAP_AUDIO_*' mode of the
+// sub-channels that are available for analysis, 0 if there are none.
+// PQ sub-channels are converted to BCD.
+// Return: 0: OK
+//         1: SCSI error occured
+int GenericMMC::readSubChannelData(TrackData::SubChannelMode sm,
+				   long lba, long len, Sample *audioData,
+				   unsigned long *subChanMode,
+				   long *blockLength)
 {
   int retries = 5;
   unsigned char cmd[12];
   int i;
   long blockLen = 0;
-  unsigned long subChanMode = 0;
 
   cmd[0] = 0xbe;  // READ CD
   cmd[1] = 0;
@@ -1732,6 +1891,8 @@ int GenericMMC::readSubChannels(TrackData::SubChannelMode sm,
   cmd[9] = 0xf8;
   cmd[11] = 0;
 
+  *subChanMode = 0;
+
   switch (sm) {
   case TrackData::SUBCHAN_NONE:
     // no sub-channel data selected choose what is available
@@ -1741,7 +1902,7 @@ int GenericMMC::readSubChannels(TrackData::SubChannelMode sm,
       blockLen = AUDIO_BLOCK_LEN + 96;
       cmd[10] = 0x01;  // raw P-W sub-channel data
 
-      subChanMode = CDR_READ_CAP_AUDIO_PW_RAW;
+      *subChanMode = CDR_READ_CAP_AUDIO_PW_RAW;
     }
     else if ((readCapabilities_ & 
 	      (CDR_READ_CAP_AUDIO_PQ_BCD|CDR_READ_CAP_AUDIO_PQ_HEX)) != 0) {
@@ -1750,16 +1911,16 @@ int GenericMMC::readSubChannels(TrackData::SubChannelMode sm,
       cmd[10] = 0x02;  // PQ sub-channel data
 
       if ((readCapabilities_ & CDR_READ_CAP_AUDIO_PQ_BCD) != 0)
-	subChanMode = CDR_READ_CAP_AUDIO_PQ_BCD;
+	*subChanMode = CDR_READ_CAP_AUDIO_PQ_BCD;
       else
-	subChanMode = CDR_READ_CAP_AUDIO_PQ_HEX;
+	*subChanMode = CDR_READ_CAP_AUDIO_PQ_HEX;
     }
     else {
       // no usable sub-channel reading mode is supported
       blockLen = AUDIO_BLOCK_LEN;
       cmd[10] = 0;
 
-      subChanMode = 0;
+      *subChanMode = 0;
     }
     break;
 
@@ -1797,55 +1958,21 @@ int GenericMMC::readSubChannels(TrackData::SubChannelMode sm,
   }
 #endif
 
-  if (subChanMode != 0) {
+  if (*subChanMode == CDR_READ_CAP_AUDIO_PQ_HEX) {
     unsigned char *buf = transferBuffer_ + AUDIO_BLOCK_LEN;
 
     for (i = 0; i < len; i++) {
-      switch (subChanMode) {
-      case CDR_READ_CAP_AUDIO_PQ_HEX:
-	// All numbers in sub-channel data are hex conforming to the
-	// MMC standard. We have to convert them back to BCD for the
-	// 'SubChannel' class.
-	buf[1] = SubChannel::bcd(buf[1]);
-	buf[2] = SubChannel::bcd(buf[2]);
-	buf[3] = SubChannel::bcd(buf[3]);
-	buf[4] = SubChannel::bcd(buf[4]);
-	buf[5] = SubChannel::bcd(buf[5]);
-	buf[6] = SubChannel::bcd(buf[6]);
-	buf[7] = SubChannel::bcd(buf[7]);
-	buf[8] = SubChannel::bcd(buf[8]);
-	buf[9] = SubChannel::bcd(buf[9]);
-	// fall through
-
-      case CDR_READ_CAP_AUDIO_PQ_BCD:
-	((PQSubChannel16*)scannedSubChannels_[i])->init(buf);
-	if (scannedSubChannels_[i]->type() != SubChannel::QMODE_ILLEGAL) {
-	  // the CRC of the sub-channel data is usually invalid -> mark the
-	  // sub-channel object that it should not try to verify the CRC
-	  scannedSubChannels_[i]->crcInvalid();
-	}
-	break;
-      
-      case CDR_READ_CAP_AUDIO_PW_RAW:
-	((PWSubChannel96*)scannedSubChannels_[i])->init(buf);
-	break;
-      }
-
-#if 0
-      if (subChanMode == CDR_READ_CAP_AUDIO_PW_RAW) {
-	// xxam!
-	int j, k;
-	
-	log_message(0, "");
-	for (j = 0; j < 4; j++) {
-	  for (k = 0; k < 24; k++) {
-	    unsigned char data = buf[j * 24 + k];
-	    log_message(0, "%02x ", data&0x3f);
-	  }
-	  log_message(0, "");
-	}
-      }
-#endif
+      // All numbers in sub-channel data are hex conforming to the
+      // MMC standard. We have to convert them back to BCD.
+      buf[1] = SubChannel::bcd(buf[1]);
+      buf[2] = SubChannel::bcd(buf[2]);
+      buf[3] = SubChannel::bcd(buf[3]);
+      buf[4] = SubChannel::bcd(buf[4]);
+      buf[5] = SubChannel::bcd(buf[5]);
+      buf[6] = SubChannel::bcd(buf[6]);
+      buf[7] = SubChannel::bcd(buf[7]);
+      buf[8] = SubChannel::bcd(buf[8]);
+      buf[9] = SubChannel::bcd(buf[9]);
 
       buf += blockLen;
     }
@@ -1874,10 +2001,86 @@ int GenericMMC::readSubChannels(TrackData::SubChannelMode sm,
     }
   }
 
-  if (subChanMode == 0)
+  *blockLength = blockLen;
+
+  return 0;
+}
+
+int GenericMMC::readSubChannels(TrackData::SubChannelMode sm,
+				long lba, long len, SubChannel ***chans,
+				Sample *audioData)
+{
+  unsigned long subChanMode;
+  long blockLen;
+  int i;
+
+  if (readSubChannelData(sm, lba, len, audioData, &subChanMode,
+			 &blockLen) != 0)
+    return 1;
+
+  if (subChanMode == 0) {
     *chans = NULL;
-  else
-    *chans = scannedSubChannels_;
+    return 0;
+  }
+
+  unsigned char *buf = transferBuffer_ + AUDIO_BLOCK_LEN;
+
+  for (i = 0; i < len; i++) {
+    switch (subChanMode) {
+    case CDR_READ_CAP_AUDIO_PQ_HEX:
+    case CDR_READ_CAP_AUDIO_PQ_BCD:
+      ((PQSubChannel16*)scannedSubChannels_[i])->init(buf);
+      if (scannedSubChannels_[i]->type() != SubChannel::QMODE_ILLEGAL) {
+	// the CRC of the sub-channel data is usually invalid -> mark the
+	// sub-channel object that it should not try to verify the CRC
+	scannedSubChannels_[i]->crcInvalid();
+      }
+      break;
+      
+    case CDR_READ_CAP_AUDIO_PW_RAW:
+      ((PWSubChannel96*)scannedSubChannels_[i])->init(buf);
+      break;
+    }
+
+    buf += blockLen;
+  }
+
+  *chans = scannedSubChannels_;
+
+  return 0;
+}
+
+// Decodes the sub-channels directly from the transfer buffer.
+int GenericMMC::readSubChannelBatch(TrackData::SubChannelMode sm,
+				    long lba, long len,
+				    const SubChannelBatch **batch,
+				    Sample *audioData)
+{
+  unsigned long subChanMode;
+  long blockLen;
+
+  if (readSubChannelData(sm, lba, len, audioData, &subChanMode,
+			 &blockLen) != 0)
+    return 1;
+
+  switch (subChanMode) {
+  case CDR_READ_CAP_AUDIO_PQ_HEX:
+  case CDR_READ_CAP_AUDIO_PQ_BCD:
+    subChannelBatch_->decode(SubChannelBatch::PQ16,
+			     transferBuffer_ + AUDIO_BLOCK_LEN, blockLen, len);
+    *batch = subChannelBatch_;
+    break;
+
+  case CDR_READ_CAP_AUDIO_PW_RAW:
+    subChannelBatch_->decode(SubChannelBatch::PW96,
+			     transferBuffer_ + AUDIO_BLOCK_LEN, blockLen, len);
+    *batch = subChannelBatch_;
+    break;
+
+  default:
+    *batch = NULL;
+    break;
+  }
 
   return 0;
 }
@@ -136,6 +136,15 @@ public:
   */
   int speed(int);
 
+  /*! \brief Changes write speed while writing
+
+    Sends a SET CD SPEED command with the new write speed. The previous
+    speed is kept if the drive rejects the command.
+    \param int Write speed as multiplier.
+    \return 0 on success, 1 if SCSI command error
+  */
+  int changeWriteSpeed(int);
+
   /*! \brief Returns current write speed
 
     Rebuilds the GenericMMC::driveInfo_ structure by reading
@@ -232,7 +241,7 @@ public:
     \return 0 if OK, 1 if WRITE command failed
   */
   int writeData(TrackData::Mode, TrackData::SubChannelMode, long &lba,
-		const char *buf, long len);
+		char *buf, long len);
 
   /*! \brief Gets useful parameters about the device.
 
@@ -299,6 +308,15 @@ protected:
     \return 0 on success, 1 on SCSI error.
   */
   virtual int getStartOfSession(long *);
+  /*! \brief Variant of GenericMMC::writeData that keeps up to 'depth'
+    WRITE commands queued with CdrDriver::submitCmd.
+
+    Used by GenericMMC::writeData if the SCSI interface supports queued
+    commands. All commands are completed when this function returns.
+    \return 0 if OK, 1 if WRITE command failed
+  */
+  int writeDataQueued(long &lba, char *buf, long len, long blockLength,
+		      int depth);
   /*! \brief Still unused */
   virtual int getFeature(unsigned int feature, unsigned char *buf,
 			 unsigned long bufLen, int showMsg);
@@ -428,6 +446,13 @@ protected:
   int readSubChannels(TrackData::SubChannelMode, long lba, long len,
 		      SubChannel ***, Sample *);
 
+  int readSubChannelBatch(TrackData::SubChannelMode, long lba, long len,
+			  const SubChannelBatch **, Sample *);
+
+  int readSubChannelData(TrackData::SubChannelMode, long lba, long len,
+			 Sample *, unsigned long *subChanMode,
+			 long *blockLen);
+
   /*!
   \brief retrieve mode of the track that starts at the specified trackStartLba.
 
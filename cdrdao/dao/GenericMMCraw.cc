@@ -42,8 +42,6 @@ GenericMMCraw::GenericMMCraw(ScsiIf *scsiIf, unsigned long options)
 
   leadInLen_ = leadOutLen_ = 0;
   subChannel_ = NULL;
-  encSubChannel_ = NULL;
-  encodeBuffer_ = NULL;
 
   // CD-TEXT dynamic data
   cdTextStartLba_ = 0;
@@ -56,10 +54,6 @@ GenericMMCraw::GenericMMCraw(ScsiIf *scsiIf, unsigned long options)
 GenericMMCraw::~GenericMMCraw()
 {
   delete subChannel_, subChannel_ = NULL;
-  delete[] encodeBuffer_, encodeBuffer_ = NULL;
-
-  delete[] encSubChannel_;
-  encSubChannel_ = NULL;
 
   cdTextStartLba_ = 0;
   cdTextEndLba_ = 0;
@@ -108,8 +102,7 @@ int GenericMMCraw::subChannelEncodingMode(TrackData::SubChannelMode sm) const
       ret = 0; // plain
       break;
     case 3:
-      ret = -1; // currently not supported
-      //ret = 1; // have to create parity and perform interleaving
+      ret = 1; // have to create parity and perform interleaving
       break;
     default:
       ret = -1; // not supported
@@ -128,6 +121,18 @@ int GenericMMCraw::subChannelEncodingMode(TrackData::SubChannelMode sm) const
   return ret;
 }
 
+// Returns the length of the blocks that are passed to 'writeData()'. Each
+// block is followed by space for the sub-channel data of the selected
+// writing mode, independent of the sub-channel data contained in the toc.
+long GenericMMCraw::blockSize(TrackData::Mode m,
+			      TrackData::SubChannelMode sm) const
+{
+  if (subChannel_ == NULL)
+    return CdrDriver::blockSize(m, sm);
+
+  return AUDIO_BLOCK_LEN + subChannel_->dataLength();
+}
+
 // Sets write parameters via mode page 0x05.
 // return: 0: OK
 //         1: scsi command failed
@@ -490,20 +495,25 @@ int GenericMMCraw::initDao(const Toc *toc)
     cdTextSubChannelAct_ = 0;
   }
 
+  // The PQ sub-channels only depend on the toc. Encode them for the whole
+  // session now so that 'writeData()' just has to copy them and so that
+  // they can be checked before writing starts.
+  n = leadInLen_ + 150 + CdrDriver::toc_->length().lba() + leadOutLen_;
+  log_message(4, "Encoding PQ sub-channels of %ld blocks.", n);
+
+  encodeStream(leadInStart_.lba() - 450150, n);
+
+  if (checkStream() != 0) {
+    log_message(-3, "PQ sub-channel encoding failed.");
+    return 1;
+  }
+
   // allocate buffer for write zeros
   n = blocksPerWrite_ * (AUDIO_BLOCK_LEN + subChannel_->dataLength());
   delete[] zeroBuffer_;
   zeroBuffer_ = new char[n];
   memset(zeroBuffer_, 0, n);
 
-  // allocate buffer for sub-channel encoding
-  n = blocksPerWrite_ * blockLength_;
-  delete[] encodeBuffer_;
-  encodeBuffer_ = new unsigned char[n];
-
-  delete[] encSubChannel_;
-  encSubChannel_ = new unsigned char[blocksPerWrite_ * subChannel_->dataLength()];
-
   /*
   SessionInfo sessInfo;
   
@@ -579,7 +589,6 @@ int GenericMMCraw::finishDao()
 
   delete cdTextEncoder_, cdTextEncoder_ = NULL;
   delete[] zeroBuffer_, zeroBuffer_ = NULL;
-  delete[] encodeBuffer_, encodeBuffer_ = NULL;
 
   return 0;
 }
@@ -613,24 +622,24 @@ long GenericMMCraw::nextWritableAddress()
 
 }
 
-// Writes data to target. The encoded sub-channel data is appended to each
-// block.
+// Writes data to target. The blocks in 'buf' must be 'blockSize()' bytes
+// long, the encoded sub-channel data is filled into the space following
+// the audio data of each block so that the buffer can be sent to the drive
+// without copying it.
 // return: 0: OK
 //         1: scsi command failed
 int GenericMMCraw::writeData(TrackData::Mode mode,
 			     TrackData::SubChannelMode sm,
-			     long &lba, const char *buf, long len)
+			     long &lba, char *buf, long len)
 {
   assert(blockLength_ > 0);
   assert(blocksPerWrite_ > 0);
   assert(mode == TrackData::AUDIO);
+  assert(blockSize(mode, sm) == blockLength_);
   int writeLen = 0;
   unsigned char cmd[10];
   int i, j;
 
-  long iblen = blockSize(mode, sm);
-  long slen = subChannel_->dataLength();
-
   /*
   log_message(0, "lba: %ld, len: %ld, bpc: %d, bl: %d ", lba, len, blocksPerCmd,
 	 blockLength_);
@@ -650,87 +659,43 @@ int GenericMMCraw::writeData(TrackData::Mode mode,
     cmd[7] = writeLen >> 8;
     cmd[8] = writeLen;
 
-    // encode the PQ sub-channel data
-    encode(lba, encSubChannel_, writeLen);
-
-    for (i = 0; i < writeLen; i++) {
-      memcpy(encodeBuffer_ + i * blockLength_, buf + i * iblen,
-	     AUDIO_BLOCK_LEN);
-
-      memcpy(encodeBuffer_ + i * blockLength_ + AUDIO_BLOCK_LEN,
-	     encSubChannel_ + i * slen, slen);
-
-      if (cdTextSubChannels_ != NULL && lba >= cdTextStartLba_ &&
-	  lba + i < cdTextEndLba_) {
-
+    // PQ sub-channels were encoded by 'initDao()', they are placed
+    // directly behind the audio data of each block, R-W data was placed
+    // there by the reader
+    copyStream(lba, writeLen, (unsigned char *)buf + AUDIO_BLOCK_LEN,
+	       blockLength_, sm != TrackData::SUBCHAN_NONE);
+
+    // merge the R-W data of CD-TEXT
+    for (i = 0; cdTextSubChannels_ != NULL && i < writeLen; i++) {
+      if (lba + i >= cdTextStartLba_ && lba + i < cdTextEndLba_) {
+	unsigned char *subBuf = (unsigned char *)buf + i * blockLength_ +
+	  AUDIO_BLOCK_LEN;
 	const unsigned char *data = cdTextSubChannels_[cdTextSubChannelAct_]->data();
 	long dataLen = cdTextSubChannels_[cdTextSubChannelAct_]->dataLength();
 
-	unsigned char *actBuf = encodeBuffer_ + i * blockLength_ + AUDIO_BLOCK_LEN;
-
 	//log_message(0, "Adding CD-TEXT channel %ld for LBA %ld", cdTextSubChannelAct_, lba + i);
-	for (j = 0; j < dataLen; j++) {
-	  *actBuf |= (*data & 0x3f);
-	  actBuf++;
-	  data++;
-	}
+	for (j = 0; j < dataLen; j++)
+	  subBuf[j] = (subBuf[j] & 0xc0) | (data[j] & 0x3f);
 
 	cdTextSubChannelAct_++;
 	if (cdTextSubChannelAct_ >= cdTextSubChannelCount_)
 	  cdTextSubChannelAct_ = 0;
       }
-      else {
-	switch (sm) {
-	case TrackData::SUBCHAN_NONE:
-	  break;
-
-	case TrackData::SUBCHAN_RW:
-	case TrackData::SUBCHAN_RW_RAW:
-	  {
-	    unsigned char *oBuf = encodeBuffer_ + i * blockLength_ + AUDIO_BLOCK_LEN;
-	    const char *iBuf = buf + i * iblen + AUDIO_BLOCK_LEN;
-
-	    for (j = 0; j < PW_SUBCHANNEL_LEN; j++) {
-	      *oBuf |= (*iBuf & 0x3f);
-	      oBuf++;
-	      iBuf++;
-	    }
-	  }
-	  break;
-	}
-      }
     }
 
 
 #if 0
     // consistency checks
-    long sum1, sum2;
-    int n;
-    const char *p;
     for (i = 0; i < writeLen; i++) {
       log_message(0, "%ld: ", lba + i);
-      SubChannel *chan = subChannel_->makeSubChannel(encodeBuffer_ + i * blockLength_ + AUDIO_BLOCK_LEN);
+      SubChannel *chan = subChannel_->makeSubChannel((unsigned char *)buf + i * blockLength_ + AUDIO_BLOCK_LEN);
       chan->print();
       delete chan;
-
-      sum1 = 0;
-      for (p = buf + i * iblen, n = 0;
-	   n < AUDIO_BLOCK_LEN; n++, p++) {
-	sum1 += *p;
-      }
-
-      sum2 = 0;
-      for (n = 0; n < AUDIO_BLOCK_LEN; n++) {
-	sum2 += *(char *)(encodeBuffer_ + i * blockLength_ + n);
-      }
-
-      //log_message(0, "%ld - %ld", sum1, sum2);
-      assert(sum1 == sum2);
     }
 #endif
 
 #if 1
-    if (sendCmd(cmd, 10, encodeBuffer_, writeLen * blockLength_,
+    if (sendCmd(cmd, 10, (unsigned char *)buf, writeLen * blockLength_,
 		NULL, 0) != 0) {
       log_message(-2, "Write data failed.");
       return 1;
@@ -740,7 +705,7 @@ int GenericMMCraw::writeData(TrackData::Mode mode,
 
     lba += writeLen;
     len -= writeLen;
-    buf += writeLen * iblen;
+    buf += writeLen * blockLength_;
   }
 
   //log_message(0, "");
@@ -41,16 +41,17 @@ public:
   int finishDao();
 
   int writeData(TrackData::Mode, TrackData::SubChannelMode, long &lba,
-		const char *buf, long len);
+		char *buf, long len);
+
+  // blocks are laid out with room for the sub-channel data so that it can
+  // be filled in place by 'writeData()'
+  long blockSize(TrackData::Mode, TrackData::SubChannelMode) const;
 
 protected:
   
   int setWriteParameters(int);
 
 private:  
-  unsigned char *encodeBuffer_; // buffer for encoding sub-channels
-  unsigned char *encSubChannel_; // holds encoded sub-channels
-
   SubChannel *subChannel_; // sub channel template
 
   int subChannelMode_; /* selected sub-channel writing mode:
@@ -0,0 +1,372 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/types.h>
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
+#include "ImageWriter.h"
+#include "util.h"
+#include "log.h"
+#include "stats.h"
+
+// Size and number of the buffers. Large writes suit network file systems
+// better than the short bursts read from the drive.
+#define BUFFER_LEN (1024 * 1024)
+#define NOF_BUFFERS 4
+
+struct Buffer {
+  unsigned char *data;
+  long len;          // number of filled bytes
+  long long offset;  // file offset, -1 if not seekable
+};
+
+struct ImageWriter::Ring {
+  int fd;
+  ImageWriter::Mode mode;
+
+  Buffer buffers[NOF_BUFFERS];
+  int head;  // oldest queued buffer
+  int count; // number of queued buffers
+  int error; // errno of first failed write, -1: disk full
+
+  // range that is dropped from the page cache with the next write
+  long long dropOffset;
+  long dropLen;
+
+#ifdef USE_POSIX_THREADS
+  int threaded;
+  int stop;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t work; // signaled when a buffer is queued
+  pthread_cond_t done; // signaled when a buffer is written
+#endif
+};
+
+// Waits until the previously written range reached the disk and drops it
+// from the page cache. The write-back of the given range is started so
+// that it is finished with the next call. Pass 'len' 0 to drop the last
+// range.
+static void dropCache(ImageWriter::Ring *r, long long offset, long len)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+  if (len > 0)
+    sync_file_range(r->fd, offset, len, SYNC_FILE_RANGE_WRITE);
+
+  if (r->dropLen > 0)
+    sync_file_range(r->fd, r->dropOffset, r->dropLen,
+		    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+		    SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+
+#ifdef HAVE_POSIX_FADVISE
+  if (r->dropLen > 0)
+    posix_fadvise(r->fd, r->dropOffset, r->dropLen, POSIX_FADV_DONTNEED);
+#endif
+
+  r->dropOffset = offset;
+  r->dropLen = len;
+}
+
+// Writes given buffer to the file.
+// return: 0: OK, errno of failed write or -1 if the disk is full
+static int writeBuffer(ImageWriter::Ring *r, Buffer *b)
+{
+  long long start = stats_start();
+  long ret;
+
+  if ((ret = fullWrite(r->fd, b->data, b->len)) != b->len)
+    return ret < 0 ? errno : -1;
+
+  stats_end(STAT_FILE_WRITE, start, b->len);
+
+  if (r->mode == ImageWriter::NOCACHE && b->offset >= 0)
+    dropCache(r, b->offset, b->len);
+
+  return 0;
+}
+
+#ifdef USE_POSIX_THREADS
+
+static void *writerThread(void *arg)
+{
+  ImageWriter::Ring *r = (ImageWriter::Ring *)arg;
+  Buffer *b;
+  int err;
+
+  stats_thread_name("writer");
+
+  pthread_mutex_lock(&r->mutex);
+
+  for (;;) {
+    if (r->count == 0) {
+      if (r->stop)
+	break;
+
+      pthread_cond_wait(&r->work, &r->mutex);
+      continue;
+    }
+
+    b = &r->buffers[r->head];
+    err = r->error;
+
+    pthread_mutex_unlock(&r->mutex);
+
+    // data following a failed write is dropped
+    if (err == 0)
+      err = writeBuffer(r, b);
+
+    pthread_mutex_lock(&r->mutex);
+
+    r->error = err;
+    r->head = (r->head + 1) % NOF_BUFFERS;
+    r->count--;
+    pthread_cond_broadcast(&r->done);
+  }
+
+  pthread_mutex_unlock(&r->mutex);
+
+  stats_thread_exit();
+
+  return NULL;
+}
+
+#endif
+
+ImageWriter::ImageWriter(int fd, long maxLen, Mode mode)
+{
+  int i;
+
+  assert(maxLen > 0);
+
+  maxLen_ = maxLen;
+
+  // a buffer holds a whole number of 'maxLen' blocks
+  bufLen_ = (BUFFER_LEN / maxLen) * maxLen;
+  if (bufLen_ == 0)
+    bufLen_ = maxLen;
+
+  ring_ = new Ring;
+  ring_->fd = fd;
+  ring_->mode = mode;
+  ring_->head = 0;
+  ring_->count = 0;
+  ring_->error = 0;
+  ring_->dropOffset = 0;
+  ring_->dropLen = 0;
+
+  for (i = 0; i < NOF_BUFFERS; i++) {
+    ring_->buffers[i].data = new unsigned char[bufLen_];
+    ring_->buffers[i].len = 0;
+    ring_->buffers[i].offset = -1;
+  }
+
+  fill_ = 0;
+  reported_ = false;
+
+  if ((offset_ = lseek(fd, 0, SEEK_CUR)) < 0)
+    offset_ = -1;
+
+#ifdef USE_POSIX_THREADS
+  ring_->stop = 0;
+
+  pthread_mutex_init(&ring_->mutex, NULL);
+  pthread_cond_init(&ring_->work, NULL);
+  pthread_cond_init(&ring_->done, NULL);
+
+  ring_->threaded =
+    (pthread_create(&ring_->thread, NULL, writerThread, ring_) == 0);
+
+  if (!ring_->threaded)
+    log_message(4, "Cannot create image writer thread - writing synchronously.");
+
+  stats_label("file_write", ring_->threaded ? "thread" : "sync");
+#else
+  stats_label("file_write", "sync");
+#endif
+}
+
+ImageWriter::~ImageWriter()
+{
+  int i;
+
+#ifdef USE_POSIX_THREADS
+  if (ring_->threaded) {
+    pthread_mutex_lock(&ring_->mutex);
+    ring_->stop = 1;
+    pthread_cond_signal(&ring_->work);
+    pthread_mutex_unlock(&ring_->mutex);
+
+    pthread_join(ring_->thread, NULL);
+  }
+
+  pthread_cond_destroy(&ring_->done);
+  pthread_cond_destroy(&ring_->work);
+  pthread_mutex_destroy(&ring_->mutex);
+#endif
+
+  for (i = 0; i < NOF_BUFFERS; i++)
+    delete[] ring_->buffers[i].data;
+
+  delete ring_;
+}
+
+void ImageWriter::preallocate(long long len)
+{
+  if (ring_->mode != NOCACHE || offset_ < 0 || len <= 0)
+    return;
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+  // the file size is not changed so that an aborted read leaves no
+  // unwritten space at the end of the image
+  if (fallocate(ring_->fd, FALLOC_FL_KEEP_SIZE, offset_, len) != 0)
+    log_message(4, "Cannot preallocate %lld bytes of image file: %s", len,
+		strerror(errno));
+#endif
+}
+
+unsigned char *ImageWriter::reserve(long len)
+{
+  Buffer *b = &ring_->buffers[fill_];
+
+  assert(len <= maxLen_);
+
+  if (b->len + len > bufLen_) {
+    queue();
+    b = &ring_->buffers[fill_];
+  }
+
+  return b->data + b->len;
+}
+
+int ImageWriter::commit(long len)
+{
+  Buffer *b = &ring_->buffers[fill_];
+
+  b->len += len;
+
+  assert(b->len <= bufLen_);
+
+  // pass full buffers to the writer as early as possible
+  if (b->len + maxLen_ > bufLen_)
+    queue();
+
+  return checkError();
+}
+
+int ImageWriter::finish()
+{
+  queue();
+
+#ifdef USE_POSIX_THREADS
+  if (ring_->threaded) {
+    pthread_mutex_lock(&ring_->mutex);
+    while (ring_->count > 0)
+      pthread_cond_wait(&ring_->done, &ring_->mutex);
+    pthread_mutex_unlock(&ring_->mutex);
+  }
+#endif
+
+  if (ring_->mode == NOCACHE)
+    dropCache(ring_, 0, 0);
+
+  return checkError();
+}
+
+// Queues the buffer that is currently filled for writing and waits until
+// the next buffer is free.
+void ImageWriter::queue()
+{
+  Buffer *b = &ring_->buffers[fill_];
+
+  if (b->len == 0)
+    return;
+
+  b->offset = offset_;
+
+  if (offset_ >= 0)
+    offset_ += b->len;
+
+#ifdef USE_POSIX_THREADS
+  if (ring_->threaded) {
+    pthread_mutex_lock(&ring_->mutex);
+
+    ring_->count++;
+    pthread_cond_signal(&ring_->work);
+
+    while (ring_->count == NOF_BUFFERS)
+      pthread_cond_wait(&ring_->done, &ring_->mutex);
+
+    pthread_mutex_unlock(&ring_->mutex);
+
+    fill_ = (fill_ + 1) % NOF_BUFFERS;
+    ring_->buffers[fill_].len = 0;
+    return;
+  }
+#endif
+
+  if (ring_->error == 0)
+    ring_->error = writeBuffer(ring_, b);
+
+  b->len = 0;
+}
+
+// Prints the message for a failed write once.
+// return: 0: no write error
+//         1: write failed
+int ImageWriter::checkError()
+{
+  int err;
+
+#ifdef USE_POSIX_THREADS
+  if (ring_->threaded) {
+    pthread_mutex_lock(&ring_->mutex);
+    err = ring_->error;
+    pthread_mutex_unlock(&ring_->mutex);
+  }
+  else {
+    err = ring_->error;
+  }
+#else
+  err = ring_->error;
+#endif
+
+  if (err == 0)
+    return 0;
+
+  if (!reported_) {
+    if (err > 0)
+      log_message(-2, "Writing of data failed: %s", strerror(err));
+    else
+      log_message(-2, "Writing of data failed: Disk full");
+
+    reported_ = true;
+  }
+
+  return 1;
+}
@@ -0,0 +1,75 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __IMAGEWRITER_H__
+#define __IMAGEWRITER_H__
+
+//! \brief Writes the data read from a CD to the image file.
+// The data is collected in a ring of buffers that are written by a
+// separate thread so that reading from the drive does not wait for slow
+// file systems. Without thread support the buffers are written
+// synchronously when they are full.
+//
+// In mode 'NOCACHE' the space for the expected amount of data is reserved
+// with 'fallocate()' and the written data is dropped from the page cache.
+
+class ImageWriter {
+public:
+  enum Mode { BUFFERED, NOCACHE };
+
+  // 'fd': output file, written from its current offset
+  // 'maxLen': maximum length passed to 'reserve()'
+  ImageWriter(int fd, long maxLen, Mode mode);
+
+  // Waits for the queued buffers, write errors are not reported.
+  ~ImageWriter();
+
+  // Reserves file space for 'len' bytes following the current file
+  // offset. Only done in mode 'NOCACHE', failures are ignored.
+  void preallocate(long long len);
+
+  // Returns a buffer for 'len' bytes that will be written with the next
+  // 'commit()'. Waits until a buffer is free if required.
+  unsigned char *reserve(long len);
+
+  // Appends the first 'len' bytes of the last reserved buffer to the
+  // file.
+  // return: 0: OK
+  //         1: a previous write failed, message is already printed
+  int commit(long len);
+
+  // Waits until all data is written.
+  // return: 0: OK
+  //         1: write failed, message is already printed
+  int finish();
+
+  struct Ring;
+
+private:
+  long maxLen_;
+  long bufLen_;
+
+  Ring *ring_;
+  int fill_;          // buffer that is currently filled
+  long long offset_;  // file offset of 'fill_', -1 if not seekable
+  bool reported_;     // write error was printed
+
+  void queue();
+  int checkError();
+};
+
+#endif
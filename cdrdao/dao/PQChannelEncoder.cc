@@ -24,6 +24,8 @@
 #include <assert.h>
 
 #include "PQChannelEncoder.h"
+#include "PQSubChannel16.h"
+#include "PWSubChannel96.h"
 
 #include "Msf.h"
 #include "Track.h"
@@ -40,6 +42,10 @@ PQChannelEncoder::PQChannelEncoder()
   current_ = NULL;
   catalog_ = NULL;
   isrc_ = NULL;
+  stream_ = NULL;
+  streamStart_ = 0;
+  streamLen_ = 0;
+  streamChannels_ = NULL;
 }
 
 PQChannelEncoder::~PQChannelEncoder()
@@ -55,6 +61,8 @@ PQChannelEncoder::~PQChannelEncoder()
   delete current_;
   delete catalog_;
   delete isrc_;
+  delete[] stream_;
+  delete[] streamChannels_;
 }
 
 
@@ -532,3 +540,142 @@ CueSheetEntry *PQChannelEncoder::nextCueSheetEntry(CueSheetEntry *act,
 }
 
 
+
+// Number of blocks that are interleaved in one go by 'copyStream()'
+#define STREAM_CHANNEL_BLOCKS 64
+
+void PQChannelEncoder::encodeStream(long lba, long blocks)
+{
+  unsigned char channels[96];
+  unsigned char *rec;
+  const SubChannel *chan;
+  long i;
+
+  delete[] stream_;
+  stream_ = new unsigned char[blocks * 16];
+  streamStart_ = lba;
+  streamLen_ = blocks;
+
+  if (subChannel_->dataLength() == 96 && streamChannels_ == NULL) {
+    streamChannels_ = new unsigned char[STREAM_CHANNEL_BLOCKS * 96];
+    memset(streamChannels_, 0, STREAM_CHANNEL_BLOCKS * 96);
+  }
+
+  for (i = 0, rec = stream_; i < blocks; i++, rec += 16) {
+    chan = encodeSubChannel(lba + i);
+
+    if (chan->dataLength() == 96) {
+      PWSubChannel96::deinterleave(chan->data(), 96, channels, 1);
+      memcpy(rec, channels + 12, 12);
+      memset(rec + 12, 0, 4);
+      rec[15] = channels[0] & 0x80;
+    }
+    else {
+      memcpy(rec, chan->data(), 16);
+    }
+  }
+}
+
+long PQChannelEncoder::checkStream() const
+{
+  PQSubChannel16 pq;
+  PWSubChannel96 pw;
+  SubChannel *chan;
+  unsigned char buf[96];
+  long errors = 0;
+  long i, lba;
+
+  // decode the records with the sub channel format that is written
+  if (subChannel_->dataLength() == 96)
+    chan = &pw;
+  else
+    chan = &pq;
+
+  for (i = 0; i < streamLen_; i++) {
+    int ok;
+
+    lba = streamStart_ + i;
+    copyStream(lba, 1, buf, 96);
+
+    if (chan == &pw)
+      pw.init(buf);
+    else
+      pq.init(buf);
+
+    if (!chan->checkCrc()) {
+      ok = 0;
+    }
+    else if (lba < -150) {
+      // lead-in contains only the toc
+      ok = (chan->type() == SubChannel::QMODE1DATA);
+    }
+    else {
+      Msf m(lba + 150);
+
+      switch (chan->type()) {
+      case SubChannel::QMODE1DATA:
+	ok = (chan->amin() == m.min() && chan->asec() == m.sec() &&
+	      chan->aframe() == m.frac());
+	break;
+
+      case SubChannel::QMODE2:
+      case SubChannel::QMODE3:
+	ok = (chan->aframe() == m.frac());
+	break;
+
+      default:
+	ok = 0;
+	break;
+      }
+    }
+
+    if (!ok) {
+      if (errors < 10)
+	log_message(-2, "Encoded sub-channel of block %ld is defective.", lba);
+      errors++;
+    }
+  }
+
+  return errors;
+}
+
+void PQChannelEncoder::copyStream(long lba, long blocks, unsigned char *out,
+				  long stride, int keepRW) const
+{
+  const unsigned char *rec;
+  long i, n;
+
+  assert(lba >= streamStart_ && lba + blocks <= streamStart_ + streamLen_);
+
+  rec = stream_ + (lba - streamStart_) * 16;
+
+  if (subChannel_->dataLength() != 96) {
+    for (i = 0; i < blocks; i++, rec += 16, out += stride)
+      memcpy(out, rec, 16);
+
+    return;
+  }
+
+  while (blocks > 0) {
+    n = blocks > STREAM_CHANNEL_BLOCKS ? STREAM_CHANNEL_BLOCKS : blocks;
+
+    // only the P and Q channels are replaced
+    if (keepRW)
+      PWSubChannel96::deinterleave(out, stride, streamChannels_, n);
+
+    for (i = 0; i < n; i++, rec += 16) {
+      unsigned char *ch = streamChannels_ + i * 96;
+
+      memset(ch, (rec[15] & 0x80) ? 0xff : 0, 12);
+      memcpy(ch + 12, rec, 12);
+
+      if (!keepRW)
+	memset(ch + 24, 0, 72);
+    }
+
+    PWSubChannel96::interleave(streamChannels_, out, stride, n);
+
+    out += n * stride;
+    blocks -= n;
+  }
+}
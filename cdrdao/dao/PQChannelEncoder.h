@@ -68,6 +68,28 @@ public:
   // PQ sub channel data in caller provided buffer 'out'
   void encode(long lba, unsigned char *out, long blocks);
 
+  // returns the PQ sub channel for block 'lba', must be called for
+  // consecutive blocks like 'encode()'
+  const SubChannel *encodeSubChannel(long lba);
+
+  // Encodes the PQ sub channels of 'blocks' consecutive blocks starting
+  // at 'lba' in advance. They are kept as 16 byte records (Q sub channel
+  // in bytes 0-11, P channel flag in bit 7 of byte 15). Must be called
+  // directly after 'setCueSheet()' instead of 'encodeSubChannel()'.
+  void encodeStream(long lba, long blocks);
+
+  // Checks the CRC, mode and absolute time of all encoded records.
+  // Return: number of defective records
+  long checkStream() const;
+
+  // Copies the encoded sub channels of 'blocks' blocks starting at 'lba'
+  // to 'out' in the format of the sub channel template, the sub channels
+  // of consecutive blocks are placed 'stride' bytes apart. If 'keepRW' is
+  // set the R-W channels that are already stored in 'out' are kept,
+  // otherwise they are cleared (96 byte sub channels only).
+  void copyStream(long lba, long blocks, unsigned char *out,
+		  long stride, int keepRW = 0) const;
+
 private:
   SubChannel *subChannel_; // template for all sub channel objects
 
@@ -104,8 +126,12 @@ private:
 
   SubChannel *current_;
 
+  unsigned char *stream_; // records created by 'encodeStream()'
+  long streamStart_;      // lba of first record
+  long streamLen_;        // number of records
+  unsigned char *streamChannels_; // deinterleaved P-W for 'copyStream()'
+
   int analyzeCueSheet();
-  const SubChannel *encodeSubChannel(long lba);
   void nextTransition();
   CueSheetEntry *nextCueSheetEntry(CueSheetEntry *act, int adr);
   CueSheetEntry *nextCueSheetEntry(CueSheetEntry *act, int trackNr,
@@ -17,17 +17,28 @@
  *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
-#include "PWSubChannel96.h"
+#include <config.h>
 
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
+// SIMD variants of the P-W sub-channel (de)interleaving
+#if defined(HAVE_BUILTIN_CPU_SUPPORTS) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_PW
+#include <immintrin.h>
+#endif
+
+#include "PWSubChannel96.h"
+
 #include "log.h"
 
 PWSubChannel96::PWSubChannel96()
 {
   memset(data_, 0, 96);
+  memset(channels_, 0, 96);
+  dataValid_ = channelsValid_ = 1;
   type_ = QMODE1DATA;
 }
 
@@ -39,6 +50,8 @@ PWSubChannel96::PWSubChannel96(unsigned char *buf)
 void PWSubChannel96::init(unsigned char *buf)
 {
   memcpy(data_, buf, 96);
+  dataValid_ = 1;
+  channelsValid_ = 0;
 
   switch (getChannelByte(Q_CHAN, 0) & 0x0f) {
   case 1:
@@ -111,45 +124,43 @@ void PWSubChannel96::setChannelByte(Channel chan, int byteNr,
 {
   assert(byteNr >= 0 && byteNr < 12);
 
-  register unsigned char setMask = 1 << chan;
-  register unsigned char clearMask = ~setMask;
-
-  register unsigned char *p = data_ + (byteNr * 8);
-  register int i;
-
-  for (i = 0; i < 8; i++) {
-    if (value & 0x80)
-      *p |= setMask;
-    else
-      *p &= clearMask;
+  syncChannels();
 
-    p++;
-    value <<= 1;
-  }
+  channels_[(7 - chan) * 12 + byteNr] = value;
+  dataValid_ = 0;
 }
 
 unsigned char PWSubChannel96::getChannelByte(Channel chan, int byteNr) const
 {
   assert(byteNr >= 0 && byteNr < 12);
 
-  register unsigned char testMask = 1 << chan;
-  register const unsigned char *p = data_ + (byteNr * 8);
-  register unsigned char val = 0;
-  register int i;
-  
-  for (i = 0; i < 8; i++) {
-    val <<= 1;
-    if ((*p) & testMask)
-      val |= 0x01;
+  syncChannels();
+
+  return channels_[(7 - chan) * 12 + byteNr];
+}
 
-    p++;
+// Updates 'data_' from 'channels_' if required.
+void PWSubChannel96::syncData() const
+{
+  if (!dataValid_) {
+    interleave(channels_, data_, 96, 1);
+    dataValid_ = 1;
   }
+}
 
-  return val;
+// Updates 'channels_' from 'data_' if required.
+void PWSubChannel96::syncChannels() const
+{
+  if (!channelsValid_) {
+    deinterleave(data_, 96, channels_, 1);
+    channelsValid_ = 1;
+  }
 }
 
 const unsigned char *PWSubChannel96::data() const
 {
+  syncData();
+
   return data_;
 }
 
@@ -202,16 +213,10 @@ int PWSubChannel96::checkCrc() const
 // sets P channel bit
 void PWSubChannel96::pChannel(int f)
 {
-  register int i;
+  syncChannels();
 
-  if (f != 0) {
-    for (i = 0; i < 96; i++)
-      data_[i] |= 0x80;
-  }
-  else {
-    for (i = 0; i < 96; i++)
-      data_[i] &= 0x7f;
-  }    
+  memset(channels_, f != 0 ? 0xff : 0, 12);
+  dataValid_ = 0;
 }
 
 // returns Q type
@@ -512,6 +517,9 @@ void PWSubChannel96::setRawRWdata(const unsigned char *data)
 {
   int i;
 
+  syncData();
+  channelsValid_ = 0;
+
   for (i = 0; i < 96; i += 4) {
     data_[i]     |= (data[0] >> 2) & 0x3f;
     data_[i + 1] |= ((data[0] << 4) & 0x30) | ((data[1] >> 4) & 0x0f);
@@ -527,6 +535,8 @@ void PWSubChannel96::getRawRWdata(unsigned char *data) const
 {
   int i;
 
+  syncData();
+
   for (i = 0; i < 96; i += 4) {
     data[0] = ((data_[i] << 2) & 0xfc)     | ((data_[i + 1] >> 4) & 0x03);
     data[1] = ((data_[i + 1] << 4) & 0xf0) | ((data_[i + 2] >> 2) & 0x0f);
@@ -535,3 +545,393 @@ void PWSubChannel96::getRawRWdata(unsigned char *data) const
     data += 3;
   }
 }
+
+// Conversion between raw and deinterleaved P-W sub-channel data: every
+// group of 8 raw bytes holds one byte of each channel with the P bit in
+// bit 7 of each raw byte. Each group is an 8x8 bit matrix that is
+// transposed to get the channel bytes and vice versa. The fastest variant
+// supported by the CPU is selected at the first call.
+
+typedef void (*DeinterleaveKernel)(const unsigned char *raw, long stride,
+				   unsigned char *channels, long count);
+typedef void (*InterleaveKernel)(const unsigned char *channels,
+				 unsigned char *raw, long stride, long count);
+
+// Transposes the 8x8 bit matrix with row 0 in the most significant byte
+// and column 0 in the most significant bit of each row.
+static inline unsigned long long transpose8x8(unsigned long long x)
+{
+  unsigned long long t;
+
+  t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+  x ^= t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+  x ^= t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+  x ^= t ^ (t << 28);
+
+  return x;
+}
+
+// Layout of the batches used by 'checkKernels()': 2352 bytes of audio data
+// followed by the raw P-W data like in a READ CD transfer.
+#define CHECK_STRIDE 2448
+#define CHECK_BATCH 27
+
+// Reference implementations that move one bit at a time.
+static void deinterleaveRef(const unsigned char *raw, long stride,
+			    unsigned char *channels, long count)
+{
+  long n;
+  int c, i, j;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    for (c = 0; c < 8; c++) {
+      for (i = 0; i < 12; i++) {
+	unsigned char val = 0;
+
+	for (j = 0; j < 8; j++)
+	  val = (val << 1) | ((raw[i * 8 + j] >> (7 - c)) & 0x01);
+
+	channels[c * 12 + i] = val;
+      }
+    }
+  }
+}
+
+static void interleaveRef(const unsigned char *channels, unsigned char *raw,
+			  long stride, long count)
+{
+  long n;
+  int c, i, j;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    memset(raw, 0, 96);
+
+    for (c = 0; c < 8; c++) {
+      for (i = 0; i < 12; i++) {
+	unsigned char val = channels[c * 12 + i];
+
+	for (j = 0; j < 8; j++, val <<= 1) {
+	  if (val & 0x80)
+	    raw[i * 8 + j] |= 1 << (7 - c);
+	}
+      }
+    }
+  }
+}
+
+static void deinterleaveScalar(const unsigned char *raw, long stride,
+			       unsigned char *channels, long count)
+{
+  unsigned long long x;
+  long n;
+  int g, i;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    for (g = 0; g < 12; g++) {
+      x = 0;
+      for (i = 0; i < 8; i++)
+	x = (x << 8) | raw[g * 8 + i];
+
+      x = transpose8x8(x);
+
+      for (i = 0; i < 8; i++)
+	channels[i * 12 + g] = (unsigned char)(x >> (56 - 8 * i));
+    }
+  }
+}
+
+static void interleaveScalar(const unsigned char *channels,
+			     unsigned char *raw, long stride, long count)
+{
+  unsigned long long x;
+  long n;
+  int g, i;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    for (g = 0; g < 12; g++) {
+      x = 0;
+      for (i = 0; i < 8; i++)
+	x = (x << 8) | channels[i * 12 + g];
+
+      x = transpose8x8(x);
+
+      for (i = 0; i < 8; i++)
+	raw[g * 8 + i] = (unsigned char)(x >> (56 - 8 * i));
+    }
+  }
+}
+
+#ifdef USE_X86_PW
+// 'movemask' collects bit 7 of each byte, shifting a 64 bit lane left by
+// 'c' moves bit 7 - c of each byte to bit 7 without crossing bytes. The
+// bytes of each lane are reversed first so that the first byte ends up
+// in the most significant bit.
+
+__attribute__((target("sse2")))
+static void deinterleaveSse2(const unsigned char *raw, long stride,
+			     unsigned char *channels, long count)
+{
+  long n;
+  int k, c, m;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    for (k = 0; k < 6; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(raw + 16 * k));
+
+      v = _mm_shufflelo_epi16(v, 0x1b);
+      v = _mm_shufflehi_epi16(v, 0x1b);
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+      for (c = 0; c < 8; c++) {
+	m = _mm_movemask_epi8(_mm_slli_epi64(v, c));
+	channels[c * 12 + 2 * k] = (unsigned char)m;
+	channels[c * 12 + 2 * k + 1] = (unsigned char)(m >> 8);
+      }
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static void deinterleaveAvx2(const unsigned char *raw, long stride,
+			     unsigned char *channels, long count)
+{
+  const __m256i rev = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+				      0, 1, 2, 3, 4, 5, 6, 7,
+				      8, 9, 10, 11, 12, 13, 14, 15,
+				      0, 1, 2, 3, 4, 5, 6, 7);
+  long n;
+  int k, c, m;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    for (k = 0; k < 3; k++) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(raw + 32 * k));
+
+      v = _mm256_shuffle_epi8(v, rev);
+
+      for (c = 0; c < 8; c++) {
+	m = _mm256_movemask_epi8(_mm256_slli_epi64(v, c));
+	memcpy(channels + c * 12 + 4 * k, &m, 4);
+      }
+    }
+  }
+}
+
+// Stores the transposed rows of two groups of channel bytes (W ... P in
+// each lane) to the raw data of groups 'g' and 'g' + 1.
+__attribute__((target("sse2")))
+static inline void storeGroupsSse2(__m128i v, unsigned char *raw, int g)
+{
+  int r, m;
+
+  for (r = 0; r < 8; r++) {
+    m = _mm_movemask_epi8(_mm_slli_epi64(v, r));
+    raw[g * 8 + r] = (unsigned char)m;
+    raw[g * 8 + 8 + r] = (unsigned char)(m >> 8);
+  }
+}
+
+// Loads the 12 bytes of channel vector 'c'.
+__attribute__((target("sse2")))
+static inline __m128i loadChannelSse2(const unsigned char *channels, int c)
+{
+  int x;
+
+  memcpy(&x, channels + c * 12 + 8, 4);
+
+  return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(channels +
+							      c * 12)),
+			    _mm_cvtsi32_si128(x));
+}
+
+__attribute__((target("sse2")))
+static void interleaveSse2(const unsigned char *channels,
+			   unsigned char *raw, long stride, long count)
+{
+  long n;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    __m128i c[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+      c[i] = loadChannelSse2(channels, i);
+
+    // byte transpose so that each lane holds the bytes of one group in
+    // the order W ... P
+    __m128i a0 = _mm_unpacklo_epi8(c[7], c[6]);
+    __m128i a1 = _mm_unpacklo_epi8(c[5], c[4]);
+    __m128i a2 = _mm_unpacklo_epi8(c[3], c[2]);
+    __m128i a3 = _mm_unpacklo_epi8(c[1], c[0]);
+    __m128i e0 = _mm_unpackhi_epi8(c[7], c[6]);
+    __m128i e1 = _mm_unpackhi_epi8(c[5], c[4]);
+    __m128i e2 = _mm_unpackhi_epi8(c[3], c[2]);
+    __m128i e3 = _mm_unpackhi_epi8(c[1], c[0]);
+
+    __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+    __m128i f0 = _mm_unpacklo_epi16(e0, e1);
+    __m128i f2 = _mm_unpacklo_epi16(e2, e3);
+
+    storeGroupsSse2(_mm_unpacklo_epi32(b0, b2), raw, 0);
+    storeGroupsSse2(_mm_unpackhi_epi32(b0, b2), raw, 2);
+    storeGroupsSse2(_mm_unpacklo_epi32(b1, b3), raw, 4);
+    storeGroupsSse2(_mm_unpackhi_epi32(b1, b3), raw, 6);
+    storeGroupsSse2(_mm_unpacklo_epi32(f0, f2), raw, 8);
+    storeGroupsSse2(_mm_unpackhi_epi32(f0, f2), raw, 10);
+  }
+}
+#endif
+
+static DeinterleaveKernel deinterleaveKernel = NULL;
+static InterleaveKernel interleaveKernel = NULL;
+
+static void selectPWKernels()
+{
+#ifdef USE_X86_PW
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse2")) {
+    if (__builtin_cpu_supports("avx2"))
+      deinterleaveKernel = deinterleaveAvx2;
+    else
+      deinterleaveKernel = deinterleaveSse2;
+
+    interleaveKernel = interleaveSse2;
+    return;
+  }
+#endif
+
+  deinterleaveKernel = deinterleaveScalar;
+  interleaveKernel = interleaveScalar;
+}
+
+// Checks one variant with the reference implementations for 'count'
+// sectors of pseudo random data that are 'stride' bytes apart. The bytes
+// between and behind the sub-channel data must not be touched.
+// Return: number of mismatches
+static int checkVariant(const char *name, DeinterleaveKernel deinterleave,
+			InterleaveKernel interleave, long stride, long count,
+			unsigned int *seed)
+{
+  long len = (count - 1) * stride + 96;
+  unsigned char *raw = new unsigned char[len];
+  unsigned char *ref = new unsigned char[len + 1];
+  unsigned char *out = new unsigned char[len + 1];
+  unsigned char *refChannels = new unsigned char[count * 96];
+  unsigned char *channels = new unsigned char[count * 96 + 1];
+  int errors = 0;
+  long i;
+
+  for (i = 0; i < len; i++) {
+    *seed = *seed * 1103515245 + 12345;
+    raw[i] = *seed >> 16;
+  }
+
+  // the sentinel byte behind the data must not be touched
+  memset(channels, 0xa5, count * 96 + 1);
+
+  deinterleaveRef(raw, stride, refChannels, count);
+  deinterleave(raw, stride, channels, count);
+
+  if (memcmp(refChannels, channels, count * 96) != 0 ||
+      channels[count * 96] != 0xa5) {
+    log_message(-2, "P-W deinterleave variant '%s' failed for stride %ld.",
+		name, stride);
+    errors++;
+  }
+
+  if (interleave != NULL) {
+    // start from inverted data so that every sub-channel byte is written
+    for (i = 0; i < len; i++)
+      ref[i] = out[i] = ~raw[i];
+
+    ref[len] = out[len] = 0xa5;
+
+    interleaveRef(refChannels, ref, stride, count);
+    interleave(refChannels, out, stride, count);
+
+    if (memcmp(ref, out, len + 1) != 0) {
+      log_message(-2, "P-W interleave variant '%s' failed for stride %ld.",
+		  name, stride);
+      errors++;
+    }
+  }
+
+  delete[] raw;
+  delete[] ref;
+  delete[] out;
+  delete[] refChannels;
+  delete[] channels;
+
+  return errors;
+}
+
+// Compares all variants that are supported by the CPU with the reference
+// implementations for 'count' sectors of pseudo random data. The sectors
+// are checked one at a time and in batches that are laid out like a READ
+// CD transfer with audio data in front of each sub-channel block.
+// Return: number of mismatches
+int PWSubChannel96::checkKernels(long count)
+{
+  struct {
+    const char *name;
+    DeinterleaveKernel deinterleave;
+    InterleaveKernel interleave;
+    int cpu; // 0: any, 1: SSE2, 2: AVX2
+  } variants[] = {
+    { "scalar", deinterleaveScalar, interleaveScalar, 0 },
+#ifdef USE_X86_PW
+    { "sse2", deinterleaveSse2, interleaveSse2, 1 },
+    { "avx2", deinterleaveAvx2, NULL, 2 },
+#endif
+  };
+  unsigned int seed = 1;
+  int errors = 0;
+  unsigned int v;
+  long n;
+
+#ifdef USE_X86_PW
+  __builtin_cpu_init();
+#endif
+
+  for (v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+#ifdef USE_X86_PW
+    if ((variants[v].cpu == 1 && !__builtin_cpu_supports("sse2")) ||
+	(variants[v].cpu == 2 && !__builtin_cpu_supports("avx2")))
+      continue;
+#endif
+
+    for (n = 0; n < count; n++)
+      errors += checkVariant(variants[v].name, variants[v].deinterleave,
+			     variants[v].interleave, 96, 1, &seed);
+
+    for (n = 0; n < count; n += CHECK_BATCH)
+      errors += checkVariant(variants[v].name, variants[v].deinterleave,
+			     variants[v].interleave, CHECK_STRIDE,
+			     CHECK_BATCH, &seed);
+  }
+
+  return errors;
+}
+
+void PWSubChannel96::deinterleave(const unsigned char *raw, long stride,
+				  unsigned char *channels, long count)
+{
+  if (deinterleaveKernel == NULL)
+    selectPWKernels();
+
+  deinterleaveKernel(raw, stride, channels, count);
+}
+
+void PWSubChannel96::interleave(const unsigned char *channels,
+				unsigned char *raw, long stride, long count)
+{
+  if (interleaveKernel == NULL)
+    selectPWKernels();
+
+  interleaveKernel(channels, raw, stride, count);
+}
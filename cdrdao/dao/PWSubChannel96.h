@@ -122,12 +122,35 @@ public:
 
   const unsigned char *data() const;
 
+  // Converts the raw P-W sub-channel data of 'count' sectors to 8 vectors
+  // of 12 bytes per sector, one for each of the channels P, Q, R, ... W.
+  // The raw data of consecutive sectors is 'stride' bytes apart, the
+  // channel vectors are stored with 96 bytes per sector.
+  static void deinterleave(const unsigned char *raw, long stride,
+			   unsigned char *channels, long count);
+
+  // Inverse of 'deinterleave()'.
+  static void interleave(const unsigned char *channels, unsigned char *raw,
+			 long stride, long count);
+
+  // Compares the SIMD variants of 'deinterleave()' and 'interleave()' with
+  // the bitwise reference implementation, returns the number of mismatches.
+  static int checkKernels(long count);
+
 protected:
-  unsigned char data_[96]; // P - W sub channel data
+  // The sub-channel data is kept in raw and in deinterleaved form, the
+  // other form is only updated when it is accessed.
+  mutable unsigned char data_[96];     // raw P - W sub channel data
+  mutable unsigned char channels_[96]; // 12 bytes for each channel P - W
+  mutable int dataValid_;     // 1 if 'data_' is up to date
+  mutable int channelsValid_; // 1 if 'channels_' is up to date
 
 private:
   void setChannelByte(Channel, int byteNr, unsigned char value);
   unsigned char getChannelByte(Channel, int byteNr) const;
+
+  void syncData() const;
+  void syncChannels() const;
 };
 
 #endif
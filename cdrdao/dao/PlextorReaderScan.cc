@@ -25,6 +25,7 @@
 #include "PlextorReaderScan.h"
 #include "PWSubChannel96.h"
 #include "PQSubChannel16.h"
+#include "SubChannelBatch.h"
 
 #include "Toc.h"
 #include "log.h"
@@ -93,9 +94,13 @@ int PlextorReaderScan::analyzeTrack(TrackData::Mode mode, int trackNr,
   return ret;
 }
 
-int PlextorReaderScan::readSubChannels(TrackData::SubChannelMode sm,
-				       long lba, long len, SubChannel ***chans,
-				       Sample *audioData)
+// Reads 'len' sectors starting at 'lba' with PQ or raw P-W sub-channel
+// data into 'transferBuffer_' and copies the audio data to 'audioData' if
+// it is not NULL. PQ sub-channels are converted to BCD.
+// Return: 0: OK
+//         1: SCSI error occured
+int PlextorReaderScan::readSubChannelData(long lba, long len,
+					  Sample *audioData, long *blockLength)
 {
   unsigned char cmd[12];
   int i;
@@ -150,22 +155,54 @@ int PlextorReaderScan::readSubChannels(TrackData::SubChannelMode sm,
 
   unsigned char *p =  transferBuffer_ + AUDIO_BLOCK_LEN;
 
+  if ((options_ & OPT_PLEX_USE_PQ) && !(options_ & OPT_PLEX_PQ_BCD)) {
+    for (i = 0; i < len; i++) {
+      // Numbers in sub-channel data are hex instead of BCD.
+      // We have to convert them back to BCD.
+      p[1] = SubChannel::bcd(p[1]);
+      p[2] = SubChannel::bcd(p[2]);
+      p[3] = SubChannel::bcd(p[3]);
+      p[4] = SubChannel::bcd(p[4]);
+      p[5] = SubChannel::bcd(p[5]);
+      p[6] = SubChannel::bcd(p[6]);
+      p[7] = SubChannel::bcd(p[7]);
+      p[8] = SubChannel::bcd(p[8]);
+      p[9] = SubChannel::bcd(p[9]);
+
+      p += blockLen;
+    }
+  }
+
+  if (audioData != NULL) {
+    p = transferBuffer_;
+
+    for (i = 0; i < len; i++) {
+      memcpy(audioData, p, AUDIO_BLOCK_LEN);
+
+      p += blockLen;
+      audioData += SAMPLES_PER_BLOCK;
+    }
+  }
+
+  *blockLength = blockLen;
+
+  return 0;
+}
+
+int PlextorReaderScan::readSubChannels(TrackData::SubChannelMode,
+				       long lba, long len, SubChannel ***chans,
+				       Sample *audioData)
+{
+  long blockLen;
+  int i;
+
+  if (readSubChannelData(lba, len, audioData, &blockLen) != 0)
+    return 1;
+
+  unsigned char *p =  transferBuffer_ + AUDIO_BLOCK_LEN;
+
   for (i = 0; i < len; i++) {
     if (options_ & OPT_PLEX_USE_PQ) {
-      if (!(options_ & OPT_PLEX_PQ_BCD)) {
-	// Numbers in sub-channel data are hex instead of BCD.
-	// We have to convert them back to BCD for the 'SubChannel' class.
-	p[1] = SubChannel::bcd(p[1]);
-	p[2] = SubChannel::bcd(p[2]);
-	p[3] = SubChannel::bcd(p[3]);
-	p[4] = SubChannel::bcd(p[4]);
-	p[5] = SubChannel::bcd(p[5]);
-	p[6] = SubChannel::bcd(p[6]);
-	p[7] = SubChannel::bcd(p[7]);
-	p[8] = SubChannel::bcd(p[8]);
-	p[9] = SubChannel::bcd(p[9]);
-      }
-
       ((PQSubChannel16*)scannedSubChannels_[i])->init(p);
 
       if (scannedSubChannels_[i]->type() != SubChannel::QMODE_ILLEGAL) {
@@ -181,18 +218,26 @@ int PlextorReaderScan::readSubChannels(TrackData::SubChannelMode sm,
     p += blockLen;
   }
 
-  if (audioData != NULL) {
-    p = transferBuffer_;
+  *chans = scannedSubChannels_;
+  return 0;
+}
 
-    for (i = 0; i < len; i++) {
-      memcpy(audioData, p, AUDIO_BLOCK_LEN);
+// Decodes the sub-channels directly from the transfer buffer.
+int PlextorReaderScan::readSubChannelBatch(TrackData::SubChannelMode,
+					   long lba, long len,
+					   const SubChannelBatch **batch,
+					   Sample *audioData)
+{
+  long blockLen;
 
-      p += blockLen;
-      audioData += SAMPLES_PER_BLOCK;
-    }
-  }
+  if (readSubChannelData(lba, len, audioData, &blockLen) != 0)
+    return 1;
 
-  *chans = scannedSubChannels_;
+  subChannelBatch_->decode((options_ & OPT_PLEX_USE_PQ) ?
+			   SubChannelBatch::PQ16 : SubChannelBatch::PW96,
+			   transferBuffer_ + AUDIO_BLOCK_LEN, blockLen, len);
+
+  *batch = subChannelBatch_;
   return 0;
 }
 
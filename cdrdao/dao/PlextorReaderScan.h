@@ -49,6 +49,11 @@ protected:
   int readSubChannels(TrackData::SubChannelMode, long lba, long len,
 		      SubChannel ***, Sample *);
 
+  int readSubChannelBatch(TrackData::SubChannelMode, long lba, long len,
+			  const SubChannelBatch **, Sample *);
+
+  int readSubChannelData(long lba, long len, Sample *, long *blockLen);
+
   int readAudioRange(ReadDiskInfo *, int fd, long start, long end,
 		     int startTrack, int endTrack, TrackInfo *);
 
@@ -193,7 +193,7 @@ void RicohMP6200::abortDao()
 // return: 0: OK
 //         1: scsi command failed
 int RicohMP6200::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-			   long &lba, const char *buf, long len)
+			   long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
   assert(blockLength_ > 0);
@@ -39,7 +39,7 @@ public:
   void abortDao();
 
   int writeData(TrackData::Mode, TrackData::SubChannelMode, long &lba,
-		const char *buf, long len);
+		char *buf, long len);
 
   int loadUnload(int unload) const;
 
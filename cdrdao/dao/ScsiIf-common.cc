@@ -143,3 +143,53 @@ bool ScsiIf::checkMmc(bool *cd_r_read,  bool *cd_r_write,
   *cd_rw_write = p2a->cd_rw_write;
   return true;
 }
+
+#ifndef SCSIIF_IO_MODES
+// Only indirect transfers are supported by this interface.
+
+ScsiIf::IoMode ScsiIf::ioMode(IoMode)
+{
+  return IO_INDIRECT;
+}
+
+ScsiIf::IoMode ScsiIf::ioMode() const
+{
+  return IO_INDIRECT;
+}
+
+unsigned char *ScsiIf::mappedBuffer() const
+{
+  return NULL;
+}
+#endif
+
+#ifndef SCSIIF_ASYNC
+// Commands can only be sent synchronously with 'sendCmd()'.
+
+int ScsiIf::maxPendingCmds() const
+{
+  return 0;
+}
+
+int ScsiIf::pendingCmds() const
+{
+  return 0;
+}
+
+int ScsiIf::submitCmd(const unsigned char *, int, const unsigned char *, int,
+		      unsigned char *, int, void *)
+{
+  return 1;
+}
+
+int ScsiIf::pollCmd(int)
+{
+  return 0;
+}
+
+int ScsiIf::reapCmd(void **tag, int)
+{
+  *tag = NULL;
+  return 1;
+}
+#endif
@@ -29,12 +29,15 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
 #include <glob.h>
 #include <asm/param.h>
 #include <scsi/scsi.h>
 #include <scsi/sg.h>
 
 #include "ScsiIf.h"
+#include "ScsiSim.h"
 #include "sg_err.h"
 #include "log.h"
 #include "util.h"
@@ -59,21 +62,52 @@
 #define SG_MAX_SENSE 16
 #endif
 
+#ifndef SG_FLAG_MMAP_IO
+#define SG_FLAG_MMAP_IO 4
+#endif
+
+#ifndef SG_INFO_DIRECT_IO_MASK
+#define SG_INFO_DIRECT_IO_MASK 0x6
+#define SG_INFO_DIRECT_IO 0x2
+#endif
+
+// controls if the sg driver honors SG_FLAG_DIRECT_IO
+#define SG_ALLOW_DIO "/proc/scsi/sg/allow_dio"
+
 #define CDRDAO_DEFAULT_TIMEOUT 30000
 
+// number of commands that may be queued with 'submitCmd()'
+#define SG_MAX_PENDING 4
+
 #define SYSFS_SCSI_DEVICES "/sys/bus/scsi/devices"
 
 typedef unsigned char uchar;
 
+struct SgPendingCmd {
+    sg_io_hdr_t hdr;
+    uchar cmd[16];
+    uchar sense[SG_MAX_SENSE];
+    void *tag;
+    bool done;
+    int error; // result is lost, errno of the failed read(), see 'waitCmd()'
+};
+
 class ScsiIfImpl
 {
 public:
     char* filename_; // user provided device name
     int   fd_;
+    ScsiSim *sim_;   // emulated drive selected with "sim:<image>"
     bool  readOnlyMode;
 
     int openScsiDevAsSg(const char* devname);
     int adjustReservedBuffer(int requestedSize);
+    bool directIoAllowed();
+
+    ScsiIf::IoMode ioMode_;
+    uchar* mappedBuffer_; // sg reserved buffer mapped in IO_MMAP mode
+    int   mappedLen_;
+    bool  indirectReported_; // kernel fell back to indirect transfer
 
     uchar sense_buffer[SG_MAX_SENSE];
     uchar sense_buffer_length;
@@ -82,6 +116,19 @@ public:
     uchar last_command_status;
 
     int timeout_ms;
+
+    // ring buffer of commands queued with 'submitCmd()'
+    SgPendingCmd pending_[SG_MAX_PENDING];
+    int pendingHead_;
+    int pendingCount_;
+    int packId_;
+
+    int readCompleted(int timeout);
+    int waitCmd(SgPendingCmd *p, int timeout);
+    void drainQueue();
+    int simCmd(const uchar *cmd, int cmdLen, const uchar *dataOut,
+	       int dataOutLen, uchar *dataIn, int dataInLen,
+	       uchar *sense, uchar *senseLen, uchar *status);
 };
 
 
@@ -98,9 +145,19 @@ ScsiIf::ScsiIf(const char *dev)
 
 ScsiIf::~ScsiIf()
 {
+    void *tag;
+
+    // the kernel may still transfer to or from the queued data buffers
+    while (impl_->pendingCount_ > 0)
+	reapCmd(&tag, 0);
+
+    if (impl_->mappedBuffer_ != NULL)
+	munmap(impl_->mappedBuffer_, impl_->mappedLen_);
+
     if (impl_->fd_ >= 0)
 	close(impl_->fd_);
 
+    delete impl_->sim_;
     delete[] impl_->filename_;
     delete impl_;
 }
@@ -112,6 +169,20 @@ int ScsiIf::init()
     int flags;
     int sg_version = 0;
 
+    if (ScsiSim::isSimDevice(impl_->filename_)) {
+	impl_->sim_ = new ScsiSim(impl_->filename_ + 4);
+
+	if (impl_->sim_->open() != 0)
+	    return 1;
+
+	maxDataLen_ = 64 * 1024;
+
+	if (inquiry() != 0)
+	    return 2;
+
+	return 0;
+    }
+
     impl_->fd_ = open(impl_->filename_, O_RDWR | O_NONBLOCK | O_EXCL);
 
     if (impl_->fd_ < 0) {
@@ -142,6 +213,9 @@ int ScsiIf::init()
 
     maxDataLen_ = impl_->adjustReservedBuffer(64 * 1024);
 
+    // direct transfers have always been requested, keep this as default
+    ioMode(IO_DIRECT);
+
     if (inquiry() != 0) {
 	return 2;
     }
@@ -186,7 +260,6 @@ int ScsiIf::sendCmd(const uchar *cmd, int cmdLen, const uchar *dataOut,
     io_hdr.timeout = impl_->timeout_ms;
     io_hdr.sbp = impl_->sense_buffer;
     io_hdr.mx_sb_len = impl_->sense_buffer_length;
-    io_hdr.flags = 1;
     
     if (dataOut) {
 	io_hdr.dxferp = (void*)dataOut;
@@ -198,10 +271,28 @@ int ScsiIf::sendCmd(const uchar *cmd, int cmdLen, const uchar *dataOut,
 	io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
     }
 
+    if (io_hdr.dxfer_len > 0) {
+	if (impl_->ioMode_ == IO_MMAP && io_hdr.dxferp == impl_->mappedBuffer_) {
+	    // data is already in the reserved buffer
+	    io_hdr.flags = SG_FLAG_MMAP_IO;
+	    io_hdr.dxferp = NULL;
+	} else if (impl_->ioMode_ != IO_INDIRECT) {
+	    // the kernel silently falls back to an indirect transfer if the
+	    // buffer does not satisfy the alignment of the host adapter
+	    io_hdr.flags = SG_FLAG_DIRECT_IO;
+	}
+    }
+
     log_message(4, "%s: Initiating SCSI command %s%s",
 		impl_->filename_, sg_strcommand(cmd[0]),
 		sg_strcmdopts(cmd));
 
+    if (impl_->sim_ != NULL)
+	return impl_->simCmd(cmd, cmdLen, dataOut, dataOutLen, dataIn,
+			     dataInLen, impl_->sense_buffer,
+			     &impl_->last_sense_buffer_length,
+			     &impl_->last_command_status);
+
     if (ioctl(impl_->fd_, SG_IO, &io_hdr) < 0) {
 	int errnosave = errno;
 	log_message((showMsg ? -2 : 3), "%s: SCSI command %s (0x%02x) "
@@ -218,6 +309,14 @@ int ScsiIf::sendCmd(const uchar *cmd, int cmdLen, const uchar *dataOut,
     impl_->last_sense_buffer_length = io_hdr.sb_len_wr;
     impl_->last_command_status = io_hdr.status;
 
+    if ((io_hdr.flags & SG_FLAG_DIRECT_IO) && !impl_->indirectReported_ &&
+	(io_hdr.info & SG_INFO_DIRECT_IO_MASK) != SG_INFO_DIRECT_IO) {
+	log_message(4, "%s: Direct transfer not possible for %s, "
+		    "using indirect transfer.", impl_->filename_,
+		    sg_strcommand(cmd[0]));
+	impl_->indirectReported_ = true;
+    }
+
     if (io_hdr.status) {
 	if (io_hdr.sb_len_wr > 0)
 	    return 2;
@@ -228,6 +327,220 @@ int ScsiIf::sendCmd(const uchar *cmd, int cmdLen, const uchar *dataOut,
     return 0;
 }
 
+// Queued commands are passed to the sg driver with write() and their
+// results are fetched with read(). The device is opened non-blocking,
+// poll() is used to wait for completions.
+
+int ScsiIf::maxPendingCmds() const
+{
+    if (impl_->sim_ != NULL)
+	return SG_MAX_PENDING;
+
+    if (impl_->fd_ < 0 || impl_->readOnlyMode)
+	return 0;
+
+    // A queued command that cannot be transferred directly falls back to
+    // the reserved buffer, which is mapped and used by 'sendCmd()' in
+    // IO_MMAP mode.
+    if (impl_->ioMode_ == IO_MMAP)
+	return 0;
+
+    return SG_MAX_PENDING;
+}
+
+int ScsiIf::pendingCmds() const
+{
+    return impl_->pendingCount_;
+}
+
+int ScsiIf::submitCmd(const uchar *cmd, int cmdLen, const uchar *dataOut,
+		      int dataOutLen, uchar *dataIn, int dataInLen, void *tag)
+{
+    SgPendingCmd *p;
+
+    assert(cmdLen >= 0 && cmdLen <= 16);
+    assert(!(dataOut && dataIn));
+
+    if (impl_->pendingCount_ >= maxPendingCmds()) {
+	log_message(-3, "ScsiIf::submitCmd: Command queue is full.");
+	return 1;
+    }
+
+    p = &impl_->pending_[(impl_->pendingHead_ + impl_->pendingCount_) %
+			 SG_MAX_PENDING];
+
+    memset(p, 0, sizeof(SgPendingCmd));
+    memcpy(p->cmd, cmd, cmdLen);
+    p->tag = tag;
+
+    p->hdr.interface_id = 'S';
+    p->hdr.cmd_len = cmdLen;
+    p->hdr.cmdp = p->cmd;
+    p->hdr.timeout = impl_->timeout_ms;
+    p->hdr.sbp = p->sense;
+    p->hdr.mx_sb_len = SG_MAX_SENSE;
+    p->hdr.pack_id = impl_->packId_++;
+    p->hdr.usr_ptr = p;
+
+    if (dataOut) {
+	p->hdr.dxferp = (void*)dataOut;
+	p->hdr.dxfer_len = dataOutLen;
+	p->hdr.dxfer_direction = SG_DXFER_TO_DEV;
+    } else if (dataIn) {
+	p->hdr.dxferp = dataIn;
+	p->hdr.dxfer_len = dataInLen;
+	p->hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    }
+
+    // queued commands are not accepted in IO_MMAP mode, see
+    // 'maxPendingCmds()'
+    if (p->hdr.dxfer_len > 0 && impl_->ioMode_ != IO_INDIRECT)
+	p->hdr.flags = SG_FLAG_DIRECT_IO;
+
+    log_message(4, "%s: Queueing SCSI command %s%s",
+		impl_->filename_, sg_strcommand(cmd[0]),
+		sg_strcmdopts(cmd));
+
+    if (impl_->sim_ != NULL) {
+	// the emulated drive completes commands immediately
+	uchar len, status;
+
+	impl_->simCmd(cmd, cmdLen, dataOut, dataOutLen, dataIn, dataInLen,
+		      p->sense, &len, &status);
+	p->hdr.sb_len_wr = len;
+	p->hdr.status = status;
+	p->done = true;
+	impl_->pendingCount_++;
+	return 0;
+    }
+
+    if (write(impl_->fd_, &p->hdr, sizeof(p->hdr)) < 0) {
+	log_message(-2, "%s: Cannot queue SCSI command %s (0x%02x): %s.",
+		    impl_->filename_, sg_strcommand(cmd[0]), cmd[0],
+		    strerror(errno));
+	return 1;
+    }
+
+    impl_->pendingCount_++;
+
+    return 0;
+}
+
+int ScsiIf::pollCmd(int timeout)
+{
+    SgPendingCmd *p = &impl_->pending_[impl_->pendingHead_];
+
+    if (impl_->pendingCount_ == 0)
+	return 0;
+
+    return impl_->waitCmd(p, timeout);
+}
+
+int ScsiIf::reapCmd(void **tag, int showMsg)
+{
+    SgPendingCmd *p = &impl_->pending_[impl_->pendingHead_];
+
+    *tag = NULL;
+
+    if (impl_->pendingCount_ == 0)
+	return 1;
+
+    impl_->waitCmd(p, -1);
+
+    *tag = p->tag;
+    impl_->pendingHead_ = (impl_->pendingHead_ + 1) % SG_MAX_PENDING;
+    impl_->pendingCount_--;
+
+    if (!p->done) {
+	log_message((showMsg ? -2 : 3), "%s: SCSI command %s (0x%02x) "
+		    "failed: %s.", impl_->filename_,
+		    sg_strcommand(p->cmd[0]), p->cmd[0], strerror(p->error));
+	return 1;
+    }
+
+    log_message(4, "%s: SCSI command %s (0x%02x) executed in %u ms, status=%d",
+		impl_->filename_, sg_strcommand(p->cmd[0]),
+		p->cmd[0], p->hdr.duration, p->hdr.status);
+
+    memcpy(impl_->sense_buffer, p->sense, SG_MAX_SENSE);
+    impl_->last_sense_buffer_length = p->hdr.sb_len_wr;
+    impl_->last_command_status = p->hdr.status;
+
+    if ((p->hdr.flags & SG_FLAG_DIRECT_IO) && !impl_->indirectReported_ &&
+	(p->hdr.info & SG_INFO_DIRECT_IO_MASK) != SG_INFO_DIRECT_IO) {
+	log_message(4, "%s: Direct transfer not possible for %s, "
+		    "using indirect transfer.", impl_->filename_,
+		    sg_strcommand(p->cmd[0]));
+	impl_->indirectReported_ = true;
+    }
+
+    if (p->hdr.status) {
+	if (p->hdr.sb_len_wr > 0)
+	    return 2;
+	else
+	    return 1;
+    }
+
+    return 0;
+}
+
+// Negotiates the data transfer mode. IO_MMAP maps the sg reserved
+// buffer, commands using it do not copy any data. IO_DIRECT maps user
+// buffers into the kernel if enabled in /proc/scsi/sg/allow_dio.
+
+ScsiIf::IoMode ScsiIf::ioMode(IoMode mode)
+{
+    if (impl_->mappedBuffer_ != NULL) {
+	munmap(impl_->mappedBuffer_, impl_->mappedLen_);
+	impl_->mappedBuffer_ = NULL;
+	impl_->mappedLen_ = 0;
+    }
+
+    impl_->ioMode_ = IO_INDIRECT;
+    impl_->indirectReported_ = false;
+
+    if (impl_->fd_ < 0 || maxDataLen_ <= 0)
+	return impl_->ioMode_;
+
+    if (mode == IO_MMAP) {
+	void *p = mmap(NULL, maxDataLen_, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       impl_->fd_, 0);
+
+	if (p != MAP_FAILED) {
+	    impl_->mappedBuffer_ = (uchar*)p;
+	    impl_->mappedLen_ = maxDataLen_;
+	    impl_->ioMode_ = IO_MMAP;
+	    log_message(4, "SG: Mapped %d bytes of reserved buffer.",
+			maxDataLen_);
+	    return impl_->ioMode_;
+	}
+
+	log_message(-1, "Cannot map SCSI transfer buffer: %s",
+		    strerror(errno));
+	mode = IO_DIRECT;
+    }
+
+    if (mode == IO_DIRECT) {
+	if (impl_->directIoAllowed())
+	    impl_->ioMode_ = IO_DIRECT;
+	else
+	    log_message(3, "SG: Direct transfers disabled in %s.",
+			SG_ALLOW_DIO);
+    }
+
+    return impl_->ioMode_;
+}
+
+ScsiIf::IoMode ScsiIf::ioMode() const
+{
+    return impl_->ioMode_;
+}
+
+unsigned char *ScsiIf::mappedBuffer() const
+{
+    return impl_->mappedBuffer_;
+}
+
 const uchar *ScsiIf::getSense(int &len) const
 {
     len = impl_->last_sense_buffer_length;
@@ -412,6 +725,8 @@ ScsiIf::ScanData *ScsiIf::scan(int *len, char* scsi_dev_path)
     return NULL;
 }
 
+#define SCSIIF_IO_MODES
+#define SCSIIF_ASYNC
 #include "ScsiIf-common.cc"
 
 int ScsiIfImpl::adjustReservedBuffer(int requestedSize)
@@ -433,3 +748,177 @@ int ScsiIfImpl::adjustReservedBuffer(int requestedSize)
 
     return maxTransferLength;
 }
+
+// Returns true if the sg driver performs direct transfers. Older drivers
+// without the control file always try to.
+
+bool ScsiIfImpl::directIoAllowed()
+{
+    FILE *fp = fopen(SG_ALLOW_DIO, "r");
+    int allow = 1;
+
+    if (fp != NULL) {
+	if (fscanf(fp, "%d", &allow) != 1)
+	    allow = 0;
+	fclose(fp);
+    }
+
+    return allow != 0;
+}
+
+// Waits up to 'timeout' milliseconds for a queued command to complete and
+// stores its result in the corresponding ring buffer entry. Commands may
+// complete in any order.
+// Return: 1: a result was fetched
+//         0: timeout
+//        -1: error, 'errno' is set
+
+int ScsiIfImpl::readCompleted(int timeout)
+{
+    struct pollfd pfd;
+    sg_io_hdr_t hdr;
+    SgPendingCmd *p;
+    int ret;
+
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+	ret = poll(&pfd, 1, timeout);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret <= 0)
+	return ret;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.interface_id = 'S';
+
+    if (read(fd_, &hdr, sizeof(hdr)) < 0) {
+	if (errno == EAGAIN || errno == EINTR)
+	    return 0;
+	return -1;
+    }
+
+    p = (SgPendingCmd*)hdr.usr_ptr;
+
+    if (p < pending_ || p >= pending_ + SG_MAX_PENDING) {
+	log_message(-3, "SG: Received result of unknown command.");
+	return 0;
+    }
+
+    p->hdr = hdr;
+    p->done = true;
+
+    return 1;
+}
+
+// Waits up to 'timeout' milliseconds until the queued command 'p' is
+// completed. If fetching a result fails it is unknown which command the
+// lost result belongs to and the kernel may still transfer to the buffers
+// of the others, so the queue is drained before the entries that are not
+// completed are marked as failed.
+// Return: 1: 'p' is completed or failed
+//         0: timeout
+
+int ScsiIfImpl::waitCmd(SgPendingCmd *p, int timeout)
+{
+    SgPendingCmd *q;
+    int ret, err, i;
+
+    while (!p->done && p->error == 0) {
+	if ((ret = readCompleted(timeout)) == 0)
+	    return 0;
+
+	if (ret < 0) {
+	    err = errno;
+
+	    log_message(-2, "%s: Cannot fetch result of queued SCSI command: "
+			"%s.", filename_, strerror(err));
+
+	    drainQueue();
+
+	    for (i = 0; i < pendingCount_; i++) {
+		q = &pending_[(pendingHead_ + i) % SG_MAX_PENDING];
+
+		if (!q->done)
+		    q->error = err;
+	    }
+	}
+    }
+
+    return 1;
+}
+
+// Fetches all results the sg driver still holds until it reports no
+// outstanding request. If the driver does not give up its requests within
+// the command timeout the device is reopened, the driver finishes the
+// requests of the closed file descriptor on its own.
+
+void ScsiIfImpl::drainQueue()
+{
+    sg_req_info_t table[SG_MAX_QUEUE];
+    int waited = 0;
+    int active, i;
+
+    while (waited <= timeout_ms) {
+	memset(table, 0, sizeof(table));
+
+	if (ioctl(fd_, SG_GET_REQUEST_TABLE, table) < 0)
+	    break;
+
+	for (active = 0, i = 0; i < SG_MAX_QUEUE; i++) {
+	    if (table[i].req_state != 0)
+		active++;
+	}
+
+	if (active == 0)
+	    return;
+
+	if (readCompleted(100) > 0)
+	    waited = 0;
+	else
+	    waited += 100;
+    }
+
+    log_message(-2, "%s: SCSI command queue is out of sync, reopening device.",
+		filename_);
+
+    close(fd_);
+
+    fd_ = open(filename_, readOnlyMode ? O_RDONLY | O_NONBLOCK
+		                       : O_RDWR | O_NONBLOCK | O_EXCL);
+
+    if (fd_ < 0) {
+	log_message(-2, "Unable to open SCSI device %s: %s.", filename_,
+		    strerror(errno));
+	return;
+    }
+
+    adjustReservedBuffer(64 * 1024);
+}
+
+// Passes a command to the emulated drive and stores its sense data and
+// status like the sg driver does.
+
+int ScsiIfImpl::simCmd(const uchar *cmd, int cmdLen, const uchar *dataOut,
+		       int dataOutLen, uchar *dataIn, int dataInLen,
+		       uchar *sense, uchar *senseLen, uchar *status)
+{
+    const uchar *s;
+    int len;
+    int ret;
+
+    ret = sim_->sendCmd(cmd, cmdLen, dataOut, dataOutLen, dataIn, dataInLen);
+    s = sim_->getSense(len);
+
+    if (len > SG_MAX_SENSE)
+	len = SG_MAX_SENSE;
+
+    memset(sense, 0, SG_MAX_SENSE);
+    memcpy(sense, s, len);
+    *senseLen = len;
+    *status = ret == 0 ? 0 : CHECK_CONDITION << 1;
+
+    return ret;
+}
@@ -358,3 +358,49 @@ int ScsiIf::inquiry()
 
   return 0;
 }
+
+// Only indirect transfers are supported by this interface.
+
+ScsiIf::IoMode ScsiIf::ioMode(IoMode)
+{
+  return IO_INDIRECT;
+}
+
+ScsiIf::IoMode ScsiIf::ioMode() const
+{
+  return IO_INDIRECT;
+}
+
+unsigned char *ScsiIf::mappedBuffer() const
+{
+  return NULL;
+}
+
+// Commands can only be sent synchronously with 'sendCmd()'.
+
+int ScsiIf::maxPendingCmds() const
+{
+  return 0;
+}
+
+int ScsiIf::pendingCmds() const
+{
+  return 0;
+}
+
+int ScsiIf::submitCmd(const unsigned char *, int, const unsigned char *, int,
+		      unsigned char *, int, void *)
+{
+  return 1;
+}
+
+int ScsiIf::pollCmd(int)
+{
+  return 0;
+}
+
+int ScsiIf::reapCmd(void **tag, int)
+{
+  *tag = NULL;
+  return 1;
+}
@@ -71,6 +71,36 @@ class ScsiIf
     // \brief Accessor method: returns max DMA transfer length.
     int maxDataLen() const { return maxDataLen_; }
 
+    //! \brief Data transfer modes between user memory and the device.
+    enum IoMode {
+	IO_INDIRECT, //!< data is copied through a kernel buffer
+	IO_DIRECT,   //!< data is transferred directly from/to user buffers
+	IO_MMAP      //!< data is transferred from/to 'mappedBuffer()'
+    };
+
+    //! \brief Requests given data transfer mode. Must be called after
+    // 'init()'. Falls back to the next less efficient mode if the OS or
+    // host adapter does not support the requested mode.
+    // \return the negotiated mode
+    IoMode ioMode(IoMode);
+
+    //! \brief Accessor method: negotiated data transfer mode.
+    IoMode ioMode() const;
+
+    //! \brief Returns the buffer of 'maxDataLen()' bytes that is shared
+    // with the kernel in IO_MMAP mode, NULL in all other modes. Commands
+    // that use this buffer as data buffer do not copy any data. Its
+    // content is only valid until the next command is sent.
+    unsigned char *mappedBuffer() const;
+
+    static const char *ioModeString(IoMode m) {
+	switch (m) {
+	case IO_DIRECT: return "direct";
+	case IO_MMAP:   return "mmap";
+	default:        return "indirect";
+	}
+    }
+
     //! \brief Sends a SCSI command and receives data
     // \param cmd Buffer with CDB
     // \param cmdLen Length of CDB
@@ -92,6 +122,42 @@ class ScsiIf
 		const unsigned char *dataOut, int dataOutLen,
 		unsigned char *dataIn, int dataInLen, int showMessage = 1);
 
+    //! \brief Maximum number of commands that may be queued with
+    // 'submitCmd()'. 0 if the interface only supports 'sendCmd()' or if
+    // the data transfer mode is IO_MMAP.
+    int maxPendingCmds() const;
+
+    //! \brief Number of submitted commands that were not reaped, yet.
+    int pendingCmds() const;
+
+    //! \brief Queues a SCSI command and returns without waiting for
+    // its completion. Parameters are the same as for 'sendCmd()'. The
+    // data buffer must stay valid until the command is reaped and should
+    // be page aligned, otherwise the OS may transfer the data through an
+    // internal buffer.
+    // \param tag User value that is returned by 'reapCmd()'.
+    // \return int
+    //   - 0 OK
+    //   - 1 command could not be queued
+    int submitCmd(const unsigned char *cmd, int cmdLen,
+		  const unsigned char *dataOut, int dataOutLen,
+		  unsigned char *dataIn, int dataInLen, void *tag);
+
+    //! \brief Waits up to 'timeout' milliseconds (-1: forever) for the
+    // completion of the oldest pending command.
+    // \return int
+    //   - 0 timeout or no command pending
+    //   - 1 oldest command is completed and can be reaped
+    int pollCmd(int timeout);
+
+    //! \brief Waits for the oldest pending command. Commands are
+    // always reaped in submission order. The sense data of the reaped
+    // command is available with 'getSense()' afterwards.
+    // \param tag Filled with the tag given to 'submitCmd()'.
+    // \param showMessage Like for 'sendCmd()'.
+    // \return same as 'sendCmd()', 1 if no command is pending
+    int reapCmd(void **tag, int showMessage = 1);
+
     //! \brief Return the actual sense buffer in scglib
     // \param len will be overwritten and contain
     //        ScsiIf::impl->scgp_->scmd->sense_count (length of returned
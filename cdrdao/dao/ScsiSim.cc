@@ -0,0 +1,1830 @@
+/*  cdrdao - emulated MMC drive
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "ScsiSim.h"
+#include "PQChannelEncoder.h"
+#include "PWSubChannel96.h"
+#include "TrackData.h"
+#include "Msf.h"
+#include "port.h"
+#include "lec.h"
+#include "subrw.h"
+#include "log.h"
+#include "util.h"
+
+// The image file starts with a header of SIM_HEADER_SIZE bytes holding
+// the 'ScsiSimImage' structure, followed by one record of SIM_BLOCK_LEN
+// bytes for each block starting at lba -150. A record holds the
+// unscrambled main channel data and the raw P-W sub-channel data. Blocks
+// of the lead-in are not stored, the TOC, catalog number, ISRC codes and
+// CD-TEXT packs are extracted from the sub-channel data instead.
+
+#define SIM_MAGIC "cdrdao-sim-1"
+#define SIM_HEADER_SIZE 65536
+#define SIM_BLOCK_LEN (AUDIO_BLOCK_LEN + PW_SUBCHANNEL_LEN)
+
+#define SIM_MAX_TOC 104
+#define SIM_MAX_CDTEXT_PACKS 2048
+
+#define SIM_MAX_DATA_LEN (64 * 1024)
+
+// KB/s of single speed as reported in mode page 2A
+#define SIM_SPEED_1X 176
+
+// speed factor reported for the 'unlimited' speed
+#define SIM_SPEED_UNLIMITED 48
+
+// start of the lead-in as reported in the ATIP: 97:27:00
+#define SIM_LEADIN_MIN 97
+#define SIM_LEADIN_SEC 27
+#define SIM_LEADIN_FRAME 0
+
+struct ScsiSimTocEntry {
+  unsigned char ctlAdr; // Q channel layout: control in bits 4-7
+  unsigned char point;
+  unsigned char pmin;
+  unsigned char psec;
+  unsigned char pframe;
+};
+
+// the image header must fit into SIM_HEADER_SIZE bytes
+struct ScsiSimImage {
+  char magic[16];
+  unsigned char complete; // 1: a session was written and closed
+  unsigned char erasable;
+  unsigned char catalogValid;
+  char catalog[14];
+  unsigned char isrcValid[100];
+  char isrc[100][13];
+  int tocLen;
+  ScsiSimTocEntry toc[SIM_MAX_TOC];
+  int cdTextLen; // number of CD-TEXT packs
+  unsigned char cdText[SIM_MAX_CDTEXT_PACKS][18];
+};
+
+static const unsigned char SYNC_PATTERN[12] = {
+  0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00
+};
+
+// Extracts the 12 Q channel bytes from raw P-W sub-channel data.
+static void getQ(const unsigned char *pw, unsigned char *q)
+{
+  int i, j;
+
+  for (i = 0; i < 12; i++) {
+    q[i] = 0;
+    for (j = 0; j < 8; j++) {
+      q[i] <<= 1;
+      if (pw[i * 8 + j] & 0x40)
+	q[i] |= 1;
+    }
+  }
+}
+
+// Converts 16 byte P-Q sub-channel data (PQSubChannel16 layout) to raw
+// P-W sub-channel data. The CRC field is ignored, the inverted Q CRC is
+// generated like a drive does.
+static void pq2pw(const unsigned char *pq, unsigned char *pw)
+{
+  int i;
+
+  for (i = 0; i < 96; i++) {
+    pw[i] = 0;
+    if (pq[15] & 0x80)
+      pw[i] |= 0x80;
+    if (pq[i / 8] & (0x80 >> (i % 8)))
+      pw[i] |= 0x40;
+  }
+
+  PWSubChannel96 chan(pw);
+
+  chan.calcCrc();
+  memcpy(pw, chan.data(), PW_SUBCHANNEL_LEN);
+}
+
+// Reverses 'lec_scramble()' for a data sector that was written in raw
+// mode. The sector is left untouched if it does not start with a sync
+// pattern in either byte order.
+static void descramble(unsigned char *sector)
+{
+  static unsigned char table[AUDIO_BLOCK_LEN];
+  static int tableInit = 0;
+  unsigned char swapped[12];
+  unsigned char tmp;
+  int i;
+
+  if (!tableInit) {
+    memset(table, 0, AUDIO_BLOCK_LEN);
+    lec_scramble(table);
+    for (i = 0; i < AUDIO_BLOCK_LEN; i += 2) {
+      tmp = table[i];
+      table[i] = table[i + 1];
+      table[i + 1] = tmp;
+    }
+    tableInit = 1;
+  }
+
+  for (i = 0; i < 12; i += 2) {
+    swapped[i] = SYNC_PATTERN[i + 1];
+    swapped[i + 1] = SYNC_PATTERN[i];
+  }
+
+  if (memcmp(sector, swapped, 12) == 0) {
+    for (i = 0; i < AUDIO_BLOCK_LEN; i += 2) {
+      tmp = sector[i];
+      sector[i] = sector[i + 1];
+      sector[i + 1] = tmp;
+    }
+  }
+  else if (memcmp(sector, SYNC_PATTERN, 12) != 0) {
+    return;
+  }
+
+  for (i = 12; i < AUDIO_BLOCK_LEN; i++)
+    sector[i] ^= table[i];
+}
+
+// Default mode pages. Page 2A is created on the fly.
+static const unsigned char DEFAULT_PAGE_01[12] = {
+  0x01, 0x0a, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00
+};
+
+static const unsigned char DEFAULT_PAGE_05[0x38] = {
+  0x05, 0x36, 0x01, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x96
+};
+
+static const unsigned char DEFAULT_PAGE_0E[16] = {
+  0x0e, 0x0e, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x01, 0xff, 0x02, 0xff, 0x00, 0x00, 0x00, 0x00
+};
+
+
+ScsiSim::ScsiSim(const char *spec)
+{
+  int i;
+
+  fd_ = -1;
+
+  bufferSize_ = 2048 * 1024;
+  maxSpeed_ = 0;
+  latency_ = 0;
+  capacity_ = 80 * 60 * 75;
+  erasable_ = false;
+
+  image_ = new ScsiSimImage;
+  memset(image_, 0, sizeof(ScsiSimImage));
+
+  memset(sense_, 0, sizeof(sense_));
+  senseLen_ = 0;
+
+  for (i = 0; i < 0x40; i++)
+    modePages_[i] = NULL;
+
+  modePages_[0x01] = new unsigned char[256];
+  memset(modePages_[0x01], 0, 256);
+  memcpy(modePages_[0x01], DEFAULT_PAGE_01, sizeof(DEFAULT_PAGE_01));
+
+  modePages_[0x05] = new unsigned char[256];
+  memset(modePages_[0x05], 0, 256);
+  memcpy(modePages_[0x05], DEFAULT_PAGE_05, sizeof(DEFAULT_PAGE_05));
+
+  modePages_[0x0e] = new unsigned char[256];
+  memset(modePages_[0x0e], 0, 256);
+  memcpy(modePages_[0x0e], DEFAULT_PAGE_0E, sizeof(DEFAULT_PAGE_0E));
+
+  blockLength_ = MODE1_BLOCK_LEN;
+
+  readSpeed_ = writeSpeed_ = 0xffff;
+
+  cueSheet_ = NULL;
+  cueSheetLen_ = 0;
+  encoder_ = NULL;
+  subChannel_ = NULL;
+  encodeLba_ = 0;
+  rwDelayIndex_ = 0;
+  memset(rwDelayLine_, 0, sizeof(rwDelayLine_));
+  nextWritableLba_ = 0;
+  writing_ = false;
+  cdTextDone_ = false;
+  trackNr_ = 0;
+
+  bufferFill_ = 0;
+  drainTime_ = 0;
+  burning_ = false;
+  dry_ = false;
+  underruns_ = 0;
+
+  readReady_ = 0;
+
+  file_ = NULL;
+  parseSpec(spec);
+}
+
+ScsiSim::~ScsiSim()
+{
+  int i;
+
+  if (fd_ >= 0)
+    close(fd_);
+
+  delete encoder_;
+  delete subChannel_;
+  delete[] cueSheet_;
+
+  for (i = 0; i < 0x40; i++)
+    delete[] modePages_[i];
+
+  delete image_;
+  delete[] file_;
+}
+
+bool ScsiSim::isSimDevice(const char *dev)
+{
+  return dev != NULL && strncmp(dev, "sim:", 4) == 0;
+}
+
+// Parses '<image file>[,option=value...]'.
+
+void ScsiSim::parseSpec(const char *spec)
+{
+  char *s = strdupCC(spec);
+  char *opt, *val;
+  char *next;
+
+  next = strchr(s, ',');
+  if (next != NULL)
+    *next++ = 0;
+
+  file_ = strdupCC(s);
+
+  for (opt = next; opt != NULL; opt = next) {
+    next = strchr(opt, ',');
+    if (next != NULL)
+      *next++ = 0;
+
+    val = strchr(opt, '=');
+    if (val != NULL)
+      *val++ = 0;
+
+    if (strcmp(opt, "rw") == 0) {
+      erasable_ = true;
+    }
+    else if (val == NULL || *val == 0) {
+      log_message(-1, "Simulated drive: option '%s' needs a value.", opt);
+    }
+    else if (strcmp(opt, "buffer") == 0) {
+      bufferSize_ = atol(val) * 1024;
+      if (bufferSize_ < SIM_MAX_DATA_LEN)
+	bufferSize_ = SIM_MAX_DATA_LEN;
+    }
+    else if (strcmp(opt, "speed") == 0) {
+      maxSpeed_ = atoi(val);
+      if (maxSpeed_ < 0)
+	maxSpeed_ = 0;
+    }
+    else if (strcmp(opt, "latency") == 0) {
+      latency_ = atol(val);
+    }
+    else if (strcmp(opt, "capacity") == 0) {
+      capacity_ = atol(val) * 60 * 75;
+      if (capacity_ <= 0 || capacity_ > 99 * 60 * 75)
+	capacity_ = 80 * 60 * 75;
+    }
+    else {
+      log_message(-1, "Simulated drive: unknown option '%s' ignored.", opt);
+    }
+  }
+
+  delete[] s;
+}
+
+int ScsiSim::open()
+{
+  struct stat st;
+
+  fd_ = ::open(file_, O_RDWR | O_CREAT, 0666);
+
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    log_message(-2, "Cannot open simulated disc image \"%s\": %s", file_,
+		strerror(errno));
+    return 1;
+  }
+
+  if (st.st_size == 0) {
+    resetImage();
+    image_->erasable = erasable_ ? 1 : 0;
+
+    if (writeHeader() != 0)
+      return 1;
+
+    log_message(3, "Simulated drive: created blank disc \"%s\".", file_);
+  }
+  else {
+    if (pread(fd_, image_, sizeof(ScsiSimImage), 0) !=
+	(ssize_t)sizeof(ScsiSimImage) ||
+	strcmp(image_->magic, SIM_MAGIC) != 0) {
+      log_message(-2, "\"%s\" is not a simulated disc image.", file_);
+      return 1;
+    }
+
+    if (erasable_)
+      image_->erasable = 1;
+  }
+
+  return 0;
+}
+
+void ScsiSim::resetImage()
+{
+  unsigned char erasable = image_->erasable;
+
+  memset(image_, 0, sizeof(ScsiSimImage));
+  strcpy(image_->magic, SIM_MAGIC);
+  image_->erasable = erasable;
+}
+
+int ScsiSim::writeHeader()
+{
+  if (pwrite(fd_, image_, sizeof(ScsiSimImage), 0) !=
+      (ssize_t)sizeof(ScsiSimImage)) {
+    log_message(-2, "Cannot write simulated disc image \"%s\": %s", file_,
+		strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+const unsigned char *ScsiSim::getSense(int &len) const
+{
+  len = senseLen_;
+  return sense_;
+}
+
+// Sets up fixed format sense data and returns the value for a failed
+// command with sense data.
+
+int ScsiSim::checkCondition(int key, int asc, int ascq)
+{
+  memset(sense_, 0, sizeof(sense_));
+
+  sense_[0] = 0x70;
+  sense_[2] = key;
+  sense_[7] = 10;
+  sense_[12] = asc;
+  sense_[13] = ascq;
+
+  senseLen_ = sizeof(sense_);
+
+  return 2;
+}
+
+int ScsiSim::sendData(unsigned char *dataIn, int dataInLen,
+		      const unsigned char *data, long len)
+{
+  if (dataIn != NULL && dataInLen > 0)
+    memcpy(dataIn, data, len < dataInLen ? len : dataInLen);
+
+  return 0;
+}
+
+int ScsiSim::sendCmd(const unsigned char *cmd, int cmdLen,
+		     const unsigned char *dataOut, int dataOutLen,
+		     unsigned char *dataIn, int dataInLen)
+{
+  senseLen_ = 0;
+
+  if (fd_ < 0)
+    return 1;
+
+  if (latency_ > 0)
+    mSleep(latency_);
+
+  switch (cmd[0]) {
+  case 0x00: // TEST UNIT READY
+  case 0x01: // REZERO UNIT
+  case 0x1b: // START STOP UNIT
+  case 0x1e: // PREVENT ALLOW MEDIUM REMOVAL
+  case 0x2b: // SEEK
+  case 0x45: // PLAY AUDIO
+  case 0x47: // PLAY AUDIO MSF
+  case 0x4b: // PAUSE RESUME
+  case 0x54: // SEND OPC INFORMATION
+    return 0;
+
+  case 0x03: // REQUEST SENSE
+    return sendData(dataIn, dataInLen, sense_, sizeof(sense_));
+
+  case 0x12:
+    return inquiry(cmd, dataIn, dataInLen);
+
+  case 0x15:
+  case 0x55:
+    return modeSelect(cmd, cmdLen, dataOut, dataOutLen);
+
+  case 0x1a:
+  case 0x5a:
+    return modeSense(cmd, cmdLen, dataIn, dataInLen);
+
+  case 0x25:
+    return readCapacity(dataIn, dataInLen);
+
+  case 0x28:
+    return read10(cmd, dataIn, dataInLen);
+
+  case 0x2a:
+    return write10(cmd, dataOut, dataOutLen);
+
+  case 0x35:
+    return synchronizeCache();
+
+  case 0x42:
+    return readSubChannel(cmd, dataIn, dataInLen);
+
+  case 0x43:
+    return readTocPmaAtip(cmd, dataIn, dataInLen);
+
+  case 0x46: // GET CONFIGURATION: profile only, no features
+    {
+      unsigned char data[8];
+
+      memset(data, 0, 8);
+      data[3] = 4;
+      data[7] = image_->erasable ? 0x0a : 0x09;
+      return sendData(dataIn, dataInLen, data, 8);
+    }
+
+  case 0x51:
+    return readDiscInfo(cmd, dataIn, dataInLen);
+
+  case 0x52:
+    return readTrackInfo(cmd, dataIn, dataInLen);
+
+  case 0x5c:
+    return readBufferCapacity(cmd, dataIn, dataInLen);
+
+  case 0x5d:
+    return sendCueSheet(dataOut, dataOutLen);
+
+  case 0xa1:
+    return blank();
+
+  case 0xbb:
+    return setCdSpeed(cmd);
+
+  case 0xbd: // MECHANISM STATUS: no changer
+    {
+      unsigned char data[8];
+
+      memset(data, 0, 8);
+      return sendData(dataIn, dataInLen, data, 8);
+    }
+
+  case 0xbe:
+    return readCd(cmd, dataIn, dataInLen);
+  }
+
+  log_message(4, "Simulated drive: unsupported command 0x%02x.", cmd[0]);
+
+  return checkCondition(5, 0x20, 0x00); // invalid command operation code
+}
+
+long ScsiSim::leadInStartLba() const
+{
+  return Msf(SIM_LEADIN_MIN, SIM_LEADIN_SEC, SIM_LEADIN_FRAME).lba() - 450150;
+}
+
+long ScsiSim::leadOutStartLba() const
+{
+  int i;
+
+  for (i = 0; i < image_->tocLen; i++) {
+    const ScsiSimTocEntry &e = image_->toc[i];
+
+    if (e.point == 0xa2)
+      return Msf(e.pmin, e.psec, e.pframe).lba() - 150;
+  }
+
+  return 0;
+}
+
+int ScsiSim::writeType() const
+{
+  return modePages_[0x05][2] & 0x0f;
+}
+
+bool ScsiSim::testWrite() const
+{
+  return (modePages_[0x05][2] & 0x10) != 0;
+}
+
+bool ScsiSim::bufferUnderrunFree() const
+{
+  return (modePages_[0x05][2] & 0x40) != 0;
+}
+
+// KB/s of given speed setting limited by the 'speed' option, 0 if the
+// speed is unlimited.
+
+int ScsiSim::effectiveSpeed(int kbs) const
+{
+  if (maxSpeed_ == 0)
+    return 0;
+
+  if (kbs <= 0 || kbs > maxSpeed_ * SIM_SPEED_1X)
+    kbs = maxSpeed_ * SIM_SPEED_1X;
+
+  return kbs;
+}
+
+// The drive buffer is drained with the write speed once it was filled
+// completely. A buffer under run occurs if it runs empty while the
+// session is not finished.
+
+void ScsiSim::drainBuffer()
+{
+  long long now = usecTime();
+  int kbs = effectiveSpeed(writeSpeed_);
+
+  if (burning_ && kbs > 0) {
+    bufferFill_ -= (double)kbs * 1000.0 * (now - drainTime_) / 1000000.0;
+
+    if (bufferFill_ <= 0) {
+      bufferFill_ = 0;
+      burning_ = false;
+      dry_ = true;
+    }
+  }
+
+  drainTime_ = now;
+}
+
+int ScsiSim::fillBuffer(long bytes)
+{
+  int kbs = effectiveSpeed(writeSpeed_);
+
+  if (kbs == 0)
+    return 0;
+
+  drainBuffer();
+
+  if (dry_) {
+    dry_ = false;
+
+    if (!bufferUnderrunFree()) {
+      log_message(3, "Simulated drive: buffer under run.");
+      return checkCondition(3, 0x0c, 0x09); // loss of streaming
+    }
+
+    underruns_++;
+    log_message(3, "Simulated drive: buffer under run at lba %ld, "
+		"recovered by BURN-Proof.", nextWritableLba_);
+  }
+
+  if (bufferFill_ + bytes > bufferSize_) {
+    // buffer is full: start writing and block until there is room
+    if (!burning_) {
+      burning_ = true;
+      drainTime_ = usecTime();
+    }
+
+    double wait = (bufferFill_ + bytes - bufferSize_) / (kbs * 1000.0);
+    long ms = (long)(wait * 1000.0) + 1;
+
+    mSleep(ms);
+    drainBuffer();
+
+    if (dry_) {
+      dry_ = false;
+      bufferFill_ = 0;
+    }
+  }
+
+  bufferFill_ += bytes;
+
+  return 0;
+}
+
+// Delays read commands so that the read speed is not exceeded.
+
+void ScsiSim::throttleRead(long bytes)
+{
+  int kbs = effectiveSpeed(readSpeed_);
+  long long now;
+
+  if (kbs == 0)
+    return;
+
+  now = usecTime();
+
+  if (readReady_ < now)
+    readReady_ = now;
+
+  readReady_ += (long long)bytes * 1000 / kbs;
+
+  if (readReady_ - now >= 1000)
+    mSleep((long)((readReady_ - now) / 1000));
+}
+
+// Reads the record of given block.
+// return: 0: OK
+//         1: block is beyond the image or was never written
+
+int ScsiSim::readBlock(long lba, unsigned char *block)
+{
+  off_t pos;
+  int i;
+
+  if (lba < -150)
+    return 1;
+
+  pos = SIM_HEADER_SIZE + (off_t)(lba + 150) * SIM_BLOCK_LEN;
+
+  if (pread(fd_, block, SIM_BLOCK_LEN, pos) != SIM_BLOCK_LEN)
+    return 1;
+
+  // holes read as zero: written blocks always have a Q channel
+  for (i = AUDIO_BLOCK_LEN; i < SIM_BLOCK_LEN; i++) {
+    if (block[i] != 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+int ScsiSim::writeBlock(long lba, const unsigned char *block)
+{
+  off_t pos = SIM_HEADER_SIZE + (off_t)(lba + 150) * SIM_BLOCK_LEN;
+
+  if (pwrite(fd_, block, SIM_BLOCK_LEN, pos) != SIM_BLOCK_LEN) {
+    log_message(-2, "Cannot write simulated disc image \"%s\": %s", file_,
+		strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+// Extracts the disc information that is needed to answer READ TOC/PMA/ATIP
+// and READ SUB-CHANNEL from the sub-channel data of a written block.
+
+void ScsiSim::processSubChannel(long lba, const unsigned char *pw)
+{
+  unsigned char q[12];
+  unsigned char buf[PW_SUBCHANNEL_LEN];
+  int adr, i;
+
+  getQ(pw, q);
+  adr = q[0] & 0x0f;
+
+  if (lba < -150) {
+    // lead-in: TOC entries and CD-TEXT packs
+    if (adr == 1 && q[1] == 0) {
+      ScsiSimTocEntry e;
+
+      e.ctlAdr = q[0];
+      e.point = q[2] >= 0xa0 ? q[2] : bcd2int(q[2]);
+      e.pmin = bcd2int(q[7]);
+      e.psec = q[2] == 0xa0 ? q[8] : bcd2int(q[8]); // A0: disc type
+      e.pframe = bcd2int(q[9]);
+
+      for (i = 0; i < image_->tocLen; i++) {
+	if (image_->toc[i].point == e.point)
+	  break;
+      }
+
+      if (i < SIM_MAX_TOC) {
+	image_->toc[i] = e;
+	if (i == image_->tocLen)
+	  image_->tocLen++;
+      }
+    }
+
+    if (!cdTextDone_) {
+      unsigned char packs[72];
+      unsigned char *p;
+
+      memcpy(buf, pw, PW_SUBCHANNEL_LEN);
+      PWSubChannel96 chan(buf);
+      chan.getRawRWdata(packs);
+
+      for (i = 0, p = packs; i < 4 && !cdTextDone_; i++, p += 18) {
+	if (p[0] < 0x80)
+	  continue; // no CD-TEXT pack
+
+	if (image_->cdTextLen > 0 && memcmp(p, image_->cdText[0], 18) == 0)
+	  cdTextDone_ = true; // packs are repeated
+	else if (image_->cdTextLen < SIM_MAX_CDTEXT_PACKS)
+	  memcpy(image_->cdText[image_->cdTextLen++], p, 18);
+      }
+    }
+
+    return;
+  }
+
+  switch (adr) {
+  case 1:
+    if (q[1] != 0xaa)
+      trackNr_ = bcd2int(q[1]);
+    break;
+
+  case 2:
+    if (!image_->catalogValid) {
+      memcpy(buf, pw, PW_SUBCHANNEL_LEN);
+      PWSubChannel96 chan(buf);
+      strncpy(image_->catalog, chan.catalog(), 13);
+      image_->catalog[13] = 0;
+      image_->catalogValid = 1;
+    }
+    break;
+
+  case 3:
+    if (trackNr_ >= 1 && trackNr_ <= 99 && !image_->isrcValid[trackNr_]) {
+      memcpy(buf, pw, PW_SUBCHANNEL_LEN);
+      PWSubChannel96 chan(buf);
+      strncpy(image_->isrc[trackNr_], chan.isrc(), 12);
+      image_->isrc[trackNr_][12] = 0;
+      image_->isrcValid[trackNr_] = 1;
+    }
+    break;
+  }
+}
+
+// Returns the P-Q sub-channel data that the drive generates for given
+// block in session-at-once mode. Blocks that were skipped by the host,
+// usually the lead-in, are passed to 'processSubChannel()' on the fly.
+
+const unsigned char *ScsiSim::encodeSubChannel(long lba)
+{
+  const SubChannel *chan;
+
+  while (encodeLba_ < lba) {
+    chan = encoder_->encodeSubChannel(encodeLba_);
+    processSubChannel(encodeLba_, chan->data());
+    encodeLba_++;
+  }
+
+  encodeLba_++;
+
+  return encoder_->encodeSubChannel(lba)->data();
+}
+
+// Returns the data form of the cue sheet entry that covers given block.
+
+int ScsiSim::cueSheetDataForm(long lba) const
+{
+  const unsigned char *e;
+  int form = 0;
+  long i;
+
+  for (i = 0; i < cueSheetLen_; i += 8) {
+    e = cueSheet_ + i;
+
+    if ((e[0] & 0x0f) != 1 || e[1] == 0)
+      continue;
+
+    if (Msf(e[5], e[6], e[7]).lba() - 150 > lba)
+      break;
+
+    form = e[3];
+  }
+
+  return form;
+}
+
+int ScsiSim::inquiry(const unsigned char *cmd, unsigned char *dataIn,
+		     int dataInLen)
+{
+  unsigned char data[36];
+
+  memset(data, 0, sizeof(data));
+
+  data[0] = 0x05; // CD-ROM device
+  data[1] = 0x80; // removable
+  data[2] = 0x02;
+  data[3] = 0x02;
+  data[4] = sizeof(data) - 5;
+  memcpy(data + 8, "CDRDAO  ", 8);
+  memcpy(data + 16, "SIMULATED DRIVE ", 16);
+  memcpy(data + 32, "1.0 ", 4);
+
+  return sendData(dataIn, dataInLen, data, sizeof(data));
+}
+
+int ScsiSim::modeSense(const unsigned char *cmd, int cmdLen,
+		       unsigned char *dataIn, int dataInLen)
+{
+  unsigned char data[8 + 256];
+  unsigned char page[256];
+  int pageCode = cmd[2] & 0x3f;
+  int hlen = cmd[0] == 0x1a ? 4 : 8;
+  int len;
+
+  memset(page, 0, sizeof(page));
+
+  if (pageCode == 0x2a) {
+    int maxKbs = (maxSpeed_ > 0 ? maxSpeed_ : SIM_SPEED_UNLIMITED) *
+      SIM_SPEED_1X;
+    int rkbs = effectiveSpeed(readSpeed_);
+    int wkbs = effectiveSpeed(writeSpeed_);
+    long bufKb = bufferSize_ / 1024;
+
+    if (rkbs == 0)
+      rkbs = maxKbs;
+    if (wkbs == 0)
+      wkbs = maxKbs;
+
+    page[0] = 0x2a;
+    page[1] = 0x1c;
+    page[2] = 0x03; // reads CD-R and CD-RW
+    page[3] = 0x07; // writes CD-R and CD-RW, test write
+    page[4] = 0x80 | 0x30; // BURN-Proof, mode 2 form 1 and 2
+    page[5] = 0x01 | 0x02 | 0x04 | 0x08 | 0x20 | 0x40; // CD-DA, accurate,
+                                                       // R-W, ISRC, UPC
+    page[6] = 0x28; // tray, eject
+    page[8] = maxKbs >> 8;
+    page[9] = maxKbs;
+    page[11] = 0x02; // volume levels
+    page[12] = bufKb >> 8;
+    page[13] = bufKb;
+    page[14] = rkbs >> 8;
+    page[15] = rkbs;
+    page[18] = maxKbs >> 8;
+    page[19] = maxKbs;
+    page[20] = wkbs >> 8;
+    page[21] = wkbs;
+  }
+  else if (modePages_[pageCode] != NULL) {
+    memcpy(page, modePages_[pageCode], modePages_[pageCode][1] + 2);
+  }
+  else {
+    return checkCondition(5, 0x24, 0x00); // invalid field in CDB
+  }
+
+  len = page[1] + 2;
+
+  memset(data, 0, hlen);
+
+  if (hlen == 4) {
+    data[0] = hlen + len - 1;
+  }
+  else {
+    data[0] = (hlen + len - 2) >> 8;
+    data[1] = hlen + len - 2;
+  }
+
+  memcpy(data + hlen, page, len);
+
+  return sendData(dataIn, dataInLen, data, hlen + len);
+}
+
+int ScsiSim::modeSelect(const unsigned char *cmd, int cmdLen,
+			const unsigned char *dataOut, int dataOutLen)
+{
+  int hlen = cmd[0] == 0x15 ? 4 : 8;
+  long bdLen;
+  const unsigned char *p;
+  long len;
+
+  if (dataOutLen < hlen)
+    return checkCondition(5, 0x1a, 0x00); // parameter list length error
+
+  if (hlen == 4)
+    bdLen = dataOut[3];
+  else
+    bdLen = (dataOut[6] << 8) | dataOut[7];
+
+  if (hlen + bdLen > dataOutLen)
+    return checkCondition(5, 0x1a, 0x00);
+
+  if (bdLen >= 8) {
+    long bl = (dataOut[hlen + 5] << 16) | (dataOut[hlen + 6] << 8) |
+      dataOut[hlen + 7];
+
+    if (bl != MODE1_BLOCK_LEN && bl != MODE2_BLOCK_LEN && bl != 2340 &&
+	bl != AUDIO_BLOCK_LEN)
+      return checkCondition(5, 0x26, 0x00); // invalid field in parameter list
+
+    blockLength_ = bl;
+  }
+
+  p = dataOut + hlen + bdLen;
+  len = dataOutLen - hlen - bdLen;
+
+  while (len >= 2) {
+    int pageCode = p[0] & 0x3f;
+    long pageLen = p[1] + 2;
+
+    if (pageLen > len)
+      return checkCondition(5, 0x1a, 0x00);
+
+    if (pageCode == 0x05) {
+      int wt = p[2] & 0x0f;
+      int dbt = p[4] & 0x0f;
+
+      if (wt < 1 || wt > 3 || (wt == 3 && dbt != 1 && dbt != 3) ||
+	  (p[8] != 0x00 && p[8] != 0x10 && p[8] != 0x20))
+	return checkCondition(5, 0x26, 0x02); // parameter value invalid
+    }
+
+    if (pageCode != 0x2a) {
+      if (modePages_[pageCode] == NULL)
+	modePages_[pageCode] = new unsigned char[256];
+
+      memset(modePages_[pageCode], 0, 256);
+      memcpy(modePages_[pageCode], p, pageLen);
+      modePages_[pageCode][0] &= 0x3f;
+    }
+
+    p += pageLen;
+    len -= pageLen;
+  }
+
+  return 0;
+}
+
+int ScsiSim::readTocPmaAtip(const unsigned char *cmd, unsigned char *dataIn,
+			    int dataInLen)
+{
+  int format = cmd[2] & 0x0f;
+  int msf = cmd[1] & 0x02;
+  long allocLen = (cmd[7] << 8) | cmd[8];
+  unsigned char *data;
+  long len = 4;
+  int first = 99, last = 0;
+  long lba;
+  int i, ret;
+
+  if (format == 0 && (cmd[9] & 0xc0) != 0)
+    format = cmd[9] >> 6; // older format field
+
+  if (format == 4) {
+    // ATIP
+    unsigned char atip[28];
+    Msf lo(capacity_);
+
+    memset(atip, 0, sizeof(atip));
+    atip[1] = sizeof(atip) - 2;
+    atip[4] = 0x80 | 0x50;
+    atip[6] = image_->erasable ? 0x40 : 0x00;
+    atip[8] = SIM_LEADIN_MIN;
+    atip[9] = SIM_LEADIN_SEC;
+    atip[10] = SIM_LEADIN_FRAME;
+    atip[12] = lo.min();
+    atip[13] = lo.sec();
+    atip[14] = lo.frac();
+
+    return sendData(dataIn, dataInLen, atip, sizeof(atip));
+  }
+
+  if (format == 5) {
+    // CD-TEXT
+    len = 4 + image_->cdTextLen * 18;
+    data = new unsigned char[len];
+    memset(data, 0, 4);
+    data[0] = (len - 2) >> 8;
+    data[1] = len - 2;
+    memcpy(data + 4, image_->cdText, image_->cdTextLen * 18);
+
+    ret = sendData(dataIn, allocLen < dataInLen ? allocLen : dataInLen,
+		   data, len);
+    delete[] data;
+    return ret;
+  }
+
+  if (!image_->complete || format > 2)
+    return checkCondition(5, 0x24, 0x00); // invalid field in CDB
+
+  for (i = 0; i < image_->tocLen; i++) {
+    int p = image_->toc[i].point;
+
+    if (p >= 1 && p <= 99) {
+      if (p < first)
+	first = p;
+      if (p > last)
+	last = p;
+    }
+  }
+
+  data = new unsigned char[4 + (SIM_MAX_TOC + 1) * 11];
+  memset(data, 0, 4 + (SIM_MAX_TOC + 1) * 11);
+
+  data[2] = first;
+  data[3] = last;
+
+  if (format == 2) {
+    // raw TOC: A0, A1, A2 and all tracks as found in the lead-in
+    data[2] = data[3] = 1;
+
+    for (i = 0; i < image_->tocLen; i++) {
+      const ScsiSimTocEntry &e = image_->toc[i];
+      unsigned char *p = data + len;
+
+      p[0] = 1;
+      p[1] = ((e.ctlAdr & 0x0f) << 4) | (e.ctlAdr >> 4);
+      p[3] = e.point;
+      p[8] = e.pmin;
+      p[9] = e.psec;
+      p[10] = e.pframe;
+      len += 11;
+    }
+  }
+  else {
+    int t;
+    int start = cmd[6];
+
+    if (format == 1)
+      data[2] = data[3] = 1; // single session
+
+    // tracks in ascending order followed by the lead-out
+    for (t = (format == 1 ? first : 1); t <= 0xaa; t++) {
+      if (t == 100)
+	t = 0xa2;
+
+      for (i = 0; i < image_->tocLen; i++) {
+	if (image_->toc[i].point == t)
+	  break;
+      }
+
+      if (i == image_->tocLen || (t < 100 && t < start))
+	continue;
+
+      const ScsiSimTocEntry &e = image_->toc[i];
+      unsigned char *p = data + len;
+
+      p[1] = ((e.ctlAdr & 0x0f) << 4) | (e.ctlAdr >> 4);
+      p[2] = t == 0xa2 ? 0xaa : t;
+
+      lba = Msf(e.pmin, e.psec, e.pframe).lba() - 150;
+
+      if (msf) {
+	Msf m(lba + 150);
+	p[5] = m.min();
+	p[6] = m.sec();
+	p[7] = m.frac();
+      }
+      else {
+	p[4] = lba >> 24;
+	p[5] = lba >> 16;
+	p[6] = lba >> 8;
+	p[7] = lba;
+      }
+
+      len += 8;
+
+      if (format == 1)
+	break;
+    }
+  }
+
+  data[0] = (len - 2) >> 8;
+  data[1] = len - 2;
+
+  ret = sendData(dataIn, allocLen < dataInLen ? allocLen : dataInLen,
+		 data, len);
+
+  delete[] data;
+
+  return ret;
+}
+
+int ScsiSim::readDiscInfo(const unsigned char *cmd, unsigned char *dataIn,
+			  int dataInLen)
+{
+  unsigned char data[34];
+  int first = 1, last = 1;
+  int i;
+
+  memset(data, 0, sizeof(data));
+
+  data[1] = sizeof(data) - 2;
+  data[2] = image_->erasable ? 0x10 : 0x00;
+  data[3] = 1;
+  data[4] = 1;
+
+  if (image_->complete) {
+    first = 99;
+    last = 0;
+
+    for (i = 0; i < image_->tocLen; i++) {
+      const ScsiSimTocEntry &e = image_->toc[i];
+
+      if (e.point >= 1 && e.point <= 99) {
+	if (e.point < first)
+	  first = e.point;
+	if (e.point > last)
+	  last = e.point;
+      }
+      else if (e.point == 0xa0) {
+	data[8] = e.psec; // disc type
+      }
+    }
+
+    data[2] |= 0x0e; // complete disc, complete session
+    data[3] = first;
+
+    memset(data + 16, 0xff, 8);
+  }
+  else {
+    Msf lo(capacity_);
+
+    data[17] = SIM_LEADIN_MIN;
+    data[18] = SIM_LEADIN_SEC;
+    data[19] = SIM_LEADIN_FRAME;
+    data[21] = lo.min();
+    data[22] = lo.sec();
+    data[23] = lo.frac();
+  }
+
+  data[5] = first;
+  data[6] = last;
+
+  return sendData(dataIn, dataInLen, data, sizeof(data));
+}
+
+int ScsiSim::readTrackInfo(const unsigned char *cmd, unsigned char *dataIn,
+			   int dataInLen)
+{
+  unsigned char data[36];
+  long nr = (cmd[2] << 24) | (cmd[3] << 16) | (cmd[4] << 8) | cmd[5];
+  long start = 0, size = 0;
+  int i;
+
+  if ((cmd[1] & 0x03) != 1)
+    return checkCondition(5, 0x24, 0x00);
+
+  memset(data, 0, sizeof(data));
+  data[1] = sizeof(data) - 2;
+  data[3] = 1;
+
+  if (nr == 0xff && !image_->complete) {
+    // invisible track of a blank disc
+    data[2] = 1;
+    data[5] = 0x04;
+    data[6] = 0x40; // blank
+    data[7] = 0x01; // next writable address is valid
+    size = capacity_ - 150;
+  }
+  else {
+    for (i = 0; i < image_->tocLen; i++) {
+      if (image_->toc[i].point == nr)
+	break;
+    }
+
+    if (nr < 1 || nr > 99 || i == image_->tocLen)
+      return checkCondition(5, 0x24, 0x00);
+
+    const ScsiSimTocEntry &e = image_->toc[i];
+
+    start = Msf(e.pmin, e.psec, e.pframe).lba() - 150;
+    size = leadOutStartLba() - start;
+
+    for (i = 0; i < image_->tocLen; i++) {
+      const ScsiSimTocEntry &n = image_->toc[i];
+      long s = Msf(n.pmin, n.psec, n.pframe).lba() - 150;
+
+      if (n.point > nr && n.point <= 99 && s - start < size)
+	size = s - start;
+    }
+
+    data[2] = nr;
+    data[5] = e.ctlAdr >> 4;
+    data[6] = (e.ctlAdr & 0x40) ? 0x01 : 0x00;
+  }
+
+  data[8] = start >> 24;
+  data[9] = start >> 16;
+  data[10] = start >> 8;
+  data[11] = start;
+  data[24] = size >> 24;
+  data[25] = size >> 16;
+  data[26] = size >> 8;
+  data[27] = size;
+
+  return sendData(dataIn, dataInLen, data, sizeof(data));
+}
+
+int ScsiSim::readSubChannel(const unsigned char *cmd, unsigned char *dataIn,
+			    int dataInLen)
+{
+  unsigned char data[24];
+  int track = cmd[6];
+
+  memset(data, 0, sizeof(data));
+  data[1] = 0x15; // no audio status
+
+  switch (cmd[3]) {
+  case 1: // current position
+    data[3] = 12;
+    data[4] = 1;
+    data[5] = 0x10;
+    data[6] = 1;
+    data[7] = 1;
+    return sendData(dataIn, dataInLen, data, 16);
+
+  case 2: // media catalog number
+    data[3] = 20;
+    data[4] = 2;
+    if (image_->catalogValid) {
+      data[8] = 0x80;
+      memcpy(data + 9, image_->catalog, 13);
+    }
+    return sendData(dataIn, dataInLen, data, 24);
+
+  case 3: // ISRC
+    data[3] = 20;
+    data[4] = 3;
+    data[6] = track;
+    if (track >= 1 && track <= 99 && image_->isrcValid[track]) {
+      data[8] = 0x80;
+      memcpy(data + 9, image_->isrc[track], 12);
+    }
+    return sendData(dataIn, dataInLen, data, 24);
+  }
+
+  return checkCondition(5, 0x24, 0x00);
+}
+
+int ScsiSim::readCapacity(unsigned char *dataIn, int dataInLen)
+{
+  unsigned char data[8];
+  long last = image_->complete ? leadOutStartLba() - 1 : 0;
+
+  data[0] = last >> 24;
+  data[1] = last >> 16;
+  data[2] = last >> 8;
+  data[3] = last;
+  data[4] = 0;
+  data[5] = 0;
+  data[6] = MODE1_BLOCK_LEN >> 8;
+  data[7] = MODE1_BLOCK_LEN & 0xff;
+
+  return sendData(dataIn, dataInLen, data, 8);
+}
+
+int ScsiSim::readBufferCapacity(const unsigned char *cmd,
+				unsigned char *dataIn, int dataInLen)
+{
+  unsigned char data[12];
+  long avail;
+
+  drainBuffer();
+
+  avail = bufferSize_ - (long)bufferFill_;
+
+  memset(data, 0, sizeof(data));
+  data[1] = 10;
+  data[4] = bufferSize_ >> 24;
+  data[5] = bufferSize_ >> 16;
+  data[6] = bufferSize_ >> 8;
+  data[7] = bufferSize_;
+  data[8] = avail >> 24;
+  data[9] = avail >> 16;
+  data[10] = avail >> 8;
+  data[11] = avail;
+
+  return sendData(dataIn, dataInLen, data, sizeof(data));
+}
+
+// Error for reading given unreadable block.
+
+int ScsiSim::readError(long lba)
+{
+  if (lba < -150 || !image_->complete || lba >= leadOutStartLba())
+    return checkCondition(5, 0x21, 0x00); // lba out of range
+
+  return checkCondition(3, 0x11, 0x00); // unrecovered read error
+}
+
+int ScsiSim::read10(const unsigned char *cmd, unsigned char *dataIn,
+		    int dataInLen)
+{
+  long lba = (long)((cmd[2] << 24) | (cmd[3] << 16) | (cmd[4] << 8) | cmd[5]);
+  long len = (cmd[7] << 8) | cmd[8];
+  unsigned char block[SIM_BLOCK_LEN];
+  unsigned char q[12];
+  long offset;
+  long i;
+
+  if (len * blockLength_ > dataInLen)
+    return checkCondition(5, 0x24, 0x00);
+
+  throttleRead(len * AUDIO_BLOCK_LEN);
+
+  for (i = 0; i < len; i++) {
+    if (readBlock(lba + i, block) != 0)
+      return readError(lba + i);
+
+    getQ(block + AUDIO_BLOCK_LEN, q);
+
+    if (blockLength_ == AUDIO_BLOCK_LEN) {
+      offset = 0;
+    }
+    else if ((q[0] & 0x40) == 0) {
+      return checkCondition(5, 0x64, 0x00); // illegal mode for this track
+    }
+    else if (blockLength_ == MODE1_BLOCK_LEN) {
+      offset = block[15] == 2 ? 24 : 16;
+    }
+    else {
+      offset = AUDIO_BLOCK_LEN - blockLength_;
+    }
+
+    memcpy(dataIn + i * blockLength_, block + offset, blockLength_);
+  }
+
+  return 0;
+}
+
+int ScsiSim::readCd(const unsigned char *cmd, unsigned char *dataIn,
+		    int dataInLen)
+{
+  long lba = (long)((cmd[2] << 24) | (cmd[3] << 16) | (cmd[4] << 8) | cmd[5]);
+  long len = (cmd[6] << 16) | (cmd[7] << 8) | cmd[8];
+  int sectorType = (cmd[1] >> 2) & 0x07;
+  int flags = cmd[9];
+  int subSel = cmd[10] & 0x07;
+  unsigned char block[SIM_BLOCK_LEN];
+  unsigned char q[12];
+  unsigned char *out = dataIn;
+  long i;
+
+  throttleRead(len * AUDIO_BLOCK_LEN);
+
+  for (i = 0; i < len; i++) {
+    const unsigned char *pw = block + AUDIO_BLOCK_LEN;
+    int type; // sector type as encoded in 'cmd[1]'
+    int start, end;
+
+    if (readBlock(lba + i, block) != 0)
+      return readError(lba + i);
+
+    getQ(pw, q);
+
+    if ((q[0] & 0x40) == 0)
+      type = 1;
+    else if (block[15] == 1)
+      type = 2;
+    else if (block[15] != 2)
+      type = 0;
+    else if (memcmp(block + 16, block + 20, 4) != 0)
+      type = 3;
+    else
+      type = (block[18] & 0x20) ? 5 : 4;
+
+    if (sectorType != 0 && sectorType != type)
+      return checkCondition(5, 0x64, 0x00); // illegal mode for this track
+
+    // select the requested fields of the main channel
+    start = end = 0;
+
+    if (type == 1) {
+      if (flags & 0xf8)
+	end = AUDIO_BLOCK_LEN;
+    }
+    else if (flags & 0xf8) {
+      int userStart, userEnd;
+
+      switch (type) {
+      case 2:
+	userStart = 16;
+	userEnd = 16 + MODE1_BLOCK_LEN;
+	break;
+      case 4:
+	userStart = 24;
+	userEnd = 24 + MODE1_BLOCK_LEN;
+	break;
+      case 5:
+	userStart = 24;
+	userEnd = 24 + 2324;
+	break;
+      default:
+	userStart = 16;
+	userEnd = AUDIO_BLOCK_LEN;
+	break;
+      }
+
+      if (flags & 0x80)
+	start = 0;
+      else if (flags & 0x20)
+	start = 12;
+      else if (flags & 0x40)
+	start = type >= 4 ? 16 : userStart;
+      else
+	start = userStart;
+
+      if (flags & 0x08)
+	end = AUDIO_BLOCK_LEN;
+      else if (flags & 0x10)
+	end = userEnd;
+      else if (flags & 0x40)
+	end = userStart;
+      else
+	end = 16;
+    }
+
+    long blen = (end - start) + ((flags & 0x06) ? ((flags & 0x04) ? 296 : 294)
+				 : 0) +
+      (subSel == 1 || subSel == 4 ? PW_SUBCHANNEL_LEN :
+       subSel == 2 ? PQ_SUBCHANNEL_LEN : 0);
+
+    if ((out - dataIn) + blen > dataInLen)
+      return checkCondition(5, 0x24, 0x00);
+
+    memcpy(out, block + start, end - start);
+    out += end - start;
+
+    if (flags & 0x06) {
+      // no C2 errors
+      long c2 = (flags & 0x04) ? 296 : 294;
+      memset(out, 0, c2);
+      out += c2;
+    }
+
+    switch (subSel) {
+    case 1:
+      memcpy(out, pw, PW_SUBCHANNEL_LEN);
+      out += PW_SUBCHANNEL_LEN;
+      break;
+
+    case 2:
+      memset(out, 0, PQ_SUBCHANNEL_LEN);
+      memcpy(out, q, 12);
+      if (pw[0] & 0x80)
+	out[15] = 0x80;
+      out += PQ_SUBCHANNEL_LEN;
+      break;
+
+    case 4:
+      readCookedRW(lba + i, pw, out);
+      out += PW_SUBCHANNEL_LEN;
+      break;
+    }
+  }
+
+  return 0;
+}
+
+// Deinterleaves and corrects the R-W sub-channel data of block 'lba'
+// like a drive does for READ CD with sub-channel selection 100b. 'pw' is
+// the raw P-W data of the block, the interleaving also requires the
+// following blocks which are taken as empty behind the written area.
+// Packs with uncorrectable errors are returned as they are.
+
+void ScsiSim::readCookedRW(long lba, const unsigned char *pw,
+			   unsigned char *out)
+{
+  unsigned char raw[(1 + SUBRW_DECODE_LOOKAHEAD) * PW_SUBCHANNEL_LEN];
+  unsigned char block[SIM_BLOCK_LEN];
+  int i;
+
+  memcpy(raw, pw, PW_SUBCHANNEL_LEN);
+
+  for (i = 1; i <= SUBRW_DECODE_LOOKAHEAD; i++) {
+    if (readBlock(lba + i, block) == 0)
+      memcpy(raw + i * PW_SUBCHANNEL_LEN, block + AUDIO_BLOCK_LEN,
+	     PW_SUBCHANNEL_LEN);
+    else
+      memset(raw + i * PW_SUBCHANNEL_LEN, 0, PW_SUBCHANNEL_LEN);
+  }
+
+  subrw_decode_sectors(raw, PW_SUBCHANNEL_LEN, out, PW_SUBCHANNEL_LEN, 1, NULL);
+}
+
+int ScsiSim::sendCueSheet(const unsigned char *dataOut, int dataOutLen)
+{
+  if (image_->complete)
+    return checkCondition(5, 0x21, 0x02); // invalid address for write
+
+  if (writeType() != 2)
+    return checkCondition(5, 0x2c, 0x00); // command sequence error
+
+  if (dataOutLen <= 0 || (dataOutLen % 8) != 0)
+    return checkCondition(5, 0x1a, 0x00);
+
+  delete encoder_;
+  delete subChannel_;
+  delete[] cueSheet_;
+
+  cueSheet_ = new unsigned char[dataOutLen];
+  memcpy(cueSheet_, dataOut, dataOutLen);
+  cueSheetLen_ = dataOutLen;
+
+  subChannel_ = new PWSubChannel96;
+  encoder_ = new PQChannelEncoder;
+
+  if (encoder_->setCueSheet(subChannel_, modePages_[0x05][8], cueSheet_,
+			    cueSheetLen_, Msf(SIM_LEADIN_MIN, SIM_LEADIN_SEC,
+					      SIM_LEADIN_FRAME)) != 0) {
+    delete encoder_;
+    encoder_ = NULL;
+    return checkCondition(5, 0x26, 0x00); // invalid field in parameter list
+  }
+
+  encodeLba_ = leadInStartLba();
+  writing_ = false;
+  rwDelayIndex_ = 0;
+  memset(rwDelayLine_, 0, sizeof(rwDelayLine_));
+
+  return 0;
+}
+
+int ScsiSim::write10(const unsigned char *cmd, const unsigned char *dataOut,
+		     int dataOutLen)
+{
+  long lba = (long)((cmd[2] << 24) | (cmd[3] << 16) | (cmd[4] << 8) | cmd[5]);
+  long len = (cmd[7] << 8) | cmd[8];
+  long blockLen;
+  int ret;
+
+  if (len == 0)
+    return 0;
+
+  if (image_->complete)
+    return checkCondition(5, 0x21, 0x02); // invalid address for write
+
+  if ((dataOutLen % len) != 0)
+    return checkCondition(5, 0x24, 0x00);
+
+  blockLen = dataOutLen / len;
+
+  if (writeType() == 2 && encoder_ == NULL)
+    return checkCondition(5, 0x2c, 0x00); // command sequence error
+  if (writeType() != 2 && writeType() != 3)
+    return checkCondition(5, 0x64, 0x00); // illegal mode for this track
+
+  if (!writing_) {
+    if (lba < leadInStartLba())
+      return checkCondition(5, 0x21, 0x02);
+
+    // start of a new session
+    unsigned char erasable = image_->erasable;
+    memset(image_, 0, sizeof(ScsiSimImage));
+    strcpy(image_->magic, SIM_MAGIC);
+    image_->erasable = erasable;
+
+    writing_ = true;
+    nextWritableLba_ = lba;
+    trackNr_ = 0;
+    cdTextDone_ = false;
+    bufferFill_ = 0;
+    burning_ = false;
+    dry_ = false;
+    underruns_ = 0;
+  }
+
+  if (lba != nextWritableLba_)
+    return checkCondition(5, 0x21, 0x02); // invalid address for write
+
+  // the lead-in is written by the drive before the program area and does
+  // not pass the buffer
+  if (lba + len > -150 &&
+      (ret = fillBuffer((lba + len - (lba > -150 ? lba : -150)) *
+			AUDIO_BLOCK_LEN)) != 0)
+    return ret;
+
+  if (writeType() == 2)
+    ret = writeCooked(lba, len, blockLen, dataOut);
+  else
+    ret = writeRaw(lba, len, blockLen, dataOut);
+
+  if (ret == 0)
+    nextWritableLba_ += len;
+
+  return ret;
+}
+
+// Session-at-once write: the drive encodes data sectors and generates the
+// P-Q sub-channel from the cue sheet.
+
+int ScsiSim::writeCooked(long lba, long len, long blockLen,
+			 const unsigned char *data)
+{
+  unsigned char block[SIM_BLOCK_LEN];
+  unsigned char *pw = block + AUDIO_BLOCK_LEN;
+  unsigned char rw[PW_SUBCHANNEL_LEN];
+  const unsigned char *pq;
+  long l;
+  int i;
+
+  for (l = lba; l < lba + len; l++, data += blockLen) {
+    if (l < -150) {
+      // lead-in, only R-W sub-channel data is transferred for CD-TEXT
+      if (blockLen != PW_SUBCHANNEL_LEN)
+	return checkCondition(5, 0x64, 0x00);
+
+      pq = encodeSubChannel(l);
+      for (i = 0; i < PW_SUBCHANNEL_LEN; i++)
+	pw[i] = pq[i] | (data[i] & 0x3f);
+
+      processSubChannel(l, pw);
+      continue;
+    }
+
+    int form = cueSheetDataForm(l);
+    long subLen = (form & 0xc0) ? PW_SUBCHANNEL_LEN : 0;
+    long mainLen;
+
+    switch (form & 0x3f) {
+    case 0x00:
+      mainLen = AUDIO_BLOCK_LEN;
+      break;
+    case 0x10:
+      mainLen = MODE1_BLOCK_LEN;
+      break;
+    case 0x20:
+    case 0x30:
+      mainLen = MODE2_BLOCK_LEN;
+      break;
+    default:
+      mainLen = 0;
+      break;
+    }
+
+    if (blockLen != mainLen + subLen)
+      return checkCondition(5, 0x64, 0x00); // illegal mode for this track
+
+    memset(block, 0, AUDIO_BLOCK_LEN);
+
+    switch (form & 0x3f) {
+    case 0x00:
+      memcpy(block, data, AUDIO_BLOCK_LEN);
+      break;
+    case 0x10:
+      memcpy(block + 16, data, MODE1_BLOCK_LEN);
+      lec_encode_mode1_sector(l + 150, block);
+      break;
+    case 0x20:
+      memcpy(block + 16, data, MODE2_BLOCK_LEN);
+      if (block[18] & 0x20)
+	lec_encode_mode2_form2_sector(l + 150, block);
+      else
+	lec_encode_mode2_form1_sector(l + 150, block);
+      break;
+    case 0x30:
+      memcpy(block + 16, data, MODE2_BLOCK_LEN);
+      lec_encode_mode2_sector(l + 150, block);
+      break;
+    }
+
+    pq = encodeSubChannel(l);
+
+    if (subLen > 0) {
+      memcpy(rw, data + mainLen, PW_SUBCHANNEL_LEN);
+
+      // packed R-W data is encoded and interleaved by the drive
+      if ((form & 0xc0) == 0xc0)
+	subrw_encode_sectors(rw, 1, PW_SUBCHANNEL_LEN, &rwDelayIndex_,
+			     rwDelayLine_);
+    }
+    else {
+      memset(rw, 0, PW_SUBCHANNEL_LEN);
+    }
+
+    for (i = 0; i < PW_SUBCHANNEL_LEN; i++)
+      pw[i] = pq[i] | (rw[i] & 0x3f);
+
+    processSubChannel(l, pw);
+
+    if (!testWrite() && writeBlock(l, block) != 0)
+      return checkCondition(3, 0x0c, 0x00); // write error
+  }
+
+  return 0;
+}
+
+// Raw write: blocks contain scrambled main channel data and the complete
+// sub-channel data including the lead-in.
+
+int ScsiSim::writeRaw(long lba, long len, long blockLen,
+		      const unsigned char *data)
+{
+  unsigned char block[SIM_BLOCK_LEN];
+  unsigned char *pw = block + AUDIO_BLOCK_LEN;
+  unsigned char q[12];
+  int dbt = modePages_[0x05][4] & 0x0f;
+  long l;
+
+  if (blockLen != (dbt == 1 ? AUDIO_BLOCK_LEN + PQ_SUBCHANNEL_LEN :
+		   SIM_BLOCK_LEN))
+    return checkCondition(5, 0x64, 0x00); // illegal mode for this track
+
+  for (l = lba; l < lba + len; l++, data += blockLen) {
+    memcpy(block, data, AUDIO_BLOCK_LEN);
+
+    if (dbt == 1)
+      pq2pw(data + AUDIO_BLOCK_LEN, pw);
+    else
+      memcpy(pw, data + AUDIO_BLOCK_LEN, PW_SUBCHANNEL_LEN);
+
+    processSubChannel(l, pw);
+
+    if (l < -150 || testWrite())
+      continue;
+
+    // data blocks are identified by the control nibble of the Q channel
+    getQ(pw, q);
+    if (q[0] & 0x40)
+      descramble(block);
+
+    if (writeBlock(l, block) != 0)
+      return checkCondition(3, 0x0c, 0x00); // write error
+  }
+
+  return 0;
+}
+
+// Finishes the session: the buffer is flushed and the TOC collected from
+// the lead-in is made persistent.
+
+int ScsiSim::synchronizeCache()
+{
+  int kbs = effectiveSpeed(writeSpeed_);
+
+  drainBuffer();
+
+  if (kbs > 0 && bufferFill_ > 0) {
+    mSleep((long)(bufferFill_ / kbs) + 1);
+    bufferFill_ = 0;
+  }
+
+  burning_ = false;
+  dry_ = false;
+
+  if (!writing_)
+    return 0;
+
+  writing_ = false;
+
+  delete encoder_;
+  encoder_ = NULL;
+  delete subChannel_;
+  subChannel_ = NULL;
+  delete[] cueSheet_;
+  cueSheet_ = NULL;
+  cueSheetLen_ = 0;
+
+  if (underruns_ > 0)
+    log_message(2, "Simulated drive: %ld buffer under runs.", underruns_);
+
+  if (testWrite()) {
+    resetImage();
+    return 0;
+  }
+
+  if (image_->tocLen > 0)
+    image_->complete = 1;
+
+  if (writeHeader() != 0)
+    return checkCondition(3, 0x0c, 0x00);
+
+  return 0;
+}
+
+int ScsiSim::blank()
+{
+  if (!image_->erasable)
+    return checkCondition(5, 0x30, 0x05); // cannot write medium
+
+  resetImage();
+
+  if (ftruncate(fd_, 0) != 0 || writeHeader() != 0)
+    return checkCondition(3, 0x0c, 0x00);
+
+  return 0;
+}
+
+int ScsiSim::setCdSpeed(const unsigned char *cmd)
+{
+  readSpeed_ = (cmd[2] << 8) | cmd[3];
+  writeSpeed_ = (cmd[4] << 8) | cmd[5];
+
+  return 0;
+}
@@ -0,0 +1,162 @@
+/*  cdrdao - emulated MMC drive
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// \file ScsiSim.h
+//   \brief Emulated MMC drive backed by an image file.
+
+#ifndef __SCSISIM_H__
+#define __SCSISIM_H__
+
+#include <sys/types.h>
+
+class PQChannelEncoder;
+class SubChannel;
+struct ScsiSimImage;
+
+//! \brief Emulates an MMC CD recorder at the CDB level. The disc is
+// stored in an image file so that a disc written with 'cdrdao write'
+// can be read back with 'cdrdao read-cd'.
+//
+// The device is selected with 'sim:<image file>[,option=value...]'.
+// Supported options:
+//   - buffer=<KB>     size of the drive buffer (default 2048)
+//   - speed=<x>       maximum read and write speed, 0 is unlimited (default)
+//   - latency=<ms>    delay added to each command (default 0)
+//   - capacity=<min>  capacity of blank discs in minutes (default 80)
+//   - rw              emulate an erasable CD-RW disc
+
+class ScsiSim
+{
+ public:
+    //! \brief Constructor. 'spec' is the device string without the
+    // "sim:" prefix.
+    ScsiSim(const char *spec);
+    ~ScsiSim();
+
+    //! \brief Returns true if 'dev' selects the emulated drive.
+    static bool isSimDevice(const char *dev);
+
+    //! \brief Opens or creates the image file.
+    // \return 0 OK, 1 error
+    int open();
+
+    //! \brief Executes a command. Parameters and return values are the
+    // same as for 'ScsiIf::sendCmd()'.
+    int sendCmd(const unsigned char *cmd, int cmdLen,
+		const unsigned char *dataOut, int dataOutLen,
+		unsigned char *dataIn, int dataInLen);
+
+    //! \brief Sense data of the last command, 'len' is 0 if the last
+    // command succeeded.
+    const unsigned char *getSense(int &len) const;
+
+ private:
+    char *file_;
+    int fd_;
+
+    long bufferSize_; // bytes
+    int maxSpeed_;    // speed factor, 0: unlimited
+    long latency_;    // milli seconds
+    long capacity_;   // blocks
+    bool erasable_;
+
+    ScsiSimImage *image_; // persistent disc state
+
+    unsigned char sense_[18];
+    int senseLen_;
+
+    // mode pages, indexed by page code
+    unsigned char *modePages_[0x40];
+    long blockLength_; // block length used by READ(10)
+
+    int readSpeed_;  // KB/s, from SET CD SPEED
+    int writeSpeed_; // KB/s
+
+    // state of the current write session
+    unsigned char *cueSheet_;
+    long cueSheetLen_;
+    PQChannelEncoder *encoder_;
+    SubChannel *subChannel_; // template for 'encoder_'
+    long encodeLba_;         // next lba expected by 'encoder_'
+    long nextWritableLba_;
+    bool writing_;
+    bool cdTextDone_;
+    int trackNr_; // track of the last written block with a position Q
+    // R-W interleaver state for packed sub-channel data, see 'writeCooked()'
+    unsigned long rwDelayIndex_;
+    unsigned char rwDelayLine_[8][24];
+
+    // drive buffer emulation
+    double bufferFill_; // bytes
+    long long drainTime_;
+    bool burning_;
+    bool dry_; // buffer ran empty while burning
+    long underruns_;
+
+    long long readReady_; // time when the last read command completes
+
+    void parseSpec(const char *spec);
+    void resetImage();
+    int writeHeader();
+
+    int checkCondition(int key, int asc, int ascq);
+    int sendData(unsigned char *dataIn, int dataInLen,
+		 const unsigned char *data, long len);
+
+    long leadInStartLba() const;
+    long leadOutStartLba() const;
+    int writeType() const;
+    bool testWrite() const;
+    bool bufferUnderrunFree() const;
+    int effectiveSpeed(int kbs) const;
+
+    void drainBuffer();
+    int fillBuffer(long bytes);
+    void throttleRead(long bytes);
+
+    int readBlock(long lba, unsigned char *block);
+    int readError(long lba);
+    int writeBlock(long lba, const unsigned char *block);
+    void processSubChannel(long lba, const unsigned char *pw);
+    const unsigned char *encodeSubChannel(long lba);
+    int cueSheetDataForm(long lba) const;
+    void readCookedRW(long lba, const unsigned char *pw, unsigned char *out);
+
+    int inquiry(const unsigned char *cmd, unsigned char *, int);
+    int modeSense(const unsigned char *cmd, int cmdLen, unsigned char *, int);
+    int modeSelect(const unsigned char *cmd, int cmdLen,
+		   const unsigned char *, int);
+    int readTocPmaAtip(const unsigned char *cmd, unsigned char *, int);
+    int readDiscInfo(const unsigned char *cmd, unsigned char *, int);
+    int readTrackInfo(const unsigned char *cmd, unsigned char *, int);
+    int readSubChannel(const unsigned char *cmd, unsigned char *, int);
+    int readCapacity(unsigned char *, int);
+    int readBufferCapacity(const unsigned char *cmd, unsigned char *, int);
+    int read10(const unsigned char *cmd, unsigned char *, int);
+    int readCd(const unsigned char *cmd, unsigned char *, int);
+    int sendCueSheet(const unsigned char *, int);
+    int write10(const unsigned char *cmd, const unsigned char *, int);
+    int writeCooked(long lba, long len, long blockLen,
+		    const unsigned char *data);
+    int writeRaw(long lba, long len, long blockLen,
+		 const unsigned char *data);
+    int synchronizeCache();
+    int blank();
+    int setCdSpeed(const unsigned char *cmd);
+};
+
+#endif
@@ -521,7 +521,7 @@ void SonyCDU920::abortDao()
 // return: 0: OK
 //         1: scsi command failed
 int SonyCDU920::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-			  long &lba, const char *buf, long len)
+			  long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
 
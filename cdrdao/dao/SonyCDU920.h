@@ -46,7 +46,7 @@ public:
   int finishDao();
   void abortDao();
   int writeData(TrackData::Mode, TrackData::SubChannelMode, long &lba,
-		const char *buf, long len);
+		char *buf, long len);
 
   DiskInfo *diskInfo();
   Toc *readDiskToc(int session, const char *audioFilename);
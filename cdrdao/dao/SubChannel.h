@@ -115,6 +115,8 @@ public:
   static int isBcd(unsigned char);
 
 protected:
+  friend class SubChannelBatch;
+
   Type type_;
   int crcValid_; // 0 if sub channel has no valid CRC that can be checked,
                  // 1 if CRC is valid and can be checked
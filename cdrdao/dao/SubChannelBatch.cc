@@ -0,0 +1,244 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "SubChannelBatch.h"
+#include "PWSubChannel96.h"
+#include "stats.h"
+
+SubChannelBatch::SubChannelBatch(long maxLen)
+{
+  maxLen_ = maxLen;
+  len_ = 0;
+
+  channels_ = new unsigned char[maxLen][96];
+
+  ok_ = new unsigned char[maxLen];
+  type_ = new unsigned char[maxLen];
+  ctl_ = new unsigned char[maxLen];
+  trackNr_ = new unsigned char[maxLen];
+  indexNr_ = new unsigned char[maxLen];
+  time_ = new long[maxLen];
+  atime_ = new long[maxLen];
+}
+
+SubChannelBatch::~SubChannelBatch()
+{
+  delete[] channels_;
+  delete[] ok_;
+  delete[] type_;
+  delete[] ctl_;
+  delete[] trackNr_;
+  delete[] indexNr_;
+  delete[] time_;
+  delete[] atime_;
+}
+
+void SubChannelBatch::decode(Format format, const unsigned char *buf,
+			     long blockLen, long len)
+{
+  long long start = stats_start();
+  long i;
+
+  assert(len <= maxLen_);
+
+  len_ = len;
+
+  switch (format) {
+  case PQ16:
+    for (i = 0; i < len; i++, buf += blockLen) {
+      memcpy(channels_[i] + 12, buf, 12);
+      ok_[i] = 1;
+    }
+    break;
+
+  case PW96:
+    PWSubChannel96::deinterleave(buf, blockLen, channels_[0], len);
+
+    checkCrc(len);
+    break;
+  }
+
+  decodeFields(format, len);
+
+  stats_end(STAT_SUBCHAN_DECODE, start, len * (format == PQ16 ? 16 : 96));
+}
+
+void SubChannelBatch::decode(SubChannel **chans, long len)
+{
+  long long start = stats_start();
+  Format format = PQ16;
+  long bytes = 0;
+  long i;
+
+  assert(len <= maxLen_);
+
+  len_ = len;
+
+  for (i = 0; i < len; i++) {
+    if (chans[i]->dataLength() == 96) {
+      PWSubChannel96::deinterleave(chans[i]->data(), 96, channels_[i], 1);
+      format = PW96;
+    }
+    else {
+      memcpy(channels_[i] + 12, chans[i]->data(), 12);
+    }
+
+    // the objects know whether their CRC can be checked
+    ok_[i] = chans[i]->checkCrc() ? 1 : 0;
+    bytes += chans[i]->dataLength();
+  }
+
+  decodeFields(format, len);
+
+  stats_end(STAT_SUBCHAN_DECODE, start, bytes);
+}
+
+// Verifies the CRC stored in bytes 10 and 11 of the Q sub-channels of
+// raw P-W data and sets 'ok_' accordingly.
+void SubChannelBatch::checkCrc(long len)
+{
+  const unsigned short *tab = SubChannel::crctab;
+  long i;
+  int j;
+
+  for (i = 0; i < len; i++) {
+    const unsigned char *q = this->q(i);
+    unsigned short crc = 0;
+
+    for (j = 0; j < 10; j++)
+      crc = tab[(crc >> 8) ^ q[j]] ^ (crc << 8);
+
+    crc = ~crc;
+
+    ok_[i] = (q[10] == (crc >> 8) && q[11] == (crc & 0xff));
+  }
+}
+
+// Fills the field arrays from the Q sub-channel bytes and clears 'ok_'
+// for sectors with inconsistent fields. The checks are the same as in
+// 'PQSubChannel16::checkConsistency()' and
+// 'SubChannel::checkConsistency()'.
+void SubChannelBatch::decodeFields(Format format, long len)
+{
+  char buf[14];
+  long i;
+  int j;
+
+  for (i = 0; i < len; i++) {
+    const unsigned char *q = this->q(i);
+    int consistent = 1;
+    int m, s, f;
+
+    ctl_[i] = q[0] >> 4;
+
+    switch (q[0] & 0x0f) {
+    case 1:
+      type_[i] = SubChannel::QMODE1DATA;
+
+      trackNr_[i] = SubChannel::bcd2int(q[1]);
+      indexNr_[i] = SubChannel::bcd2int(q[2]);
+
+      if (trackNr_[i] < 1 || trackNr_[i] > 99 || indexNr_[i] > 99)
+	consistent = 0;
+
+      m = SubChannel::bcd2int(q[3]);
+      s = SubChannel::bcd2int(q[4]);
+      f = SubChannel::bcd2int(q[5]);
+      time_[i] = m * 4500 + s * 75 + f;
+
+      if (m > 99 || s > 59 || f > 74)
+	consistent = 0;
+
+      m = SubChannel::bcd2int(q[7]);
+      s = SubChannel::bcd2int(q[8]);
+      f = SubChannel::bcd2int(q[9]);
+      atime_[i] = m * 4500 + s * 75 + f;
+
+      if (m > 99 || s > 59 || f > 74)
+	consistent = 0;
+
+      if (format == PQ16 &&
+	  (!SubChannel::isBcd(q[3]) || !SubChannel::isBcd(q[4]) ||
+	   !SubChannel::isBcd(q[5]) || !SubChannel::isBcd(q[7]) ||
+	   !SubChannel::isBcd(q[8]) || !SubChannel::isBcd(q[9])))
+	consistent = 0;
+      break;
+
+    case 2:
+      type_[i] = SubChannel::QMODE2;
+
+      catalog(i, buf);
+      for (j = 0; j < 13; j++) {
+	if (!isdigit(buf[j]))
+	  consistent = 0;
+      }
+      break;
+
+    case 3:
+      type_[i] = SubChannel::QMODE3;
+
+      isrc(i, buf);
+      for (j = 0; j < 5; j++) {
+	if (!isdigit(buf[j]) && !isupper(buf[j]))
+	  consistent = 0;
+      }
+      for (j = 5; j < 12; j++) {
+	if (!isdigit(buf[j]))
+	  consistent = 0;
+      }
+      break;
+
+    case 5:
+      type_[i] = SubChannel::QMODE5TOC;
+      break;
+
+    default:
+      type_[i] = SubChannel::QMODE_ILLEGAL;
+      consistent = 0;
+      break;
+    }
+
+    if (!consistent)
+      ok_[i] = 0;
+  }
+}
+
+void SubChannelBatch::catalog(long i, char *buf) const
+{
+  const unsigned char *q = this->q(i);
+
+  SubChannel::decodeCatalogNumber(q + 1, &buf[0], &buf[1], &buf[2], &buf[3],
+				  &buf[4], &buf[5], &buf[6], &buf[7], &buf[8],
+				  &buf[9], &buf[10], &buf[11], &buf[12]);
+  buf[13] = 0;
+}
+
+void SubChannelBatch::isrc(long i, char *buf) const
+{
+  const unsigned char *q = this->q(i);
+
+  SubChannel::decodeIsrcCode(q + 1, &buf[0], &buf[1], &buf[2], &buf[3],
+			     &buf[4], &buf[5], &buf[6], &buf[7], &buf[8],
+			     &buf[9], &buf[10], &buf[11]);
+  buf[12] = 0;
+}
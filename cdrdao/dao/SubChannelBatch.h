@@ -0,0 +1,96 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __SUB_CHANNEL_BATCH_H__
+#define __SUB_CHANNEL_BATCH_H__
+
+#include "SubChannel.h"
+
+// Decoded Q sub-channels of a range of sectors, usually of a complete
+// READ CD transfer. Each field is stored in a separate array with one
+// element per sector so that the sub-channels can be analyzed without
+// creating and querying a 'SubChannel' object for each sector.
+class SubChannelBatch {
+public:
+  // Layout of the sub-channel data that is decoded
+  enum Format { PQ16, // 16 bytes, Q sub-channel in bytes 0-11, the CRC
+		      // is usually invalid and is not checked
+		PW96  // 96 bytes of raw interleaved P-W sub-channels
+  };
+
+  // 'maxLen': maximum number of sectors that can be decoded in one go
+  SubChannelBatch(long maxLen);
+  ~SubChannelBatch();
+
+  // Decodes the sub-channel data of 'len' sectors from 'buf'. The data of
+  // consecutive sectors is 'blockLen' bytes apart.
+  void decode(Format, const unsigned char *buf, long blockLen, long len);
+
+  // Decodes the sub-channel data of given 'SubChannel' objects, used for
+  // drivers that only provide 'readSubChannels()'.
+  void decode(SubChannel **, long len);
+
+  long length() const { return len_; } // number of decoded sectors
+
+  // 1 if the CRC of the Q sub-channel of sector 'i' is correct and all
+  // fields are consistent, 0 otherwise
+  int ok(long i) const { return ok_[i]; }
+
+  SubChannel::Type type(long i) const { return (SubChannel::Type)type_[i]; }
+
+  // control nibble in bits 0-3
+  unsigned char ctl(long i) const { return ctl_[i]; }
+
+  int trackNr(long i) const { return trackNr_[i]; } // QMODE1DATA
+  int indexNr(long i) const { return indexNr_[i]; } // QMODE1DATA
+
+  // track relative time as block count (QMODE1DATA)
+  long time(long i) const { return time_[i]; }
+
+  // absolute time as block count, starts at 150 (QMODE1DATA)
+  long atime(long i) const { return atime_[i]; }
+
+  // Writes the catalog number (QMODE2) of sector 'i' to given 14 byte
+  // buffer.
+  void catalog(long i, char *buf) const;
+
+  // Writes the ISRC code (QMODE3) of sector 'i' to given 13 byte buffer.
+  void isrc(long i, char *buf) const;
+
+private:
+  long maxLen_;
+  long len_;
+
+  // deinterleaved sub-channels of each sector, 12 bytes for each of the
+  // channels P - W, only Q is set for 'PQ16'
+  unsigned char (*channels_)[96];
+
+  unsigned char *ok_;
+  unsigned char *type_;
+  unsigned char *ctl_;
+  unsigned char *trackNr_;
+  unsigned char *indexNr_;
+  long *time_;
+  long *atime_;
+
+  const unsigned char *q(long i) const { return channels_[i] + 12; }
+
+  void checkCrc(long len);
+  void decodeFields(Format, long len);
+};
+
+#endif
@@ -194,7 +194,7 @@ void TaiyoYuden::abortDao()
 // return: 0: OK
 //         1: scsi command failed
 int TaiyoYuden::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-			  long &lba, const char *buf, long len)
+			  long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
   assert(blockLength_ > 0);
@@ -51,7 +51,7 @@ public:
   void abortDao();
 
   int writeData(TrackData::Mode, TrackData::SubChannelMode, long &lba,
-		const char *buf, long len);
+		char *buf, long len);
 
 protected:
   DiskInfo diskInfo_;
@@ -783,7 +783,7 @@ int TeacCdr55::setIsrc()
 // Need to overload this function to set the WriteExtension flag. It'll
 // also change the write density if the actual mode changes.
 int TeacCdr55::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-			 long &lba, const char *buf, long len)
+			 long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
   int writeLen = 0;
@@ -34,6 +34,7 @@
 #include "Toc.h"
 #include "PQSubChannel16.h"
 #include "log.h"
+#include "stats.h"
 #include "port.h"
 
 
@@ -810,7 +811,7 @@ int YamahaCDR10x::driveInfo(DriveInfo *info, bool showErrorMsg)
 // return: 0: OK
 //         1: scsi command failed
 int YamahaCDR10x::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
-			    long &lba, const char *buf, long len)
+			    long &lba, char *buf, long len)
 {
   assert(blocksPerWrite_ > 0);
   int writeLen = 0;
@@ -858,7 +859,9 @@ int YamahaCDR10x::writeData(TrackData::Mode mode, TrackData::SubChannelMode sm,
 	// we spin on the write here, waiting a reasonable time in between
 	// we should really use READ BLOCK LIMIT (0x05)
 	if(senseLen && sense[2] == 9 && sense[0xc] == 0xb8) {
+	  long long start = stats_start();
 	  mSleep(40);
+	  stats_end(STAT_SCSI_RETRY, start, 0);
           retry = 1;
         }
 	else {
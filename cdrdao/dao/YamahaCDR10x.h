@@ -62,7 +62,7 @@ public:
 
   int driveInfo(DriveInfo *, bool showErrorMsg);
   int writeData(TrackData::Mode, TrackData::SubChannelMode, long &lba,
-		const char *buf, long len);
+		char *buf, long len);
 
 protected:
   int scsiTimeout_;
@@ -27,6 +27,8 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <assert.h>
 
 #ifdef linux
@@ -36,6 +38,9 @@
 
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
 #endif
 
 #ifdef USE_POSIX_THREADS
@@ -43,11 +48,16 @@
 #else
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#include <poll.h>
+#endif
 #endif
 
 #include "dao.h"
 #include "util.h"
 #include "log.h"
+#include "stats.h"
 #include "port.h"
 #include "log.h"
 
@@ -66,6 +76,7 @@
 struct ShmSegment {
   int id;
   char *buffer;
+  long size; // length of mapped memory, 0 if allocated with 'new'
 };
 
 struct Buffer {
@@ -78,10 +89,50 @@ struct Buffer {
   int trackNr; // if != 0 a new track with given number has started
   int trackProgress; // reading progress of current track 0..1000
   char *buffer; // address of buffer that should be written
+
+  // encoding stage, see 'encodeBuffer()'
+  long lba;      // address of first block, used for the sector headers
+  long blockLen; // length of each block in 'buffer'
+  int encode;    // 1: data blocks must be L-EC encoded and scrambled
+  int swap;      // 1: samples must be swapped after encoding
+  TrackData::Mode *blockModes; // data mode of each block
+  long encoded;  // set to the buffer's sequence number + 1 when the buffer
+                 // may be written
 };
-  
+
+// Wake-up channel for one direction of the FIFO. 'waiting' tells the
+// signaling side if it has to issue a wake-up at all so that the common
+// case (no one sleeping) costs no system call. Several encoder threads may
+// wait on the same event, the eventfd variant supports a single waiter only.
+struct FifoEvent {
+  int waiting;            // number of threads that may block on the event
+  long long signalTime;   // time of last wake-up, for hand-off statistics
+
+  long wakeups;           // statistics, updated by the waiting side only
+  long long latencySum;   // sum of wake-up latencies (usec)
+  long long latencyMax;   // maximum wake-up latency (usec)
+
+#if defined(USE_POSIX_THREADS)
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#elif defined(HAVE_SYS_EVENTFD_H)
+  int fd;
+#endif
+};
+
+// Ring of buffers that passes three stages: the reader fills buffers with
+// track data, the encoder threads perform the L-EC encoding and sample
+// swapping and the writer sends them to the recorder. 'buffersRead' is only
+// written by the reader and 'buffersWritten' only by the writer. Encoders
+// claim buffers through 'buffersClaimed' and finish them in any order, the
+// writer waits for the 'encoded' field of the next buffer. Without encoder
+// threads the reader encodes itself. All counters are accessed with
+// acquire/release semantics so that the contents of a slot are visible
+// before its counter update.
 struct BufferHeader {
   long buffersRead;    // number of blocks that are read and put to the buffer
+  long buffersClaimed; // number of blocks taken by an encoder thread
+  long buffersEncoded; // number of blocks that finished the encoding stage
   long buffersWritten; // number of blocks that were taken from the buffer
   int buffersFilled;   // set to 1 by reader process when buffer is filled the
                        // first time
@@ -89,23 +140,252 @@ struct BufferHeader {
   int readerTerminated;
   int terminateReader;
 
+  FifoEvent dataAvail;   // signaled by encoding stage, waited for by writer
+  FifoEvent spaceAvail;  // signaled by writer, waited for by reader
+  FifoEvent encodeAvail; // signaled by reader, waited for by encoders
+
   long nofBuffers;     // number of available buffers
+  long bufferBlocks;   // number of blocks per buffer
   Buffer *buffers;
 };
 
-// buffer size in blocks
+// default buffer size in blocks, used if the driver's WRITE size is unknown
 int BUFFER_SIZE = 75;
 
 static int TERMINATE = 0;
 
+// maximum time a FIFO side blocks before it re-checks the termination flags
+#define FIFO_WAIT_TIMEOUT 100 // msec
+
+// maximum number of encoder threads
+#define MAX_ENCODERS 4
 
 
 
-static int getSharedMemory(long nofBuffers, BufferHeader **header,
-			   long *nofSegments, ShmSegment **shmSegments);
+static int getSharedMemory(long nofBuffers, long bufferBlocks, int memFlags,
+			   BufferHeader **header, long *nofSegments,
+			   ShmSegment **shmSegments);
 static void releaseSharedMemory(long nofSegments, ShmSegment *shmSegments);
 
 
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+
+template<class T> static inline T fifoLoad(const T *p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<class T> static inline void fifoStore(T *p, T val)
+{
+  __atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+
+static inline void fifoFence()
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+template<class T> static inline T fifoAdd(T *p, T val)
+{
+  return __atomic_add_fetch(p, val, __ATOMIC_ACQ_REL);
+}
+
+template<class T> static inline int fifoCas(T *p, T expected, T val)
+{
+  return __atomic_compare_exchange_n(p, &expected, val, 0, __ATOMIC_ACQ_REL,
+				     __ATOMIC_ACQUIRE);
+}
+
+#else
+
+template<class T> static inline T fifoLoad(const T *p)
+{
+  T val = *(volatile const T *)p;
+  __sync_synchronize();
+  return val;
+}
+
+template<class T> static inline void fifoStore(T *p, T val)
+{
+  __sync_synchronize();
+  *(volatile T *)p = val;
+}
+
+static inline void fifoFence()
+{
+  __sync_synchronize();
+}
+
+template<class T> static inline T fifoAdd(T *p, T val)
+{
+  return __sync_add_and_fetch(p, val);
+}
+
+template<class T> static inline int fifoCas(T *p, T expected, T val)
+{
+  return __sync_bool_compare_and_swap(p, expected, val);
+}
+
+#endif
+
+// Initializes given event.
+// return: 0: OK
+//         1: failed
+static int fifoInitEvent(FifoEvent *ev)
+{
+  memset(ev, 0, sizeof(FifoEvent));
+
+#if defined(USE_POSIX_THREADS)
+  if (pthread_mutex_init(&ev->mutex, NULL) != 0) {
+    log_message(-2, "pthread_mutex_init failed: %s", strerror(errno));
+    return 1;
+  }
+
+  if (pthread_cond_init(&ev->cond, NULL) != 0) {
+    log_message(-2, "pthread_cond_init failed: %s", strerror(errno));
+    pthread_mutex_destroy(&ev->mutex);
+    return 1;
+  }
+#elif defined(HAVE_SYS_EVENTFD_H)
+  if ((ev->fd = eventfd(0, 0)) < 0) {
+    // not fatal, 'fifoWait()' falls back to polling
+    log_message(3, "Cannot create eventfd: %s", strerror(errno));
+  }
+#endif
+
+  return 0;
+}
+
+static void fifoDestroyEvent(FifoEvent *ev)
+{
+#if defined(USE_POSIX_THREADS)
+  pthread_cond_destroy(&ev->cond);
+  pthread_mutex_destroy(&ev->mutex);
+#elif defined(HAVE_SYS_EVENTFD_H)
+  if (ev->fd >= 0)
+    close(ev->fd);
+  ev->fd = -1;
+#endif
+}
+
+// Wakes up one thread that is waiting on 'ev', or all threads if 'all' is
+// 1. Must be called after the counter the other side is waiting for has been
+// updated.
+static void fifoSignal(FifoEvent *ev, int all = 0)
+{
+  // orders the preceding counter update before the check of 'waiting',
+  // pairs with the fence in 'fifoWait()'
+  fifoFence();
+
+  if (fifoLoad(&ev->waiting) == 0)
+    return;
+
+#if defined(USE_POSIX_THREADS)
+  pthread_mutex_lock(&ev->mutex);
+  ev->signalTime = usecTime();
+  if (all)
+    pthread_cond_broadcast(&ev->cond);
+  else
+    pthread_cond_signal(&ev->cond);
+  pthread_mutex_unlock(&ev->mutex);
+#elif defined(HAVE_SYS_EVENTFD_H)
+  if (ev->fd >= 0) {
+    u_int64_t one = 1;
+
+    fifoStore(&ev->signalTime, usecTime());
+    if (write(ev->fd, &one, sizeof(one)) != sizeof(one))
+      log_message(4, "eventfd write failed: %s", strerror(errno));
+  }
+#endif
+}
+
+// Updates the wake-up statistics of 'ev' for a wait that started at 'start'.
+// With POSIX threads this is called with the event mutex held.
+static void fifoRecordWakeup(FifoEvent *ev, long long start)
+{
+  long long signalTime = fifoLoad(&ev->signalTime);
+  long long latency = usecTime() - signalTime;
+
+  if (latency >= 0 && signalTime >= start) {
+    ev->wakeups += 1;
+    ev->latencySum += latency;
+    if (latency > ev->latencyMax)
+      ev->latencyMax = latency;
+  }
+}
+
+// Blocks until '*counter' differs from 'seen', the event is signaled or
+// 'timeout' milliseconds have passed. Spurious returns are possible, the
+// caller has to re-check its condition.
+static void fifoWait(FifoEvent *ev, const long *counter, long seen,
+		     long timeout)
+{
+  long long start = usecTime();
+  int woken = 0;
+
+#if defined(USE_POSIX_THREADS)
+  struct timespec ts;
+  long long end = start + timeout * 1000;
+
+  ts.tv_sec = end / 1000000;
+  ts.tv_nsec = (end % 1000000) * 1000;
+
+  pthread_mutex_lock(&ev->mutex);
+  fifoStore(&ev->waiting, ev->waiting + 1);
+  fifoFence();
+
+  if (fifoLoad(counter) == seen) {
+    if (pthread_cond_timedwait(&ev->cond, &ev->mutex, &ts) == 0)
+      fifoRecordWakeup(ev, start);
+  }
+
+  fifoStore(&ev->waiting, ev->waiting - 1);
+  pthread_mutex_unlock(&ev->mutex);
+
+#elif defined(HAVE_SYS_EVENTFD_H)
+  if (ev->fd >= 0) {
+    struct pollfd pfd;
+    u_int64_t cnt;
+
+    fifoStore(&ev->waiting, 1);
+    fifoFence();
+
+    if (fifoLoad(counter) == seen) {
+      pfd.fd = ev->fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      if (poll(&pfd, 1, timeout) > 0 &&
+	  read(ev->fd, &cnt, sizeof(cnt)) == sizeof(cnt))
+	woken = 1;
+    }
+
+    fifoStore(&ev->waiting, 0);
+  }
+  else if (fifoLoad(counter) == seen) {
+    mSleep(10);
+  }
+
+#else
+  if (fifoLoad(counter) == seen)
+    mSleep(10);
+#endif
+
+  if (woken)
+    fifoRecordWakeup(ev, start);
+}
+
+static void fifoPrintStats(int level, const char *name, const FifoEvent *ev)
+{
+  if (ev->wakeups == 0) {
+    log_message(level, "  %s: no wake-ups", name);
+    return;
+  }
+
+  log_message(level, "  %s: %ld wake-ups, latency avg %lld us, max %lld us",
+	      name, ev->wakeups, ev->latencySum / ev->wakeups, ev->latencyMax);
+}
+
 
 static RETSIGTYPE terminationRequest(int sig)
 {
@@ -196,6 +476,158 @@ static void unblockSignals()
 #endif
 }
 
+// Adaptive speed control: the writer samples the fill level of the FIFO and
+// of the drive's buffer at a fixed rate. If the smoothed trend predicts
+// that both will run empty within SPEED_CONTROL_HORIZON the writing speed
+// is stepped down, it is raised again after the FIFO stayed full for
+// SPEED_CONTROL_HOLD.
+#define SPEED_CONTROL_INTERVAL 500 // msec between two samples
+#define SPEED_CONTROL_HORIZON  8   // sec
+#define SPEED_CONTROL_HOLD     10  // sec
+#define SPEED_CONTROL_MIN_GAP  4   // min. sec between two speed changes
+
+struct SpeedControl {
+  int enabled;
+  int maxSpeed;          // speed at start of writing, never exceeded
+  int speed;             // current speed
+  long long lastSample;  // time of last sample (usec)
+  long long lastChange;  // time of last speed change (usec)
+  long long fullSince;   // time since the FIFO is full, 0 if it is not
+  double lastReserve;    // buffered blocks (FIFO + drive) at last sample
+  double trend;          // smoothed change of 'lastReserve' (blocks/sec)
+  int changes;           // number of speed changes
+};
+
+static const int SPEED_STEPS[] = { 1, 2, 4, 6, 8, 10, 12, 16, 20, 24, 32, 40,
+				   48, 52 };
+#define NOF_SPEED_STEPS ((int)(sizeof(SPEED_STEPS) / sizeof(SPEED_STEPS[0])))
+
+static void speedControlInit(SpeedControl *sc, CdrDriver *cdr)
+{
+  memset(sc, 0, sizeof(SpeedControl));
+
+  if (cdr == NULL || !cdr->adaptiveSpeed())
+    return;
+
+  if (!cdr->writeSpeedControl()) {
+    log_message(-1, "Adaptive speed disabled because writing speed control "
+		"is disabled.");
+    return;
+  }
+
+  if ((sc->maxSpeed = cdr->speed()) <= 1) {
+    log_message(-1, "Adaptive speed disabled: cannot determine writing "
+		"speed.");
+    return;
+  }
+
+  sc->speed = sc->maxSpeed;
+  sc->lastSample = sc->lastChange = usecTime();
+  sc->lastReserve = -1;
+  sc->enabled = 1;
+
+  log_message(3, "Adaptive speed control enabled, writing at %dx.",
+	      sc->speed);
+}
+
+// Returns the next lower (dir < 0) or higher (dir > 0) speed step, or 0 if
+// there is none.
+static int speedControlStep(const SpeedControl *sc, int dir)
+{
+  int i;
+
+  if (dir < 0) {
+    for (i = NOF_SPEED_STEPS - 1; i >= 0; i--) {
+      if (SPEED_STEPS[i] < sc->speed)
+	return SPEED_STEPS[i];
+    }
+  }
+  else {
+    for (i = 0; i < NOF_SPEED_STEPS; i++) {
+      if (SPEED_STEPS[i] > sc->speed)
+	return SPEED_STEPS[i] <= sc->maxSpeed ? SPEED_STEPS[i] : sc->maxSpeed;
+    }
+  }
+
+  return 0;
+}
+
+static void speedControlChange(SpeedControl *sc, CdrDriver *cdr, int speed,
+			       long long now)
+{
+  if (speed <= 0 || speed == sc->speed)
+    return;
+
+  if (cdr->changeWriteSpeed(speed) != 0) {
+    log_message(-1, "Cannot change writing speed, adaptive speed disabled.");
+    sc->enabled = 0;
+    return;
+  }
+
+  log_message(2, "%s writing speed to %dx.",
+	      speed < sc->speed ? "Reducing" : "Raising", speed);
+
+  sc->speed = speed;
+  sc->lastChange = now;
+  sc->fullSince = 0;
+  sc->changes += 1;
+}
+
+// Called by the writer after each written buffer.
+// fifoBlocks: number of blocks in the FIFO
+// fifoFull: 1 if FIFO is (almost) completely filled
+// readerFinished: 1 if all data is in the FIFO, the FIFO drains legally then
+static void speedControlSample(SpeedControl *sc, CdrDriver *cdr,
+			       long fifoBlocks, int fifoFull,
+			       int readerFinished)
+{
+  long long now = usecTime();
+  long total, avail;
+  double reserve, dt, rate;
+
+  if (!sc->enabled || now - sc->lastSample < SPEED_CONTROL_INTERVAL * 1000)
+    return;
+
+  dt = (now - sc->lastSample) / 1e6;
+  sc->lastSample = now;
+
+  reserve = fifoBlocks;
+
+  if (cdr->readBufferCapacity(&total, &avail) && total > avail)
+    reserve += (double)(total - avail) / AUDIO_BLOCK_LEN;
+
+  if (sc->lastReserve >= 0) {
+    rate = (reserve - sc->lastReserve) / dt;
+    sc->trend = 0.5 * sc->trend + 0.5 * rate;
+  }
+
+  sc->lastReserve = reserve;
+
+  if (readerFinished)
+    return;
+
+  if (fifoFull) {
+    if (sc->fullSince == 0)
+      sc->fullSince = now;
+  }
+  else {
+    sc->fullSince = 0;
+  }
+
+  if (now - sc->lastChange < SPEED_CONTROL_MIN_GAP * 1000000LL)
+    return;
+
+  if (sc->trend < 0 && reserve / -sc->trend < SPEED_CONTROL_HORIZON) {
+    log_message(4, "Predicted buffer under run in %.1f s.",
+		reserve / -sc->trend);
+    speedControlChange(sc, cdr, speedControlStep(sc, -1), now);
+  }
+  else if (sc->fullSince != 0 && sc->speed < sc->maxSpeed &&
+	   now - sc->fullSince >= SPEED_CONTROL_HOLD * 1000000LL) {
+    speedControlChange(sc, cdr, speedControlStep(sc, 1), now);
+  }
+}
+
 // return: 0: OK 
 //         1: child process terminated and has been collected with 'wait()'
 //         2: error -> child process must be terminated
@@ -218,16 +650,21 @@ static int writer(const Toc *toc, CdrDriver *cdr, BufferHeader *header,
   long actProgress;
   TrackData::Mode dataMode;
   TrackData::SubChannelMode subChanMode;
+  SpeedControl speedControl;
 #ifndef USE_POSIX_THREADS
   int status;
 #endif
 
   log_message(3, "Waiting for reader process");
 
-  while (header->buffersFilled == 0) {
-    sleep(1);
+  while (fifoLoad(&header->buffersFilled) == 0) {
+    fifoWait(&header->dataAvail, &header->buffersEncoded,
+	     fifoLoad(&header->buffersEncoded), 1000);
+
+    if (fifoLoad(&header->buffersFilled) != 0)
+      break;
 
-    if (header->readerTerminated) {
+    if (fifoLoad(&header->readerTerminated)) {
       log_message(-2, "Reader process terminated abnormally.");
       return 1;
     }
@@ -260,14 +697,25 @@ static int writer(const Toc *toc, CdrDriver *cdr, BufferHeader *header,
       unblockSignals();
       return 2;
     }
+    speedControlInit(&speedControl, cdr);
     unblockSignals();
   }
+  else {
+    speedControlInit(&speedControl, NULL);
+  }
 
   do {
     //log_message(4, "Slave: waiting for master.");
 
-    while (header->buffersWritten == header->buffersRead) {
-      if (header->readerTerminated) {
+    Buffer &buf = header->buffers[header->buffersWritten % header->nofBuffers];
+
+    while (1) {
+      long encoded = fifoLoad(&header->buffersEncoded);
+
+      if (fifoLoad(&buf.encoded) == header->buffersWritten + 1)
+	break;
+
+      if (fifoLoad(&header->readerTerminated)) {
 	log_message(-2, "Reader process terminated abnormally.");
 	return 1;
       }
@@ -284,21 +732,27 @@ static int writer(const Toc *toc, CdrDriver *cdr, BufferHeader *header,
       }
 #endif
 
-      mSleep(10);
+      if (TERMINATE)
+	break;
+
+      fifoWait(&header->dataAvail, &header->buffersEncoded, encoded,
+	       FIFO_WAIT_TIMEOUT);
     }
 
-    Buffer &buf = header->buffers[header->buffersWritten % header->nofBuffers];
+    if (TERMINATE)
+      break;
+
     len = buf.bufLen;
     dataMode = buf.mode;
     subChanMode = buf.subChanMode;
 
-    if (header->readerFinished) {
+    if (fifoLoad(&header->readerFinished)) {
       buffFill = 100;
       if (maxFill == 0)
 	maxFill = 100;
     }
     else {
-      buffered = header->buffersRead - header->buffersWritten;
+      buffered = fifoLoad(&header->buffersRead) - header->buffersWritten;
 
       if (buffered == header->nofBuffers ||
 	  buffered == header->nofBuffers - 1) {
@@ -325,6 +779,10 @@ static int writer(const Toc *toc, CdrDriver *cdr, BufferHeader *header,
 	log_message(1, "Wrote %ld blocks. Buffer fill min %d%%/max %d%%.",
 		blkCount, minFill, maxFill);
 
+      if (speedControl.changes > 0)
+	log_message(2, "Changed writing speed %d times, final speed %dx.",
+		    speedControl.changes, speedControl.speed);
+
 #if DEBUG_WRITE
       if (fp != NULL)
 	fclose(fp);
@@ -397,6 +855,11 @@ static int writer(const Toc *toc, CdrDriver *cdr, BufferHeader *header,
         lastMb = cntMb;
       }
 
+      speedControlSample(&speedControl, cdr,
+			 (fifoLoad(&header->buffersRead) -
+			  header->buffersWritten - 1) * header->bufferBlocks,
+			 buffFill == 100, fifoLoad(&header->readerFinished));
+
       unblockSignals();
 
       actProgress = cnt;
@@ -417,7 +880,8 @@ static int writer(const Toc *toc, CdrDriver *cdr, BufferHeader *header,
     }
 
 
-    header->buffersWritten += 1;
+    fifoStore(&header->buffersWritten, header->buffersWritten + 1);
+    fifoSignal(&header->spaceAvail);
 
   } while (!TERMINATE);
 
@@ -432,14 +896,103 @@ struct ReaderArgs {
   int swap;
   BufferHeader *header;
   long startLba;
+  int nofEncoders; // number of encoder threads, 0: reader encodes itself
 };
 
+// Performs the CPU intensive part of the block preparation: L-EC encoding
+// and scrambling of data blocks and byte swapping of samples.
+static void encodeBuffer(Buffer *buf)
+{
+  if (buf->encode)
+    TrackReader::encodeData(buf->blockModes, buf->lba, buf->buffer,
+			    buf->bufLen, buf->blockLen);
+
+  if (buf->swap) {
+    char *brun = buf->buffer;
+    long i;
+
+    for (i = 0; i < buf->bufLen; i++, brun += buf->blockLen)
+      swapSamples((Sample *)brun, SAMPLES_PER_BLOCK);
+  }
+}
+
+// Marks the buffer with sequence number 'seq' as ready for writing.
+static void finishBuffer(BufferHeader *header, Buffer *buf, long seq)
+{
+  fifoStore(&buf->encoded, seq + 1);
+  fifoAdd(&header->buffersEncoded, 1L);
+  fifoSignal(&header->dataAvail);
+}
+
+#ifdef USE_POSIX_THREADS
+// Encoder thread: takes filled buffers in order of their sequence number,
+// encodes them and hands them to the writer. Runs until the reader is told
+// to terminate.
+static void *encoder(void *args)
+{
+  BufferHeader *header = ((ReaderArgs*)args)->header;
+  long claim;
+
+  stats_thread_name("encoder");
+  setRealTimeScheduling(4);
+
+  while (fifoLoad(&header->terminateReader) == 0) {
+    claim = fifoLoad(&header->buffersClaimed);
+
+    if (claim == fifoLoad(&header->buffersRead)) {
+      fifoWait(&header->encodeAvail, &header->buffersRead, claim,
+	       FIFO_WAIT_TIMEOUT);
+      continue;
+    }
+
+    if (!fifoCas(&header->buffersClaimed, claim, claim + 1))
+      continue; // taken by another encoder
+
+    Buffer &buf = header->buffers[claim % header->nofBuffers];
+
+    encodeBuffer(&buf);
+    finishBuffer(header, &buf, claim);
+  }
+
+  stats_thread_exit();
+  return NULL;
+}
+#endif
+
+// Decides once per track where the samples are byte swapped for the
+// recorder: audio samples without sub-channel data are swapped by 'reader'
+// while they are copied, all other blocks are swapped by 'encodeBuffer()'.
+// Must be called before 'reader.openData()'.
+// return: 1 if the blocks of 'track' must be swapped by 'encodeBuffer()'
+static int setupSwap(TrackReader &reader, const Track *track, CdrDriver *cdr,
+		     int encodingMode, int swap)
+{
+  int swapBlocks;
+
+  if (cdr == NULL)
+    swapBlocks = 0;
+  else if (track->type() == TrackData::AUDIO)
+    swapBlocks = swap || (encodingMode == 0 && cdr->bigEndianSamples() == 0);
+  else
+    swapBlocks = (encodingMode == 0 && cdr->bigEndianSamples() == 0);
+
+  if (swapBlocks && track->type() == TrackData::AUDIO &&
+      track->subChannelType() == TrackData::SUBCHAN_NONE) {
+    reader.swapSamples(1);
+    return 0;
+  }
+
+  reader.swapSamples(0);
+  return swapBlocks;
+}
+
 static void *reader(void *args)
 {
   const Toc *toc = ((ReaderArgs*)args)->toc;
   CdrDriver *cdr = ((ReaderArgs*)args)->cdr;
   int swap = ((ReaderArgs*)args)->swap;
   BufferHeader *header = ((ReaderArgs*)args)->header;
+  int nofEncoders = ((ReaderArgs*)args)->nofEncoders;
   long lba = ((ReaderArgs*)args)->startLba + 150; // used to encode the sector
                                                   // header (MSF)
 
@@ -453,9 +1006,11 @@ static void *reader(void *args)
   int encodingMode = 0;
   int subChanEncodingMode = 1;
   int newTrack;
+  int swapBlocks; // 1: blocks of current track are swapped by the encoder
   long tact; // number of blocks already read from current track
   long tprogress;
 
+  stats_thread_name("reader");
   setRealTimeScheduling(4);
 
   giveUpRootPrivileges();
@@ -474,6 +1029,7 @@ static void *reader(void *args)
 
   track = itr.first();
   reader.init(track);
+  swapBlocks = setupSwap(reader, track, cdr, encodingMode, swap);
 
   if (reader.openData() != 0) {
     log_message(-2, "Opening of track data failed.");
@@ -490,13 +1046,19 @@ static void *reader(void *args)
     subChanEncodingMode = cdr->subChannelEncodingMode(subChanMode);
 
   do {
-    n = (length > BUFFER_SIZE ? BUFFER_SIZE : length);
+    n = (length > header->bufferBlocks ? header->bufferBlocks : length);
 
     Buffer &buf = header->buffers[header->buffersRead % header->nofBuffers];
 
     do {
+      // the driver may request room for sub-channel data behind each block
+      if (cdr != NULL)
+	buf.blockLen = cdr->blockSize(dataMode, subChanMode);
+      else
+	buf.blockLen = AUDIO_BLOCK_LEN + TrackData::subChannelSize(subChanMode);
+
       rn = reader.readData(encodingMode, subChanEncodingMode, lba, buf.buffer,
-			   n);
+			   n, buf.blockModes, buf.blockLen);
     
       if (rn < 0) {
 	log_message(-2, "Reading of track data failed.");
@@ -506,6 +1068,7 @@ static void *reader(void *args)
       if (rn == 0) {
 	track = itr.next();
 	reader.init(track);
+	swapBlocks = setupSwap(reader, track, cdr, encodingMode, swap);
 
 	if (reader.openData() != 0) {
 	  log_message(-2, "Opening of track data failed.");
@@ -527,21 +1090,14 @@ static void *reader(void *args)
       }
     } while (rn == 0);
 
+    // L-EC encoding and swapping is done by the encoding stage
+    buf.lba = lba;
+    buf.encode = (encodingMode == 0 && track->type() != TrackData::AUDIO);
+    buf.swap = swapBlocks;
+
     lba += rn;
     tact += rn;
 
-    if (cdr != NULL &&
-	((track->type() == TrackData::AUDIO && swap) ||
-	 (encodingMode == 0 && cdr->bigEndianSamples() == 0))) {
-      // swap audio data 
-      long blockLen = cdr->blockSize(dataMode, subChanMode);
-      char *brun = buf.buffer;
-      int i;
-	
-      for (i = 0; i < rn; i++, brun += blockLen)
-	swapSamples((Sample *)brun, SAMPLES_PER_BLOCK);
-    }
-
     buf.bufLen = rn;
     buf.mode = dataMode;
     buf.trackMode = track->type();
@@ -560,8 +1116,6 @@ static void *reader(void *args)
       buf.trackNr = 0;
     }
 
-    header->buffersRead += 1;
-
     length -= rn;
 
     if (first > 0) {
@@ -569,29 +1123,51 @@ static void *reader(void *args)
       if (first == 0 || length == 0) {
 	log_message(3, "Buffer filled");
 
-	header->buffersFilled = 1;
+	// must be visible before the counter update below
+	fifoStore(&header->buffersFilled, 1);
       }
     }
+
+    // publish the filled buffer
+    if (nofEncoders == 0) {
+      encodeBuffer(&buf);
+      finishBuffer(header, &buf, header->buffersRead);
+    }
+
+    fifoStore(&header->buffersRead, header->buffersRead + 1);
+
+    if (nofEncoders > 0)
+      fifoSignal(&header->encodeAvail);
     
     // wait for writing process to finish writing of previous buffer
     //log_message(4, "Reader: waiting for Writer.");
-    while (header->buffersRead - header->buffersWritten 
+    while (header->buffersRead - fifoLoad(&header->buffersWritten)
 	   == header->nofBuffers &&
-	   header->terminateReader == 0) {
-      mSleep(10);
+	   fifoLoad(&header->terminateReader) == 0) {
+      fifoWait(&header->spaceAvail, &header->buffersWritten,
+	       header->buffersRead - header->nofBuffers, FIFO_WAIT_TIMEOUT);
     }
 
 
     newTrack = 0;
-  } while (length > 0 && header->terminateReader == 0);
+  } while (length > 0 && fifoLoad(&header->terminateReader) == 0);
 
-  header->readerFinished = 1;
+  fifoStore(&header->readerFinished, 1);
 
-  if (header->terminateReader == 0) {
+  if (fifoLoad(&header->terminateReader) == 0) {
     Buffer &buf1 = header->buffers[header->buffersRead % header->nofBuffers];
     buf1.bufLen = 0;
     buf1.trackNr = 0;
-    header->buffersRead += 1;
+    buf1.encode = 0;
+    buf1.swap = 0;
+
+    if (nofEncoders == 0)
+      finishBuffer(header, &buf1, header->buffersRead);
+
+    fifoStore(&header->buffersRead, header->buffersRead + 1);
+
+    if (nofEncoders > 0)
+      fifoSignal(&header->encodeAvail);
   }
 
 #ifndef USE_POSIX_THREADS
@@ -602,32 +1178,124 @@ static void *reader(void *args)
   exit(0);
 #endif
 
+  stats_thread_exit();
   return NULL;
 
 fail:
-  header->readerTerminated = 1;
+  fifoStore(&header->readerTerminated, 1);
+  fifoSignal(&header->dataAvail);
 
 #ifndef USE_POSIX_THREADS
   exit(1);
 #endif
 
+  stats_thread_exit();
   return NULL;
 }
 
+// Prints FIFO hand-off latencies and the CPU time that was used since
+// 'startTime'/'startUsage'. With 'read-test' and '--speed' this serves as
+// a benchmark for the reader/writer hand-off at a given block rate.
+static void printFifoStats(int level, const BufferHeader *header,
+			   int nofEncoders, long long startTime,
+			   const struct rusage *startUsage)
+{
+  struct rusage usage;
+  double wall, user, sys;
+
+  wall = (usecTime() - startTime) / 1e6;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return;
+
+  user = (usage.ru_utime.tv_sec - startUsage->ru_utime.tv_sec) +
+    (usage.ru_utime.tv_usec - startUsage->ru_utime.tv_usec) / 1e6;
+  sys = (usage.ru_stime.tv_sec - startUsage->ru_stime.tv_sec) +
+    (usage.ru_stime.tv_usec - startUsage->ru_stime.tv_usec) / 1e6;
+
+  log_message(level, "FIFO statistics (%ld buffers of %ld blocks, %d encoder "
+	      "threads):", header->nofBuffers, header->bufferBlocks,
+	      nofEncoders);
+  fifoPrintStats(level, "writer", &header->dataAvail);
+  fifoPrintStats(level, "reader", &header->spaceAvail);
+  if (nofEncoders > 0)
+    fifoPrintStats(level, "encoders", &header->encodeAvail);
+
+  if (wall > 0) {
+    log_message(level, "  CPU time: user %.2fs, system %.2fs, %.1f%% of "
+		"%.2fs", user, sys, 100.0 * (user + sys) / wall, wall);
+  }
+}
+
+// Returns the number of encoder threads that should be used. One CPU is
+// left for the reader and writer which mostly wait for I/O.
+static int encoderThreads()
+{
+#if defined(USE_POSIX_THREADS)
+  long n = 2;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+  n -= 1;
+
+  if (n < 1)
+    n = 1;
+  else if (n > MAX_ENCODERS)
+    n = MAX_ENCODERS;
+
+  return n;
+#else
+  return 0;
+#endif
+}
+
+// Returns the number of blocks per FIFO buffer. If the driver's WRITE
+// command size is known the buffer holds the multiple of it that is
+// closest to 'BUFFER_SIZE' so that 'CdrDriver::writeData()' never has to
+// issue a short WRITE command in the middle of a track. 'blocksPerWrite()'
+// is derived from 'ScsiIf::maxDataLen()' by the driver so a single chunk
+// never exceeds the transfer limit of the SCSI interface.
+static long fifoBufferBlocks(const CdrDriver *cdr)
+{
+  long bpw;
+  long n;
+
+  if (cdr == NULL || (bpw = cdr->blocksPerWrite()) <= 0)
+    return BUFFER_SIZE;
+
+  n = (BUFFER_SIZE + bpw / 2) / bpw;
+
+  if (n < 1)
+    n = 1;
+
+  return n * bpw;
+}
 
 int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
-		    int testMode, int speed)
+		    int testMode, int speed, int fifoMemFlags)
 {
   int err = 0;
   BufferHeader *header = NULL;
   long nofShmSegments = 0;
   ShmSegment *shmSegments = NULL;
   long startLba = 0;
+  long long startTime;
+  struct rusage startUsage;
+  int nofEncoders = encoderThreads();
+  ReaderArgs rargs;
+  long bufferBlocks;
+  int eventsInitialized = 0;
+  long b;
 
 #ifdef USE_POSIX_THREADS
   pthread_t readerThread;
   pthread_attr_t readerThreadAttr;
   int threadStarted = 0;
+  pthread_t encoderThread[MAX_ENCODERS];
+  int encodersStarted = 0;
+  int i;
 #else
   int pid = 0;
   int status;
@@ -640,19 +1308,6 @@ int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
   }
 #endif
 
-  if (getSharedMemory(nofBuffers, &header, &nofShmSegments,
-		      &shmSegments)  != 0) {
-    releaseSharedMemory(nofShmSegments, shmSegments);
-    return 1;
-  }
-
-  header->buffersRead = 0;
-  header->buffersWritten = 0;
-  header->buffersFilled = 0;
-  header->readerFinished = 0;
-  header->readerTerminated = 0;
-  header->terminateReader = 0;
-
   TERMINATE = 0;
 
   installSignalHandler(SIGINT, SIG_IGN);
@@ -674,21 +1329,89 @@ int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
     }
   }
 
-  // start reader process
-#ifdef USE_POSIX_THREADS
+  // the buffer geometry depends on the driver's WRITE size which is set up
+  // by 'initDao()'
+  bufferBlocks = fifoBufferBlocks(cdr);
 
-  if (pthread_attr_init(&readerThreadAttr) != 0) {
-    log_message(-2, "pthread_attr_init failed: %s", strerror(errno));
+  log_message(4, "FIFO: %d buffers of %ld blocks, %ld blocks per WRITE.",
+	      nofBuffers, bufferBlocks, cdr != NULL ? cdr->blocksPerWrite() : 0);
+
+  if (getSharedMemory(nofBuffers, bufferBlocks, fifoMemFlags, &header,
+		      &nofShmSegments, &shmSegments)  != 0) {
+    releaseSharedMemory(nofShmSegments, shmSegments);
+    header = NULL;
+    if (cdr != NULL && !testMode)
+      cdr->abortDao();
+    err = 1; goto fail;
+  }
+
+  header->buffersRead = 0;
+  header->buffersClaimed = 0;
+  header->buffersEncoded = 0;
+  header->buffersWritten = 0;
+  header->buffersFilled = 0;
+  header->readerFinished = 0;
+  header->readerTerminated = 0;
+  header->terminateReader = 0;
+
+  if (fifoInitEvent(&header->dataAvail) != 0) {
+    eventsInitialized = 0;
+  }
+  else if (fifoInitEvent(&header->spaceAvail) != 0) {
+    fifoDestroyEvent(&header->dataAvail);
+    eventsInitialized = 0;
+  }
+  else if (fifoInitEvent(&header->encodeAvail) != 0) {
+    fifoDestroyEvent(&header->dataAvail);
+    fifoDestroyEvent(&header->spaceAvail);
+    eventsInitialized = 0;
+  }
+  else {
+    eventsInitialized = 1;
+  }
+
+  if (!eventsInitialized) {
+    if (cdr != NULL && !testMode)
+      cdr->abortDao();
     err = 1; goto fail;
   }
-  
-  ReaderArgs rargs;
+
+  for (b = 0; b < header->nofBuffers; b++)
+    header->buffers[b].encoded = 0;
+
+  if (cdr != NULL)
+    cdr->resetWriteStats();
+
+  startTime = usecTime();
+  getrusage(RUSAGE_SELF, &startUsage);
+  stats_reset();
 
   rargs.toc = toc;
   rargs.cdr = cdr;
   rargs.swap = swap;
   rargs.header = header;
   rargs.startLba = startLba;
+  rargs.nofEncoders = nofEncoders;
+
+  // start reader process
+#ifdef USE_POSIX_THREADS
+
+  if (pthread_attr_init(&readerThreadAttr) != 0) {
+    log_message(-2, "pthread_attr_init failed: %s", strerror(errno));
+    err = 1; goto fail;
+  }
+
+  for (i = 0; i < nofEncoders; i++) {
+    if (pthread_create(&encoderThread[i], &readerThreadAttr, encoder,
+		       &rargs) != 0) {
+      log_message(-2, "Cannot create thread: %s", strerror(errno));
+      pthread_attr_destroy(&readerThreadAttr);
+      err = 1; goto fail;
+    }
+    encodersStarted++;
+  }
+
+  log_message(4, "Started %d encoder threads.", nofEncoders);
 
   if (pthread_create(&readerThread, &readerThreadAttr, reader, &rargs) != 0) {
     log_message(-2, "Cannot create thread: %s", strerror(errno));
@@ -715,14 +1438,6 @@ int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
     }
 #endif
 
-    ReaderArgs rargs;
-
-    rargs.toc = toc;
-    rargs.cdr = cdr;
-    rargs.swap = swap;
-    rargs.header = header;
-    rargs.startLba = startLba;
-
     reader(&rargs);
   }
   else if (pid < 0) {
@@ -772,9 +1487,13 @@ int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
 #endif
 
 #ifdef USE_POSIX_THREADS
-  if (threadStarted) {
-    header->terminateReader = 1;
+  if (eventsInitialized) {
+    fifoStore(&header->terminateReader, 1);
+    fifoSignal(&header->spaceAvail);
+    fifoSignal(&header->encodeAvail, 1);
+  }
 
+  if (threadStarted) {
     if (pthread_join(readerThread, NULL) != 0) {
       log_message(-2, "pthread_join failed: %s", strerror(errno));
       err = 1;
@@ -783,6 +1502,13 @@ int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
     pthread_attr_destroy(&readerThreadAttr);
   }
 
+  for (i = 0; i < encodersStarted; i++) {
+    if (pthread_join(encoderThread[i], NULL) != 0) {
+      log_message(-2, "pthread_join failed: %s", strerror(errno));
+      err = 1;
+    }
+  }
+
 #else
   if (pid != 0) {
     if (kill(pid, SIGKILL) == 0) {
@@ -791,6 +1517,25 @@ int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
   }
 #endif
 
+  if (err == 0) {
+    printFifoStats(testMode ? 1 : 3, header, nofEncoders, startTime,
+		   &startUsage);
+
+    if (cdr != NULL && cdr->writeCmdCount() > 0) {
+      log_message(2, "Issued %ld WRITE commands, average length %lld bytes.",
+		  cdr->writeCmdCount(),
+		  cdr->writeCmdBytes() / cdr->writeCmdCount());
+    }
+  }
+
+  stats_dump(cdr != NULL ? "write" : "read-test");
+
+  if (eventsInitialized) {
+    fifoDestroyEvent(&header->dataAvail);
+    fifoDestroyEvent(&header->spaceAvail);
+    fifoDestroyEvent(&header->encodeAvail);
+  }
+
   releaseSharedMemory(nofShmSegments, shmSegments);
 
   installSignalHandler(SIGINT, SIG_DFL);
@@ -804,13 +1549,193 @@ int writeDiskAtOnce(const Toc *toc, CdrDriver *cdr, int nofBuffers, int swap,
 }
 
 
+// Returns the system's page size.
+static long fifoPageSize()
+{
+  long pageSize = 0;
+
+#if defined(HAVE_GETPAGESIZE)
+  pageSize = getpagesize();
+#elif defined(_SC_PAGESIZE)
+  pageSize = sysconf(_SC_PAGESIZE);
+#endif
+
+  if (pageSize <= 0)
+    pageSize = 4096;
+
+  return pageSize;
+}
+
+// Rounds 'len' up to a multiple of 'align'.
+static long fifoAlign(long len, long align)
+{
+  return ((len + align - 1) / align) * align;
+}
+
+// Returns the size of the memory that holds the buffer header, the buffer
+// descriptors and the per block data modes. It is rounded to full pages so
+// that buffers following it are page aligned.
+static long bufferHeaderSize(long nofBuffers, long bufferBlocks)
+{
+  return fifoAlign(sizeof(BufferHeader) + nofBuffers * sizeof(Buffer) +
+		   nofBuffers * bufferBlocks * sizeof(TrackData::Mode),
+		   fifoPageSize());
+}
+
+// Returns the size of a single buffer, rounded to full pages.
+static long bufferDataSize(long bufferBlocks)
+{
+  return fifoAlign(bufferBlocks * (AUDIO_BLOCK_LEN + PW_SUBCHANNEL_LEN),
+		   fifoPageSize());
+}
+
+// Sets up the buffer header at 'base' which must provide
+// 'bufferHeaderSize()' bytes. The data buffers are not assigned.
+static BufferHeader *setupBufferHeader(char *base, long nofBuffers,
+				       long bufferBlocks)
+{
+  BufferHeader *header = (BufferHeader*)base;
+  TrackData::Mode *modes;
+  long b;
+
+  header->nofBuffers = nofBuffers;
+  header->bufferBlocks = bufferBlocks;
+  header->buffers = (Buffer*)(base + sizeof(BufferHeader));
+
+  modes = (TrackData::Mode*)(base + sizeof(BufferHeader) +
+			     nofBuffers * sizeof(Buffer));
+
+  for (b = 0; b < nofBuffers; b++)
+    header->buffers[b].blockModes = modes + b * bufferBlocks;
+
+  return header;
+}
+
+// Locks and/or pre-faults given FIFO memory according to 'memFlags' so
+// that no page faults occur while the disk is written.
+static void prepareFifoMemory(char *mem, long len, int memFlags)
+{
+  long pageSize = fifoPageSize();
+  long i;
+
+  if (memFlags & FIFO_MEM_LOCK) {
+#if defined(HAVE_MLOCK) && defined(HAVE_SYS_MMAN_H)
+    if (mlock(mem, len) != 0)
+      log_message(-1, "Cannot lock FIFO memory: %s", strerror(errno));
+    else
+      log_message(4, "Locked %ld bytes of FIFO memory.", len);
+#else
+    log_message(-1, "Locking of FIFO memory is not supported.");
+#endif
+  }
+
+  if (memFlags & FIFO_MEM_PREFAULT) {
+    for (i = 0; i < len; i += pageSize)
+      ((volatile char *)mem)[i] = 0;
+  }
+}
+
+// assumed huge page size, used to round the size of huge page mappings
+#define FIFO_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#ifdef HAVE_SYS_MMAN_H
+
+// Maps anonymous memory of 'size' bytes. With POSIX threads the mapping is
+// private to the process, otherwise it is shared with the forked reader
+// process. The shared mapping is backed by a memfd if available so that it
+// shows up in /proc/<pid>/maps as "cdrdao-fifo". Both variants are released
+// automatically when all processes exit, even after a crash, and are not
+// subject to the SysV IPC limits.
+// size: requested size, updated if rounded for huge pages
+// return: mapped memory or MAP_FAILED
+static void *mapFifoMemory(long *size, int memFlags)
+{
+  void *mem = MAP_FAILED;
+  long hsize = fifoAlign(*size, FIFO_HUGE_PAGE_SIZE);
+
 #ifdef USE_POSIX_THREADS
-static int getSharedMemory(long nofBuffers,
+  int mapFlags = MAP_PRIVATE|MAP_ANONYMOUS;
+#else
+  int mapFlags = MAP_SHARED|MAP_ANONYMOUS;
+#endif
+
+#if !defined(USE_POSIX_THREADS) && defined(HAVE_MEMFD_CREATE)
+  int fd = -1;
+
+#ifdef MFD_HUGETLB
+  if (memFlags & FIFO_MEM_HUGEPAGES) {
+    if ((fd = memfd_create("cdrdao-fifo", MFD_CLOEXEC|MFD_HUGETLB)) >= 0) {
+      if (ftruncate(fd, hsize) == 0)
+	mem = mmap(NULL, hsize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+      close(fd);
+    }
+
+    if (mem != MAP_FAILED) {
+      *size = hsize;
+      log_message(3, "Using huge pages for FIFO.");
+      return mem;
+    }
+
+    log_message(2, "Cannot map huge pages for FIFO: %s", strerror(errno));
+  }
+#endif
+
+  if ((fd = memfd_create("cdrdao-fifo", MFD_CLOEXEC)) >= 0) {
+    if (ftruncate(fd, *size) == 0)
+      mem = mmap(NULL, *size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    else
+      log_message(-1, "Cannot size FIFO memory: %s", strerror(errno));
+
+    close(fd);
+  }
+
+  if (mem != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+    if (memFlags & FIFO_MEM_HUGEPAGES)
+      madvise(mem, *size, MADV_HUGEPAGE);
+#endif
+    return mem;
+  }
+
+  log_message(4, "memfd mapping failed, using anonymous shared mapping.");
+#endif
+
+#ifdef MAP_HUGETLB
+  if (memFlags & FIFO_MEM_HUGEPAGES) {
+    mem = mmap(NULL, hsize, PROT_READ|PROT_WRITE, mapFlags|MAP_HUGETLB, -1, 0);
+
+    if (mem != MAP_FAILED) {
+      *size = hsize;
+      log_message(3, "Using huge pages for FIFO.");
+      return mem;
+    }
+
+    log_message(2, "Cannot map huge pages for FIFO: %s", strerror(errno));
+  }
+#endif
+
+  mem = mmap(NULL, *size, PROT_READ|PROT_WRITE, mapFlags, -1, 0);
+
+#ifdef MADV_HUGEPAGE
+  if (mem != MAP_FAILED && (memFlags & FIFO_MEM_HUGEPAGES))
+    madvise(mem, *size, MADV_HUGEPAGE);
+#endif
+
+  return mem;
+}
+
+// Allocates the FIFO as a single mapping that holds the buffer header and
+// all buffers.
+static int getSharedMemory(long nofBuffers, long bufferBlocks, int memFlags,
 			   BufferHeader **header, long *nofSegments,
 			   ShmSegment **shmSegment)
 {
   long b;
-  long bufferSize = BUFFER_SIZE * (AUDIO_BLOCK_LEN + PW_SUBCHANNEL_LEN);
+  long headerSize = bufferHeaderSize(nofBuffers, bufferBlocks);
+  long bufferSize = bufferDataSize(bufferBlocks);
+  long size = headerSize + nofBuffers * bufferSize;
+  void *mem;
 
   *header = NULL;
   *nofSegments = 0;
@@ -820,27 +1745,92 @@ static int getSharedMemory(long nofBuffers,
     return 1;
   }
 
+  if ((mem = mapFifoMemory(&size, memFlags)) == MAP_FAILED) {
+    log_message(-2, "Cannot allocated memory for ring buffer: %s",
+		strerror(errno));
+    log_message(-2, "Try to reduce the buffer count (option --buffers).");
+    return 1;
+  }
+
   *shmSegment = new ShmSegment;
   *nofSegments = 1;
 
   (*shmSegment)->id = -1;
+  (*shmSegment)->buffer = (char *)mem;
+  (*shmSegment)->size = size;
 
-  (*shmSegment)->buffer = new char[sizeof(BufferHeader) +
-				  nofBuffers * sizeof(Buffer) +
-				  nofBuffers * bufferSize];
+  log_message(4, "Mapped %ld bytes of FIFO memory.", size);
+
+  prepareFifoMemory((char *)mem, size, memFlags);
+
+  *header = setupBufferHeader((char *)mem, nofBuffers, bufferBlocks);
+
+  char *bufferBase = (char *)mem + headerSize;
+
+  for (b = 0; b < nofBuffers; b++)
+    (*header)->buffers[b].buffer = bufferBase + b * bufferSize;
+
+  return 0;
+}
+
+static void releaseSharedMemory(long nofSegments, ShmSegment *shmSegment)
+{
+  if (shmSegment == NULL || nofSegments == 0)
+    return;
+
+  if (shmSegment->buffer != NULL) {
+    if (munmap(shmSegment->buffer, shmSegment->size) != 0)
+      log_message(-2, "munmap: %s", strerror(errno));
+    shmSegment->buffer = NULL;
+  }
+
+  delete shmSegment;
+}
+
+#elif defined(USE_POSIX_THREADS)
+
+static int getSharedMemory(long nofBuffers, long bufferBlocks, int memFlags,
+			   BufferHeader **header, long *nofSegments,
+			   ShmSegment **shmSegment)
+{
+  long b;
+  long headerSize = bufferHeaderSize(nofBuffers, bufferBlocks);
+  long bufferSize = bufferDataSize(bufferBlocks);
+  long size = headerSize + nofBuffers * bufferSize;
+  long pageSize = fifoPageSize();
+  char *base;
+
+  *header = NULL;
+  *nofSegments = 0;
+  *shmSegment = NULL;
+
+  if (nofBuffers <= 0) {
+    return 1;
+  }
+
+  *shmSegment = new ShmSegment;
+  *nofSegments = 1;
+
+  (*shmSegment)->id = -1;
+  (*shmSegment)->size = 0;
+  (*shmSegment)->buffer = new char[size + pageSize];
 
   if ( (*shmSegment)->buffer == NULL) {
     log_message(-2, "Cannot allocated memory for ring buffer.");
     return 1;
   }
 
-  *header = (BufferHeader*)((*shmSegment)->buffer);
-  (*header)->nofBuffers = nofBuffers;
-  (*header)->buffers =
-	(Buffer*)((*shmSegment)->buffer + sizeof(BufferHeader));
+  base = (*shmSegment)->buffer;
+  base += pageSize - ((unsigned long)base % pageSize);
+
+  if (memFlags & FIFO_MEM_HUGEPAGES)
+    log_message(2, "Huge pages are not supported.");
+
+  prepareFifoMemory(base, size, memFlags);
 
-  char *bufferBase = (*shmSegment)->buffer + sizeof(BufferHeader) +
-                      nofBuffers * sizeof(Buffer);
+  *header = setupBufferHeader(base, nofBuffers, bufferBlocks);
+
+  char *bufferBase = base + headerSize;
 
   for (b = 0; b < nofBuffers; b++)
     (*header)->buffers[b].buffer = bufferBase + b * bufferSize;
@@ -861,16 +1851,20 @@ static void releaseSharedMemory(long nofSegments, ShmSegment *shmSegment)
   delete shmSegment;
 }
 
-#else /* USE_POSIX_THREADS */
+#else /* HAVE_SYS_MMAN_H */
 
-static int getSharedMemory(long nofBuffers,
+// Without mmap() the forked reader process shares the FIFO through SysV
+// shared memory segments.
+static int getSharedMemory(long nofBuffers, long bufferBlocks, int memFlags,
 			   BufferHeader **header, long *nofSegments,
 			   ShmSegment **shmSegments)
 {
   long i, b;
-  long bufferSize = BUFFER_SIZE * (AUDIO_BLOCK_LEN + PW_SUBCHANNEL_LEN);
+  long headerSize = bufferHeaderSize(nofBuffers, bufferBlocks);
+  long bufferSize = bufferDataSize(bufferBlocks);
   long maxSegmentSize = 0;
   long bcnt = 0;
+  int shmFlags = 0600|IPC_CREAT;
 
   *header = NULL;
   *nofSegments = 0;
@@ -902,12 +1896,21 @@ static int getSharedMemory(long nofBuffers,
   log_message(4, "Shm max segement size: %ld (%ld MB)", maxSegmentSize,
 	  maxSegmentSize >> 20);
 
-  if (maxSegmentSize < sizeof(BufferHeader) + nofBuffers * sizeof(Buffer)) {
+  if (memFlags & FIFO_MEM_HUGEPAGES) {
+#ifdef SHM_HUGETLB
+    shmFlags |= SHM_HUGETLB;
+    maxSegmentSize -= maxSegmentSize % FIFO_HUGE_PAGE_SIZE;
+#else
+    log_message(2, "Huge pages are not supported.");
+#endif
+  }
+
+  if (maxSegmentSize < headerSize) {
     log_message(-2, "Shared memory segment cannot hold a single buffer.");
     return 1;
   }
 
-  maxSegmentSize -= sizeof(BufferHeader) + nofBuffers * sizeof(Buffer);
+  maxSegmentSize -= headerSize;
 
   long buffersPerSegment = maxSegmentSize / bufferSize;
 
@@ -928,6 +1931,7 @@ static int getSharedMemory(long nofBuffers,
   for (i = 0; i < *nofSegments; i++) {
     (*shmSegments)[i].id = -1;
     (*shmSegments)[i].buffer = NULL;
+    (*shmSegments)[i].size = 0;
   }
 
   long bufCnt = nofBuffers;
@@ -941,10 +1945,25 @@ static int getSharedMemory(long nofBuffers,
     segmentLength = n * bufferSize;
     if (*header == NULL) {
       // first segment contains the buffer header
-      segmentLength += sizeof(BufferHeader) + nofBuffers * sizeof(Buffer);
+      segmentLength += headerSize;
     }
 
-    (*shmSegments)[i].id = shmget(IPC_PRIVATE, segmentLength, 0600|IPC_CREAT);
+#ifdef SHM_HUGETLB
+    if (shmFlags & SHM_HUGETLB) {
+      (*shmSegments)[i].id =
+	shmget(IPC_PRIVATE, fifoAlign(segmentLength, FIFO_HUGE_PAGE_SIZE),
+	       shmFlags);
+
+      if ((*shmSegments)[i].id < 0) {
+	log_message(2, "Cannot get huge pages for FIFO: %s", strerror(errno));
+	shmFlags &= ~SHM_HUGETLB;
+      }
+    }
+#endif
+
+    if ((*shmSegments)[i].id < 0)
+      (*shmSegments)[i].id = shmget(IPC_PRIVATE, segmentLength, shmFlags);
+
     if ((*shmSegments)[i].id < 0) {
       log_message(-2, "Cannot create shared memory segment: %s",
 	      strerror(errno));
@@ -961,14 +1980,12 @@ static int getSharedMemory(long nofBuffers,
       return 1;
     }
 
+    prepareFifoMemory((*shmSegments)[i].buffer, segmentLength, memFlags);
     
     if (*header == NULL) {
-      bufferBase = (*shmSegments)[i].buffer + sizeof(BufferHeader) +
-	           nofBuffers * sizeof(Buffer);
-      *header = (BufferHeader*)(*shmSegments)[i].buffer;
-      (*header)->nofBuffers = nofBuffers;
-      (*header)->buffers =
-	(Buffer*)((*shmSegments)[i].buffer + sizeof(BufferHeader));
+      bufferBase = (*shmSegments)[i].buffer + headerSize;
+      *header = setupBufferHeader((*shmSegments)[i].buffer, nofBuffers,
+				  bufferBlocks);
     }
     else {
       bufferBase = (*shmSegments)[i].buffer;
@@ -1007,4 +2024,4 @@ static void releaseSharedMemory(long nofSegments, ShmSegment *shmSegments)
 
   delete[] shmSegments;
 }
-#endif /* USE_POSIX_THREADS */
+#endif /* HAVE_SYS_MMAN_H */
@@ -23,7 +23,12 @@
 #include "Toc.h"
 #include "CdrDriver.h"
 
+// flags for the memory of the FIFO, see 'writeDiskAtOnce()'
+#define FIFO_MEM_HUGEPAGES 0x01 // use huge pages if available
+#define FIFO_MEM_LOCK      0x02 // lock FIFO memory with 'mlock()'
+#define FIFO_MEM_PREFAULT  0x04 // touch all FIFO pages before writing
+
 int writeDiskAtOnce(const Toc *, CdrDriver *, int nofBuffers, int swap,
-		    int testMode, int speed);
+		    int testMode, int speed, int fifoMemFlags = 0);
 
 #endif
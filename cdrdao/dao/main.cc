@@ -40,6 +40,7 @@
 #include <assert.h>
 
 #include "log.h"
+#include "stats.h"
 #include "util.h"
 #include "Toc.h"
 #include "ScsiIf.h"
@@ -50,6 +51,8 @@
 #include "Cddb.h"
 #include "TempFileManager.h"
 #include "FormatConverter.h"
+#include "AudioInfoCache.h"
+#include "verify.h"
 
 #ifdef __CYGWIN__
 #define NOMINMAX
@@ -88,6 +91,7 @@ typedef enum {
     MSINFO,
     DRIVE_INFO,
     DISCID,
+    VERIFY_IMAGE,
     SHOW_VERSION,
     LAST_CMD,
 } DaoCommand;
@@ -136,6 +140,7 @@ static struct {
     { MSINFO,       "msinfo",     NEED_CDR_R,  0, 0, 1 },
     { DRIVE_INFO,   "drive-info", NEED_CDR_R,  0, 0, 1 },
     { DISCID,       "discid",     NEED_CDR_R,  0, 0, 1 },
+    { VERIFY_IMAGE, "verify-image", NO_DEVICE, 1, 1, 1 },
     { SHOW_VERSION, "version",    NO_DEVICE,   0, 0, 0 },
 };
 
@@ -162,10 +167,17 @@ typedef struct {
     int  verbose;
     int  session;
     int  fifoBuffers;
+    int  fifoMemFlags;
+    const char* statsFile;
+    const char* audioCache;
+    ScsiIf::IoMode scsiIoMode;
+    TrackDataReader::FileIo fileIo;
+    ImageWriter::Mode imageIo;
     bool fastToc;
     bool pause;
     bool readRaw;
     bool mode2Mixed;
+    bool lecCorrection;
     bool remoteMode;
     int  remoteFd;
     bool reload;
@@ -184,8 +196,10 @@ typedef struct {
     bool overburn;
     int  bufferUnderrunProtection;
     bool writeSpeedControl;
+    bool adaptiveSpeed;
     bool keep;
     bool printQuery;
+    long seekTest;
 
     CdrDriver::BlankingMode blankingMode;
     TrackData::SubChannelMode readSubchanMode;
@@ -235,12 +249,17 @@ static void setOptionDefaults(DaoCommandLine* options)
     options->session = 1;
     options->pause = true;
     options->mode2Mixed = true;
+    options->lecCorrection = true;
     options->remoteFd = -1;
     options->paranoiaMode = 3;
     options->cddbTimeout = 60;
     options->taoSourceAdjust = -1;
     options->bufferUnderrunProtection = 1;
     options->writeSpeedControl = true;
+    options->scsiIoMode = ScsiIf::IO_DIRECT;
+    options->fileIo = TrackDataReader::FILE_IO_BUFFERED;
+    options->imageIo = ImageWriter::BUFFERED;
+    options->audioCache = NULL;
     options->keep = false;
     options->printQuery = false;
 #if defined(__FreeBSD__)
@@ -273,6 +292,7 @@ static void printUsage(DaoCommandLine* options)
 "  read-cddb  - contact CDDB server and add data as CD-TEXT to toc-file\n"
 "  show-data  - prints out audio data and exits\n"
 "  read-test  - reads all audio files and exits\n"
+"  verify-image - checks EDC and L-EC data of raw data tracks\n"
 "  disk-info  - shows information about inserted medium\n"
 "  discid     - prints out CDDB information\n"
 "  msinfo     - shows multi session info, output is suited for scripts\n"
@@ -295,6 +315,7 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --tmpdir <path>         - sets directory for temporary wav files\n"
 "  --keep                  - keep generated temp wav files after exit\n"
+"  --audio-cache <file>    - keep parsed WAVE headers in given file\n"
 "  -v #                    - sets verbose level\n");
     break;
     
@@ -304,8 +325,23 @@ static void printUsage(DaoCommandLine* options)
     break;
     
   case READ_TEST:
-    log_message(0, "\nUsage: %s read-test [-v #] toc-file\n",
+    log_message(0, "\nUsage: %s read-test [options] toc-file",
 		options->progName);
+    log_message(0,
+"options:\n"
+"  --speed <speed>         - simulates writing at given speed, reports FIFO\n"
+"                            hand-off latency and CPU usage\n"
+"  --seek-test #           - reads # blocks at random positions instead,\n"
+"                            reports the average access time\n"
+"  --buffers #             - sets fifo buffer size (min. 10)\n"
+"  --fifo-hugepages        - use huge pages for the fifo if available\n"
+"  --fifo-lock             - lock fifo memory to avoid paging\n"
+"  --fifo-prefault         - touch all fifo pages before writing starts\n"
+"  --file-io <mode>        - image file reading: buffered, direct\n"
+"  --audio-cache <file>    - keep parsed WAVE headers in given file\n"
+"  --stats-file <file>     - append JSON timing statistics to given file\n"
+"  --swap                  - swap byte order of audio files\n"
+"  -v #                    - sets verbose level\n");
     break;
   
   case SIMULATE:
@@ -315,6 +351,7 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --device [proto:]{<x,y,z>|device} - sets SCSI device of CD-writer\n"
 "  --driver <id>           - force usage of specified driver\n"
+"  --scsi-io <mode>        - SCSI transfer mode: indirect, direct, mmap\n"
 "  --speed <writing-speed> - selects writing speed\n"
 "  --multi                 - session will not be closed\n"
 "  --overburn              - allow to overburn a medium\n"
@@ -327,6 +364,12 @@ static void printUsage(DaoCommandLine* options)
 "  --eject                 - ejects cd after simulation\n"
 "  --swap                  - swap byte order of audio files\n"
 "  --buffers #             - sets fifo buffer size (min. 10)\n"
+"  --fifo-hugepages        - use huge pages for the fifo if available\n"
+"  --fifo-lock             - lock fifo memory to avoid paging\n"
+"  --fifo-prefault         - touch all fifo pages before writing starts\n"
+"  --file-io <mode>        - image file reading: buffered, direct\n"
+"  --audio-cache <file>    - keep parsed WAVE headers in given file\n"
+"  --stats-file <file>     - append JSON timing statistics to given file\n"
 "  --reload                - reload the disk if necessary for writing\n"
 "  --force                 - force execution of operation\n"
 "  --tmpdir <path>         - sets directory for temporary wav files\n"
@@ -341,6 +384,7 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --device [proto:]{<x,y,z>|device} - sets SCSI device of CD-writer\n"
 "  --driver <id>           - force usage of specified driver\n"
+"  --scsi-io <mode>        - SCSI transfer mode: indirect, direct, mmap\n"
 "  --simulate              - just perform a write simulation\n"
 "  --speed <writing-speed> - selects writing speed\n"
 "  --multi                 - session will not be closed\n"
@@ -349,6 +393,7 @@ static void printUsage(DaoCommandLine* options)
 "                            1: enable buffer under run protection (default)\n"
 "  --write-speed-control # - 0: disable writing speed control by the drive\n"
 "                            1: enable writing speed control (default)\n" 
+"  --adaptive-speed        - lower writing speed while the fifo runs empty\n"
 "  --overburn              - allow to overburn a medium\n"
 "  --full-burn             - force burning to the outer disk edge\n"
 "                            with '--driver generic-mmc-raw'\n"
@@ -359,6 +404,12 @@ static void printUsage(DaoCommandLine* options)
 "  --eject                 - ejects cd after writing or simulation\n"
 "  --swap                  - swap byte order of audio files\n"
 "  --buffers #             - sets fifo buffer size (min. 10)\n"
+"  --fifo-hugepages        - use huge pages for the fifo if available\n"
+"  --fifo-lock             - lock fifo memory to avoid paging\n"
+"  --fifo-prefault         - touch all fifo pages before writing starts\n"
+"  --file-io <mode>        - image file reading: buffered, direct\n"
+"  --audio-cache <file>    - keep parsed WAVE headers in given file\n"
+"  --stats-file <file>     - append JSON timing statistics to given file\n"
 "  --reload                - reload the disk if necessary for writing\n"
 "  --force                 - force execution of operation\n"
 "  --tmpdir <path>         - sets directory for temporary wav files\n"
@@ -374,6 +425,7 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --device [proto:]{<x,y,z>|device} - sets SCSI device of CD-ROM reader\n"
 "  --driver <id>    - force usage of specified driver for source device\n"
+"  --scsi-io <mode>        - SCSI transfer mode: indirect, direct, mmap\n"
 "  --datafile <filename>   - name of data file placed in toc-file\n"
 "  --session #             - select session\n"
 "  --fast-toc              - do not extract pre-gaps and index marks\n"
@@ -423,10 +475,12 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --device [proto:]{<x,y,z>|device} - sets SCSI device of CD-ROM reader\n"
 "  --driver <id>    - force usage of specified driver for source device\n"
+"  --scsi-io <mode>        - SCSI transfer mode: indirect, direct, mmap\n"
 "  --datafile <filename>   - name of data file placed in toc-file\n"
 "  --session #             - select session\n"
 "  --fast-toc              - do not extract pre-gaps and index marks\n"
 "  --read-raw              - read raw data sectors (including L-EC data)\n"
+"  --no-lec-correction     - don't correct raw data sectors in software\n"
 "  --no-mode2-mixed        - don't switch to mode2_mixed\n"
 "  --rspeed <read-speed>   - selects reading speed\n"
 "  --read-subchan <mode>   - defines sub-channel reading mode\n"
@@ -434,6 +488,8 @@ static void printUsage(DaoCommandLine* options)
 "  --tao-source            - indicate that source CD was written in TAO mode\n"
 "  --tao-source-adjust #   - # of link blocks for TAO source CDs (def. 2)\n"
 "  --paranoia-mode #       - DAE paranoia mode (0..3)\n"
+"  --image-io <mode>       - image file writing: buffered, nocache\n"
+"  --stats-file <file>     - append JSON timing statistics to given file\n"
 "  --with-cddb             - retrieve CDDB CD-TEXT data while copying\n"
 "  --cddb-servers <list>   - sets space separated list of CDDB servers\n"
 "  --cddb-timeout #        - timeout in seconds for CDDB server communication\n"
@@ -450,9 +506,22 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --tmpdir <path>         - sets directory for temporary wav files\n"
 "  --keep                  - keep generated temp wav files after exit\n"
+"  --audio-cache <file>    - keep parsed WAVE headers in given file\n"
 "  -v #                    - sets verbose level\n");
     break;
     
+  case VERIFY_IMAGE:
+    log_message(0, "\nUsage: %s verify-image [options] toc-file",
+		options->progName);
+    log_message(0,
+"options:\n"
+"  --file-io <mode>        - image file reading: buffered, direct\n"
+"  --tmpdir <path>         - sets directory for temporary wav files\n"
+"  --keep                  - keep generated temp wav files after exit\n"
+"  --audio-cache <file>    - keep parsed WAVE headers in given file\n"
+"  -v #                    - sets verbose level\n");
+    break;
+
   case TOC_SIZE:
     log_message(0, "\nUsage: %s toc-size [options] toc-file",
 		options->progName);
@@ -460,6 +529,7 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --tmpdir <path>         - sets directory for temporary wav files\n"
 "  --keep                  - keep generated temp wav files after exit\n"
+"  --audio-cache <file>    - keep parsed WAVE headers in given file\n"
 "  -v #                    - sets verbose level\n");
     break;
 
@@ -496,6 +566,7 @@ static void printUsage(DaoCommandLine* options)
 "options:\n"
 "  --device [proto:]{<x,y,z>|device} - sets SCSI device of CD-writer\n"
 "  --driver <id>           - force usage of specified driver\n"
+"  --scsi-io <mode>        - SCSI transfer mode: indirect, direct, mmap\n"
 "  -v #                    - sets verbose level\n");
     break;
     
@@ -507,6 +578,7 @@ static void printUsage(DaoCommandLine* options)
 "  --source-device {<x,y,z>|device} - sets SCSI device of CD-ROM reader\n"
 "  --driver <id>           - force usage of specified driver\n"
 "  --source-driver <id>    - force usage of specified driver for source device\n"
+"  --scsi-io <mode>        - SCSI transfer mode: indirect, direct, mmap\n"
 "  --simulate              - just perform a copy simulation\n"
 "  --speed <writing-speed> - selects writing speed\n"
 "  --rspeed <read-speed>   - selects reading speed\n"
@@ -516,6 +588,7 @@ static void printUsage(DaoCommandLine* options)
 "                            1: enable buffer under run protection (default)\n"
 "  --write-speed-control # - 0: disable writing speed control by the drive\n"
 "                            1: enable writing speed control (default)\n" 
+"  --adaptive-speed        - lower writing speed while the fifo runs empty\n"
 "  --overburn              - allow to overburn a medium\n"
 "  --full-burn             - force burning to the outer disk edge\n"
 "                            with '--driver generic-mmc-raw'\n"
@@ -528,8 +601,15 @@ static void printUsage(DaoCommandLine* options)
 "  --on-the-fly            - perform on-the-fly copy, no image file is created\n"
 "  --datafile <filename>   - name of temporary data file\n"
 "  --buffers #             - sets fifo buffer size (min. 10)\n"
+"  --fifo-hugepages        - use huge pages for the fifo if available\n"
+"  --fifo-lock             - lock fifo memory to avoid paging\n"
+"  --fifo-prefault         - touch all fifo pages before writing starts\n"
+"  --file-io <mode>        - image file reading: buffered, direct\n"
+"  --image-io <mode>       - image file writing: buffered, nocache\n"
+"  --stats-file <file>     - append JSON timing statistics to given file\n"
 "  --session #             - select session\n"
 "  --fast-toc              - do not extract pre-gaps and index marks\n"
+"  --no-lec-correction     - don't correct raw data sectors in software\n"
 "  --read-subchan <mode>   - defines sub-channel reading mode\n"
 "                            <mode> = rw | rw_raw\n"
 "  --keepimage             - the image will not be deleted after copy\n"
@@ -867,6 +947,19 @@ static int parseCmdline(int argc, char **argv, DaoCommandLine* opts,
 		    argc--, argv++;
 		}
 	    }
+	    else if (strcmp((*argv) + 2, "seek-test") == 0) {
+		if (argc < 2) {
+		    log_message(-2, "Missing argument after: %s", *argv);
+		    return 1;
+		} else {
+		    opts->seekTest = atol(argv[1]);
+		    if (opts->seekTest < 0) {
+			log_message(-2, "Illegal seek count: %s", argv[1]);
+			return 1;
+		    }
+		    argc--, argv++;
+		}
+	    }
 	    else if (strcmp((*argv) + 2, "capacity") == 0) {
 		if (argc < 2) {
 		    log_message(-2, "Missing argument after: %s", *argv);
@@ -927,6 +1020,36 @@ static int parseCmdline(int argc, char **argv, DaoCommandLine* opts,
 	    else if (strcmp((*argv) + 2, "eject") == 0) {
 		opts->eject = true;
 	    }
+	    else if (strcmp((*argv) + 2, "adaptive-speed") == 0) {
+		opts->adaptiveSpeed = true;
+	    }
+	    else if (strcmp((*argv) + 2, "fifo-hugepages") == 0) {
+		opts->fifoMemFlags |= FIFO_MEM_HUGEPAGES;
+	    }
+	    else if (strcmp((*argv) + 2, "fifo-lock") == 0) {
+		opts->fifoMemFlags |= FIFO_MEM_LOCK;
+	    }
+	    else if (strcmp((*argv) + 2, "fifo-prefault") == 0) {
+		opts->fifoMemFlags |= FIFO_MEM_PREFAULT;
+	    }
+	    else if (strcmp((*argv) + 2, "stats-file") == 0) {
+		if (argc < 2) {
+		    log_message(-2, "Missing argument after: %s", *argv);
+		    return 1;
+		} else {
+		    opts->statsFile = argv[1];
+		    argc--, argv++;
+		}
+	    }
+	    else if (strcmp((*argv) + 2, "audio-cache") == 0) {
+		if (argc < 2) {
+		    log_message(-2, "Missing argument after: %s", *argv);
+		    return 1;
+		} else {
+		    opts->audioCache = argv[1];
+		    argc--, argv++;
+		}
+	    }
 	    else if (strcmp((*argv) + 2, "swap") == 0) {
 		opts->swap = true;
 	    }
@@ -948,6 +1071,9 @@ static int parseCmdline(int argc, char **argv, DaoCommandLine* opts,
 	    else if (strcmp((*argv) + 2, "no-mode2-mixed") == 0) {
 		opts->mode2Mixed = false;
 	    }
+	    else if (strcmp((*argv) + 2, "no-lec-correction") == 0) {
+		opts->lecCorrection = false;
+	    }
 	    else if (strcmp((*argv) + 2, "reload") == 0) {
 		opts->reload = true;
 	    }
@@ -1130,6 +1256,62 @@ static int parseCmdline(int argc, char **argv, DaoCommandLine* opts,
 		    argc--, argv++;
 		}
 	    }
+	    else if (strcmp((*argv) + 2, "scsi-io") == 0) {
+		if (argc < 2) {
+		    log_message(-2, "Missing argument after: %s", *argv);
+		    return 1;
+		} else {
+		    if (strcmp(argv[1], "indirect") == 0) {
+			opts->scsiIoMode = ScsiIf::IO_INDIRECT;
+		    } else if (strcmp(argv[1], "direct") == 0) {
+			opts->scsiIoMode = ScsiIf::IO_DIRECT;
+		    } else if (strcmp(argv[1], "mmap") == 0) {
+			opts->scsiIoMode = ScsiIf::IO_MMAP;
+		    } else {
+			log_message(-2, "Invalid argument after %s: %s",
+				    argv[0], argv[1]);
+			return 1;
+		    }
+
+		    argc--, argv++;
+		}
+	    }
+	    else if (strcmp((*argv) + 2, "image-io") == 0) {
+		if (argc < 2) {
+		    log_message(-2, "Missing argument after: %s", *argv);
+		    return 1;
+		} else {
+		    if (strcmp(argv[1], "buffered") == 0) {
+			opts->imageIo = ImageWriter::BUFFERED;
+		    } else if (strcmp(argv[1], "nocache") == 0) {
+			opts->imageIo = ImageWriter::NOCACHE;
+		    } else {
+			log_message(-2, "Invalid argument after %s: %s",
+				    argv[0], argv[1]);
+			return 1;
+		    }
+
+		    argc--, argv++;
+		}
+	    }
+	    else if (strcmp((*argv) + 2, "file-io") == 0) {
+		if (argc < 2) {
+		    log_message(-2, "Missing argument after: %s", *argv);
+		    return 1;
+		} else {
+		    if (strcmp(argv[1], "buffered") == 0) {
+			opts->fileIo = TrackDataReader::FILE_IO_BUFFERED;
+		    } else if (strcmp(argv[1], "direct") == 0) {
+			opts->fileIo = TrackDataReader::FILE_IO_DIRECT;
+		    } else {
+			log_message(-2, "Invalid argument after %s: %s",
+				    argv[0], argv[1]);
+			return 1;
+		    }
+
+		    argc--, argv++;
+		}
+	    }
 	    else {
 		log_message(-2, "Illegal option: %s", *argv);
 		return 1;
@@ -1285,7 +1467,8 @@ static CdrDriver *setupDevice(DaoCommand cmd, const char *scsiDevice,
 			      const char *driverId, int initDevice,
 			      int checkReady, int checkEmpty,
 			      int readingSpeed,
-			      bool remote, bool reload)
+			      bool remote, bool reload,
+			      ScsiIf::IoMode ioMode)
 {
   ScsiIf *scsiIf = NULL;
   CdrDriver *cdr = NULL;
@@ -1313,6 +1496,11 @@ static CdrDriver *setupDevice(DaoCommand cmd, const char *scsiDevice,
   log_message(2, "%s: %s %s\tRev: %s", scsiDevice, scsiIf->vendor(),
 	  scsiIf->product(), scsiIf->revision());
 
+  if (scsiIf->ioMode(ioMode) != ioMode)
+    log_message(2, "Using %s SCSI transfers instead of %s.",
+		ScsiIf::ioModeString(scsiIf->ioMode()),
+		ScsiIf::ioModeString(ioMode));
+
 
   if (inquiryFailed && driverId == NULL) {
     log_message(-2, "Inquiry failed and no driver id is specified.");
@@ -1642,6 +1830,49 @@ void showData(const Toc *toc, bool swap)
   }
 }
 
+// Reads 'count' blocks at pseudo random positions of the toc like
+// gcdmaster does while scanning and playing. Used to measure the cost of
+// locating the track and sub-track of a sample position.
+static int seekTest(const Toc *toc, long count)
+{
+  unsigned long length = toc->length().samples();
+  unsigned long rnd = 1;
+  Sample buf[SAMPLES_PER_BLOCK];
+  long long startTime;
+  long i;
+
+  if (length <= SAMPLES_PER_BLOCK) {
+    log_message(-2, "Toc is too short for a seek test.");
+    return 1;
+  }
+
+  TocReader reader(toc);
+
+  if (reader.openData() != 0) {
+    log_message(-2, "Cannot open audio data.");
+    return 1;
+  }
+
+  startTime = usecTime();
+
+  for (i = 0; i < count; i++) {
+    rnd = rnd * 1103515245 + 12345;
+
+    if (reader.seekSample((rnd >> 8) % (length - SAMPLES_PER_BLOCK)) != 0 ||
+	reader.readSamples(buf, SAMPLES_PER_BLOCK) != SAMPLES_PER_BLOCK) {
+      log_message(-2, "Read of audio data failed.");
+      return 1;
+    }
+  }
+
+  double secs = (usecTime() - startTime) / 1e6;
+
+  log_message(1, "%ld random seeks in %.3f seconds, %.2f us per seek.",
+	      count, secs, count > 0 ? secs * 1e6 / count : 0.0);
+
+  return 0;
+}
+
 void showDiskInfo(DiskInfo *di)
 {
   const char *s1, *s2;
@@ -1979,11 +2210,16 @@ static int copyCd(DaoCommandLine* opts, CdrDriver *src, CdrDriver *dst)
     }
 
     src->rawDataReading(true);
+    src->lecCorrection(opts->lecCorrection);
     src->taoSource(opts->taoSource);
     if (opts->taoSourceAdjust >= 0)
 	src->taoSourceAdjust(opts->taoSourceAdjust);
 
-    if ((toc = src->readDisk(opts->session, opts->dataFilename)) == NULL) {
+    stats_reset();
+    toc = src->readDisk(opts->session, opts->dataFilename);
+    stats_dump("read-cd");
+
+    if (toc == NULL) {
 	unlink(opts->dataFilename);
 	log_message(-2, "Creation of source CD image failed.");
 	return 1;
@@ -2077,7 +2313,8 @@ static int copyCd(DaoCommandLine* opts, CdrDriver *src, CdrDriver *dst)
 	return 1;
     }
     
-    if (writeDiskAtOnce(toc, dst, opts->fifoBuffers, opts->swap, 0, 0) != 0) {
+    if (writeDiskAtOnce(toc, dst, opts->fifoBuffers, opts->swap, 0, 0,
+			opts->fifoMemFlags) != 0) {
 	if (dst->simulate())
 	    log_message(-2, "Simulation failed.");
 	else
@@ -2129,6 +2366,7 @@ static int copyCdOnTheFly(DaoCommandLine* opts,CdrDriver *src, CdrDriver *dst)
     }
   
     src->rawDataReading(true);
+    src->lecCorrection(opts->lecCorrection);
     src->taoSource(opts->taoSource);
     if (opts->taoSourceAdjust >= 0)
 	src->taoSourceAdjust(opts->taoSourceAdjust);
@@ -2251,7 +2489,8 @@ static int copyCdOnTheFly(DaoCommandLine* opts,CdrDriver *src, CdrDriver *dst)
 	goto fail;
     }
 
-    if (writeDiskAtOnce(toc, dst, opts->fifoBuffers, opts->swap, 0, 0) != 0) {
+    if (writeDiskAtOnce(toc, dst, opts->fifoBuffers, opts->swap, 0, 0,
+			opts->fifoMemFlags) != 0) {
 	if (dst->simulate())
 	    log_message(-2, "Simulation failed.");
 	else
@@ -2368,6 +2607,15 @@ int main(int argc, char **argv)
     log_set_verbose(options.verbose);
     commitSettings(&options, settings, settingsPath);
 
+    stats_init();
+    if (options.statsFile != NULL)
+	stats_output(options.statsFile);
+
+    TrackDataReader::fileIo(options.fileIo);
+
+    if (options.audioCache != NULL)
+	AudioInfoCache::load(options.audioCache);
+
     printVersion();
 
     // Just show version ? We're done.
@@ -2402,6 +2650,9 @@ int main(int argc, char **argv)
 
 	toc->recomputeLength();
 
+	if (options.audioCache != NULL)
+	    AudioInfoCache::save(options.audioCache);
+
 	if (cmdInfo[options.command].tocCheck) {
 	    if (checkToc(toc, options.force) != 0) {
 		log_message(-2, "Toc file \"%s\" is inconsistent.",
@@ -2436,7 +2687,8 @@ int main(int argc, char **argv)
 			   options.command == WRITE) ? 1 : 0,
 			  options.readingSpeed,
 			  options.remoteMode,
-			  options.reload);
+			  options.reload,
+			  options.scsiIoMode);
 
 	if (cdr == NULL) {
 	    log_message(-2, "Cannot setup device %s.", options.scsiDevice);
@@ -2484,7 +2736,8 @@ int main(int argc, char **argv)
 	    delSrcDevice = 1;
 	    srcCdr = setupDevice(READ_CD, options.sourceScsiDevice,
 				 options.sourceDriverId,
-				 1, 1, 0, options.readingSpeed, false, false);
+				 1, 1, 0, options.readingSpeed, false, false,
+				 options.scsiIoMode);
 
 	    if (srcCdr == NULL) {
 		log_message(-2, "Cannot setup source device %s.",
@@ -2528,6 +2781,8 @@ int main(int argc, char **argv)
 
     case DRIVE_INFO:
 	showDriveInfo(cdr->driveInfo(true));
+	printf("SCSI transfer mode: %s\n",
+	       ScsiIf::ioModeString(cdr->scsiIf()->ioMode()));
 	break;
 
     case SHOW_TOC:
@@ -2558,13 +2813,25 @@ int main(int argc, char **argv)
 	showData(toc, options.swap);
 	break;
 
+    case VERIFY_IMAGE:
+	exitCode = verifyImage(toc, options.tocFile);
+	break;
+
     case READ_TEST:
+	if (options.seekTest > 0) {
+	    if (seekTest(toc, options.seekTest) != 0) {
+		exitCode = 1; goto fail;
+	    }
+	    break;
+	}
+
 	log_message(1, "Starting read test...");
 	log_message(2, "Process can be aborted with QUIT signal "
 		    "(usually CTRL-\\).");
 	if (writeDiskAtOnce(toc, NULL, options.fifoBuffers,
 			    options.swap, 1,
-			    options.writingSpeed) != 0) {
+			    options.writingSpeed,
+			    options.fifoMemFlags) != 0) {
 	    log_message(-2, "Read test failed.");
 	    exitCode = 1; goto fail;
 	}
@@ -2698,6 +2965,8 @@ int main(int argc, char **argv)
 
 	cdr->subChanReadMode(options.readSubchanMode);
 	cdr->rawDataReading(options.readRaw);
+	cdr->lecCorrection(options.lecCorrection);
+	cdr->imageIo(options.imageIo);
 	cdr->mode2Mixed(options.mode2Mixed);
 	cdr->taoSource(options.taoSource);
 	if (options.taoSourceAdjust >= 0)
@@ -2708,9 +2977,11 @@ int main(int argc, char **argv)
 	cdr->remote(options.remoteMode, options.remoteFd);
 	cdr->force(options.force);
 
+	stats_reset();
 	toc = cdr->readDisk(options.session,
 			    (options.dataFilename == NULL) ? "data.bin" :
 			    options.dataFilename);
+	stats_dump("read-cd");
       
 	if (toc == NULL) {
 	    cdr->rezeroUnit(0);
@@ -2785,6 +3056,7 @@ int main(int argc, char **argv)
 
 	cdr->bufferUnderRunProtection(options.bufferUnderrunProtection);
 	cdr->writeSpeedControl(options.writeSpeedControl);
+	cdr->adaptiveSpeed(options.adaptiveSpeed);
 
 	cdr->force(options.force);
 	cdr->remote(options.remoteMode, options.remoteFd);
@@ -2828,7 +3100,7 @@ int main(int argc, char **argv)
 	}
 
 	if (writeDiskAtOnce(toc, cdr, options.fifoBuffers,
-			    options.swap, 0, 0) != 0) {
+			    options.swap, 0, 0, options.fifoMemFlags) != 0) {
 	    if (cdr->simulate()) {
 		log_message(-2, "Simulation failed.");
 	    } else {
@@ -2876,6 +3148,7 @@ int main(int argc, char **argv)
 
 	cdr->bufferUnderRunProtection(options.bufferUnderrunProtection);
 	cdr->writeSpeedControl(options.writeSpeedControl);
+	cdr->adaptiveSpeed(options.adaptiveSpeed);
     
 	if (options.multiSession) {
 	    if (cdr->multiSession(1) != 0) {
@@ -2895,6 +3168,7 @@ int main(int argc, char **argv)
 
 	srcCdr->paranoiaMode(options.paranoiaMode);
 	srcCdr->subChanReadMode(options.readSubchanMode);
+	srcCdr->imageIo(options.imageIo);
 	srcCdr->fastTocReading(options.fastToc);
 	srcCdr->force(options.force);
     
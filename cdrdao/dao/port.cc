@@ -28,15 +28,9 @@
 #include <pthread.h>
 #endif
 
-#if defined(HAVE_USLEEP)
-
-#else
-
 #include <sys/time.h>
 #include <sys/types.h>
 
-#endif
-
 #ifdef __CYGWIN__
 #include <windows.h>
 #endif
@@ -117,6 +111,17 @@ void mSleep(long milliSeconds)
 #endif
 }
 
+// Returns wall clock time in micro seconds. Only differences between two
+// values are meaningful.
+long long usecTime()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 // Installs signal handler for signal 'sig' that will stay installed after
 // it is called.
 void installSignalHandler(int sig, SignalHandler handler)
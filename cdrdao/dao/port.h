@@ -25,6 +25,7 @@
 typedef RETSIGTYPE (*SignalHandler)(int);
 
 void mSleep(long milliSeconds);
+long long usecTime();
 void installSignalHandler(int sig, SignalHandler);
 void blockSignal(int sig);
 void unblockSignal(int sig);
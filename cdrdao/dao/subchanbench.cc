@@ -0,0 +1,235 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Measures the throughput of 'PWSubChannel96::deinterleave()' and
+ * 'PWSubChannel96::interleave()' and of the bitwise loops that were used
+ * by 'getChannelByte()' and 'setChannelByte()' before. The data is laid
+ * out like a READ CD transfer with 2448 bytes per sector. The R-W
+ * Reed-Solomon encoder and decoder are checked and measured, too.
+ *
+ * Build with 'make subchanbench' in the dao directory.
+ * Usage: subchanbench [sectors per batch] [batches]
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "PWSubChannel96.h"
+#include "subrw.h"
+
+#define BLOCK_LEN 2448
+
+static double now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void bitDeinterleave(const unsigned char *raw, long stride,
+			    unsigned char *channels, long count)
+{
+  long n;
+  int c, i, j;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    for (c = 0; c < 8; c++) {
+      const unsigned char *p = raw;
+      unsigned char mask = 1 << (7 - c);
+
+      for (i = 0; i < 12; i++) {
+	unsigned char val = 0;
+
+	for (j = 0; j < 8; j++) {
+	  val <<= 1;
+	  if (*p++ & mask)
+	    val |= 0x01;
+	}
+
+	channels[c * 12 + i] = val;
+      }
+    }
+  }
+}
+
+static void bitInterleave(const unsigned char *channels, unsigned char *raw,
+			  long stride, long count)
+{
+  long n;
+  int c, i, j;
+
+  for (n = 0; n < count; n++, raw += stride, channels += 96) {
+    for (c = 0; c < 8; c++) {
+      unsigned char *p = raw;
+      unsigned char setMask = 1 << (7 - c);
+      unsigned char clearMask = ~setMask;
+
+      for (i = 0; i < 12; i++) {
+	unsigned char val = channels[c * 12 + i];
+
+	for (j = 0; j < 8; j++) {
+	  if (val & 0x80)
+	    *p |= setMask;
+	  else
+	    *p &= clearMask;
+
+	  p++;
+	  val <<= 1;
+	}
+      }
+    }
+  }
+}
+
+// Returns sectors per second, 'dir' 0: deinterleave, 1: interleave
+static double run(int bitwise, int dir, unsigned char *raw,
+		  unsigned char *channels, long count, long batches)
+{
+  double t;
+  long b;
+
+  t = now();
+
+  for (b = 0; b < batches; b++) {
+    if (dir == 0) {
+      if (bitwise)
+	bitDeinterleave(raw + 2352, BLOCK_LEN, channels, count);
+      else
+	PWSubChannel96::deinterleave(raw + 2352, BLOCK_LEN, channels, count);
+    }
+    else {
+      if (bitwise)
+	bitInterleave(channels, raw + 2352, BLOCK_LEN, count);
+      else
+	PWSubChannel96::interleave(channels, raw + 2352, BLOCK_LEN, count);
+    }
+  }
+
+  t = now() - t;
+
+  return t > 0 ? count * batches / t : 0;
+}
+
+// Returns sectors per second for R-W encoding ('dir' 0) or decoding.
+static double runRW(int dir, unsigned char *raw, unsigned char *rw,
+		    long count, long batches)
+{
+  unsigned char delayLine[SUBRW_DELAY_PACKS][SUBRW_PACK_LEN];
+  unsigned long delayIndex = 0;
+  long n = dir == 0 ? count : count - SUBRW_DECODE_LOOKAHEAD;
+  double t;
+  long b;
+
+  memset(delayLine, 0, sizeof(delayLine));
+
+  t = now();
+
+  for (b = 0; b < batches; b++) {
+    if (dir == 0)
+      subrw_encode_sectors(raw + 2352, count, BLOCK_LEN, &delayIndex,
+			   delayLine);
+    else
+      subrw_decode_sectors(raw + 2352, BLOCK_LEN, rw, SUBRW_SECTOR_LEN, n,
+			   NULL);
+  }
+
+  t = now() - t;
+
+  return t > 0 ? n * batches / t : 0;
+}
+
+int main(int argc, char **argv)
+{
+  long count = 27;
+  long batches = 20000;
+  unsigned char *raw;
+  unsigned char *channels, *channels2;
+  unsigned int seed = 1;
+  double r1, r2;
+  int errors;
+  long i;
+
+  if (argc > 1)
+    count = atol(argv[1]);
+  if (argc > 2)
+    batches = atol(argv[2]);
+
+  if (count <= SUBRW_DECODE_LOOKAHEAD || batches < 1) {
+    fprintf(stderr, "Usage: %s [sectors per batch] [batches]\n", argv[0]);
+    return 1;
+  }
+
+  if ((errors = PWSubChannel96::checkKernels(1000)) != 0) {
+    fprintf(stderr, "Kernel check failed: %d mismatches.\n", errors);
+    return 1;
+  }
+
+  if ((errors = subrw_check(100)) != 0) {
+    fprintf(stderr, "R-W encoder check failed: %d mismatches.\n", errors);
+    return 1;
+  }
+
+  printf("Kernel check passed.\n");
+
+  raw = new unsigned char[count * BLOCK_LEN];
+  channels = new unsigned char[count * 96];
+  channels2 = new unsigned char[count * 96];
+
+  for (i = 0; i < count * BLOCK_LEN; i++) {
+    seed = seed * 1103515245 + 12345;
+    raw[i] = seed >> 16;
+  }
+
+  // both implementations must agree on the benchmark data, too
+  bitDeinterleave(raw + 2352, BLOCK_LEN, channels, count);
+  PWSubChannel96::deinterleave(raw + 2352, BLOCK_LEN, channels2, count);
+
+  if (memcmp(channels, channels2, count * 96) != 0) {
+    fprintf(stderr, "Deinterleaved data differs.\n");
+    return 1;
+  }
+
+  printf("%ld sectors per batch, %ld batches\n\n", count, batches);
+  printf("%-14s %14s %14s %8s\n", "operation", "bitwise", "transpose",
+	 "speedup");
+
+  r1 = run(1, 0, raw, channels, count, batches);
+  r2 = run(0, 0, raw, channels, count, batches);
+  printf("%-14s %14.0f %14.0f %7.1fx\n", "deinterleave", r1, r2,
+	 r1 > 0 ? r2 / r1 : 0);
+
+  r1 = run(1, 1, raw, channels, count, batches);
+  r2 = run(0, 1, raw, channels, count, batches);
+  printf("%-14s %14.0f %14.0f %7.1fx\n", "interleave", r1, r2,
+	 r1 > 0 ? r2 / r1 : 0);
+
+  printf("\n%-14s %14s\n", "R-W parity", "sectors/s");
+  printf("%-14s %14.0f\n", "encode", runRW(0, raw, channels, count, batches));
+  printf("%-14s %14.0f\n", "decode", runRW(1, raw, channels, count, batches));
+
+  delete[] raw;
+  delete[] channels;
+  delete[] channels2;
+
+  return 0;
+}
@@ -0,0 +1,688 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <vector>
+#include <utility>
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
+#include "verify.h"
+#include "Track.h"
+#include "lec.h"
+#include "util.h"
+#include "log.h"
+
+// Number of blocks that are read and checked as a unit. The memory used
+// is bounded by the number of chunks, see 'VERIFY_CHUNKS_PER_THREAD'.
+#define VERIFY_CHUNK_BLOCKS 128
+
+// Chunks per worker thread that can be filled while others are checked.
+#define VERIFY_CHUNKS_PER_THREAD 2
+
+#define MAX_VERIFY_THREADS 16
+
+static const unsigned char SYNC_PATTERN[12] = {
+  0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0
+};
+
+// Error counters of a range of sectors.
+struct VerifyCounts {
+  long bad;         // sectors with at least one error
+  long sync;        // wrong sync pattern
+  long address;     // header address does not continue the track
+  long mode;        // header mode does not match the track mode
+  long edc;         // EDC does not match
+  long parity;      // P/Q parity does not match
+  long correctable; // bad sectors that can be repaired with the L-EC data
+  long firstBad;    // address of first bad sector, -1 if none
+};
+
+struct VerifyTrack {
+  const Track *track;
+  int trackNr;
+  long start;  // position of first block in the image
+  long length; // blocks
+  long address; // header address of first block, -1 if not found
+  long skipped; // blocks of ZERO data that are not in the image
+  int checked; // 1: raw data track that is checked
+  VerifyCounts counts;
+};
+
+struct VerifyChunk {
+  unsigned char *buf;
+  TrackData::Mode *modes;
+  long lba;      // position of first block in the image
+  long address;  // expected header address of first block
+  long len;      // number of blocks
+  long blockLen; // distance of the blocks in 'buf'
+  int mode;      // expected mode byte: 1 or 2
+  VerifyTrack *track;
+};
+
+struct VerifyQueue {
+  VerifyChunk *chunks;
+  int nofChunks;
+
+  int *free;       // stack of unused chunks
+  int nofFree;
+  int *work;       // ring of filled chunks
+  int workHead;
+  int workLen;
+  int quit;
+
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_t mutex;
+  pthread_cond_t workAvail;
+  pthread_cond_t chunkFree;
+#endif
+};
+
+static void clearCounts(VerifyCounts *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->firstBad = -1;
+}
+
+static void addCounts(VerifyCounts *sum, const VerifyCounts *c)
+{
+  sum->bad += c->bad;
+  sum->sync += c->sync;
+  sum->address += c->address;
+  sum->mode += c->mode;
+  sum->edc += c->edc;
+  sum->parity += c->parity;
+  sum->correctable += c->correctable;
+
+  if (c->firstBad >= 0 && (sum->firstBad < 0 || c->firstBad < sum->firstBad))
+    sum->firstBad = c->firstBad;
+}
+
+// Returns the address stored in the header of given raw sector, -1 if the
+// sync pattern or the header address is invalid.
+static long headerAddress(const unsigned char *sector)
+{
+  int i;
+
+  if (memcmp(sector, SYNC_PATTERN, 12) != 0)
+    return -1;
+
+  for (i = 12; i < 15; i++) {
+    if ((sector[i] & 0x0f) > 9 || (sector[i] >> 4) > 9)
+      return -1;
+  }
+
+  if (bcd2int(sector[13]) >= 60 || bcd2int(sector[14]) >= 75)
+    return -1;
+
+  return Msf(bcd2int(sector[12]), bcd2int(sector[13]),
+	     bcd2int(sector[14])).lba();
+}
+
+// Checks one raw sector.
+// lba: position of the sector in the image
+// address: expected header address
+// mode: expected mode byte
+static void checkSector(const unsigned char *sector, long lba, long address,
+			int mode, VerifyCounts *c)
+{
+  Msf m(address);
+  unsigned char tmp[AUDIO_BLOCK_LEN];
+  int lecType;
+  int flags = 0;
+  int bad = 0;
+
+  if (memcmp(sector, SYNC_PATTERN, 12) != 0) {
+    c->sync++;
+    bad = 1;
+  }
+
+  if (sector[12] != int2bcd(m.min()) || sector[13] != int2bcd(m.sec()) ||
+      sector[14] != int2bcd(m.frac())) {
+    c->address++;
+    bad = 1;
+  }
+
+  if (sector[15] != mode) {
+    c->mode++;
+    bad = 1;
+  }
+
+  // the L-EC data is checked according to the actual mode byte
+  switch (sector[15]) {
+  case 1:
+    lecType = LEC_MODE1;
+    break;
+  case 2:
+    lecType = LEC_MODE2_FORM_MIX;
+    break;
+  default:
+    lecType = -1;
+    break;
+  }
+
+  if (lecType >= 0)
+    flags = lec_check_sector(lecType, sector);
+
+  if (flags & LEC_EDC_ERROR)
+    c->edc++;
+
+  if (flags & LEC_PARITY_ERROR)
+    c->parity++;
+
+  if (flags != 0) {
+    bad = 1;
+
+    memcpy(tmp, sector, AUDIO_BLOCK_LEN);
+
+    if (lec_correct_sector(lecType, tmp) == 1)
+      c->correctable++;
+  }
+
+  if (bad) {
+    log_message(3, "Sector %ld (%s):%s%s%s%s%s", lba, m.str(),
+		memcmp(sector, SYNC_PATTERN, 12) != 0 ? " sync" : "",
+		sector[12] != int2bcd(m.min()) ||
+		sector[13] != int2bcd(m.sec()) ||
+		sector[14] != int2bcd(m.frac()) ? " address" : "",
+		sector[15] != mode ? " mode" : "",
+		(flags & LEC_EDC_ERROR) ? " EDC" : "",
+		(flags & LEC_PARITY_ERROR) ? " parity" : "");
+
+    c->bad++;
+
+    if (c->firstBad < 0)
+      c->firstBad = lba;
+  }
+}
+
+static void checkChunk(VerifyQueue *q, VerifyChunk *chunk)
+{
+  VerifyCounts c;
+  long i;
+
+  clearCounts(&c);
+
+  for (i = 0; i < chunk->len; i++)
+    checkSector(chunk->buf + i * chunk->blockLen, chunk->lba + i,
+		chunk->address + i, chunk->mode, &c);
+
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_lock(&q->mutex);
+#endif
+
+  addCounts(&chunk->track->counts, &c);
+
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_unlock(&q->mutex);
+#endif
+}
+
+#ifdef USE_POSIX_THREADS
+
+static void *verifyThread(void *args)
+{
+  VerifyQueue *q = (VerifyQueue *)args;
+  VerifyChunk *chunk;
+  int c;
+
+  pthread_mutex_lock(&q->mutex);
+
+  while (1) {
+    while (q->workLen == 0 && !q->quit)
+      pthread_cond_wait(&q->workAvail, &q->mutex);
+
+    if (q->workLen == 0)
+      break;
+
+    c = q->work[q->workHead];
+    q->workHead = (q->workHead + 1) % q->nofChunks;
+    q->workLen--;
+
+    pthread_mutex_unlock(&q->mutex);
+
+    chunk = &q->chunks[c];
+    checkChunk(q, chunk);
+
+    pthread_mutex_lock(&q->mutex);
+
+    q->free[q->nofFree++] = c;
+    pthread_cond_signal(&q->chunkFree);
+  }
+
+  pthread_mutex_unlock(&q->mutex);
+
+  return NULL;
+}
+
+#endif
+
+// Returns an unused chunk, waits until a worker has finished one if
+// necessary.
+static VerifyChunk *getChunk(VerifyQueue *q)
+{
+  VerifyChunk *chunk;
+
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_lock(&q->mutex);
+
+  while (q->nofFree == 0)
+    pthread_cond_wait(&q->chunkFree, &q->mutex);
+#endif
+
+  chunk = &q->chunks[q->free[--q->nofFree]];
+
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_unlock(&q->mutex);
+#endif
+
+  return chunk;
+}
+
+// Returns an unused chunk to the free list.
+static void releaseChunk(VerifyQueue *q, VerifyChunk *chunk)
+{
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_lock(&q->mutex);
+#endif
+
+  q->free[q->nofFree++] = chunk - q->chunks;
+
+#ifdef USE_POSIX_THREADS
+  pthread_cond_signal(&q->chunkFree);
+  pthread_mutex_unlock(&q->mutex);
+#endif
+}
+
+// Hands a filled chunk over to the workers. Without thread support it is
+// checked immediately.
+static void submitChunk(VerifyQueue *q, VerifyChunk *chunk, int nofThreads)
+{
+  int c = chunk - q->chunks;
+
+  if (nofThreads == 0) {
+    checkChunk(q, chunk);
+    q->free[q->nofFree++] = c;
+    return;
+  }
+
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_lock(&q->mutex);
+
+  q->work[(q->workHead + q->workLen) % q->nofChunks] = c;
+  q->workLen++;
+
+  pthread_cond_signal(&q->workAvail);
+  pthread_mutex_unlock(&q->mutex);
+#endif
+}
+
+// Returns the number of worker threads.
+static int verifyThreads()
+{
+#ifdef USE_POSIX_THREADS
+  long n = 2;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+  if (n < 1)
+    n = 1;
+  else if (n > MAX_VERIFY_THREADS)
+    n = MAX_VERIFY_THREADS;
+
+  return n;
+#else
+  return 0;
+#endif
+}
+
+// Collects the block ranges [first, end) of given track that consist of
+// ZERO data, e.g. the pre-gap "ZERO MODE2_RAW 00:02:00" written by
+// 'read-cd'. These blocks are not in the image and cannot be checked.
+static void zeroRanges(const Track *t,
+		       std::vector<std::pair<long, long> > *ranges)
+{
+  SubTrackIterator itr(t);
+  const SubTrack *st;
+  long blen, first, end;
+
+  for (st = itr.first(); st != NULL; st = itr.next()) {
+    if (((const TrackData *)st)->type() != TrackData::ZERODATA)
+      continue;
+
+    blen = TrackData::dataBlockSize(st->mode(), st->subChannelMode());
+
+    // only blocks that are completely covered
+    first = (st->start() + blen - 1) / blen;
+    end = (st->start() + st->length()) / blen;
+
+    if (end > first)
+      ranges->push_back(std::make_pair(first, end));
+  }
+}
+
+// Reads all blocks of given track and queues them for checking. The header
+// addresses must continue the address of the first valid header of the
+// track so that images of later sessions are checked, too.
+// Return: 0: OK
+//         1: read error
+static int readTrack(VerifyQueue *q, VerifyTrack *vt, int nofThreads)
+{
+  TrackReader reader(vt->track);
+  long blockLen = AUDIO_BLOCK_LEN +
+    TrackData::subChannelSize(vt->track->subChannelType());
+  long lba = vt->start;
+  long len = vt->length;
+  long n, rn, i, pos;
+  std::vector<std::pair<long, long> > zero;
+  size_t r = 0; // next range in 'zero'
+  int inZero;
+
+  zeroRanges(vt->track, &zero);
+
+  if (reader.openData() != 0)
+    return 1;
+
+  while (len > 0) {
+    VerifyChunk *chunk = getChunk(q);
+
+    n = len > VERIFY_CHUNK_BLOCKS ? VERIFY_CHUNK_BLOCKS : len;
+
+    // a chunk must not cross the border of a ZERO range
+    pos = lba - vt->start;
+
+    while (r < zero.size() && zero[r].second <= pos)
+      r++;
+
+    inZero = (r < zero.size() && zero[r].first <= pos);
+
+    if (inZero && zero[r].second - pos < n)
+      n = zero[r].second - pos;
+    else if (!inZero && r < zero.size() && zero[r].first - pos < n)
+      n = zero[r].first - pos;
+
+    // a non NULL 'modes' array leaves the raw sectors unencoded
+    rn = reader.readData(0, 0, lba + 150, (char *)chunk->buf, n,
+			 chunk->modes, blockLen);
+
+    if (rn <= 0) {
+      releaseChunk(q, chunk);
+      reader.closeData();
+      return 1;
+    }
+
+    if (inZero) {
+      vt->skipped += rn;
+      releaseChunk(q, chunk);
+      lba += rn;
+      len -= rn;
+      continue;
+    }
+
+    // take the first sector with a valid header as base
+    for (i = 0; vt->address < 0 && i < rn; i++) {
+      if ((vt->address = headerAddress(chunk->buf + i * blockLen)) >= 0)
+	vt->address -= lba + i - vt->start;
+    }
+
+    chunk->lba = lba;
+    chunk->address = (vt->address >= 0 ? vt->address : vt->start + 150) +
+      lba - vt->start;
+    chunk->len = rn;
+    chunk->blockLen = blockLen;
+    chunk->mode = vt->track->type() == TrackData::MODE1_RAW ? 1 : 2;
+    chunk->track = vt;
+
+    submitChunk(q, chunk, nofThreads);
+
+    lba += rn;
+    len -= rn;
+  }
+
+  reader.closeData();
+
+  return 0;
+}
+
+static void printJsonString(const char *s)
+{
+  putchar('"');
+
+  for (; *s != 0; s++) {
+    if (*s == '"' || *s == '\\')
+      printf("\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      printf("\\u%04x", *s);
+    else
+      putchar(*s);
+  }
+
+  putchar('"');
+}
+
+static void printJsonCounts(const VerifyCounts *c)
+{
+  printf("\"bad\":%ld,\"correctable\":%ld,\"first_bad\":%ld,"
+	 "\"errors\":{\"sync\":%ld,\"address\":%ld,\"mode\":%ld,"
+	 "\"edc\":%ld,\"parity\":%ld}", c->bad, c->correctable, c->firstBad,
+	 c->sync, c->address, c->mode, c->edc, c->parity);
+}
+
+static void logTrack(const VerifyTrack *vt)
+{
+  const VerifyCounts *c = &vt->counts;
+  Msf start(vt->start);
+
+  if (vt->checked && vt->address >= 0 && vt->address != vt->start + 150)
+    log_message(2, "Track %2d: sector headers start at %s.", vt->trackNr,
+		Msf(vt->address).str());
+
+  if (!vt->checked) {
+    log_message(1, "Track %2d %-14s %s %7ld blocks: not checked",
+		vt->trackNr, TrackData::mode2String(vt->track->type()),
+		start.str(), vt->length);
+  }
+  else if (c->bad == 0) {
+    log_message(1, "Track %2d %-14s %s %7ld blocks: OK", vt->trackNr,
+		TrackData::mode2String(vt->track->type()), start.str(),
+		vt->length);
+  }
+  else {
+    log_message(1, "Track %2d %-14s %s %7ld blocks: %ld bad sectors, "
+		"%ld correctable", vt->trackNr,
+		TrackData::mode2String(vt->track->type()), start.str(),
+		vt->length, c->bad, c->correctable);
+    log_message(1, "         sync %ld, address %ld, mode %ld, EDC %ld, "
+		"parity %ld, first bad sector %ld", c->sync, c->address,
+		c->mode, c->edc, c->parity, c->firstBad);
+  }
+
+  if (vt->skipped > 0)
+    log_message(1, "         %ld blocks of ZERO data are not in the image, "
+		"not checked", vt->skipped);
+}
+
+int verifyImage(const Toc *toc, const char *tocFile)
+{
+  int nofTracks = toc->nofTracks();
+  int nofThreads = verifyThreads();
+  VerifyTrack *tracks = new VerifyTrack[nofTracks];
+  VerifyQueue q;
+  VerifyCounts total;
+  const Track *t;
+  struct timeval tstart, tend;
+  double seconds;
+  long lba = 0;
+  long checked = 0;
+  long skipped = 0;
+  int err = 0;
+  int i;
+
+#ifdef USE_POSIX_THREADS
+  pthread_t threads[MAX_VERIFY_THREADS];
+  int threadsStarted = 0;
+#endif
+
+  gettimeofday(&tstart, NULL);
+
+  // setup the chunks, their number bounds the used memory
+  q.nofChunks = nofThreads * VERIFY_CHUNKS_PER_THREAD + 1;
+  q.chunks = new VerifyChunk[q.nofChunks];
+  q.free = new int[q.nofChunks];
+  q.work = new int[q.nofChunks];
+  q.nofFree = q.workHead = q.workLen = q.quit = 0;
+
+  for (i = 0; i < q.nofChunks; i++) {
+    q.chunks[i].buf = new unsigned char[VERIFY_CHUNK_BLOCKS *
+					(AUDIO_BLOCK_LEN + PW_SUBCHANNEL_LEN)];
+    q.chunks[i].modes = new TrackData::Mode[VERIFY_CHUNK_BLOCKS];
+    q.free[q.nofFree++] = i;
+  }
+
+#ifdef USE_POSIX_THREADS
+  pthread_mutex_init(&q.mutex, NULL);
+  pthread_cond_init(&q.workAvail, NULL);
+  pthread_cond_init(&q.chunkFree, NULL);
+
+  for (i = 0; i < nofThreads; i++) {
+    if (pthread_create(&threads[i], NULL, verifyThread, &q) != 0)
+      break;
+    threadsStarted++;
+  }
+
+  nofThreads = threadsStarted;
+#endif
+
+  log_message(2, "Verifying \"%s\" with %d threads...", tocFile,
+	      nofThreads > 0 ? nofThreads : 1);
+
+  TrackIterator itr(toc);
+
+  for (t = itr.first(), i = 0; t != NULL; t = itr.next(), i++) {
+    VerifyTrack *vt = &tracks[i];
+
+    vt->track = t;
+    vt->trackNr = i + 1;
+    vt->start = lba;
+    vt->length = t->length().lba();
+    vt->address = -1;
+    vt->skipped = 0;
+    vt->checked = (t->type() == TrackData::MODE1_RAW ||
+		   t->type() == TrackData::MODE2_RAW);
+    clearCounts(&vt->counts);
+
+    if (vt->checked && err == 0) {
+      if (readTrack(&q, vt, nofThreads) != 0) {
+	log_message(-2, "Cannot read data of track %d.", vt->trackNr);
+	err = 2;
+      }
+      else {
+	checked += vt->length - vt->skipped;
+	skipped += vt->skipped;
+      }
+    }
+
+    lba += vt->length;
+  }
+
+#ifdef USE_POSIX_THREADS
+  // wait until all chunks are checked and stop the workers
+  pthread_mutex_lock(&q.mutex);
+
+  q.quit = 1;
+  pthread_cond_broadcast(&q.workAvail);
+
+  pthread_mutex_unlock(&q.mutex);
+
+  for (i = 0; i < threadsStarted; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&q.mutex);
+  pthread_cond_destroy(&q.workAvail);
+  pthread_cond_destroy(&q.chunkFree);
+#endif
+
+  gettimeofday(&tend, NULL);
+
+  seconds = (tend.tv_sec - tstart.tv_sec) +
+    (tend.tv_usec - tstart.tv_usec) / 1e6;
+
+  // per track report
+  clearCounts(&total);
+
+  for (i = 0; i < nofTracks; i++) {
+    logTrack(&tracks[i]);
+    addCounts(&total, &tracks[i].counts);
+  }
+
+  log_message(1, "Checked %ld sectors in %.1f s (%.1f MB/s): %ld bad, "
+	      "%ld correctable.", checked, seconds,
+	      seconds > 0 ? checked * (double)AUDIO_BLOCK_LEN / seconds / 1e6
+	                  : 0.0,
+	      total.bad, total.correctable);
+
+  if (skipped > 0)
+    log_message(1, "%ld blocks of ZERO data are not in the image.", skipped);
+
+  // machine readable summary
+  printf("{\"toc\":");
+  printJsonString(tocFile);
+  printf(",\"complete\":%s,\"seconds\":%.3f,\"sectors\":%ld,"
+	 "\"skipped\":%ld,", err == 0 ? "true" : "false", seconds, checked,
+	 skipped);
+  printJsonCounts(&total);
+  printf(",\"tracks\":[");
+
+  for (i = 0; i < nofTracks; i++) {
+    printf("%s{\"track\":%d,\"mode\":\"%s\",\"start\":%ld,\"length\":%ld,"
+	   "\"address\":%ld,\"checked\":%s,\"skipped\":%ld,",
+	   i > 0 ? "," : "", tracks[i].trackNr,
+	   TrackData::mode2String(tracks[i].track->type()), tracks[i].start,
+	   tracks[i].length, tracks[i].address,
+	   tracks[i].checked ? "true" : "false", tracks[i].skipped);
+    printJsonCounts(&tracks[i].counts);
+    printf("}");
+  }
+
+  printf("]}\n");
+  fflush(stdout);
+
+  for (i = 0; i < q.nofChunks; i++) {
+    delete[] q.chunks[i].buf;
+    delete[] q.chunks[i].modes;
+  }
+
+  delete[] q.chunks;
+  delete[] q.free;
+  delete[] q.work;
+  delete[] tracks;
+
+  if (err != 0)
+    return err;
+
+  return total.bad > 0 ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include "Toc.h"
+
+// Checks sync pattern, header address, EDC and P/Q parity of all sectors
+// of the MODE1_RAW and MODE2_RAW tracks of given toc. A report for each
+// track is logged, a JSON summary is written to stdout.
+// Return: 0: all sectors are valid
+//         1: invalid sectors were found
+//         2: track data could not be read
+int verifyImage(const Toc *, const char *tocFile);
+
+#endif
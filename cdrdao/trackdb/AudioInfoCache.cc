@@ -0,0 +1,271 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
+#include <map>
+#include <string>
+
+#include "AudioInfoCache.h"
+#include "log.h"
+
+// First line of the cache file. Each following line holds one entry:
+// <dev> <inode> <size> <mtime> <mtime ns> <ctime> <ctime ns> <offset>
+// <header length> <data length> <path>
+#define CACHE_MAGIC_PREFIX "# cdrdao audio info cache "
+#define CACHE_MAGIC CACHE_MAGIC_PREFIX "2"
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#define MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#else
+#define MTIME_NSEC(st) 0
+#endif
+
+#ifdef HAVE_STRUCT_STAT_ST_CTIM
+#define CTIME_NSEC(st) ((st).st_ctim.tv_nsec)
+#else
+#define CTIME_NSEC(st) 0
+#endif
+
+struct CacheEntry {
+  unsigned long long dev;
+  unsigned long long ino;
+  long long size;
+  long long mtime;
+  long mtimeNsec;
+  long long ctime;
+  long ctimeNsec;
+  long hdrlen;
+  unsigned long datalen;
+};
+
+typedef std::pair<std::string, long> CacheKey;
+typedef std::map<CacheKey, CacheEntry> CacheMap;
+
+static CacheMap cache;
+static bool dirty = false;
+
+#ifdef USE_POSIX_THREADS
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK()   pthread_mutex_lock(&cacheMutex)
+#define UNLOCK() pthread_mutex_unlock(&cacheMutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+// A same size rewrite within the resolution of the modification time
+// (or one that restores the modification time) still changes the
+// status change time, so both are compared.
+static bool matches(const CacheEntry &e, const struct stat &st)
+{
+  return e.dev == (unsigned long long)st.st_dev &&
+    e.ino == (unsigned long long)st.st_ino &&
+    e.size == (long long)st.st_size &&
+    e.mtime == (long long)st.st_mtime &&
+    e.mtimeNsec == (long)MTIME_NSEC(st) &&
+    e.ctime == (long long)st.st_ctime &&
+    e.ctimeNsec == (long)CTIME_NSEC(st);
+}
+
+bool AudioInfoCache::lookup(const char *filename, long offset,
+			    const struct stat &st, long *hdrlen,
+			    unsigned long *datalen)
+{
+  bool found = false;
+
+  LOCK();
+
+  CacheMap::const_iterator it = cache.find(CacheKey(filename, offset));
+
+  if (it != cache.end() && matches(it->second, st)) {
+    *hdrlen = it->second.hdrlen;
+    if (datalen != NULL)
+      *datalen = it->second.datalen;
+    found = true;
+  }
+
+  UNLOCK();
+
+  return found;
+}
+
+void AudioInfoCache::store(const char *filename, long offset,
+			   const struct stat &st, long hdrlen,
+			   unsigned long datalen)
+{
+  CacheEntry e;
+
+  e.dev = st.st_dev;
+  e.ino = st.st_ino;
+  e.size = st.st_size;
+  e.mtime = st.st_mtime;
+  e.mtimeNsec = MTIME_NSEC(st);
+  e.ctime = st.st_ctime;
+  e.ctimeNsec = CTIME_NSEC(st);
+  e.hdrlen = hdrlen;
+  e.datalen = datalen;
+
+  LOCK();
+  cache[CacheKey(filename, offset)] = e;
+  dirty = true;
+  UNLOCK();
+}
+
+void AudioInfoCache::clear()
+{
+  LOCK();
+  dirty = dirty || !cache.empty();
+  cache.clear();
+  UNLOCK();
+}
+
+int AudioInfoCache::load(const char *filename)
+{
+  FILE *fp;
+  char line[sizeof(CACHE_MAGIC) + 1];
+  CacheEntry e;
+  long offset;
+  std::string path;
+  long n = 0;
+  int c;
+  int ret = 0;
+
+  if ((fp = fopen(filename, "r")) == NULL) {
+    if (errno == ENOENT)
+      return 0;
+
+    log_message(-1, "Cannot open audio info cache \"%s\": %s", filename,
+		strerror(errno));
+    return 1;
+  }
+
+  if (fgets(line, sizeof(line), fp) == NULL ||
+      strncmp(line, CACHE_MAGIC_PREFIX, sizeof(CACHE_MAGIC_PREFIX) - 1) != 0) {
+    log_message(-1, "%s: not an audio info cache file - ignored.", filename);
+    fclose(fp);
+    return 1;
+  }
+
+  if (strcmp(line, CACHE_MAGIC "\n") != 0) {
+    // written by another version, the entries are rebuilt on the next save
+    log_message(4, "%s: audio info cache of other version discarded.",
+		filename);
+    fclose(fp);
+    return 0;
+  }
+
+  LOCK();
+
+  while (fscanf(fp, "%llu %llu %lld %lld %ld %lld %ld %ld %ld %lu", &e.dev,
+		&e.ino, &e.size, &e.mtime, &e.mtimeNsec, &e.ctime,
+		&e.ctimeNsec, &offset, &e.hdrlen, &e.datalen) == 10) {
+    // skip only the single blank written by 'save()', the path may
+    // start with white space itself
+    if (getc(fp) != ' ')
+      break;
+
+    path.clear();
+
+    while ((c = getc(fp)) != EOF && c != '\n')
+      path += (char)c;
+
+    if (path.empty())
+      break;
+
+    cache[CacheKey(path, offset)] = e;
+    n++;
+  }
+
+  if (!feof(fp)) {
+    log_message(-1, "%s: corrupted audio info cache, only %ld entries used.",
+		filename, n);
+    ret = 1;
+  }
+
+  dirty = false;
+
+  UNLOCK();
+
+  fclose(fp);
+
+  log_message(4, "Loaded %ld entries from audio info cache \"%s\".", n,
+	      filename);
+
+  return ret;
+}
+
+int AudioInfoCache::save(const char *filename)
+{
+  std::string tmpName = std::string(filename) + ".tmp";
+  CacheMap::const_iterator it;
+  FILE *fp;
+  int ret = 0;
+
+  LOCK();
+
+  if (!dirty) {
+    UNLOCK();
+    return 0;
+  }
+
+  if ((fp = fopen(tmpName.c_str(), "w")) == NULL) {
+    UNLOCK();
+    log_message(-1, "Cannot create audio info cache \"%s\": %s",
+		tmpName.c_str(), strerror(errno));
+    return 1;
+  }
+
+  fprintf(fp, "%s\n", CACHE_MAGIC);
+
+  for (it = cache.begin(); it != cache.end(); ++it) {
+    const std::string &path = it->first.first;
+    const CacheEntry &e = it->second;
+
+    // Relative paths are stored as well, an entry that refers to another
+    // file with the same name is rejected by 'matches()'.
+    if (path.find('\n') != std::string::npos)
+      continue;
+
+    fprintf(fp, "%llu %llu %lld %lld %ld %lld %ld %ld %ld %lu %s\n", e.dev,
+	    e.ino, e.size, e.mtime, e.mtimeNsec, e.ctime, e.ctimeNsec,
+	    it->first.second, e.hdrlen, e.datalen, path.c_str());
+  }
+
+  if (fclose(fp) != 0 || rename(tmpName.c_str(), filename) != 0) {
+    log_message(-1, "Cannot write audio info cache \"%s\": %s", filename,
+		strerror(errno));
+    unlink(tmpName.c_str());
+    ret = 1;
+  }
+  else {
+    dirty = false;
+  }
+
+  UNLOCK();
+
+  return ret;
+}
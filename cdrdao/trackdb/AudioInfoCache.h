@@ -0,0 +1,65 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// \file AudioInfoCache.h
+//   \brief Process wide cache of parsed audio file headers.
+
+#ifndef __AUDIOINFOCACHE_H__
+#define __AUDIOINFOCACHE_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//! \brief Remembers the header and data length of WAVE files so that a
+// file is parsed only once even if its length is queried while parsing,
+// checking and writing a toc-file. Entries are keyed by file name and
+// offset and are only used while device, inode, size and modification
+// time of the file are unchanged.
+//
+// The cache may be loaded from and saved to a file to keep the entries
+// between runs. All functions are thread safe.
+
+class AudioInfoCache {
+public:
+  // Looks up the header length in bytes and data length in samples of
+  // the WAVE header found at 'offset' in 'filename'. 'st' is the current
+  // status of the file.
+  // return: true if a valid entry was found
+  static bool lookup(const char *filename, long offset, const struct stat &st,
+		     long *hdrlen, unsigned long *datalen);
+
+  // Adds or replaces an entry. 'st' is the status of the file at the
+  // time its header was parsed.
+  static void store(const char *filename, long offset, const struct stat &st,
+		    long hdrlen, unsigned long datalen);
+
+  // Removes all entries.
+  static void clear();
+
+  // Reads entries from given file. A missing file is not an error.
+  // return: 0: OK
+  //         1: file could not be read or has wrong format
+  static int load(const char *filename);
+
+  // Writes all entries to given file if they were changed since the
+  // last 'load()' or 'save()'.
+  // return: 0: OK
+  //         1: file could not be written
+  static int save(const char *filename);
+};
+
+#endif
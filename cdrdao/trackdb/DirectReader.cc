@@ -0,0 +1,755 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define USE_IO_URING
+#endif
+#endif
+
+#include "DirectReader.h"
+#include "util.h"
+#include "log.h"
+
+// Size of a single read request and number of requests kept in flight.
+#define CHUNK_LEN (1024 * 1024)
+#define NOF_CHUNKS 4
+
+// Number of threads of the pread() fallback.
+#define NOF_THREADS 2
+
+// Alignment of buffers for O_DIRECT. File offsets and lengths are
+// multiples of CHUNK_LEN anyway.
+#define DIRECT_ALIGN 4096
+
+enum { CHUNK_FREE, CHUNK_QUEUED, CHUNK_BUSY, CHUNK_DONE };
+
+struct DirectReader::Chunk {
+  char *buf;
+  off_t offset;
+  long len;  // number of bytes read
+  int err;   // errno of failed read, 0 if OK
+  int state;
+  struct iovec iov;
+};
+
+// Completes chunk 'c' with pread(), 'c->len' bytes are already read.
+static void readChunk(int fd, DirectReader::Chunk *c)
+{
+  long n;
+
+  while (c->len < CHUNK_LEN) {
+    n = pread(fd, c->buf + c->len, CHUNK_LEN - c->len, c->offset + c->len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+
+      c->err = errno;
+      return;
+    }
+
+    if (n == 0)
+      break; // end of file
+
+    c->len += n;
+  }
+}
+
+#ifdef USE_IO_URING
+
+struct DirectReader::Uring {
+  int fd;
+  void *sqRing;
+  size_t sqRingLen;
+  void *cqRing;
+  size_t cqRingLen;
+  struct io_uring_sqe *sqes;
+  size_t sqesLen;
+
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+
+  unsigned toSubmit; // queued entries not passed to the kernel, yet
+};
+
+static void uringDestroy(DirectReader::Uring *u)
+{
+  if (u->sqes != NULL)
+    munmap(u->sqes, u->sqesLen);
+  if (u->cqRing != NULL)
+    munmap(u->cqRing, u->cqRingLen);
+  if (u->sqRing != NULL)
+    munmap(u->sqRing, u->sqRingLen);
+
+  close(u->fd);
+  delete u;
+}
+
+static void *uringMap(int fd, size_t len, off_t offset)
+{
+  void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		 fd, offset);
+
+  return p == MAP_FAILED ? NULL : p;
+}
+
+// Creates an io_uring instance with given number of entries.
+// return: NULL if io_uring is not supported by the kernel
+static DirectReader::Uring *uringSetup(unsigned entries)
+{
+  struct io_uring_params p;
+  DirectReader::Uring *u;
+  int fd;
+
+  memset(&p, 0, sizeof(p));
+
+  if ((fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+    return NULL;
+
+  u = new DirectReader::Uring;
+  memset(u, 0, sizeof(*u));
+  u->fd = fd;
+
+  u->sqRingLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cqRingLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  u->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  u->sqRing = uringMap(fd, u->sqRingLen, IORING_OFF_SQ_RING);
+  u->cqRing = uringMap(fd, u->cqRingLen, IORING_OFF_CQ_RING);
+  u->sqes = (struct io_uring_sqe *)uringMap(fd, u->sqesLen, IORING_OFF_SQES);
+
+  if (u->sqRing == NULL || u->cqRing == NULL || u->sqes == NULL) {
+    uringDestroy(u);
+    return NULL;
+  }
+
+  char *sq = (char *)u->sqRing;
+  char *cq = (char *)u->cqRing;
+
+  u->sqTail = (unsigned *)(sq + p.sq_off.tail);
+  u->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sqArray = (unsigned *)(sq + p.sq_off.array);
+  u->cqHead = (unsigned *)(cq + p.cq_off.head);
+  u->cqTail = (unsigned *)(cq + p.cq_off.tail);
+  u->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  return u;
+}
+
+// Passes all queued entries to the kernel and optionally waits for
+// 'minComplete' completions.
+// return: 0: OK, 1: error
+static int uringEnter(DirectReader::Uring *u, unsigned minComplete)
+{
+  int n;
+
+  do {
+    n = syscall(__NR_io_uring_enter, u->fd, u->toSubmit, minComplete,
+		minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return 1;
+
+  u->toSubmit -= n;
+
+  return 0;
+}
+
+// Marks all chunks with an available completion entry as done.
+static void uringReap(DirectReader::Uring *u, DirectReader::Chunk *chunks)
+{
+  unsigned head = *u->cqHead;
+  unsigned tail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+    DirectReader::Chunk *c = &chunks[cqe->user_data];
+
+    if (cqe->res < 0)
+      c->err = -cqe->res;
+    else
+      c->len = cqe->res;
+
+    c->state = CHUNK_DONE;
+    head++;
+  }
+
+  __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+}
+
+#endif
+
+#ifdef USE_POSIX_THREADS
+
+struct DirectReader::Pool {
+  DirectReader::Chunk *chunks;
+  int fd;
+  int stop;
+
+  pthread_t threads[NOF_THREADS];
+  int nofThreads;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work; // signaled when a chunk is queued
+  pthread_cond_t done; // signaled when a chunk is read
+};
+
+static void *poolThread(void *arg)
+{
+  DirectReader::Pool *p = (DirectReader::Pool *)arg;
+  DirectReader::Chunk *c;
+  int i, fd;
+
+  pthread_mutex_lock(&p->mutex);
+
+  while (!p->stop) {
+    // read the queued chunk with the lowest file offset first
+    c = NULL;
+
+    for (i = 0; i < NOF_CHUNKS; i++) {
+      if (p->chunks[i].state == CHUNK_QUEUED &&
+	  (c == NULL || p->chunks[i].offset < c->offset))
+	c = &p->chunks[i];
+    }
+
+    if (c == NULL) {
+      pthread_cond_wait(&p->work, &p->mutex);
+      continue;
+    }
+
+    c->state = CHUNK_BUSY;
+    fd = p->fd;
+
+    pthread_mutex_unlock(&p->mutex);
+    readChunk(fd, c);
+    pthread_mutex_lock(&p->mutex);
+
+    c->state = CHUNK_DONE;
+    pthread_cond_broadcast(&p->done);
+  }
+
+  pthread_mutex_unlock(&p->mutex);
+
+  return NULL;
+}
+
+static void poolStop(DirectReader::Pool *p)
+{
+  int i;
+
+  pthread_mutex_lock(&p->mutex);
+  p->stop = 1;
+  pthread_cond_broadcast(&p->work);
+  pthread_mutex_unlock(&p->mutex);
+
+  for (i = 0; i < p->nofThreads; i++)
+    pthread_join(p->threads[i], NULL);
+
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->work);
+  pthread_mutex_destroy(&p->mutex);
+
+  delete p;
+}
+
+// Starts the pread() threads.
+// return: NULL if no thread could be created
+static DirectReader::Pool *poolStart(DirectReader::Chunk *chunks, int fd)
+{
+  DirectReader::Pool *p = new DirectReader::Pool;
+
+  p->chunks = chunks;
+  p->fd = fd;
+  p->stop = 0;
+  p->nofThreads = 0;
+
+  pthread_mutex_init(&p->mutex, NULL);
+  pthread_cond_init(&p->work, NULL);
+  pthread_cond_init(&p->done, NULL);
+
+  while (p->nofThreads < NOF_THREADS &&
+	 pthread_create(&p->threads[p->nofThreads], NULL, poolThread, p) == 0)
+    p->nofThreads++;
+
+  if (p->nofThreads == 0) {
+    poolStop(p);
+    return NULL;
+  }
+
+  return p;
+}
+
+#endif
+
+DirectReader::DirectReader()
+{
+  filename_ = NULL;
+  fd_ = -1;
+  direct_ = false;
+  backend_ = PREAD;
+
+  fileSize_ = 0;
+  pos_ = 0;
+  nextOffset_ = 0;
+
+  mem_ = NULL;
+  chunks_ = NULL;
+  head_ = 0;
+  used_ = 0;
+
+  uring_ = NULL;
+  pool_ = NULL;
+}
+
+DirectReader::~DirectReader()
+{
+  close();
+}
+
+int DirectReader::open(const char *filename)
+{
+  struct stat st;
+  char *p;
+  int i;
+
+  close();
+
+  filename_ = strdupCC(filename);
+
+  if (openFile(true) != 0) {
+    log_message(-2, "Cannot open file \"%s\": %s", filename_, strerror(errno));
+    delete[] filename_;
+    filename_ = NULL;
+    return 1;
+  }
+
+  fileSize_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+
+  mem_ = new char[NOF_CHUNKS * CHUNK_LEN + DIRECT_ALIGN];
+  p = mem_ + DIRECT_ALIGN - ((unsigned long)mem_ % DIRECT_ALIGN);
+
+  chunks_ = new Chunk[NOF_CHUNKS];
+
+  for (i = 0; i < NOF_CHUNKS; i++) {
+    chunks_[i].buf = p + i * CHUNK_LEN;
+    chunks_[i].iov.iov_base = chunks_[i].buf;
+    chunks_[i].iov.iov_len = CHUNK_LEN;
+    chunks_[i].offset = 0;
+    chunks_[i].len = 0;
+    chunks_[i].err = 0;
+    chunks_[i].state = CHUNK_FREE;
+  }
+
+  pos_ = 0;
+  nextOffset_ = 0;
+  head_ = 0;
+  used_ = 0;
+
+  startBackend();
+
+  return 0;
+}
+
+void DirectReader::close()
+{
+  if (fd_ < 0)
+    return;
+
+  drain();
+  stopBackend();
+
+  ::close(fd_);
+  fd_ = -1;
+
+  delete[] chunks_;
+  chunks_ = NULL;
+  delete[] mem_;
+  mem_ = NULL;
+  delete[] filename_;
+  filename_ = NULL;
+}
+
+// Opens 'filename_' with O_DIRECT if 'direct' is true and O_DIRECT is
+// supported, otherwise with normal caching.
+// return: 0: OK, 1: error
+int DirectReader::openFile(bool direct)
+{
+  int flags = O_RDONLY;
+
+#ifdef __CYGWIN__
+  flags |= O_BINARY;
+#endif
+
+#ifdef O_DIRECT
+  if (direct && (fd_ = ::open(filename_, flags | O_DIRECT)) >= 0) {
+    direct_ = true;
+    return 0;
+  }
+#endif
+
+  direct_ = false;
+
+  if ((fd_ = ::open(filename_, flags)) < 0)
+    return 1;
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  return 0;
+}
+
+// Some file systems accept O_DIRECT on open() but fail the reads, the
+// file is opened again without O_DIRECT in this case.
+int DirectReader::reopenBuffered()
+{
+  drain();
+  ::close(fd_);
+
+  if (openFile(false) != 0) {
+    log_message(-2, "Cannot open file \"%s\": %s", filename_, strerror(errno));
+    return 1;
+  }
+
+#ifdef USE_POSIX_THREADS
+  if (pool_ != NULL) {
+    pthread_mutex_lock(&pool_->mutex);
+    pool_->fd = fd_;
+    pthread_mutex_unlock(&pool_->mutex);
+  }
+#endif
+
+  log_message(4, "File system does not support O_DIRECT for \"%s\".",
+	      filename_);
+
+  return 0;
+}
+
+void DirectReader::startBackend()
+{
+#ifdef USE_IO_URING
+  if ((uring_ = uringSetup(NOF_CHUNKS)) != NULL) {
+    backend_ = IO_URING;
+    return;
+  }
+#endif
+
+#ifdef USE_POSIX_THREADS
+  if ((pool_ = poolStart(chunks_, fd_)) != NULL) {
+    backend_ = THREADS;
+    return;
+  }
+#endif
+
+  backend_ = PREAD;
+}
+
+void DirectReader::stopBackend()
+{
+#ifdef USE_IO_URING
+  if (uring_ != NULL) {
+    uringDestroy(uring_);
+    uring_ = NULL;
+  }
+#endif
+
+#ifdef USE_POSIX_THREADS
+  if (pool_ != NULL) {
+    poolStop(pool_);
+    pool_ = NULL;
+  }
+#endif
+}
+
+const char *DirectReader::name() const
+{
+  switch (backend_) {
+  case IO_URING:
+    return direct_ ? "direct-io_uring" : "nocache-io_uring";
+  case THREADS:
+    return direct_ ? "direct-threads" : "nocache-threads";
+  default:
+    return direct_ ? "direct-pread" : "nocache-pread";
+  }
+}
+
+// Queues the read of chunk 'c'.
+void DirectReader::submit(Chunk *c)
+{
+  c->len = 0;
+  c->err = 0;
+
+  switch (backend_) {
+  case IO_URING:
+#ifdef USE_IO_URING
+    {
+      unsigned tail = *uring_->sqTail;
+      unsigned idx = tail & *uring_->sqMask;
+      struct io_uring_sqe *sqe = &uring_->sqes[idx];
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = fd_;
+      sqe->addr = (unsigned long)&c->iov;
+      sqe->len = 1;
+      sqe->off = c->offset;
+      sqe->user_data = c - chunks_;
+
+      uring_->sqArray[idx] = idx;
+      __atomic_store_n(uring_->sqTail, tail + 1, __ATOMIC_RELEASE);
+      uring_->toSubmit++;
+      c->state = CHUNK_QUEUED;
+    }
+#endif
+    break;
+
+  case THREADS:
+#ifdef USE_POSIX_THREADS
+    pthread_mutex_lock(&pool_->mutex);
+    c->state = CHUNK_QUEUED;
+    pthread_cond_signal(&pool_->work);
+    pthread_mutex_unlock(&pool_->mutex);
+#endif
+    break;
+
+  case PREAD:
+    // read on demand by 'wait()'
+    c->state = CHUNK_QUEUED;
+    break;
+  }
+}
+
+// Starts all reads that were queued by 'submit()'.
+void DirectReader::flush()
+{
+#ifdef USE_IO_URING
+  if (uring_ != NULL && uring_->toSubmit > 0)
+    uringEnter(uring_, 0);
+#endif
+}
+
+// Waits until chunk 'c' is read.
+// return: 0: OK, 'c->err' holds the result of the read
+//         1: the backend failed
+int DirectReader::wait(Chunk *c)
+{
+  switch (backend_) {
+  case IO_URING:
+#ifdef USE_IO_URING
+    while (c->state != CHUNK_DONE) {
+      uringReap(uring_, chunks_);
+
+      if (c->state != CHUNK_DONE && uringEnter(uring_, 1) != 0) {
+	log_message(-2, "io_uring_enter failed: %s", strerror(errno));
+	return 1;
+      }
+    }
+#endif
+    break;
+
+  case THREADS:
+#ifdef USE_POSIX_THREADS
+    pthread_mutex_lock(&pool_->mutex);
+    while (c->state != CHUNK_DONE)
+      pthread_cond_wait(&pool_->done, &pool_->mutex);
+    pthread_mutex_unlock(&pool_->mutex);
+#endif
+    break;
+
+  case PREAD:
+    if (c->state == CHUNK_QUEUED) {
+      readChunk(fd_, c);
+      c->state = CHUNK_DONE;
+    }
+    break;
+  }
+
+  // complete short reads that did not hit the end of file
+  if (c->err == 0 && c->len < CHUNK_LEN && c->offset + c->len < fileSize_)
+    readChunk(fd_, c);
+
+  return 0;
+}
+
+// Returns the oldest chunk 'c' to the free list.
+void DirectReader::release(Chunk *c)
+{
+#ifdef HAVE_POSIX_FADVISE
+  if (!direct_ && c->len > 0)
+    posix_fadvise(fd_, c->offset, c->len, POSIX_FADV_DONTNEED);
+#endif
+
+#ifdef USE_POSIX_THREADS
+  if (pool_ != NULL)
+    pthread_mutex_lock(&pool_->mutex);
+#endif
+
+  c->state = CHUNK_FREE;
+
+#ifdef USE_POSIX_THREADS
+  if (pool_ != NULL)
+    pthread_mutex_unlock(&pool_->mutex);
+#endif
+
+  head_ = (head_ + 1) % NOF_CHUNKS;
+  used_--;
+}
+
+// Waits for all reads in flight and frees all chunks.
+void DirectReader::drain()
+{
+  int i;
+
+  if (chunks_ == NULL)
+    return;
+
+  switch (backend_) {
+  case IO_URING:
+    // io_uring reads cannot be withdrawn
+    for (i = 0; i < NOF_CHUNKS; i++) {
+      if (chunks_[i].state == CHUNK_QUEUED && wait(&chunks_[i]) != 0)
+	break;
+    }
+    break;
+
+  case THREADS:
+#ifdef USE_POSIX_THREADS
+    pthread_mutex_lock(&pool_->mutex);
+
+    for (i = 0; i < NOF_CHUNKS; i++) {
+      if (chunks_[i].state == CHUNK_QUEUED)
+	chunks_[i].state = CHUNK_FREE;
+    }
+
+    for (i = 0; i < NOF_CHUNKS; i++) {
+      while (chunks_[i].state == CHUNK_BUSY)
+	pthread_cond_wait(&pool_->done, &pool_->mutex);
+    }
+
+    pthread_mutex_unlock(&pool_->mutex);
+#endif
+    break;
+
+  case PREAD:
+    break;
+  }
+
+  for (i = 0; i < NOF_CHUNKS; i++)
+    chunks_[i].state = CHUNK_FREE;
+
+  head_ = 0;
+  used_ = 0;
+}
+
+void DirectReader::seek(off_t pos)
+{
+  pos_ = pos;
+}
+
+long DirectReader::read(char *buf, long len)
+{
+  long nread = 0;
+  long n;
+  Chunk *c;
+
+  while (nread < len && pos_ < fileSize_) {
+    c = &chunks_[head_];
+
+    if (used_ > 0 && (pos_ < c->offset || pos_ >= c->offset + CHUNK_LEN)) {
+      // read position was moved, restart read-ahead
+      drain();
+    }
+
+    if (used_ == 0)
+      nextOffset_ = pos_ - (pos_ % CHUNK_LEN);
+
+    // keep all chunks busy
+    while (used_ < NOF_CHUNKS && nextOffset_ < fileSize_) {
+      c = &chunks_[(head_ + used_) % NOF_CHUNKS];
+      c->offset = nextOffset_;
+      submit(c);
+
+      nextOffset_ += CHUNK_LEN;
+      used_++;
+    }
+
+    flush();
+
+    c = &chunks_[head_];
+
+    if (wait(c) != 0)
+      return -1;
+
+    if (c->err == EINVAL && direct_) {
+      if (reopenBuffered() != 0)
+	return -1;
+      continue;
+    }
+
+    if (c->err != 0) {
+      log_message(-2, "Read error while reading file \"%s\": %s", filename_,
+		  strerror(c->err));
+      errno = c->err;
+      return -1;
+    }
+
+    n = c->offset + c->len - pos_;
+
+    if (n <= 0)
+      break; // file is shorter than expected
+
+    if (n > len - nread)
+      n = len - nread;
+
+    memcpy(buf + nread, c->buf + (pos_ - c->offset), n);
+    pos_ += n;
+    nread += n;
+
+    if (pos_ >= c->offset + c->len)
+      release(c);
+  }
+
+  return nread;
+}
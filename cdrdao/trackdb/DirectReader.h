@@ -0,0 +1,100 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// \file DirectReader.h
+//   \brief Sequential file reader that bypasses the page cache.
+
+#ifndef __DIRECTREADER_H__
+#define __DIRECTREADER_H__
+
+#include <sys/types.h>
+
+//! \brief Reads a file sequentially with O_DIRECT into aligned buffers.
+// Several reads of 'CHUNK_LEN' bytes are kept in flight so that the
+// latency of slow storage is hidden from the caller. If the file system
+// does not support O_DIRECT the file is read normally and the read data
+// is dropped from the page cache.
+//
+// The reads are queued with io_uring if available, otherwise they are
+// executed by a small pool of threads with pread(). Without thread
+// support the chunks are read synchronously when they are needed.
+
+class DirectReader {
+public:
+  enum Backend { IO_URING, THREADS, PREAD };
+
+  DirectReader();
+  ~DirectReader();
+
+  // Opens given file.
+  // return: 0: OK
+  //         1: file could not be opened
+  int open(const char *filename);
+  void close();
+
+  // Sets the file offset of the next 'read()'. Data that was read ahead
+  // is discarded with the next 'read()' if it does not contain 'pos'.
+  void seek(off_t pos);
+
+  // Reads 'len' bytes at the current file offset.
+  // return: number of bytes read, less than 'len' at end of file,
+  //         -1 on read error
+  long read(char *buf, long len);
+
+  Backend backend() const { return backend_; }
+
+  // true if the file is read with O_DIRECT
+  bool direct() const { return direct_; }
+
+  // Returns name of backend for the statistics, e.g. "direct-io_uring".
+  const char *name() const;
+
+  struct Chunk;
+  struct Uring;
+  struct Pool;
+
+private:
+  char *filename_;
+  int fd_;
+  bool direct_;
+  Backend backend_;
+
+  off_t fileSize_;
+  off_t pos_;        // file offset of next 'read()'
+  off_t nextOffset_; // file offset of next chunk that is queued
+
+  char *mem_;        // chunk buffers, not aligned
+  Chunk *chunks_;    // ring of chunks in file offset order
+  int head_;         // oldest chunk in use
+  int used_;         // number of chunks in use
+
+  Uring *uring_;
+  Pool *pool_;
+
+  int openFile(bool direct);
+  void startBackend();
+  void stopBackend();
+
+  void submit(Chunk *);
+  void flush();
+  int wait(Chunk *);
+  void release(Chunk *);
+  void drain();
+  int reopenBuffered();
+};
+
+#endif
@@ -118,7 +118,11 @@ void Toc::update()
   long tlength; // length of single track in blocks
   int tnum;
 
+  trackIndex_.clear();
+
   for (run = tracks_, tnum = 1; run != NULL; run = run->next, tnum++) {
+    trackIndex_.push_back(run);
+
     tlength = run->track->length().lba();
 
     run->absStart = Msf(length);
@@ -213,6 +217,8 @@ int Toc::check() const
   int trackNr;
   int ret = 0;
 
+  prefetchAudioInfo();
+
   for (t = tracks_, trackNr = 1; t != NULL; t = t->next, trackNr++) {
     ret |= t->track->check(trackNr);
   }
@@ -222,6 +228,8 @@ int Toc::check() const
 
 bool Toc::recomputeLength()
 {
+  prefetchAudioInfo();
+
   for (TrackEntry* t = tracks_; t; t = t->next) {
     if (!t->track->recomputeLength())
       return false;
@@ -231,6 +239,29 @@ bool Toc::recomputeLength()
   return true;
 }
 
+// Parses the headers of all WAVE files in parallel so that the
+// following length determinations are answered from 'AudioInfoCache'.
+void Toc::prefetchAudioInfo() const
+{
+  std::vector<std::pair<std::string, long> > list;
+  const TrackData *td;
+  TrackEntry *t;
+
+  for (t = tracks_; t != NULL; t = t->next) {
+    SubTrackIterator itr(t->track);
+
+    for (td = itr.first(); td != NULL; td = itr.next()) {
+      if (td->type() == TrackData::DATAFILE &&
+	  td->mode() == TrackData::AUDIO &&
+	  TrackData::audioFileType(td->filename()) == TrackData::WAVE)
+	list.push_back(std::make_pair(std::string(td->filename()),
+				      td->offset()));
+    }
+  }
+
+  TrackData::prefetchWaveLengths(list);
+}
+
 // Sets catalog number. 's' must be a string of 13 digits.
 // return: 0: OK
 //         1: illegal catalog string
@@ -321,32 +352,40 @@ void Toc::markFileConversion(const char* src, const char* dst)
     t->track->markFileConversion(src, dst);
 }
 
-// find track entry that contains given sample number
+// find track entry that contains given sample number with a binary search
+// over 'trackIndex_'
 // return: found track entry or 'NULL' if sample is out of range
 Toc::TrackEntry *Toc::findTrack(unsigned long sample) const
 {
-  TrackEntry *run;
+  long lo, hi, mid;
 
-  for (run = tracks_; run != NULL; run = run->next) {
-    if (sample < run->end.samples())
-      return run;
+  if (trackIndex_.empty() || sample >= trackIndex_.back()->end.samples())
+    return NULL;
+
+  // find first track with end > 'sample'
+  lo = 0;
+  hi = trackIndex_.size() - 1;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+
+    if (sample < trackIndex_[mid]->end.samples())
+      hi = mid;
+    else
+      lo = mid + 1;
   }
 
-  return NULL;
+  return trackIndex_[lo];
 }
 
 // find track with given number
 // return: found track entry or 'NULL' if 'trackNr' is out of range
 Toc::TrackEntry *Toc::findTrackByNumber(int trackNr) const
 {
-  TrackEntry *run;
-
-  for (run = tracks_; run != NULL; run = run->next) {
-    if (run->trackNr == trackNr)
-      return run;
-  }
+  if (trackNr < 1 || trackNr > (int)trackIndex_.size())
+    return NULL;
 
-  return NULL;
+  return trackIndex_[trackNr - 1];
 }
 
 Track *Toc::getTrack(int trackNr)
@@ -23,6 +23,7 @@
 #include <iostream>
 #include <list>
 #include <string>
+#include <vector>
 
 #include "Track.h"
 #include "CdTextContainer.h"
@@ -142,12 +143,15 @@ private:
 
   void checkConsistency();
 
+  void prefetchAudioInfo() const;
 
   TocType tocType_; // type of TOC
 
   int nofTracks_, firstTrackNo_;
   TrackEntry *tracks_;
   TrackEntry *lastTrack_;
+  std::vector<TrackEntry *> trackIndex_; // all tracks in order, rebuilt by
+                                         // 'update()'
 
   Msf length_; // total length of disc
 
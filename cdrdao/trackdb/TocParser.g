@@ -21,6 +21,8 @@
 #header <<
 #include <config.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include "Toc.h"
 #include "util.h"
 #include "log.h"
@@ -871,6 +873,10 @@ cdTextGlobal [ CdTextContainer &container ]
 <<
 ANTLRTokenType TocLexer::erraction()
 {
+  // errors are reported by the real parse, not by 'prefetchAudioFiles()'
+  if (parser_ == NULL)
+    return Eof;
+
   log_message(-2, "%s:%d: Illegal token: %s", parser_->filename_,
 	  _line, _lextext);
   parser_->error_ = 1;
@@ -911,8 +917,86 @@ void TocParserGram::syn(_ANTLRTokenPtr tok, ANTLRChar *egroup,
 }
 
 
+// Scans the toc file read from 'in' for FILE/AUDIOFILE statements and
+// parses the headers of all referenced WAVE files in parallel. The lengths
+// that are determined while parsing are then answered from
+// 'AudioInfoCache' instead of reading the headers one after another.
+// Syntax errors are ignored, they are reported by the following parse.
+static void prefetchAudioFiles(DLGInputStream *in)
+{
+  TocLexer scan(in);
+  ANTLRToken aToken;
+  ANTLRAbstractToken *tok;
+  ANTLRTokenType tt;
+  std::vector<std::pair<std::string, long> > files;
+  std::string name;
+  const char *text;
+  int state = 0; // 1: after FILE, 2: in file name, 3: after file name,
+                 // 4: after '#'
+
+  scan.setToken(&aToken);
+
+  do {
+    tok = scan.getToken();
+    tt = tok->getType();
+    text = tok->getText();
+
+    switch (state) {
+    case 1:
+      state = (tt == BeginString) ? 2 : 0;
+      name = "";
+      break;
+
+    case 2:
+      if (tt == String) {
+	name += text;
+      }
+      else if (tt == StringQuote) {
+	name += '"';
+      }
+      else if (tt == StringOctal) {
+	name += (char)strtol(text + 1, NULL, 8);
+      }
+      else {
+	if (TrackData::audioFileType(name.c_str()) == TrackData::WAVE) {
+	  files.push_back(std::make_pair(name, 0L));
+	  state = 3;
+	}
+	else {
+	  state = 0;
+	}
+      }
+      break;
+
+    case 3:
+      if (strcmp(text, "#") == 0)
+	state = 4;
+      else if (tt != Swap)
+	state = 0;
+      break;
+
+    case 4:
+      if (tt == Integer)
+	files.back().second = strtol(text, NULL, 10);
+      state = 0;
+      break;
+    }
+
+    if (state == 0 && tt != String &&
+	(strcmp(text, "FILE") == 0 || strcmp(text, "AUDIOFILE") == 0))
+      state = 1;
+
+    delete tok;
+  } while (tt != Eof);
+
+  TrackData::prefetchWaveLengths(files);
+}
+
 Toc *parseToc(const char* inp, const char *filename)
 {
+  DLGStringInput pre(inp);
+  prefetchAudioFiles(&pre);
+
   DLGStringInput in(inp);
   TocLexer scan(&in);
   ANTLRTokenBuffer pipe(&scan);
@@ -938,6 +1022,20 @@ Toc *parseToc(const char* inp, const char *filename)
 
 Toc *parseToc(FILE *fp, const char *filename)
 {
+  long pos;
+
+  // the file is scanned twice if it is seekable
+  if ((pos = ftell(fp)) >= 0) {
+    DLGFileInput pre(fp);
+    prefetchAudioFiles(&pre);
+
+    if (fseek(fp, pos, SEEK_SET) != 0) {
+      log_message(-2, "%s: Cannot rewind toc file: %s", filename,
+		  strerror(errno));
+      return NULL;
+    }
+  }
+
   DLGFileInput in(fp);
   TocLexer scan(&in);
   ANTLRTokenBuffer pipe(&scan);
@@ -30,6 +30,7 @@
 #include "TrackDataList.h"
 #include "CdTextItem.h"
 #include "lec.h"
+#include "subrw.h"
 
 Track::Track(TrackData::Mode t, TrackData::SubChannelMode st) 
   : length_(0), start_(0), end_(0)
@@ -73,6 +74,8 @@ Track::Track(const Track &obj)
       lastSubTrack_->next_->pred_ = lastSubTrack_;
       lastSubTrack_ = lastSubTrack_->next_;
     }
+
+    subTrackIndex_.push_back(lastSubTrack_);
   }
 
   nofIndices_ = obj.nofIndices_;
@@ -224,10 +227,14 @@ void Track::update()
 
   length_ = Msf(lenLba);
 
+  subTrackIndex_.clear();
+  subTrackIndex_.reserve(nofSubTracks_);
+
   slength = 0;
   for (run = subTracks_; run != NULL; run = run->next_) {
     run->start(slength); // set start position of sub-track
     slength += run->length();
+    subTrackIndex_.push_back(run);
   }
 
 
@@ -607,11 +614,12 @@ bool Track::resolveFilename(const char* path)
   return true;
 }
 
-// Locates 'SubTrack' that contains specified sample.
+// Locates 'SubTrack' that contains specified sample with a binary search
+// over 'subTrackIndex_'.
 // return: found 'SubTrack' or 'NULL' if given sample is out of range
 SubTrack *Track::findSubTrack(unsigned long sample) const
 {
-  SubTrack *run;
+  long lo, hi, mid;
 
   if (audioCutMode()) {
     if (sample >= length_.samples()) 
@@ -623,14 +631,23 @@ SubTrack *Track::findSubTrack(unsigned long sample) const
       return NULL;
   }
 
-  for (run = subTracks_;
-       run != NULL && run->next_ != NULL;
-       run = run->next_) {
-    if (sample < run->next_->start())
-      return run;
+  if (subTrackIndex_.empty())
+    return NULL;
+
+  // find last sub-track with start <= 'sample'
+  lo = 0;
+  hi = subTrackIndex_.size() - 1;
+
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+
+    if (subTrackIndex_[mid]->start() <= sample)
+      lo = mid;
+    else
+      hi = mid - 1;
   }
 
-  return run;
+  return subTrackIndex_[lo];
 }
 
 
@@ -1465,7 +1482,6 @@ int TrackReader::openData()
   assert(track_ != NULL);
 
   int ret = 0;
-  //int i;
 
   open_ = 1;
   readPos_ = 0;
@@ -1476,10 +1492,7 @@ int TrackReader::openData()
   reader.init(readSubTrack_);
 
   subChanDelayLineIndex_ = 0;
-  /*
-  for(i = 0; i < MAX_SUB_DEL; i++)
-    memset(subChanDelayLine_[i], 0, 24);
-  */
+  memset(subChanDelayLine_, 0, sizeof(subChanDelayLine_));
 
   if (readSubTrack_ != NULL) {
     ret = reader.openData();
@@ -1501,12 +1514,34 @@ void TrackReader::closeData()
 }
 
 
+// Reads 'len' blocks starting at the current read position, see
+// 'readBlock()' for the meaning of 'encodingMode' and 'subChanEncodingMode'.
+// If 'modes' is not NULL and 'encodingMode' is 0 the data mode of each
+// block is stored in 'modes' and the L-EC encoding of data blocks is left
+// to 'encodeData()'. This allows to move the CPU intensive encoding to
+// another thread. Otherwise all read data blocks are encoded in one batch
+// before returning.
+// If 'blockLen' is not 0 the blocks are stored 'blockLen' bytes apart in
+// 'buf', e.g. to leave room for sub-channel data that is added later.
+// The R-W sub-channel data of all read blocks is encoded in one batch, too.
+// Return: number of read blocks, -1 on error
+
 long TrackReader::readData(int encodingMode, int subChanEncodingMode,
-			   long lba, char *buf, long len)
+			   long lba, char *buf, long len,
+			   TrackData::Mode *modes, long blockLen)
 {
   long err = 0;
-  long b;
+  long b, i, n;
   long offset; 
+  char *startBuf = buf;
+  long startLba = lba;
+  bool encode = false;
+  bool encodeRW = (subChanEncodingMode == 1 &&
+		   track_->subChannelType() == TrackData::SUBCHAN_RW);
+  u_int8_t *rwBuf = NULL; // R-W data of the blocks of the current batch
+  u_int8_t *rw;
+  long rwStride = 0;
+  long rwCount = 0;
 
   assert(open_ != 0);
 
@@ -1516,14 +1551,91 @@ long TrackReader::readData(int encodingMode, int subChanEncodingMode,
     }
   }
 
-  for (b = 0; b < len; b++) {
+  if (modes == NULL && encodingMode == 0 &&
+      track_->type() != TrackData::AUDIO) {
+    // collect the data modes and encode all blocks at the end
+    if ((long)modes_.size() < len)
+      modes_.resize(len);
+
+    modes = &modes_[0];
+    encode = true;
+  }
+
+  b = 0;
+
+  while (b < len) {
+    if ((n = bulkBlocks(encodingMode, len - b, blockLen)) > 0) {
+      // blocks need no rearrangement, read them in one go
+      TrackData::Mode dataMode = readSubTrack_->mode();
+
+      if (reader.readData((Sample*)buf,
+			  track_->audioCutMode() ? n * SAMPLES_PER_BLOCK
+			                         : n * AUDIO_BLOCK_LEN) < 0) {
+	err = 1;
+	break;
+      }
+
+      if (modes != NULL) {
+	for (i = 0; i < n; i++)
+	  modes[b + i] = dataMode;
+      }
+
+      buf += n * AUDIO_BLOCK_LEN;
+      lba += n;
+      b += n;
+      continue;
+    }
+
     if ((offset = readBlock(encodingMode, subChanEncodingMode, lba,
-			    (Sample*)buf)) == 0) {
+			    (Sample*)buf,
+			    modes != NULL ? modes + b : NULL)) == 0) {
       err = 1;
       break;
     }
+
+    if (encodeRW) {
+      // the R-W data follows the block data, blocks of different data
+      // modes may not be equally spaced
+      rw = (u_int8_t *)buf + offset - SUBRW_SECTOR_LEN;
+
+      if (rwCount > 1 && rw != rwBuf + rwCount * rwStride) {
+	subrw_encode_sectors(rwBuf, rwCount, rwStride,
+			     &subChanDelayLineIndex_, subChanDelayLine_);
+	rwCount = 0;
+      }
+
+      if (rwCount == 0)
+	rwBuf = rw;
+      else if (rwCount == 1)
+	rwStride = rw - rwBuf;
+
+      rwCount++;
+    }
+
+    if (blockLen != 0) {
+      assert(offset <= blockLen);
+      offset = blockLen;
+    }
+
     buf += offset;
     lba++;
+    b++;
+  }
+
+  // The symbols that are still in the delay line when the end of the
+  // track is reached are dropped, see 'openData()'.
+  if (rwCount > 0 && err == 0)
+    subrw_encode_sectors(rwBuf, rwCount, rwStride, &subChanDelayLineIndex_,
+			 subChanDelayLine_);
+
+  if (encode && err == 0) {
+    // the sub-channel mode is the same for all sub-tracks so the blocks
+    // are equally spaced
+    if (blockLen == 0)
+      blockLen = AUDIO_BLOCK_LEN +
+	TrackData::subChannelSize(track_->subChannelType());
+
+    encodeData(modes, startLba, startBuf, b, blockLen);
   }
 
   readPos_ += b;
@@ -1531,6 +1643,46 @@ long TrackReader::readData(int encodingMode, int subChanEncodingMode,
   return err == 0 ? b : -1;
 }
 
+// Returns the number of the next 'len' blocks that can be read with a
+// single call of 'TrackDataReader::readData()' because they are stored
+// in the file exactly like they are required in the read buffer: AUDIO
+// or raw blocks without sub-channel data that are completely contained in
+// the current sub-track and are read with encoding mode 0.
+// Return: number of blocks, 0 if the next block must be read with
+//         'readBlock()'
+
+long TrackReader::bulkBlocks(int encodingMode, long len, long blockLen)
+{
+  if (encodingMode != 0 || len < 2 ||
+      (blockLen != 0 && blockLen != AUDIO_BLOCK_LEN))
+    return 0;
+
+  if (readSubTrack_ == NULL ||
+      readSubTrack_->subChannelMode() != TrackData::SUBCHAN_NONE)
+    return 0;
+
+  switch (readSubTrack_->mode()) {
+  case TrackData::AUDIO:
+  case TrackData::MODE1_RAW:
+  case TrackData::MODE2_RAW:
+    break;
+  default:
+    return 0;
+  }
+
+  long n = reader.readLeft();
+
+  if (track_->audioCutMode())
+    n /= SAMPLES_PER_BLOCK;
+  else
+    n /= AUDIO_BLOCK_LEN;
+
+  if (n > len)
+    n = len;
+
+  return n < 2 ? 0 : n;
+}
+
 // Reads one block from sub-tracks and performs the data encoding for the
 // block.
 // encodingMode: conrols how the sector data is encoded
@@ -1543,12 +1695,16 @@ long TrackReader::readData(int encodingMode, int subChanEncodingMode,
 //                  (2336 bytes).
 // subChanEncodingMode: conrols how the R-W sub-channel data is encoded
 //                      0: plain R-W data
-//                      1: generate Q and P parity and interleave
+//                      1: generate Q and P parity and interleave, this is
+//                         done by 'readData()' for all read blocks
 // lba: Logical block address that must be encoded into header of data blocks
+// mode: if not NULL and 'encodingMode' is 0 the L-EC encoding and scrambling
+//       of data blocks is skipped and the data mode of the block is stored
+//       here, see 'encodeData()'
 // Return: 0 if error occured, else length of block that has been filled
 //         
 int TrackReader::readBlock(int encodingMode, int subChanEncodingMode,
-			   long lba, Sample *buf)
+			   long lba, Sample *buf, TrackData::Mode *mode)
 {
   TrackData::Mode dataMode; // current data mode of sub-track
   TrackData::SubChannelMode subChanMode; // current sub-channel mode of sub-track
@@ -1687,67 +1843,10 @@ int TrackReader::readBlock(int encodingMode, int subChanEncodingMode,
   unsigned char *encBuf = (unsigned char *)buf;
 
   if (encodingMode == 0) {
-    // encode data block according to 'dataMode'
-
-    switch (dataMode) {
-    case TrackData::AUDIO:
-      break;
-    case TrackData::MODE0:
-      lec_encode_mode0_sector(lba, encBuf);
-      lec_scramble(encBuf);
-      break;
-    case TrackData::MODE1:
-      lec_encode_mode1_sector(lba, encBuf);
-      lec_scramble(encBuf);
-      break;
-    case TrackData::MODE1_RAW:
-      {
-	Msf m(lba);
-
-	if (int2bcd(m.min()) != encBuf[12] ||
-	    int2bcd(m.sec()) != encBuf[13] ||
-	    int2bcd(m.frac()) != encBuf[14]) {
-	  // sector address mismatch -> rebuild L-EC since it covers the header
-	  lec_encode_mode1_sector(lba, encBuf);
-	}
-
-	lec_scramble(encBuf);
-      }
-      break;
-    case TrackData::MODE2:
-      lec_encode_mode2_sector(lba, encBuf);
-      lec_scramble(encBuf);
-      break;
-    case TrackData::MODE2_FORM1:
-      lec_encode_mode2_form1_sector(lba, encBuf);
-      lec_scramble(encBuf);
-      break;
-    case TrackData::MODE2_FORM2:
-      lec_encode_mode2_form2_sector(lba, encBuf);
-      lec_scramble(encBuf);
-      break;
-    case TrackData::MODE2_FORM_MIX:
-      if ((encBuf[16+2] & 0x20) != 0)
-	lec_encode_mode2_form2_sector(lba, encBuf);
-      else
-	lec_encode_mode2_form1_sector(lba, encBuf);
-
-      lec_scramble(encBuf);
-      break;
-    case TrackData::MODE2_RAW:
-      {
-	Msf m(lba);
-
-	// L-EC does not cover sector header so it is relocatable
-	// just update the sector address in the header
-	encBuf[12] = int2bcd(m.min());
-	encBuf[13] = int2bcd(m.sec());
-	encBuf[14] = int2bcd(m.frac());
-
-	lec_scramble(encBuf);
-      }
-      break;
-    }
+    if (mode != NULL)
+      *mode = dataMode; // encoding is done later by 'encodeData()'
+    else
+      encodeBlocks(dataMode, lba, encBuf, 1, AUDIO_BLOCK_LEN);
   }
   else if (encodingMode == 1) {
     switch (dataMode) {
@@ -1770,32 +1869,109 @@ int TrackReader::readBlock(int encodingMode, int subChanEncodingMode,
     }
   }
 
-  // encode R-W sub-channel data
-  switch (subChanMode) {
-  case TrackData::SUBCHAN_NONE:
+  // Raw R-W data is passed unchanged. Converting it to plain data for
+  // 'subChanEncodingMode' 0 is not supported, no driver requests it.
+  if (subChannelDataLen > 0) {
+    char *subChannelTargetBuf = (char *)buf + offset;
+    
+    memcpy(subChannelTargetBuf, subChanData, subChannelDataLen);
+  }
+ 
+  return (offset + subChannelDataLen);
+}
+
+// Performs the L-EC encoding and scrambling of 'len' consecutive blocks
+// with the same data mode that were read with encoding mode 0 and
+// deferred encoding.
+// mode: data mode of blocks as returned by 'readBlock()'
+// lba : logical block address of first block
+// encBuf: block data, 2352 bytes per block
+// blockLen: distance of the blocks in 'encBuf'
+
+void TrackReader::encodeBlocks(TrackData::Mode mode, long lba,
+			       unsigned char *encBuf, long len, long blockLen)
+{
+  unsigned char *p;
+  long b;
+  int type;
+
+  switch (mode) {
+  case TrackData::AUDIO:
+    return;
+  case TrackData::MODE0:
+    type = LEC_MODE0;
+    break;
+  case TrackData::MODE1:
+    type = LEC_MODE1;
     break;
-  case TrackData::SUBCHAN_RW:
-    if (subChanEncodingMode == 1) {
-      /*do_encode_sub((unsigned char*)subChanData, 1, 1,
-		    &subChanDelayLineIndex_, subChanDelayLine_);
-      */
+  case TrackData::MODE1_RAW:
+    for (b = 0, p = encBuf; b < len; b++, p += blockLen) {
+      Msf m(lba + b);
+
+      if (int2bcd(m.min()) != p[12] ||
+          int2bcd(m.sec()) != p[13] ||
+          int2bcd(m.frac()) != p[14]) {
+        // sector address mismatch -> rebuild L-EC since it covers the header
+        lec_encode_mode1_sector(lba + b, p);
+      }
     }
+
+    type = LEC_ENCODED;
+    break;
+  case TrackData::MODE2:
+    type = LEC_MODE2;
+    break;
+  case TrackData::MODE2_FORM1:
+    type = LEC_MODE2_FORM1;
     break;
+  case TrackData::MODE2_FORM2:
+    type = LEC_MODE2_FORM2;
+    break;
+  case TrackData::MODE2_FORM_MIX:
+    type = LEC_MODE2_FORM_MIX;
+    break;
+  case TrackData::MODE2_RAW:
+    for (b = 0, p = encBuf; b < len; b++, p += blockLen) {
+      Msf m(lba + b);
 
-  case TrackData::SUBCHAN_RW_RAW:
-    if (subChanEncodingMode == 0) {
-      // to be done
+      // L-EC does not cover sector header so it is relocatable
+      // just update the sector address in the header
+      p[12] = int2bcd(m.min());
+      p[13] = int2bcd(m.sec());
+      p[14] = int2bcd(m.frac());
     }
+
+    type = LEC_ENCODED;
     break;
+  default:
+    return;
   }
-  
-  if (subChannelDataLen > 0) {
-    char *subChannelTargetBuf = (char *)buf + offset;
-    
-    memcpy(subChannelTargetBuf, subChanData, subChannelDataLen);
+
+  lec_encode_sectors(type, lba, encBuf, len, blockLen);
+}
+
+// Encodes 'len' blocks that were read by 'readData()' with encoding mode 0
+// and a non NULL 'modes' array. This is independent of the reader state and
+// may be called from a different thread than 'readData()'. Runs of blocks
+// with the same data mode are encoded as one batch.
+// modes: data mode of each block as returned by 'readData()'
+// lba: logical block address of first block
+// buf: block data
+// len: number of blocks
+// blockLen: length of each block in 'buf' including sub-channel data
+
+void TrackReader::encodeData(const TrackData::Mode *modes, long lba,
+			     char *buf, long len, long blockLen)
+{
+  long b, n;
+
+  for (b = 0; b < len; b += n) {
+    for (n = 1; b + n < len && modes[b + n] == modes[b]; n++)
+      ;
+
+    encodeBlocks(modes[b], lba + b, (unsigned char *)buf + b * blockLen, n,
+		 blockLen);
   }
- 
-  return (offset + subChannelDataLen);
 }
 
 long TrackReader::readTrackData(Sample *buf, long len)
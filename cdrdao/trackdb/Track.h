@@ -21,6 +21,7 @@
 #define __TRACK_H__
 
 #include <iostream>
+#include <vector>
 
 #include "SubTrack.h"
 #include "Msf.h"
@@ -143,6 +144,8 @@ private:
   int nofSubTracks_;    // number of sub tracks
   SubTrack *subTracks_; // list of subtracks
   SubTrack *lastSubTrack_; // points to last sub-track in list
+  std::vector<SubTrack *> subTrackIndex_; // all sub-tracks ordered by start
+                                          // position, rebuilt by 'update()'
 
   int nofIndices_;      // number of index increments
   Msf *index_;          // index increment times
@@ -181,9 +184,14 @@ public:
 
   void init(const Track *);
 
+  // see 'TrackDataReader::swapSamples()'
+  void swapSamples(int f) { reader.swapSamples(f); }
+
   int openData();
   long readData(int raw, int subChanEncodingMode, long lba, char *buf,
-		long len);
+		long len, TrackData::Mode *modes = NULL, long blockLen = 0);
+  static void encodeData(const TrackData::Mode *modes, long lba, char *buf,
+			 long len, long blockLen);
   int seekSample(unsigned long sample);
   long readSamples(Sample *buf, long len);
   void closeData();
@@ -200,12 +208,19 @@ private:
   const SubTrack *readSubTrack_; // actual read sub-track
   int open_; // 1 indicates the 'openData()' was called
 
+  std::vector<TrackData::Mode> modes_; // block modes for 'readData()'
+
+  // state of the R-W sub-channel interleaver, see 'subrw_encode_sectors()'
   unsigned long subChanDelayLineIndex_;
   unsigned char subChanDelayLine_[8][24];
 
 
   long readTrackData(Sample *buf, long len);
-  int readBlock(int raw, int subChanEncodingMode, long lba, Sample *buf);
+  long bulkBlocks(int encodingMode, long len, long blockLen);
+  int readBlock(int raw, int subChanEncodingMode, long lba, Sample *buf,
+		TrackData::Mode *mode);
+  static void encodeBlocks(TrackData::Mode, long lba, unsigned char *buf,
+			   long len, long blockLen);
 };
 
 class SubTrackIterator {
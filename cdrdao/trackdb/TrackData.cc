@@ -27,11 +27,49 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <stdarg.h>
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "TrackData.h"
 #include "Msf.h"
 #include "util.h"
 #include "log.h"
+#include "stats.h"
+#include "DirectReader.h"
+#include "AudioInfoCache.h"
+
+// Size of the read-ahead buffer of 'TrackDataReader'. Track data is
+// read from the file in chunks of this size to avoid a system call for
+// each block.
+#define READ_AHEAD_LEN (1024 * AUDIO_BLOCK_LEN)
+
+// Maximum number of threads used by 'prefetchWaveLengths()'.
+#define PREFETCH_THREADS 8
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+// Regular data files are mapped into memory instead of being read. With
+// a 64 bit address space the whole file is mapped, otherwise a sliding
+// window of MAP_WINDOW_LEN bytes.
+#define USE_MMAP_READER
+#define MAP_WINDOW_LEN (256L * 1024 * 1024)
+
+static long pageSize()
+{
+  static long size = 0;
+
+  if (size == 0)
+    size = sysconf(_SC_PAGESIZE);
+
+  return size;
+}
+#endif
 
 #ifdef UNIXWARE
 extern "C" {
@@ -585,6 +623,10 @@ TrackData *TrackData::merge(const TrackData *obj) const
   return data;
 }
 
+static int cachedWaveLength(const char *filename, long offset,
+			    const struct stat *st, bool report,
+			    long *hdrlen, unsigned long *datalen);
+
 // Checks if given audio file is suitable for cdrdao. 'length' is filled
 // with number of samples in audio file on success.
 // return: 0: file is suitable
@@ -593,8 +635,6 @@ TrackData *TrackData::merge(const TrackData *obj) const
 
 int TrackData::checkAudioFile(const char *fn, unsigned long *length)
 {
-  int fd;
-  int ret;
   struct stat buf;
   long headerLength = 0;
 
@@ -604,18 +644,11 @@ int TrackData::checkAudioFile(const char *fn, unsigned long *length)
     return 1;
   }
   
-  if ((fd = open(fn, O_RDONLY)) < 0)
-    return 1;
-
-  ret = fstat(fd, &buf);
-
-  close(fd);
-
-  if (ret != 0)
+  if (stat(fn, &buf) != 0)
     return 1;
 
   if (ft == WAVE) {
-    if (waveLength(fn, 0, &headerLength, length) != 0)
+    if (cachedWaveLength(fn, 0, &buf, true, &headerLength, length) != 0)
       return 2;
   } else {
     if (buf.st_size % sizeof(Sample) != 0) {
@@ -629,14 +662,33 @@ int TrackData::checkAudioFile(const char *fn, unsigned long *length)
 }
 
 
-// Determines length of header and audio data for WAVE files. 'hdrlen' is
-// filled with length of WAVE header in bytes. 'datalen' is filled with
-// length of audio data in samples (if != NULL).
+// Logs a message of 'parseWaveHeader()' if 'report' is true.
+static void waveMessage(bool report, int level, const char *fmt, ...)
+{
+  char buf[1024];
+  va_list args;
+
+  if (!report)
+    return;
+
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+
+  log_message(level, "%s", buf);
+}
+
+// Parses the WAVE header at 'offset' of given file. 'hdrlen' is filled
+// with length of WAVE header in bytes. 'datalen' is filled with length of
+// audio data in samples (if != NULL). 'sbuf' is filled with the status of
+// the file. 'warned' is set to true if a warning was issued about the
+// length of the data chunk.
 // return: 0: OK
 //         1: error occured
 //         2: illegal WAVE file
-int TrackData::waveLength(const char *filename, long offset,
-			  long *hdrlen, unsigned long *datalen)
+static int parseWaveHeader(const char *filename, long offset, bool report,
+			   long *hdrlen, unsigned long *datalen,
+			   struct stat *sbuf, bool *warned)
 {
   FILE *fp;
   char magic[4];
@@ -646,7 +698,8 @@ int TrackData::waveLength(const char *filename, long offset,
   short waveChannels;
   long waveRate;
   short waveBits;
-  struct stat sbuf;
+
+  *warned = false;
 
 #ifdef __CYGWIN__
   if ((fp = fopen(filename, "rb")) == NULL)
@@ -654,22 +707,23 @@ int TrackData::waveLength(const char *filename, long offset,
   if ((fp = fopen(filename, "r")) == NULL)
 #endif
   {
-    log_message(-2, "Cannot open audio file \"%s\" for reading: %s",
+    waveMessage(report, -2, "Cannot open audio file \"%s\" for reading: %s",
 	    filename, strerror(errno));
     return 1;
   }
 
   if (offset != 0) {
     if (fseek(fp, offset, SEEK_SET) != 0) {
-      log_message(-2, "Cannot seek to offset %ld in file \"%s\": %s",
+      waveMessage(report, -2, "Cannot seek to offset %ld in file \"%s\": %s",
 	      offset, filename, strerror(errno));
+      fclose(fp);
       return 1;
     }
   }
 
   if (fread(magic, sizeof(char), 4, fp) != 4 ||
       strncmp("RIFF", magic, 4) != 0) {
-    log_message(-2, "%s: not a WAVE file.", filename);
+    waveMessage(report, -2, "%s: not a WAVE file.", filename);
     fclose(fp);
     return 2;
   }
@@ -678,7 +732,7 @@ int TrackData::waveLength(const char *filename, long offset,
 
   if (fread(magic, sizeof(char), 4, fp) != 4 ||
       strncmp("WAVE", magic, 4) != 0) {
-    log_message(-2, "%s: not a WAVE file.", filename);
+    waveMessage(report, -2, "%s: not a WAVE file.", filename);
     fclose(fp);
     return 2;
   }
@@ -686,7 +740,7 @@ int TrackData::waveLength(const char *filename, long offset,
   // search for format chunk
   for (;;) {
     if (fread(magic, sizeof(char), 4, fp) != 4) {
-      log_message(-2, "%s: corrupted WAVE file.", filename);
+      waveMessage(report, -2, "%s: corrupted WAVE file.", filename);
       fclose(fp);
       return 1;
     }
@@ -701,14 +755,14 @@ int TrackData::waveLength(const char *filename, long offset,
 
     // skip chunk data
     if (fseek(fp, len, SEEK_CUR) != 0) {
-      log_message(-2, "%s: corrupted WAVE file.", filename);
+      waveMessage(report, -2, "%s: corrupted WAVE file.", filename);
       fclose(fp);
       return 1;
     }
   }
 
   if (len < 16) {
-    log_message(-2, "%s: corrupted WAVE file.", filename);
+    waveMessage(report, -2, "%s: corrupted WAVE file.", filename);
     fclose(fp);
     return 1;
   }
@@ -717,14 +771,14 @@ int TrackData::waveLength(const char *filename, long offset,
 
   if (waveFormat != 1) {
     // not PCM format
-    log_message(-2, "%s: not in PCM format.", filename);
+    waveMessage(report, -2, "%s: not in PCM format.", filename);
     fclose(fp);
     return 2;
   }
 
   waveChannels = readShort(fp);
   if (waveChannels != 2) {
-    log_message(-2, "%s: found %d channel(s), require 2 channels.",
+    waveMessage(report, -2, "%s: found %d channel(s), require 2 channels.",
 	    filename, waveChannels);
     fclose(fp);
     return 2;
@@ -732,7 +786,7 @@ int TrackData::waveLength(const char *filename, long offset,
 
   waveRate = readLong(fp);
   if (waveRate != 44100) {
-     log_message(-2, "%s: found sampling rate %ld, require 44100.",
+     waveMessage(report, -2, "%s: found sampling rate %ld, require 44100.",
 	    filename, waveRate);
      fclose(fp);
      return 2;
@@ -743,7 +797,7 @@ int TrackData::waveLength(const char *filename, long offset,
   
   waveBits = readShort(fp);
   if (waveBits != 16) {
-    log_message(-2, "%s: found %d bits per sample, require 16.",
+    waveMessage(report, -2, "%s: found %d bits per sample, require 16.",
 	    filename, waveBits);
     fclose(fp);
     return 2;
@@ -753,7 +807,7 @@ int TrackData::waveLength(const char *filename, long offset,
 
   // skip chunk data
   if (fseek(fp, len, SEEK_CUR) != 0) {
-    log_message(-2, "%s: corrupted WAVE file.", filename);
+    waveMessage(report, -2, "%s: corrupted WAVE file.", filename);
     fclose(fp);
     return 1;
   }
@@ -761,7 +815,7 @@ int TrackData::waveLength(const char *filename, long offset,
   // search wave data chunk
   for (;;) {
     if (fread(magic, sizeof(char), 4, fp) != 4) {
-      log_message(-2, "%s: corrupted WAVE file.", filename);
+      waveMessage(report, -2, "%s: corrupted WAVE file.", filename);
       fclose(fp);
       return 1;
     }
@@ -777,14 +831,14 @@ int TrackData::waveLength(const char *filename, long offset,
      
     // skip chunk data
     if (fseek(fp, len, SEEK_CUR) != 0) {
-      log_message(-2, "%s: corrupted WAVE file.", filename);
+      waveMessage(report, -2, "%s: corrupted WAVE file.", filename);
       fclose(fp);
       return 1;
     }
   }
 
   if ((headerLen = ftell(fp)) < 0) {
-    log_message(-2, "%s: cannot determine file position: %s",
+    waveMessage(report, -2, "%s: cannot determine file position: %s",
 	    filename, strerror(errno));
     fclose(fp);
     return 1;
@@ -792,8 +846,8 @@ int TrackData::waveLength(const char *filename, long offset,
 
   headerLen -= offset;
 
-  if (fstat(fileno(fp), &sbuf) != 0) {
-    log_message(-2, "Cannot fstat audio file \"%s\": %s", filename,
+  if (fstat(fileno(fp), sbuf) != 0) {
+    waveMessage(report, -2, "Cannot fstat audio file \"%s\": %s", filename,
 	    strerror(errno));
     fclose(fp);
     return 1;
@@ -801,15 +855,17 @@ int TrackData::waveLength(const char *filename, long offset,
 
   fclose(fp);
 
-  if (len + headerLen + offset > sbuf.st_size) {
-    log_message(-1,	"%s: file length does not match length from WAVE header - using actual length.", filename);
-    len = sbuf.st_size - offset - headerLen;
+  if (len + headerLen + offset > sbuf->st_size) {
+    waveMessage(report, -1,	"%s: file length does not match length from WAVE header - using actual length.", filename);
+    *warned = true;
+    len = sbuf->st_size - offset - headerLen;
   }
 
   if (len % sizeof(Sample) != 0) {
-    log_message(-1,
+    waveMessage(report, -1,
 	    "%s: length of data chunk is not a multiple of sample size (4).",
 	    filename);
+    *warned = true;
   }
 
   *hdrlen = headerLen;
@@ -821,6 +877,122 @@ int TrackData::waveLength(const char *filename, long offset,
   return 0;
 }
 
+// Like 'parseWaveHeader()' but uses 'AudioInfoCache' to avoid parsing the
+// same file again. 'st' is the current status of the file or NULL if it
+// is unknown. Quietly parsed headers that gave warnings are not cached so
+// that the warnings are issued by the next call with 'report' set.
+static int cachedWaveLength(const char *filename, long offset,
+			    const struct stat *st, bool report,
+			    long *hdrlen, unsigned long *datalen)
+{
+  struct stat sbuf;
+  unsigned long len;
+  bool warned;
+  int ret;
+
+  if (st != NULL &&
+      AudioInfoCache::lookup(filename, offset, *st, hdrlen, datalen))
+    return 0;
+
+  ret = parseWaveHeader(filename, offset, report, hdrlen, &len, &sbuf,
+			&warned);
+
+  if (ret == 0) {
+    if (report || !warned)
+      AudioInfoCache::store(filename, offset, sbuf, *hdrlen, len);
+
+    if (datalen != NULL)
+      *datalen = len;
+  }
+
+  return ret;
+}
+
+// Determines length of header and audio data for WAVE files. 'hdrlen' is
+// filled with length of WAVE header in bytes. 'datalen' is filled with
+// length of audio data in samples (if != NULL).
+// return: 0: OK
+//         1: error occured
+//         2: illegal WAVE file
+int TrackData::waveLength(const char *filename, long offset,
+			  long *hdrlen, unsigned long *datalen)
+{
+  struct stat st;
+
+  return cachedWaveLength(filename, offset,
+			  stat(filename, &st) == 0 ? &st : NULL, true,
+			  hdrlen, datalen);
+}
+
+#ifdef USE_POSIX_THREADS
+struct WavePrefetch {
+  const std::vector<std::pair<std::string, long> > *list;
+  size_t next; // index of next entry to parse
+  pthread_mutex_t mutex;
+};
+
+static void *prefetchThread(void *arg)
+{
+  WavePrefetch *p = (WavePrefetch *)arg;
+  const std::pair<std::string, long> *file;
+  struct stat st;
+  long hdrlen;
+
+  for (;;) {
+    pthread_mutex_lock(&p->mutex);
+    file = p->next < p->list->size() ? &(*p->list)[p->next++] : NULL;
+    pthread_mutex_unlock(&p->mutex);
+
+    if (file == NULL)
+      break;
+
+    if (stat(file->first.c_str(), &st) == 0)
+      cachedWaveLength(file->first.c_str(), file->second, &st, false,
+		       &hdrlen, NULL);
+  }
+
+  return NULL;
+}
+#endif
+
+// Parses the headers of the given WAVE files (file name and offset) with
+// up to PREFETCH_THREADS threads and adds them to 'AudioInfoCache'.
+// Errors are not reported, they are reported when the length of the
+// failing entry is determined. Without thread support nothing is done.
+void TrackData::prefetchWaveLengths(const std::vector<std::pair<std::string, long> > &list)
+{
+#ifdef USE_POSIX_THREADS
+  pthread_t threads[PREFETCH_THREADS];
+  WavePrefetch p;
+  int n, i;
+
+  if (list.size() < 2)
+    return;
+
+  n = list.size() < PREFETCH_THREADS ? list.size() : PREFETCH_THREADS;
+
+  p.list = &list;
+  p.next = 0;
+  pthread_mutex_init(&p.mutex, NULL);
+
+  for (i = 0; i < n; i++) {
+    if (pthread_create(&threads[i], NULL, prefetchThread, &p) != 0)
+      break;
+  }
+
+  n = i;
+
+  // parse the headers in this thread if no thread could be created
+  if (n == 0)
+    prefetchThread(&p);
+
+  for (i = 0; i < n; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&p.mutex);
+#endif
+}
+
 // Returns length in samples for given audio file.
 // return: 1: file cannot be opened
 //         2: 'fstat' failed
@@ -831,28 +1003,23 @@ int TrackData::waveLength(const char *filename, long offset,
 int TrackData::audioDataLength(const char *fname, long offset, 
 			       unsigned long *length)
 {
-  int fd;
   struct stat buf;
   long headerLength = 0;
-  int ret;
 
   *length = 0;
 
-  if ((fd = open(fname, O_RDONLY)) < 0)
+  // 'stat()' is sufficient for cached WAVE files and raw files, errors
+  // when opening the file are reported when the data is read
+  if (stat(fname, &buf) != 0)
     return 1;
 
-  ret = fstat(fd, &buf);
-  close(fd);
-
-  if (ret != 0)
-    return 2;
-
   if (offset > buf.st_size)
     return 4;
 
   FileType ftype = audioFileType(fname);
   if (ftype == WAVE) {
-    if (waveLength(fname, offset, &headerLength, length) != 0)
+    if (cachedWaveLength(fname, offset, &buf, true, &headerLength,
+			 length) != 0)
       return 3;
   } else if (ftype == MP3 || ftype == OGG) {
     return 5;
@@ -1038,6 +1205,8 @@ const char *TrackData::subChannelMode2String(SubChannelMode m)
   return ret;
 }
 
+TrackDataReader::FileIo TrackDataReader::fileIo_ = FILE_IO_BUFFERED;
+
 TrackDataReader::TrackDataReader(const TrackData *d)
 {
   trackData_ = d;
@@ -1047,6 +1216,23 @@ TrackDataReader::TrackDataReader(const TrackData *d)
   readPos_ = 0;
   headerLength_ = 0;
   readUnderRunMsgGiven_ = 0;
+
+  swapSamples_ = 0;
+  swap_ = 0;
+
+  buf_ = NULL;
+  bufLen_ = 0;
+  bufPos_ = 0;
+
+  mapped_ = 0;
+  map_ = NULL;
+  mapOffset_ = 0;
+  mapLen_ = 0;
+  filePos_ = 0;
+  fileSize_ = 0;
+  adviseEnd_ = 0;
+
+  direct_ = NULL;
 }
 
 TrackDataReader::~TrackDataReader()
@@ -1055,6 +1241,9 @@ TrackDataReader::~TrackDataReader()
     closeData();
   }
 
+  delete[] buf_;
+  buf_ = NULL;
+
   trackData_ = NULL;
 }
 
@@ -1160,6 +1349,63 @@ int TrackDataReader::openData()
   open_ = 1;
   readUnderRunMsgGiven_ = 0;
 
+  bufLen_ = 0;
+  bufPos_ = 0;
+  mapped_ = 0;
+
+  if (trackData_->type_ == TrackData::DATAFILE) {
+    struct stat st;
+
+    if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) &&
+	(filePos_ = lseek(fd_, 0, SEEK_CUR)) >= 0) {
+      if (fileIo_ == FILE_IO_DIRECT) {
+	direct_ = new DirectReader;
+
+	if (direct_->open(trackData_->filename_) != 0) {
+	  delete direct_;
+	  direct_ = NULL;
+	  close(fd_);
+	  fd_ = -1;
+	  open_ = 0;
+	  return 1;
+	}
+
+	direct_->seek(filePos_);
+      }
+#ifdef USE_MMAP_READER
+      else {
+	// the window is mapped by the first 'mappedRead()'
+	mapped_ = 1;
+	fileSize_ = st.st_size;
+      }
+#endif
+    }
+  }
+
+  if (trackData_->type_ != TrackData::ZERODATA && !mapped_ && direct_ == NULL &&
+      buf_ == NULL)
+    buf_ = new char[READ_AHEAD_LEN];
+
+  // decide once how the samples of this track data must be swapped, WAVE
+  // files contain little endian samples
+  swap_ = 0;
+
+  if (trackData_->type_ != TrackData::ZERODATA &&
+      trackData_->mode_ == TrackData::AUDIO &&
+      trackData_->subChannelMode_ == TrackData::SUBCHAN_NONE) {
+    if (trackData_->fileType_ == TrackData::WAVE)
+      swap_ = 1;
+
+    swap_ ^= trackData_->swapSamples_ ^ swapSamples_;
+  }
+
+  if (direct_ != NULL)
+    stats_label("file_read", direct_->name());
+  else if (mapped_)
+    stats_label("file_read", "mmap");
+  else if (trackData_->type_ != TrackData::ZERODATA)
+    stats_label("file_read", "read");
+
   return 0;
 }
 
@@ -1172,10 +1418,208 @@ void TrackDataReader::closeData()
       close(fd_);
     }
 
+    unmap();
+
+    delete direct_;
+    direct_ = NULL;
+
     fd_ = -1;
     open_ = 0;
     readPos_ = 0;
+    bufLen_ = 0;
+    bufPos_ = 0;
+    mapped_ = 0;
+  }
+}
+
+// Maps the window of the data file that contains file offset 'pos'.
+// return: 0: OK
+//         1: mmap failed
+int TrackDataReader::mapWindow(off_t pos)
+{
+#ifdef USE_MMAP_READER
+  unmap();
+
+  mapOffset_ = pos - (pos % pageSize());
+
+  if (sizeof(void *) >= 8 || fileSize_ - mapOffset_ <= MAP_WINDOW_LEN)
+    mapLen_ = fileSize_ - mapOffset_;
+  else
+    mapLen_ = MAP_WINDOW_LEN;
+
+  void *p = mmap(NULL, mapLen_, PROT_READ, MAP_SHARED, fd_, mapOffset_);
+
+  if (p == MAP_FAILED) {
+    log_message(-2, "Cannot map data file \"%s\": %s", trackData_->filename_,
+		strerror(errno));
+    mapLen_ = 0;
+    return 1;
+  }
+
+  map_ = (char *)p;
+  adviseEnd_ = mapOffset_;
+
+#ifdef HAVE_MADVISE
+  madvise(map_, mapLen_, MADV_SEQUENTIAL);
+#endif
+
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+void TrackDataReader::unmap()
+{
+#ifdef USE_MMAP_READER
+  if (map_ != NULL) {
+    munmap(map_, mapLen_);
+    map_ = NULL;
+    mapLen_ = 0;
   }
+#endif
+}
+
+// Copies 'len' bytes from 'src' to 'buffer + pos'. If '*swapped' is true
+// the samples are swapped on the way; 'src' may be NULL if the data was
+// already read to 'buffer + pos', it is swapped in place then. Data that is
+// not sample aligned is copied unswapped: the part of 'buffer' that was
+// swapped before is swapped back and '*swapped' is cleared so that the
+// caller swaps the whole buffer.
+void TrackDataReader::copyOut(char *buffer, long pos, const char *src,
+			      long len, bool *swapped)
+{
+  if (*swapped && (pos % sizeof(Sample) != 0 || len % sizeof(Sample) != 0)) {
+    ::swapSamples((Sample *)buffer, pos / sizeof(Sample));
+    *swapped = false;
+  }
+
+  if (*swapped) {
+    if (src != NULL)
+      copySwapSamples((Sample *)(buffer + pos), (const Sample *)src,
+		      len / sizeof(Sample));
+    else
+      ::swapSamples((Sample *)(buffer + pos), len / sizeof(Sample));
+  }
+  else if (src != NULL) {
+    memcpy(buffer + pos, src, len);
+  }
+}
+
+// Copies 'len' bytes at the current file position from the mapped data
+// file to 'buffer', see 'copyOut()' for 'swapped'. The kernel is asked to
+// read ahead of the read position.
+// return: number of bytes copied to 'buffer', less than 'len' at end of
+//         file, -1 on error
+long TrackDataReader::mappedRead(char *buffer, long len, bool *swapped)
+{
+  long nread = 0;
+  long n;
+
+  while (nread < len && filePos_ < fileSize_) {
+    if (map_ == NULL || filePos_ < mapOffset_ ||
+	filePos_ >= mapOffset_ + (off_t)mapLen_) {
+      if (mapWindow(filePos_) != 0)
+	return -1;
+    }
+
+    off_t mapEnd = mapOffset_ + mapLen_;
+
+#ifdef HAVE_MADVISE
+    if (filePos_ + READ_AHEAD_LEN > adviseEnd_ && adviseEnd_ < mapEnd) {
+      off_t start = adviseEnd_;
+
+      if (start < filePos_)
+	start = filePos_ - ((filePos_ - mapOffset_) % pageSize());
+
+      off_t end = start + 2 * READ_AHEAD_LEN;
+
+      if (end > mapEnd)
+	end = mapEnd;
+
+      madvise(map_ + (start - mapOffset_), end - start, MADV_WILLNEED);
+      adviseEnd_ = end;
+    }
+#endif
+
+    n = mapEnd - filePos_;
+
+    if (n > len - nread)
+      n = len - nread;
+
+    copyOut(buffer, nread, map_ + (filePos_ - mapOffset_), n, swapped);
+    filePos_ += n;
+    nread += n;
+  }
+
+  return nread;
+}
+
+// Reads 'len' bytes from the data file through the read-ahead buffer. The
+// buffer is never filled beyond the end of the track data so that
+// following tracks can be read from the same FIFO or stdin. See 'copyOut()'
+// for 'swapped'.
+// return: number of bytes copied to 'buffer', less than 'len' at end of
+//         file, -1 on read error
+long TrackDataReader::bufferedRead(char *buffer, long len, bool *swapped)
+{
+  long nread = 0;
+  long n;
+
+  if (mapped_)
+    return mappedRead(buffer, len, swapped);
+
+  if (direct_ != NULL) {
+    if ((n = direct_->read(buffer, len)) > 0)
+      copyOut(buffer, 0, NULL, n, swapped);
+
+    return n;
+  }
+
+  while (nread < len) {
+    if (bufPos_ == bufLen_) {
+      // amount of track data that is not yet read from the file
+      unsigned long left = trackData_->length() - readPos_;
+
+      if (trackData_->audioCutMode())
+	left *= sizeof(Sample);
+
+      left -= nread;
+
+      if (len - nread >= READ_AHEAD_LEN) {
+	// large request, bypass the buffer
+	if ((n = fullRead(fd_, buffer + nread, len - nread)) < 0)
+	  return -1;
+
+	copyOut(buffer, nread, NULL, n, swapped);
+
+	return nread + n;
+      }
+
+      bufPos_ = 0;
+      bufLen_ = 0;
+
+      if ((n = fullRead(fd_, buf_, left < READ_AHEAD_LEN ? left
+			                               : READ_AHEAD_LEN)) < 0)
+	return -1;
+
+      if (n == 0)
+	break; // end of file
+
+      bufLen_ = n;
+    }
+
+    n = bufLen_ - bufPos_;
+
+    if (n > len - nread)
+      n = len - nread;
+
+    copyOut(buffer, nread, buf_ + bufPos_, n, swapped);
+    bufPos_ += n;
+    nread += n;
+  }
+
+  return nread;
 }
 
 // fills 'buffer' with 'len' samples (in case of audio mode) or with 'len'
@@ -1184,6 +1628,7 @@ void TrackDataReader::closeData()
 long TrackDataReader::readData(Sample *buffer, long len)
 {
   long readLen = 0;
+  bool swapped = swap_ != 0; // cleared if samples must be swapped in place
 
   assert(open_ != 0);
 
@@ -1197,6 +1642,8 @@ long TrackDataReader::readData(Sample *buffer, long len)
     }
   }
 
+  long long start = stats_start();
+
   switch (trackData_->type_) {
   case TrackData::ZERODATA:
     if (trackData_->audioCutMode())
@@ -1211,7 +1658,7 @@ long TrackDataReader::readData(Sample *buffer, long len)
   case TrackData::DATAFILE:
   case TrackData::FIFO:
     if (trackData_->audioCutMode()) {
-      readLen = fullRead(fd_, buffer, len * sizeof(Sample));
+      readLen = bufferedRead((char *)buffer, len * sizeof(Sample), &swapped);
 
       if (readLen < 0) {
 	log_message(-2, "Read error while reading audio data from file \"%s\": %s",
@@ -1228,7 +1675,7 @@ long TrackDataReader::readData(Sample *buffer, long len)
 	}
 
 	// Adding zeros to the 'buffer'
-	memset(buffer + readLen, 0, pad);
+	memset((char *)buffer + readLen, 0, pad);
 	readLen = len;
       }
       else {
@@ -1236,7 +1683,7 @@ long TrackDataReader::readData(Sample *buffer, long len)
       }
     }
     else {
-      readLen = fullRead(fd_, buffer, len);
+      readLen = bufferedRead((char *)buffer, len, &swapped);
       if (readLen < 0) {
 	log_message(-2, "Read error while reading data from file \"%s\": %s",
 		trackData_->filename_, strerror(errno));
@@ -1250,26 +1697,17 @@ long TrackDataReader::readData(Sample *buffer, long len)
     break;
   }
 
-  if (readLen > 0) {
-    if (trackData_->mode_ == TrackData::AUDIO &&
-	trackData_->subChannelMode_ == TrackData::SUBCHAN_NONE) {
-      int swap = 0;
+  if (readLen > 0 && trackData_->type_ != TrackData::ZERODATA)
+    stats_end(STAT_FILE_READ, start,
+	      trackData_->audioCutMode() ? readLen * sizeof(Sample) : readLen);
 
-      if (trackData_->fileType_ == TrackData::WAVE) {
-	// WAVE files contain little endian samples
-	swap = 1;
-      }
-
-      if (trackData_->swapSamples_) 
-	swap = !swap;
-
-      if (swap) {
-	// swap samples 
-	if (trackData_->audioCutMode())
-	  swapSamples(buffer, readLen);
-	else
-	  swapSamples(buffer, readLen / sizeof(Sample));
-      }
+  if (readLen > 0) {
+    if (swap_ && !swapped) {
+      // samples were not swapped while they were copied
+      if (trackData_->audioCutMode())
+	::swapSamples(buffer, readLen);
+      else
+	::swapSamples(buffer, readLen / sizeof(Sample));
     }
 
     readPos_ += readLen;
@@ -1289,24 +1727,33 @@ int TrackDataReader::seekSample(unsigned long sample)
     return 10;
 
   if (trackData_->type_ == TrackData::DATAFILE) {
+    off_t pos;
+
     if (trackData_->audioCutMode()) {
       // 'sample' has samples as unit
-      if (lseek(fd_,
-		trackData_->offset_ + headerLength_ +
-		(sample * sizeof(Sample)) + 
-		(trackData_->startPos_ * sizeof(Sample)),
-		SEEK_SET) < 0) {
-	log_message(-2, "Cannot seek in audio file \"%s\": %s",
-		trackData_->filename_, strerror(errno));
-	return 10;
-      }
+      pos = trackData_->offset_ + headerLength_ + (sample * sizeof(Sample)) +
+	(trackData_->startPos_ * sizeof(Sample));
     }
     else {
       // 'sample' has byte as unit
-      if (lseek(fd_, trackData_->offset_ + headerLength_ + sample,
-		SEEK_SET) < 0) {
+      pos = trackData_->offset_ + headerLength_ + sample;
+    }
+
+    if (mapped_) {
+      // no system call required, the window is moved by 'mappedRead()'
+      filePos_ = pos;
+    }
+    else if (direct_ != NULL) {
+      direct_->seek(pos);
+    }
+    else {
+      // discard read-ahead data
+      bufLen_ = 0;
+      bufPos_ = 0;
+
+      if (lseek(fd_, pos, SEEK_SET) < 0) {
 	log_message(-2, "Cannot seek in audio file \"%s\": %s",
-		trackData_->filename_, strerror(errno));
+		    trackData_->filename_, strerror(errno));
 	return 10;
       }
     }
@@ -21,12 +21,16 @@
 #ifndef __TRACKDATA_H__
 #define __TRACKDATA_H__
 
+#include <sys/types.h>
 #include <iostream>
 #include <string>
 #include <set>
+#include <vector>
 
 #include "Sample.h"
 
+class DirectReader;
+
 #define AUDIO_BLOCK_LEN 2352
 #define MODE0_BLOCK_LEN 2336
 #define MODE1_BLOCK_LEN 2048
@@ -81,6 +85,7 @@ public:
   int audioCutMode() const                 { return audioCutMode_; }
 
   const char *filename() const             { return filename_; }
+  long offset() const                      { return offset_; }
   unsigned long startPos() const           { return startPos_; }
   unsigned long length() const;
 
@@ -103,6 +108,7 @@ public:
 			unsigned long *datalen = 0);
   static int audioDataLength(const char *fname, long offset,
 			     unsigned long *length);
+  static void prefetchWaveLengths(const std::vector<std::pair<std::string, long> > &);
   static FileType audioFileType(const char *filename);
   static int dataFileLength(const char *fname, long offset,
 			    unsigned long *length);
@@ -152,8 +158,24 @@ public:
   TrackDataReader(const TrackData * = 0);
   ~TrackDataReader();
 
+  // Methods for reading regular data and audio files.
+  enum FileIo {
+    FILE_IO_BUFFERED, // memory mapped or read through the page cache
+    FILE_IO_DIRECT    // O_DIRECT with several reads in flight
+  };
+
+  // Selects the method used by all readers that are opened afterwards.
+  static void fileIo(FileIo m) { fileIo_ = m; }
+  static FileIo fileIo() { return fileIo_; }
+
   void init(const TrackData *);
 
+  // Sets flag for swapping the returned audio samples in addition to the
+  // swapping required by the track data, e.g. for a recorder that expects
+  // little endian samples. Takes effect with the next 'openData()'.
+  void swapSamples(int f) { swapSamples_ = f != 0 ? 1 : 0; }
+  int swapSamples() const { return swapSamples_; }
+
   int openData();
   void closeData();
   long readData(Sample *buffer, long len);
@@ -177,6 +199,34 @@ private:
   long headerLength_; // length of audio file header
 
   int readUnderRunMsgGiven_;
+
+  int swapSamples_; // additional swapping requested by the caller
+  int swap_;        // 1: returned samples are swapped, set by 'openData()'
+
+  // read-ahead buffer for object types 'DATAFILE', 'FIFO' and 'STDIN'
+  char *buf_;
+  long bufLen_;  // amount of valid data in 'buf_'
+  long bufPos_;  // next byte of 'buf_' returned by 'bufferedRead()'
+
+  // memory mapped access for regular files of object type 'DATAFILE'
+  int mapped_;       // 1: data is read from the mapping instead of 'fd_'
+  char *map_;        // currently mapped window of the file, may be NULL
+  off_t mapOffset_;  // file offset of 'map_'
+  size_t mapLen_;    // length of 'map_'
+  off_t filePos_;    // file offset of next byte returned by 'mappedRead()'
+  off_t fileSize_;
+  off_t adviseEnd_;  // end of range that was announced with MADV_WILLNEED
+
+  DirectReader *direct_; // used for 'FILE_IO_DIRECT', may be NULL
+
+  static FileIo fileIo_;
+
+  long bufferedRead(char *buffer, long len, bool *swapped);
+  long mappedRead(char *buffer, long len, bool *swapped);
+  void copyOut(char *buffer, long pos, const char *src, long len,
+	       bool *swapped);
+  int mapWindow(off_t pos);
+  void unmap();
 };
 
 #endif
@@ -20,9 +20,22 @@
 #include <config.h>
 
 #include <assert.h>
+#include <string.h>
 #include <sys/types.h>
 
+/* SIMD variants of the P/Q parity calculation and scrambling */
+#if defined(HAVE_BUILTIN_CPU_SUPPORTS) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_LEC
+#include <immintrin.h>
+#endif
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
 #include "lec.h"
+#include "stats.h"
 
 #define GF8_PRIM_POLY 0x11d /* x^8 + x^4 + x^3 + x^2 + 1 */
 
@@ -40,6 +53,9 @@
 #define LEC_MODE2_FORM2_DATA_LEN (2324+8)
 #define LEC_MODE2_FORM2_EDC_OFFSET 2348
 
+/* maximum number of P/Q correction passes for a sector */
+#define LEC_MAX_ROUNDS 8
+
 
 typedef u_int8_t gf8_t;
 
@@ -56,24 +72,43 @@ public:
   operator const u_int16_t *() const	    { return &table[0][0]; }
 } CF8_Q_COEFFS_RESULTS_01;
 
+/* Products of the P/Q coefficients with the low and high nibble of a byte
+ * for the split-nibble multiplication with a byte shuffle:
+ * table[j][0]: low nibble  * coefficient 0 of column j
+ * table[j][1]: high nibble * coefficient 0 of column j
+ * table[j][2]: low nibble  * coefficient 1 of column j
+ * table[j][3]: high nibble * coefficient 1 of column j
+ */
+static const class Gf8_Nibble_Products {
+private:
+  u_int8_t table[43][4][16];
+public:
+  Gf8_Nibble_Products();
+  ~Gf8_Nibble_Products() {}
+  const u_int8_t *operator[] (int i) const { return &table[i][0][0]; }
+} GF8_NIBBLE_PRODUCTS;
+
 static const class CrcTable {
 private:
-  u_int32_t table[256];
+  u_int32_t table[8][256]; /* table[k]: CRC of a byte followed by k 0s */
 public:
   CrcTable();
   ~CrcTable() {}
-  u_int32_t operator[](int i) const	{ return table[i]; }
-  operator const u_int32_t *() const	{ return table;    }
+  u_int32_t operator[](int i) const	{ return table[0][i]; }
+  operator const u_int32_t *() const	{ return table[0]; }
+  const u_int32_t *slice(int k) const	{ return table[k]; }
 } CRCTABLE;
 
 static const class ScrambleTable {
 private:
   u_int8_t table[2340];
+  u_int8_t swapped_[2352]; /* byte swapped, starting at sector offset 0 */
 public:
   ScrambleTable();
   ~ScrambleTable() {}
   u_int8_t operator[](int i) const	{ return table[i]; }
   operator const u_int8_t *() const	{ return table;    }
+  const u_int8_t *swapped() const	{ return swapped_; }
 } SCRAMBLE_TABLE;
 
 /* Creates the logarithm and inverse logarithm table that is required
@@ -221,6 +256,20 @@ Gf8_Q_Coeffs_Results_01::Gf8_Q_Coeffs_Results_01()
   }
 }
 
+Gf8_Nibble_Products::Gf8_Nibble_Products()
+{
+  int i, j;
+
+  for (j = 0; j < 43; j++) {
+    for (i = 0; i < 16; i++) {
+      table[j][0][i] = CF8_Q_COEFFS_RESULTS_01[j][i];
+      table[j][1][i] = CF8_Q_COEFFS_RESULTS_01[j][i << 4];
+      table[j][2][i] = CF8_Q_COEFFS_RESULTS_01[j][i] >> 8;
+      table[j][3][i] = CF8_Q_COEFFS_RESULTS_01[j][i << 4] >> 8;
+    }
+  }
+}
+
 /* Reverses the bits in 'd'. 'bits' defines the bit width of 'd'.
  */
 static u_int32_t mirror_bits(u_int32_t d, int bits)
@@ -266,14 +315,20 @@ CrcTable::CrcTable ()
 
     r = mirror_bits(r, 32);
 
-    table[i] = r;
+    table[0][i] = r;
+  }
+
+  /* tables for processing 8 bytes at a time */
+  for (j = 1; j < 8; j++) {
+    for (i = 0; i < 256; i++)
+      table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
   }
 }
 
 /* Calculates the CRC of given data with given lengths based on the
- * table lookup algorithm.
+ * table lookup algorithm. Reference for 'calc_edc()'.
  */
-static u_int32_t calc_edc(u_int8_t *data, int len)
+static u_int32_t calc_edc_ref(const u_int8_t *data, int len)
 {
   u_int32_t crc = 0;
 
@@ -284,6 +339,41 @@ static u_int32_t calc_edc(u_int8_t *data, int len)
   return crc;
 }
 
+/* Calculates the CRC of given data with given lengths processing 8 bytes
+ * per step with one lookup in each of the 8 slice tables.
+ */
+static u_int32_t calc_edc(const u_int8_t *data, int len)
+{
+  const u_int32_t *t0 = CRCTABLE.slice(0);
+  const u_int32_t *t1 = CRCTABLE.slice(1);
+  const u_int32_t *t2 = CRCTABLE.slice(2);
+  const u_int32_t *t3 = CRCTABLE.slice(3);
+  const u_int32_t *t4 = CRCTABLE.slice(4);
+  const u_int32_t *t5 = CRCTABLE.slice(5);
+  const u_int32_t *t6 = CRCTABLE.slice(6);
+  const u_int32_t *t7 = CRCTABLE.slice(7);
+  u_int32_t crc = 0;
+  u_int32_t lo, hi;
+
+  for (; len >= 8; len -= 8, data += 8) {
+    lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) |
+		((u_int32_t)data[3] << 24));
+    hi = data[4] | (data[5] << 8) | (data[6] << 16) |
+      ((u_int32_t)data[7] << 24);
+
+    crc = t7[lo & 0xff] ^ t6[(lo >> 8) & 0xff] ^
+      t5[(lo >> 16) & 0xff] ^ t4[lo >> 24] ^
+      t3[hi & 0xff] ^ t2[(hi >> 8) & 0xff] ^
+      t1[(hi >> 16) & 0xff] ^ t0[hi >> 24];
+  }
+
+  while (len--) {
+    crc = t0[(int)(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc;
+}
+
 /* Build the scramble table as defined in the yellow book. The bytes
    12 to 2351 of a sector will be XORed with the data of this table.
  */
@@ -313,6 +403,15 @@ ScrambleTable::ScrambleTable()
 
     table[i] = d;
   }
+
+  /* the scrambled bytes are exchanged pairwise with the sector data */
+  for (i = 0; i < 12; i++)
+    swapped_[i] = 0;
+
+  for (i = 12; i < 2352; i += 2) {
+    swapped_[i] = table[i + 1 - 12];
+    swapped_[i + 1] = table[i - 12];
+  }
 }
 
 /* Calc EDC for a MODE 1 sector
@@ -383,8 +482,9 @@ static void set_sector_header(u_int8_t mode, u_int32_t adr, u_int8_t *sector)
 
 /* Calculate the P parities for the sector.
  * The 43 P vectors of length 24 are combined with the GF8_P_COEFFS.
+ * Reference for the optimized variants.
  */
-static void calc_P_parity(u_int8_t *sector)
+static void calc_P_parity_ref(u_int8_t *sector)
 {
   int i, j;
   u_int16_t p01_msb, p01_lsb;
@@ -428,8 +528,9 @@ static void calc_P_parity(u_int8_t *sector)
 
 /* Calculate the Q parities for the sector.
  * The 26 Q vectors of length 43 are combined with the GF8_Q_COEFFS.
+ * Reference for the optimized variants.
  */
-static void calc_Q_parity(u_int8_t *sector)
+static void calc_Q_parity_ref(u_int8_t *sector)
 {
   int i, j;
   u_int16_t q01_lsb, q01_msb;
@@ -476,11 +577,148 @@ static void calc_Q_parity(u_int8_t *sector)
   }
 }
 
+#ifdef USE_X86_LEC
+/* Multiplies each byte of 'v' with the coefficient whose nibble products
+ * are given in 'lo' and 'hi'.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i gf8_mult_ssse3(__m128i v, __m128i lo, __m128i hi)
+{
+  const __m128i mask = _mm_set1_epi8(0x0f);
+
+  return _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, mask)),
+		       _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4),
+							  mask)));
+}
+
+/* Like 'calc_P_parity_ref()'. The 24 rows of 86 bytes that form the P
+ * vectors are processed 16 columns at a time.
+ */
+__attribute__((target("ssse3")))
+static void calc_P_parity_ssse3(u_int8_t *sector)
+{
+  const u_int8_t *row = sector + LEC_HEADER_OFFSET;
+  __m128i p0[6], p1[6];
+  u_int8_t buf0[96], buf1[96];
+  int j, k;
+
+  for (k = 0; k < 6; k++)
+    p0[k] = p1[k] = _mm_setzero_si128();
+
+  for (j = 19; j <= 42; j++, row += 2 * 43) {
+    const __m128i *t = (const __m128i *)GF8_NIBBLE_PRODUCTS[j];
+    __m128i lo0 = _mm_loadu_si128(t);
+    __m128i hi0 = _mm_loadu_si128(t + 1);
+    __m128i lo1 = _mm_loadu_si128(t + 2);
+    __m128i hi1 = _mm_loadu_si128(t + 3);
+
+    /* the last vector of the last row reaches into the P parity area,
+       these columns are not used */
+    for (k = 0; k < 6; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(row + 16 * k));
+
+      p0[k] = _mm_xor_si128(p0[k], gf8_mult_ssse3(v, lo0, hi0));
+      p1[k] = _mm_xor_si128(p1[k], gf8_mult_ssse3(v, lo1, hi1));
+    }
+  }
+
+  for (k = 0; k < 6; k++) {
+    _mm_storeu_si128((__m128i *)(buf0 + 16 * k), p0[k]);
+    _mm_storeu_si128((__m128i *)(buf1 + 16 * k), p1[k]);
+  }
+
+  memcpy(sector + LEC_MODE1_P_PARITY_OFFSET + 2 * 43, buf0, 2 * 43);
+  memcpy(sector + LEC_MODE1_P_PARITY_OFFSET, buf1, 2 * 43);
+}
+
+/* Like 'calc_Q_parity_ref()'. Element j of Q vector i is column j of
+ * row (i + j) % 26 when the data is seen as 26 rows of 43 byte pairs.
+ * For each column the elements of all 26 Q vectors are gathered and
+ * multiplied at once.
+ */
+__attribute__((target("ssse3")))
+static void calc_Q_parity_ssse3(u_int8_t *sector)
+{
+  const u_int8_t *data = sector + LEC_HEADER_OFFSET;
+  __m128i q0[4], q1[4];
+  u_int8_t col[64];
+  u_int8_t *c;
+  int j, k, r, s;
+
+  for (k = 0; k < 4; k++)
+    q0[k] = q1[k] = _mm_setzero_si128();
+
+  memset(col, 0, sizeof(col));
+
+  for (j = 0; j <= 42; j++) {
+    const __m128i *t = (const __m128i *)GF8_NIBBLE_PRODUCTS[j];
+    __m128i lo0 = _mm_loadu_si128(t);
+    __m128i hi0 = _mm_loadu_si128(t + 1);
+    __m128i lo1 = _mm_loadu_si128(t + 2);
+    __m128i hi1 = _mm_loadu_si128(t + 3);
+
+    s = j % 26;
+    c = col;
+
+    for (r = s; r < 26; r++, c += 2)
+      memcpy(c, data + 2 * 43 * r + 2 * j, 2);
+    for (r = 0; r < s; r++, c += 2)
+      memcpy(c, data + 2 * 43 * r + 2 * j, 2);
+
+    for (k = 0; k < 4; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(col + 16 * k));
+
+      q0[k] = _mm_xor_si128(q0[k], gf8_mult_ssse3(v, lo0, hi0));
+      q1[k] = _mm_xor_si128(q1[k], gf8_mult_ssse3(v, lo1, hi1));
+    }
+  }
+
+  for (k = 0; k < 4; k++)
+    _mm_storeu_si128((__m128i *)(col + 16 * k), q0[k]);
+
+  memcpy(sector + LEC_MODE1_Q_PARITY_OFFSET + 2 * 26, col, 2 * 26);
+
+  for (k = 0; k < 4; k++)
+    _mm_storeu_si128((__m128i *)(col + 16 * k), q1[k]);
+
+  memcpy(sector + LEC_MODE1_Q_PARITY_OFFSET, col, 2 * 26);
+}
+#endif
+
+typedef void (*LecKernel)(u_int8_t *sector);
+
+/* Fastest variants of the P/Q parity calculation and scrambling that are
+ * supported by the CPU. They are selected at program start so that the
+ * encoder threads can share them without locking.
+ */
+static const class LecKernels {
+public:
+  LecKernel p_parity;
+  LecKernel q_parity;
+  LecKernel scramble;
+
+  LecKernels();
+  ~LecKernels() {}
+} LEC_KERNELS;
+
+/* Calculate the P and Q parities with the fastest variant supported by
+ * the CPU.
+ */
+static void calc_P_parity(u_int8_t *sector)
+{
+  LEC_KERNELS.p_parity(sector);
+}
+
+static void calc_Q_parity(u_int8_t *sector)
+{
+  LEC_KERNELS.q_parity(sector);
+}
+
 /* Encodes a MODE 0 sector.
  * 'adr' is the current physical sector address
  * 'sector' must be 2352 byte wide
  */
-void lec_encode_mode0_sector(u_int32_t adr, u_int8_t *sector)
+static void encode_mode0(u_int32_t adr, u_int8_t *sector)
 {
   u_int16_t i;
 
@@ -498,7 +736,7 @@ void lec_encode_mode0_sector(u_int32_t adr, u_int8_t *sector)
  * 'sector' must be 2352 byte wide containing 2048 bytes user data at
  * offset 16
  */
-void lec_encode_mode1_sector(u_int32_t adr, u_int8_t *sector)
+static void encode_mode1(u_int32_t adr, u_int8_t *sector)
 {
   set_sync_pattern(sector);
   set_sector_header(1, adr, sector);
@@ -524,7 +762,7 @@ void lec_encode_mode1_sector(u_int32_t adr, u_int8_t *sector)
  * 'sector' must be 2352 byte wide containing 2336 bytes user data at
  * offset 16
  */
-void lec_encode_mode2_sector(u_int32_t adr, u_int8_t *sector)
+static void encode_mode2(u_int32_t adr, u_int8_t *sector)
 {
   set_sync_pattern(sector);
   set_sector_header(2, adr, sector);
@@ -535,7 +773,7 @@ void lec_encode_mode2_sector(u_int32_t adr, u_int8_t *sector)
  * 'sector' must be 2352 byte wide containing 2048+8 bytes user data at
  * offset 16
  */
-void lec_encode_mode2_form1_sector(u_int32_t adr, u_int8_t *sector)
+static void encode_mode2_form1(u_int32_t adr, u_int8_t *sector)
 {
   set_sync_pattern(sector);
 
@@ -559,7 +797,7 @@ void lec_encode_mode2_form1_sector(u_int32_t adr, u_int8_t *sector)
  * 'sector' must be 2352 byte wide containing 2324+8 bytes user data at
  * offset 16
  */
-void lec_encode_mode2_form2_sector(u_int32_t adr, u_int8_t *sector)
+static void encode_mode2_form2(u_int32_t adr, u_int8_t *sector)
 {
   set_sync_pattern(sector);
 
@@ -570,8 +808,9 @@ void lec_encode_mode2_form2_sector(u_int32_t adr, u_int8_t *sector)
 
 /* Scrambles and byte swaps an encoded sector.
  * 'sector' must be 2352 byte wide.
+ * Reference for the optimized variants.
  */
-void lec_scramble(u_int8_t *sector)
+static void scramble_ref(u_int8_t *sector)
 {
   u_int16_t i;
   const u_int8_t *stable = SCRAMBLE_TABLE;
@@ -595,6 +834,697 @@ void lec_scramble(u_int8_t *sector)
     }
 }
 
+/* Like 'scramble_ref()' but swaps 8 bytes at a time and XORs them with
+ * the pre-swapped scramble table.
+ */
+static void scramble_wide(u_int8_t *sector)
+{
+  const u_int8_t *stable = SCRAMBLE_TABLE.swapped();
+  unsigned long long x, s;
+  int i;
+
+  for (i = 0; i < 2352; i += 8) {
+    memcpy(&x, sector + i, 8);
+    memcpy(&s, stable + i, 8);
+
+    x = ((x & 0x00ff00ff00ff00ffULL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+
+    x ^= s;
+    memcpy(sector + i, &x, 8);
+  }
+}
+
+#ifdef USE_X86_LEC
+__attribute__((target("ssse3")))
+static void scramble_ssse3(u_int8_t *sector)
+{
+  const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9,
+				    6, 7, 4, 5, 2, 3, 0, 1);
+  const u_int8_t *stable = SCRAMBLE_TABLE.swapped();
+  int i;
+
+  for (i = 0; i < 2352; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(sector + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(stable + i));
+
+    _mm_storeu_si128((__m128i *)(sector + i),
+		     _mm_xor_si128(_mm_shuffle_epi8(v, mask), s));
+  }
+}
+
+__attribute__((target("avx2")))
+static void scramble_avx2(u_int8_t *sector)
+{
+  const __m256i mask = _mm256_set_epi8(14, 15, 12, 13, 10, 11, 8, 9,
+				       6, 7, 4, 5, 2, 3, 0, 1,
+				       14, 15, 12, 13, 10, 11, 8, 9,
+				       6, 7, 4, 5, 2, 3, 0, 1);
+  const u_int8_t *stable = SCRAMBLE_TABLE.swapped();
+  int i;
+
+  /* 2352 = 73 * 32 + 16 */
+  for (i = 0; i + 32 <= 2352; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(sector + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(stable + i));
+
+    _mm256_storeu_si256((__m256i *)(sector + i),
+			_mm256_xor_si256(_mm256_shuffle_epi8(v, mask), s));
+  }
+
+  __m128i v = _mm_loadu_si128((const __m128i *)(sector + i));
+  __m128i s = _mm_loadu_si128((const __m128i *)(stable + i));
+
+  _mm_storeu_si128((__m128i *)(sector + i),
+		   _mm_xor_si128(_mm_shuffle_epi8(v, _mm256_castsi256_si128(mask)),
+				 s));
+}
+#endif
+
+static void scramble(u_int8_t *sector)
+{
+  LEC_KERNELS.scramble(sector);
+}
+
+LecKernels::LecKernels()
+{
+#ifdef USE_X86_LEC
+  /* required when called before 'main()' */
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("ssse3")) {
+    p_parity = calc_P_parity_ssse3;
+    q_parity = calc_Q_parity_ssse3;
+
+    if (__builtin_cpu_supports("avx2"))
+      scramble = scramble_avx2;
+    else
+      scramble = scramble_ssse3;
+
+    return;
+  }
+#endif
+
+  p_parity = calc_P_parity_ref;
+  q_parity = calc_Q_parity_ref;
+  scramble = scramble_wide;
+}
+
+/* Encodes a single sector of given type, see 'lec_encode_sectors()'.
+ */
+static void encode_sector(int type, u_int32_t adr, u_int8_t *sector)
+{
+  switch (type) {
+  case LEC_MODE0:
+    encode_mode0(adr, sector);
+    break;
+  case LEC_MODE1:
+    encode_mode1(adr, sector);
+    break;
+  case LEC_MODE2:
+    encode_mode2(adr, sector);
+    break;
+  case LEC_MODE2_FORM1:
+    encode_mode2_form1(adr, sector);
+    break;
+  case LEC_MODE2_FORM2:
+    encode_mode2_form2(adr, sector);
+    break;
+  case LEC_MODE2_FORM_MIX:
+    /* form 2 bit of the sub-header */
+    if ((sector[LEC_DATA_OFFSET + 2] & 0x20) != 0)
+      encode_mode2_form2(adr, sector);
+    else
+      encode_mode2_form1(adr, sector);
+    break;
+  }
+}
+
+void lec_encode_mode0_sector(u_int32_t adr, u_int8_t *sector)
+{
+  long long t = stats_start();
+
+  encode_mode0(adr, sector);
+
+  stats_end(STAT_LEC_ENCODE, t, 2352);
+}
+
+void lec_encode_mode1_sector(u_int32_t adr, u_int8_t *sector)
+{
+  long long t = stats_start();
+
+  encode_mode1(adr, sector);
+
+  stats_end(STAT_LEC_ENCODE, t, 2352);
+}
+
+void lec_encode_mode2_sector(u_int32_t adr, u_int8_t *sector)
+{
+  long long t = stats_start();
+
+  encode_mode2(adr, sector);
+
+  stats_end(STAT_LEC_ENCODE, t, 2352);
+}
+
+void lec_encode_mode2_form1_sector(u_int32_t adr, u_int8_t *sector)
+{
+  long long t = stats_start();
+
+  encode_mode2_form1(adr, sector);
+
+  stats_end(STAT_LEC_ENCODE, t, 2352);
+}
+
+void lec_encode_mode2_form2_sector(u_int32_t adr, u_int8_t *sector)
+{
+  long long t = stats_start();
+
+  encode_mode2_form2(adr, sector);
+
+  stats_end(STAT_LEC_ENCODE, t, 2352);
+}
+
+void lec_scramble(u_int8_t *sector)
+{
+  long long t = stats_start();
+
+  scramble(sector);
+
+  stats_end(STAT_LEC_SCRAMBLE, t, 2352);
+}
+
+/* Encodes and scrambles a slice of a batch in the calling thread.
+ */
+static void encode_slice(int type, u_int32_t adr, u_int8_t *sectors,
+			 long count, long stride)
+{
+  long long t;
+  u_int8_t *p;
+  long i;
+
+  if (type != LEC_ENCODED) {
+    t = stats_start();
+
+    for (i = 0, p = sectors; i < count; i++, p += stride)
+      encode_sector(type, adr + i, p);
+
+    stats_end(STAT_LEC_ENCODE, t, count * 2352);
+  }
+
+  t = stats_start();
+
+  for (i = 0, p = sectors; i < count; i++, p += stride)
+    scramble(p);
+
+  stats_end(STAT_LEC_SCRAMBLE, t, count * 2352);
+}
+
+#ifdef USE_POSIX_THREADS
+
+/* Worker pool of 'lec_encode_sectors()'. A batch is cut into slices of at
+ * least LEC_MIN_SLICE sectors that are taken by the workers and the
+ * calling thread. Only one batch is distributed at a time, concurrent
+ * callers encode their batch themselves.
+ */
+#define LEC_MAX_WORKERS 16
+#define LEC_MIN_SLICE 8
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t work;   /* signaled when a batch is available */
+  pthread_cond_t done;   /* signaled when the last slice is finished */
+  pthread_mutex_t batch; /* held by the caller that distributes a batch */
+  pthread_t threads[LEC_MAX_WORKERS];
+  int nofWorkers;
+  int quit;
+
+  /* current batch */
+  int type;
+  u_int32_t adr;
+  u_int8_t *sectors;
+  long count;
+  long stride;
+  long sliceLen;
+  long nofSlices;
+  long nextSlice;  /* next slice that is not taken */
+  long slicesLeft; /* slices that are not finished */
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	   PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+
+/* Takes and encodes slices of the current batch until all are taken.
+ * Called with 'pool.mutex' locked.
+ */
+static void run_slices()
+{
+  while (pool.nextSlice < pool.nofSlices) {
+    long s = pool.nextSlice++;
+    long first = s * pool.sliceLen;
+    long n = pool.count - first;
+    int type = pool.type;
+    u_int32_t adr = pool.adr + first;
+    u_int8_t *sectors = pool.sectors + first * pool.stride;
+    long stride = pool.stride;
+
+    if (n > pool.sliceLen)
+      n = pool.sliceLen;
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    encode_slice(type, adr, sectors, n, stride);
+
+    pthread_mutex_lock(&pool.mutex);
+
+    if (--pool.slicesLeft == 0)
+      pthread_cond_signal(&pool.done);
+  }
+}
+
+static void *worker(void *)
+{
+  stats_thread_name("lec");
+
+  pthread_mutex_lock(&pool.mutex);
+
+  while (!pool.quit) {
+    if (pool.nextSlice < pool.nofSlices)
+      run_slices();
+    else
+      pthread_cond_wait(&pool.work, &pool.mutex);
+  }
+
+  pthread_mutex_unlock(&pool.mutex);
+
+  stats_thread_exit();
+  return NULL;
+}
+
+int lec_start_workers(int n)
+{
+  lec_stop_workers();
+
+  if (n > LEC_MAX_WORKERS)
+    n = LEC_MAX_WORKERS;
+
+  pthread_mutex_lock(&pool.mutex);
+  pool.quit = 0;
+  pool.nofSlices = pool.nextSlice = pool.slicesLeft = 0;
+  pthread_mutex_unlock(&pool.mutex);
+
+  while (pool.nofWorkers < n) {
+    if (pthread_create(&pool.threads[pool.nofWorkers], NULL, worker,
+		       NULL) != 0)
+      break;
+
+    pool.nofWorkers++;
+  }
+
+  return pool.nofWorkers;
+}
+
+void lec_stop_workers()
+{
+  int i;
+
+  if (pool.nofWorkers == 0)
+    return;
+
+  pthread_mutex_lock(&pool.mutex);
+  pool.quit = 1;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.mutex);
+
+  for (i = 0; i < pool.nofWorkers; i++)
+    pthread_join(pool.threads[i], NULL);
+
+  pool.nofWorkers = 0;
+}
+
+void lec_encode_sectors(int type, u_int32_t adr, u_int8_t *sectors,
+			long count, long stride)
+{
+  long slices = count / LEC_MIN_SLICE;
+
+  if (slices > pool.nofWorkers + 1)
+    slices = pool.nofWorkers + 1;
+
+  if (slices < 2 || pthread_mutex_trylock(&pool.batch) != 0) {
+    encode_slice(type, adr, sectors, count, stride);
+    return;
+  }
+
+  pthread_mutex_lock(&pool.mutex);
+
+  pool.type = type;
+  pool.adr = adr;
+  pool.sectors = sectors;
+  pool.count = count;
+  pool.stride = stride;
+  pool.sliceLen = (count + slices - 1) / slices;
+  pool.nofSlices = (count + pool.sliceLen - 1) / pool.sliceLen;
+  pool.nextSlice = 0;
+  pool.slicesLeft = pool.nofSlices;
+
+  pthread_cond_broadcast(&pool.work);
+
+  run_slices();
+
+  while (pool.slicesLeft > 0)
+    pthread_cond_wait(&pool.done, &pool.mutex);
+
+  pool.nofSlices = pool.nextSlice = 0;
+
+  pthread_mutex_unlock(&pool.mutex);
+  pthread_mutex_unlock(&pool.batch);
+}
+
+#else
+
+int lec_start_workers(int)
+{
+  return 0;
+}
+
+void lec_stop_workers()
+{
+}
+
+void lec_encode_sectors(int type, u_int32_t adr, u_int8_t *sectors,
+			long count, long stride)
+{
+  encode_slice(type, adr, sectors, count, stride);
+}
+
+#endif
+
+/* Checks the EDC of a MODE 1 or XA form 1/2 sector.
+ * Returns 1 if the EDC matches, else 0.
+ */
+static int check_edc(const u_int8_t *sector, int start, int len, int edc)
+{
+  u_int32_t crc = calc_edc(sector + start, len);
+
+  return sector[edc] == (crc & 0xff) &&
+    sector[edc + 1] == ((crc >> 8) & 0xff) &&
+    sector[edc + 2] == ((crc >> 16) & 0xff) &&
+    sector[edc + 3] == ((crc >> 24) & 0xff);
+}
+
+/* Multiplication by the primitive element in the GF(8) domain.
+ */
+static gf8_t gf8_mult_a(gf8_t b)
+{
+  return (b & 0x80) ? ((b << 1) ^ GF8_PRIM_POLY) : (b << 1);
+}
+
+/* Corrects a single error of the P or Q code word whose 'len' bytes are
+ * stored at the given offsets of 'sector'. The code word is valid if
+ * the sum of all bytes and the sum of all bytes weighted with a^(len-1)
+ * down to a^0 are 0.
+ * Returns 0 if the code word is valid, 1 if an error was corrected and
+ * -1 if the code word has more than one error.
+ */
+static int correct_vector(u_int8_t *sector, const int *offsets, int len)
+{
+  gf8_t s0 = 0, s1 = 0;
+  int16_t e;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    s0 ^= sector[offsets[i]];
+    s1 = gf8_mult_a(s1) ^ sector[offsets[i]];
+  }
+
+  if (s0 == 0 && s1 == 0)
+    return 0;
+
+  if (s0 == 0 || s1 == 0)
+    return -1;
+
+  /* a single error of value s0 at position i gives s1 = s0 * a^(len-1-i) */
+  e = GF8_LOG[s1] - GF8_LOG[s0];
+
+  if (e < 0)
+    e += 255;
+
+  if (e >= len)
+    return -1;
+
+  sector[offsets[len - 1 - e]] ^= s0;
+
+  return 1;
+}
+
+/* Runs one pass of single error correction over all P and Q code words.
+ * 'failed' is set to the number of code words with more than one error.
+ * Returns the number of corrected bytes.
+ */
+static int correct_P_Q(u_int8_t *sector, int *failed)
+{
+  int offsets[45];
+  int corrected = 0;
+  int i, j, b, r;
+
+  *failed = 0;
+
+  /* 86 P code words of 24 data and 2 parity bytes */
+  for (i = 0; i < 2 * 43; i++) {
+    for (j = 0; j < 26; j++)
+      offsets[j] = LEC_HEADER_OFFSET + 2 * 43 * j + i;
+
+    if ((r = correct_vector(sector, offsets, 26)) > 0)
+      corrected++;
+    else if (r < 0)
+      (*failed)++;
+  }
+
+  /* 52 Q code words of 43 data and 2 parity bytes, see
+     'calc_Q_parity_ssse3()' for the layout */
+  for (i = 0; i < 26; i++) {
+    for (b = 0; b < 2; b++) {
+      for (j = 0; j < 43; j++)
+	offsets[j] = LEC_HEADER_OFFSET + 2 * (43 * ((i + j) % 26) + j) + b;
+
+      offsets[43] = LEC_MODE1_Q_PARITY_OFFSET + 2 * i + b;
+      offsets[44] = LEC_MODE1_Q_PARITY_OFFSET + 2 * 26 + 2 * i + b;
+
+      if ((r = correct_vector(sector, offsets, 45)) > 0)
+	corrected++;
+      else if (r < 0)
+	(*failed)++;
+    }
+  }
+
+  return corrected;
+}
+
+/* Corrects the P/Q protected part of a MODE 1 or XA form 1 sector and
+ * checks the EDC afterwards.
+ * Returns the number of corrected code words or -1 if the EDC does not
+ * match.
+ */
+static int correct_sector(u_int8_t *sector, int form1)
+{
+  u_int8_t header[4] = { 0, 0, 0, 0 };
+  int corrected = 0;
+  int round, n;
+  int failed;
+  int ok;
+
+  if (form1) {
+    /* the sector header is not covered by P/Q parity of XA sectors */
+    memcpy(header, sector + LEC_HEADER_OFFSET, 4);
+    memset(sector + LEC_HEADER_OFFSET, 0, 4);
+  }
+
+  for (round = 0; round < LEC_MAX_ROUNDS; round++) {
+    n = correct_P_Q(sector, &failed);
+    corrected += n;
+
+    if (n == 0 || failed == 0)
+      break;
+  }
+
+  if (form1) {
+    memcpy(sector + LEC_HEADER_OFFSET, header, 4);
+    ok = check_edc(sector, LEC_DATA_OFFSET, LEC_MODE2_FORM1_DATA_LEN,
+		   LEC_MODE2_FORM1_EDC_OFFSET);
+  }
+  else {
+    ok = check_edc(sector, 0, LEC_MODE1_DATA_LEN + 16, LEC_MODE1_EDC_OFFSET);
+  }
+
+  return ok ? corrected : -1;
+}
+
+int lec_correct_sector(int type, u_int8_t *sector)
+{
+  u_int8_t tmp[2352];
+  int form1;
+  int n;
+
+  switch (type) {
+  case LEC_MODE1:
+    form1 = 0;
+    break;
+
+  case LEC_MODE2_FORM1:
+  case LEC_MODE2_FORM2:
+  case LEC_MODE2_FORM_MIX:
+    form1 = 1;
+
+    if (type != LEC_MODE2_FORM1 &&
+	(type == LEC_MODE2_FORM2 ||
+	 (sector[LEC_DATA_OFFSET + 2] & 0x20) != 0)) {
+      /* form 2: the EDC is optional and there is no P/Q parity */
+      if ((sector[LEC_MODE2_FORM2_EDC_OFFSET] |
+	   sector[LEC_MODE2_FORM2_EDC_OFFSET + 1] |
+	   sector[LEC_MODE2_FORM2_EDC_OFFSET + 2] |
+	   sector[LEC_MODE2_FORM2_EDC_OFFSET + 3]) == 0 ||
+	  check_edc(sector, LEC_DATA_OFFSET, LEC_MODE2_FORM2_DATA_LEN,
+		    LEC_MODE2_FORM2_EDC_OFFSET))
+	return 0;
+
+      if (type == LEC_MODE2_FORM2)
+	return -1;
+
+      /* the form bit itself may be broken, try form 1 */
+    }
+    break;
+
+  default:
+    return 0;
+  }
+
+  /* the EDC does not cover the parity bytes, so P/Q is always checked */
+  memcpy(tmp, sector, 2352);
+
+  if ((n = correct_sector(tmp, form1)) < 0)
+    return -1;
+
+  if (n == 0)
+    return 0;
+
+  memcpy(sector, tmp, 2352);
+
+  return 1;
+}
+
+int lec_check_sector(int type, const u_int8_t *sector)
+{
+  u_int8_t tmp[2352];
+  int errors = 0;
+
+  if (type == LEC_MODE2_FORM_MIX)
+    type = (sector[LEC_DATA_OFFSET + 2] & 0x20) ? LEC_MODE2_FORM2
+                                                : LEC_MODE2_FORM1;
+
+  switch (type) {
+  case LEC_MODE1:
+    if (!check_edc(sector, 0, LEC_MODE1_DATA_LEN + 16, LEC_MODE1_EDC_OFFSET))
+      errors |= LEC_EDC_ERROR;
+
+    memcpy(tmp, sector, LEC_MODE1_P_PARITY_OFFSET);
+    break;
+
+  case LEC_MODE2_FORM1:
+    if (!check_edc(sector, LEC_DATA_OFFSET, LEC_MODE2_FORM1_DATA_LEN,
+		   LEC_MODE2_FORM1_EDC_OFFSET))
+      errors |= LEC_EDC_ERROR;
+
+    memcpy(tmp, sector, LEC_MODE1_P_PARITY_OFFSET);
+    memset(tmp + LEC_HEADER_OFFSET, 0, 4);
+    break;
+
+  case LEC_MODE2_FORM2:
+    if ((sector[LEC_MODE2_FORM2_EDC_OFFSET] |
+	 sector[LEC_MODE2_FORM2_EDC_OFFSET + 1] |
+	 sector[LEC_MODE2_FORM2_EDC_OFFSET + 2] |
+	 sector[LEC_MODE2_FORM2_EDC_OFFSET + 3]) != 0 &&
+	!check_edc(sector, LEC_DATA_OFFSET, LEC_MODE2_FORM2_DATA_LEN,
+		   LEC_MODE2_FORM2_EDC_OFFSET))
+      errors |= LEC_EDC_ERROR;
+
+    return errors;
+
+  default:
+    return 0;
+  }
+
+  /* recalculate the parity and compare it with the stored one */
+  calc_P_parity(tmp);
+  calc_Q_parity(tmp);
+
+  if (memcmp(tmp + LEC_MODE1_P_PARITY_OFFSET,
+	     sector + LEC_MODE1_P_PARITY_OFFSET,
+	     2352 - LEC_MODE1_P_PARITY_OFFSET) != 0)
+    errors |= LEC_PARITY_ERROR;
+
+  return errors;
+}
+
+int lec_check_kernels(long count)
+{
+  static const struct {
+    LecKernel ref;
+    LecKernel kernel;
+    int cpu; /* required CPU feature: 0: none, 1: SSSE3, 2: AVX2 */
+  } variants[] = {
+    { calc_P_parity_ref, calc_P_parity, 0 },
+    { calc_Q_parity_ref, calc_Q_parity, 0 },
+    { scramble_ref, scramble, 0 },
+    { scramble_ref, scramble_wide, 0 },
+#ifdef USE_X86_LEC
+    { calc_P_parity_ref, calc_P_parity_ssse3, 1 },
+    { calc_Q_parity_ref, calc_Q_parity_ssse3, 1 },
+    { scramble_ref, scramble_ssse3, 1 },
+    { scramble_ref, scramble_avx2, 2 },
+#endif
+  };
+  int cpu = 0;
+  u_int8_t ref[2352], sector[2352];
+  u_int32_t seed = 1;
+  unsigned int v;
+  long n, i;
+  int len;
+  int errors = 0;
+
+#ifdef USE_X86_LEC
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    cpu = 2;
+  else if (__builtin_cpu_supports("ssse3"))
+    cpu = 1;
+#endif
+
+  for (n = 0; n < count; n++) {
+    for (i = 0; i < 2352; i++) {
+      seed = seed * 1103515245 + 12345;
+      ref[i] = seed >> 16;
+    }
+
+    len = (seed >> 8) % 2353;
+
+    if (calc_edc(ref, len) != calc_edc_ref(ref, len))
+      errors++;
+
+    for (v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+      if (variants[v].cpu > cpu)
+	continue;
+
+      memcpy(sector, ref, 2352);
+
+      variants[v].ref(ref);
+      variants[v].kernel(sector);
+
+      if (memcmp(sector, ref, 2352) != 0)
+	errors++;
+    }
+  }
+
+  return errors;
+}
+
 #if 0
 #include <fcntl.h>
 #include <unistd.h>
@@ -66,4 +66,69 @@ void lec_encode_mode2_form2_sector(u_int32_t adr, u_int8_t *sector);
  */
 void lec_scramble(u_int8_t *sector);
 
+/* Sector types for 'lec_encode_sectors()'.
+ */
+enum {
+  LEC_MODE0,
+  LEC_MODE1,
+  LEC_MODE2,
+  LEC_MODE2_FORM1,
+  LEC_MODE2_FORM2,
+  LEC_MODE2_FORM_MIX, /* form is taken from the sub-header of each sector */
+  LEC_ENCODED         /* sectors are already encoded, only scramble them */
+};
+
+/* Encodes and scrambles 'count' consecutive sectors of given type.
+ * 'adr' is the physical sector address of the first sector
+ * 'sectors' points to the first sector, each sector must be 2352 byte wide
+ * and contain the user data as described for the single sector functions
+ * 'stride' is the distance of the sectors in bytes, at least 2352
+ * Large batches are distributed over the threads started with
+ * 'lec_start_workers()'. May be called from several threads.
+ */
+void lec_encode_sectors(int type, u_int32_t adr, u_int8_t *sectors,
+			long count, long stride);
+
+/* Starts 'n' worker threads for 'lec_encode_sectors()', workers that
+ * were started before are stopped first.
+ * Returns the number of started threads, 0 without thread support.
+ */
+int lec_start_workers(int n);
+
+/* Stops all worker threads.
+ */
+void lec_stop_workers();
+
+/* Checks the EDC of an unscrambled sector and tries to repair it with
+ * the P/Q parity if it does not match. 'type' is one of LEC_MODE1,
+ * LEC_MODE2_FORM1, LEC_MODE2_FORM2 or LEC_MODE2_FORM_MIX, the latter takes
+ * the form from the sub-header. Form 2 sectors have no P/Q parity and can
+ * only be checked. Other types are not checked.
+ * 'sector' must be 2352 byte wide and is only changed if it could be
+ * corrected.
+ * Returns 0 if the sector is valid, 1 if it was corrected and -1 if the
+ * errors could not be corrected.
+ */
+int lec_correct_sector(int type, u_int8_t *sector);
+
+/* Error flags returned by 'lec_check_sector()'.
+ */
+enum {
+  LEC_EDC_ERROR = 0x1,   /* EDC does not match */
+  LEC_PARITY_ERROR = 0x2 /* P or Q parity does not match */
+};
+
+/* Checks the EDC and P/Q parity of an unscrambled sector without
+ * changing it. 'type' is one of the types of 'lec_correct_sector()'.
+ * Returns a combination of the error flags, 0 if the sector is valid.
+ */
+int lec_check_sector(int type, const u_int8_t *sector);
+
+/* Compares the EDC, P/Q parity and scrambling variants that are supported
+ * by the CPU with the reference implementation for 'count' random
+ * sectors.
+ * Returns the number of mismatches.
+ */
+int lec_check_kernels(long count);
+
 #endif
@@ -0,0 +1,149 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Measures the throughput of 'lec_encode_sectors()' for the data sector
+ * types with a single thread and with the worker pool. The optimized
+ * EDC, parity and scrambling code is compared with the reference
+ * implementation first.
+ *
+ * Build with 'make lecbench' in the trackdb directory.
+ * Usage: lecbench [sectors per batch] [batches] [threads]
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "lec.h"
+
+static double now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void fill(u_int8_t *sectors, long count, int form2)
+{
+  long i, j;
+
+  for (i = 0; i < count; i++) {
+    u_int8_t *p = sectors + i * 2352;
+
+    for (j = 0; j < 2352; j++)
+      p[j] = (u_int8_t)(i * 7 + j * 13);
+
+    // sub-header, every other sector is form 2 for LEC_MODE2_FORM_MIX
+    p[18] = p[22] = (form2 && (i & 1)) ? 0x20 : 0;
+  }
+}
+
+// Returns sectors per second for encoding 'batches' batches.
+static double run(int type, u_int8_t *sectors, long count, long batches)
+{
+  double t;
+  long b;
+
+  fill(sectors, count, type == LEC_MODE2_FORM_MIX);
+
+  t = now();
+
+  for (b = 0; b < batches; b++)
+    lec_encode_sectors(type, 150 + b * count, sectors, count, 2352);
+
+  t = now() - t;
+
+  return t > 0 ? count * batches / t : 0;
+}
+
+int main(int argc, char **argv)
+{
+  static const struct {
+    int type;
+    const char *name;
+  } types[] = {
+    { LEC_MODE1, "MODE1" },
+    { LEC_MODE2_FORM1, "MODE2_FORM1" },
+    { LEC_MODE2_FORM2, "MODE2_FORM2" },
+    { LEC_MODE2_FORM_MIX, "MODE2_FORM_MIX" }
+  };
+  long count = 32;
+  long batches = 2000;
+  long threads = 0;
+  u_int8_t *sectors;
+  int workers;
+  int errors;
+  unsigned int i;
+
+  if (argc > 1)
+    count = atol(argv[1]);
+  if (argc > 2)
+    batches = atol(argv[2]);
+  if (argc > 3)
+    threads = atol(argv[3]);
+
+#ifdef _SC_NPROCESSORS_ONLN
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+  if (count < 1 || batches < 1 || threads < 1) {
+    fprintf(stderr, "Usage: %s [sectors per batch] [batches] [threads]\n",
+	    argv[0]);
+    return 1;
+  }
+
+  if ((errors = lec_check_kernels(1000)) != 0) {
+    fprintf(stderr, "Kernel check failed: %d mismatches.\n", errors);
+    return 1;
+  }
+
+  printf("Kernel check passed.\n");
+
+  sectors = new u_int8_t[count * 2352];
+
+  printf("%ld sectors per batch, %ld batches\n\n", count, batches);
+  printf("%-16s %8s %14s %14s\n", "type", "threads", "sectors/s",
+	 "sectors/s/core");
+
+  for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    double r;
+
+    lec_stop_workers();
+    r = run(types[i].type, sectors, count, batches);
+    printf("%-16s %8d %14.0f %14.0f\n", types[i].name, 1, r, r);
+
+    if (threads > 1) {
+      workers = lec_start_workers(threads - 1) + 1;
+      r = run(types[i].type, sectors, count, batches);
+      printf("%-16s %8d %14.0f %14.0f\n", types[i].name, workers, r,
+	     r / workers);
+    }
+  }
+
+  lec_stop_workers();
+
+  delete[] sectors;
+
+  return 0;
+}
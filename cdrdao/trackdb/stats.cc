@@ -0,0 +1,386 @@
+/*  cdrdao - per-stage latency/throughput statistics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <string>
+
+#include "stats.h"
+#include "log.h"
+
+// Counters are kept per thread so that the hot paths never share a
+// cache line or take a lock. Each thread owns one 'StatsThread' entry
+// which is only written by that thread; the dump code reads all entries
+// without synchronization which may yield slightly inconsistent
+// snapshots but never blocks the instrumented code.
+
+// Bucket n of the latency histogram counts durations of 2^n to 2^(n+1)-1
+// micro seconds, bucket 0 also holds all durations below 1 us.
+#define STATS_BUCKETS 24
+
+// Maximum number of different keys given to 'stats_label()'.
+#define STATS_LABELS 8
+
+#ifdef __GNUC__
+#define STATS_TLS __thread
+#define statsCas(ptr, old, val) __sync_bool_compare_and_swap(ptr, old, val)
+#else
+#define STATS_TLS
+#define statsCas(ptr, old, val) (*(ptr) == (old) ? (*(ptr) = (val), 1) : 0)
+#endif
+
+struct StatsCounter {
+  unsigned long long count;
+  unsigned long long sumNs;
+  unsigned long long maxNs;
+  unsigned long long bytes;
+  unsigned long long hist[STATS_BUCKETS];
+};
+
+struct StatsThread {
+  char name[16];
+  int inUse;
+  StatsCounter stage[STAT_NOF_STAGES];
+  StatsThread *next;
+};
+
+static const char *STAGE_NAMES[STAT_NOF_STAGES] = {
+  "file_read", "lec_encode", "lec_scramble", "lec_decode", "subchan_decode",
+  "swap", "scsi_write", "scsi_read", "scsi_retry", "file_write"
+};
+
+struct StatsLabel {
+  int inUse; // 0: free, 1: being filled, 2: valid
+  char key[24];
+  char value[64];
+};
+
+static struct {
+  StatsThread *threads;  // list of all thread entries, never shrinks
+  StatsLabel labels[STATS_LABELS];
+  long long resetTime;
+  std::string output;
+  volatile sig_atomic_t dumpRequest;
+} self;
+
+static STATS_TLS StatsThread *current = NULL;
+
+static void statsSigUsr1(int)
+{
+  self.dumpRequest = 1;
+}
+
+void stats_init()
+{
+  struct sigaction act;
+
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = statsSigUsr1;
+  sigemptyset(&act.sa_mask);
+  act.sa_flags = SA_RESTART;
+
+  sigaction(SIGUSR1, &act, NULL);
+
+  self.resetTime = stats_start();
+}
+
+void stats_thread_name(const char *name)
+{
+  StatsThread *t;
+
+  if (current != NULL)
+    stats_thread_exit();
+
+  // reuse a released entry with the same name
+  for (t = self.threads; t != NULL; t = t->next) {
+    if (!t->inUse && strcmp(t->name, name) == 0 && statsCas(&t->inUse, 0, 1)) {
+      current = t;
+      return;
+    }
+  }
+
+  t = new StatsThread;
+  memset(t, 0, sizeof(*t));
+  strncpy(t->name, name, sizeof(t->name) - 1);
+  t->inUse = 1;
+
+  do {
+    t->next = self.threads;
+  } while (!statsCas(&self.threads, t->next, t));
+
+  current = t;
+}
+
+void stats_thread_exit()
+{
+  if (current != NULL) {
+    current->inUse = 0;
+    current = NULL;
+  }
+}
+
+long long stats_start()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (long long)tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+#endif
+}
+
+void stats_end(StatStage stage, long long start, long bytes)
+{
+  unsigned long long ns = stats_start() - start;
+  unsigned long long us = ns / 1000;
+  StatsCounter *c;
+  int b;
+
+  if (current == NULL)
+    stats_thread_name("main");
+
+  c = &current->stage[stage];
+
+  c->count++;
+  c->sumNs += ns;
+  c->bytes += bytes;
+  if (ns > c->maxNs)
+    c->maxNs = ns;
+
+  for (b = 0; us > 1 && b < STATS_BUCKETS - 1; b++)
+    us >>= 1;
+
+  c->hist[b]++;
+
+  if (self.dumpRequest && statsCas(&self.dumpRequest, 1, 0))
+    stats_dump("snapshot");
+}
+
+void stats_label(const char *key, const char *value)
+{
+  StatsLabel *l;
+  int i;
+
+  for (i = 0; i < STATS_LABELS; i++) {
+    l = &self.labels[i];
+
+    if (l->inUse == 2 && strcmp(l->key, key) == 0) {
+      // add 'value' unless it is already listed
+      const char *p = l->value;
+      size_t len = strlen(value);
+
+      while (p != NULL) {
+	if (strncmp(p, value, len) == 0 && (p[len] == 0 || p[len] == '+'))
+	  return;
+
+	if ((p = strchr(p, '+')) != NULL)
+	  p++;
+      }
+
+      len = strlen(l->value);
+
+      if (len + 1 < sizeof(l->value))
+	snprintf(l->value + len, sizeof(l->value) - len, "+%s", value);
+
+      return;
+    }
+  }
+
+  for (i = 0; i < STATS_LABELS; i++) {
+    l = &self.labels[i];
+
+    if (statsCas(&l->inUse, 0, 1)) {
+      strncpy(l->key, key, sizeof(l->key) - 1);
+      l->key[sizeof(l->key) - 1] = 0;
+      strncpy(l->value, value, sizeof(l->value) - 1);
+      l->value[sizeof(l->value) - 1] = 0;
+      l->inUse = 2;
+      return;
+    }
+  }
+}
+
+void stats_reset()
+{
+  StatsThread *t;
+  int i;
+
+  for (t = self.threads; t != NULL; t = t->next)
+    memset(t->stage, 0, sizeof(t->stage));
+
+  for (i = 0; i < STATS_LABELS; i++)
+    self.labels[i].inUse = 0;
+
+  self.resetTime = stats_start();
+}
+
+void stats_output(const char *file)
+{
+  self.output = file != NULL ? file : "";
+}
+
+static void statsAdd(StatsCounter *sum, const StatsCounter *c)
+{
+  int b;
+
+  sum->count += c->count;
+  sum->sumNs += c->sumNs;
+  sum->bytes += c->bytes;
+  if (c->maxNs > sum->maxNs)
+    sum->maxNs = c->maxNs;
+
+  for (b = 0; b < STATS_BUCKETS; b++)
+    sum->hist[b] += c->hist[b];
+}
+
+static void statsAppend(std::string &s, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void statsAppend(std::string &s, const char *fmt, ...)
+{
+  char buf[256];
+  va_list args;
+
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+
+  s += buf;
+}
+
+// Appends the JSON object for all non empty stages of given counters.
+static void statsStages(std::string &s, const StatsCounter *stage)
+{
+  int i, b, last;
+  int first = 1;
+
+  s += "{";
+
+  for (i = 0; i < STAT_NOF_STAGES; i++) {
+    const StatsCounter *c = &stage[i];
+
+    if (c->count == 0)
+      continue;
+
+    statsAppend(s, "%s\"%s\":{\"count\":%llu,\"total_ms\":%.3f,"
+		"\"avg_us\":%.2f,\"max_us\":%.2f,\"bytes\":%llu,"
+		"\"mb_per_s\":%.2f,\"hist_us_log2\":[",
+		first ? "" : ",", STAGE_NAMES[i], c->count, c->sumNs / 1e6,
+		c->sumNs / 1e3 / c->count, c->maxNs / 1e3, c->bytes,
+		c->sumNs > 0 ? c->bytes * 1e3 / c->sumNs : 0.0);
+    first = 0;
+
+    for (last = STATS_BUCKETS - 1; last > 0 && c->hist[last] == 0; last--)
+      ;
+
+    for (b = 0; b <= last; b++)
+      statsAppend(s, "%s%llu", b > 0 ? "," : "", c->hist[b]);
+
+    s += "]}";
+  }
+
+  s += "}";
+}
+
+void stats_dump(const char *session)
+{
+  StatsCounter total[STAT_NOF_STAGES];
+  StatsCounter named[STAT_NOF_STAGES];
+  StatsThread *t, *t1;
+  std::string s;
+  int i, first;
+
+  memset(total, 0, sizeof(total));
+
+  statsAppend(s, "{\"session\":\"%s\",\"elapsed_ms\":%.1f,",
+	      session, (stats_start() - self.resetTime) / 1e6);
+
+  first = 1;
+  for (i = 0; i < STATS_LABELS; i++) {
+    const StatsLabel *l = &self.labels[i];
+
+    if (l->inUse == 2) {
+      statsAppend(s, "%s\"%s\":\"%s\"", first ? "\"labels\":{" : ",",
+		  l->key, l->value);
+      first = 0;
+    }
+  }
+  if (!first)
+    s += "},";
+
+  s += "\"threads\":{";
+
+  // aggregate entries by thread name, in order of first appearance
+  first = 1;
+  for (t = self.threads; t != NULL; t = t->next) {
+    for (t1 = self.threads; t1 != t && strcmp(t1->name, t->name) != 0;
+	 t1 = t1->next)
+      ;
+    if (t1 != t)
+      continue; // already reported
+
+    memset(named, 0, sizeof(named));
+
+    for (t1 = t; t1 != NULL; t1 = t1->next) {
+      if (strcmp(t1->name, t->name) == 0) {
+	for (i = 0; i < STAT_NOF_STAGES; i++)
+	  statsAdd(&named[i], &t1->stage[i]);
+      }
+    }
+
+    for (i = 0; i < STAT_NOF_STAGES; i++)
+      statsAdd(&total[i], &named[i]);
+
+    statsAppend(s, "%s\"%s\":", first ? "" : ",", t->name);
+    statsStages(s, named);
+    first = 0;
+  }
+
+  s += "},\"total\":";
+  statsStages(s, total);
+  s += "}";
+
+  if (!self.output.empty()) {
+    FILE *fp = fopen(self.output.c_str(), "a");
+
+    if (fp == NULL) {
+      log_message(-2, "Cannot open statistics file \"%s\": %s",
+		  self.output.c_str(), strerror(errno));
+      return;
+    }
+
+    fprintf(fp, "%s\n", s.c_str());
+    fclose(fp);
+  }
+  else {
+    // snapshots are explicitly requested, always show them
+    log_message(strcmp(session, "snapshot") == 0 ? 0 : 3, "%s", s.c_str());
+  }
+}
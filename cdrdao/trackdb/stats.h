@@ -0,0 +1,70 @@
+/*  cdrdao - per-stage latency/throughput statistics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+// Instrumented stages of the read/write paths.
+enum StatStage {
+  STAT_FILE_READ,     // reading track data from image/audio files
+  STAT_LEC_ENCODE,    // L-EC (EDC/ECC) sector encoding
+  STAT_LEC_SCRAMBLE,  // sector scrambling
+  STAT_LEC_DECODE,    // EDC check and L-EC correction of read sectors
+  STAT_SUBCHAN_DECODE,// Q sub-channel decoding of read sectors
+  STAT_SWAP,          // audio sample byte swapping
+  STAT_SCSI_WRITE,    // WRITE commands sent to the drive
+  STAT_SCSI_READ,     // READ/READ CD commands sent to the drive
+  STAT_SCSI_RETRY,    // sleeps while waiting for a busy drive
+  STAT_FILE_WRITE,    // writing read data to the image file
+  STAT_NOF_STAGES
+};
+
+// Install the SIGUSR1 handler that requests a snapshot dump. Must be
+// called once from the main thread before any worker thread is started.
+void stats_init();
+
+// Name the calling thread. Counters are aggregated per name in the
+// summary; threads that were not named are reported as "main".
+void stats_thread_name(const char *name);
+
+// Release the calling thread's counters for reuse by a later thread
+// with the same name. Collected values are kept.
+void stats_thread_exit();
+
+// Returns a time stamp to be passed to 'stats_end()'.
+long long stats_start();
+
+// Account the time elapsed since 'start' and 'bytes' processed to the
+// given stage of the calling thread.
+void stats_end(StatStage stage, long long start, long bytes);
+
+// Record a property of the current session, e.g. the backend that was
+// used for reading files. Different values given for the same key are
+// joined with '+'. Labels are cleared by 'stats_reset()'.
+void stats_label(const char *key, const char *value);
+
+// Clear all counters.
+void stats_reset();
+
+// Write the JSON summary to given file instead of the log (verbose
+// level 3). The summaries are appended, one JSON object per line.
+void stats_output(const char *file);
+
+// Dump the JSON summary of all counters tagged with given session name.
+void stats_dump(const char *session);
+
+#endif
@@ -0,0 +1,419 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <assert.h>
+
+#include "subrw.h"
+
+#define GF6_PRIM_POLY 0x43 /* x^6 + x + 1 */
+
+#define SUBRW_Q_DATA_LEN 2  /* symbols 0-1 are covered by the Q parity */
+#define SUBRW_Q_LEN 4       /* ... which is stored in symbols 2-3 */
+#define SUBRW_P_DATA_LEN 20 /* symbols 0-19 are covered by the P parity */
+
+typedef u_int8_t gf6_t;
+
+static u_int8_t GF6_LOG[64];
+static gf6_t GF6_ILOG[126]; /* repeated so that sums of two logarithms need
+			       no modulo operation */
+
+/* Symbols that are exchanged before the packs are delayed */
+static const int SUBRW_SWAP[3][2] = { { 1, 18 }, { 2, 5 }, { 3, 23 } };
+
+/* Parity contributions of each possible value of a data symbol:
+ * q[i][v]: Q parity symbols 0 and 1 in bits 0-7 and 8-15 for value 'v' at
+ *          symbol 'i'
+ * p[i][v]: P parity symbols 0-3 in bits 0-7, ..., 24-31
+ * The parity of a pack is the XOR of the entries of all data symbols.
+ */
+static const class SubRwParityTable {
+private:
+  u_int16_t q_[SUBRW_Q_DATA_LEN][64];
+  u_int32_t p_[SUBRW_P_DATA_LEN][64];
+public:
+  SubRwParityTable();
+  ~SubRwParityTable() {}
+  const u_int16_t *q(int i) const { return q_[i]; }
+  const u_int32_t *p(int i) const { return p_[i]; }
+} SUBRW_PARITY_TABLE;
+
+static void gf6_create_log_tables()
+{
+  u_int8_t log;
+  u_int8_t b;
+
+  memset(GF6_LOG, 0, sizeof(GF6_LOG));
+
+  b = 1;
+
+  for (log = 0; log < 63; log++) {
+    GF6_LOG[b] = log;
+    GF6_ILOG[log] = b;
+    GF6_ILOG[log + 63] = b;
+
+    b <<= 1;
+
+    if ((b & 0x40) != 0)
+      b ^= GF6_PRIM_POLY;
+  }
+}
+
+static gf6_t gf6_mult(gf6_t a, gf6_t b)
+{
+  if (a == 0 || b == 0)
+    return 0;
+
+  return GF6_ILOG[GF6_LOG[a] + GF6_LOG[b]];
+}
+
+static gf6_t gf6_div(gf6_t a, gf6_t b)
+{
+  assert(b != 0);
+
+  if (a == 0)
+    return 0;
+
+  return GF6_ILOG[GF6_LOG[a] + 63 - GF6_LOG[b]];
+}
+
+/* Returns alpha^e */
+static gf6_t gf6_pow(int e)
+{
+  return GF6_ILOG[e % 63];
+}
+
+/* Determines the coefficients that give the parity symbols of a code with
+ * 'n' parity symbols at the end of a 'len' symbol code word from the data
+ * symbols. Row k of the parity check matrix H is
+ *   a^(k*(len-1)) ... a^(2*k) a^k 1
+ * For each data symbol 'i' the equation system
+ *   H[parity columns] * c = H[column i]
+ * is solved, 'coeffs[i][k]' receives the coefficient of parity symbol k.
+ */
+static void solve_parity(int len, int n, gf6_t coeffs[][4])
+{
+  gf6_t m[4][5];
+  int i, j, k, r;
+
+  for (i = 0; i < len - n; i++) {
+    for (k = 0; k < n; k++) {
+      for (j = 0; j < n; j++)
+	m[k][j] = gf6_pow(k * (n - 1 - j));
+      m[k][n] = gf6_pow(k * (len - 1 - i));
+    }
+
+    /* Gauss-Jordan elimination, H is a Vandermonde matrix so that the
+     * diagonal elements never become 0 */
+    for (j = 0; j < n; j++) {
+      gf6_t d = m[j][j];
+
+      for (k = j; k <= n; k++)
+	m[j][k] = gf6_div(m[j][k], d);
+
+      for (r = 0; r < n; r++) {
+	gf6_t f = m[r][j];
+
+	if (r == j || f == 0)
+	  continue;
+
+	for (k = j; k <= n; k++)
+	  m[r][k] ^= gf6_mult(f, m[j][k]);
+      }
+    }
+
+    for (k = 0; k < n; k++)
+      coeffs[i][k] = m[k][n];
+  }
+}
+
+SubRwParityTable::SubRwParityTable()
+{
+  gf6_t qCoeffs[SUBRW_Q_DATA_LEN][4];
+  gf6_t pCoeffs[SUBRW_P_DATA_LEN][4];
+  int i, v, k;
+
+  gf6_create_log_tables();
+
+  /* Q parity: code word of symbols 0-3 with 2 parity symbols
+   * P parity: code word of symbols 0-23 with 4 parity symbols
+   */
+  solve_parity(SUBRW_Q_LEN, 2, qCoeffs);
+  solve_parity(SUBRW_PACK_LEN, 4, pCoeffs);
+
+  for (v = 0; v < 64; v++) {
+    for (i = 0; i < SUBRW_Q_DATA_LEN; i++) {
+      q_[i][v] = gf6_mult(v, qCoeffs[i][0]) |
+	(gf6_mult(v, qCoeffs[i][1]) << 8);
+    }
+
+    for (i = 0; i < SUBRW_P_DATA_LEN; i++) {
+      p_[i][v] = 0;
+      for (k = 0; k < 4; k++)
+	p_[i][v] |= (u_int32_t)gf6_mult(v, pCoeffs[i][k]) << (8 * k);
+    }
+  }
+}
+
+static void swap_symbols(u_int8_t *pack)
+{
+  int i;
+  u_int8_t t;
+
+  for (i = 0; i < 3; i++) {
+    t = pack[SUBRW_SWAP[i][0]];
+    pack[SUBRW_SWAP[i][0]] = pack[SUBRW_SWAP[i][1]];
+    pack[SUBRW_SWAP[i][1]] = t;
+  }
+}
+
+/* Calculates the Q and P parity of a plain pack in place.
+ */
+static void encode_pack(u_int8_t *pack)
+{
+  u_int32_t p = 0;
+  u_int16_t q;
+  int i;
+
+  for (i = 0; i < SUBRW_PACK_LEN; i++)
+    pack[i] &= 0x3f;
+
+  q = SUBRW_PARITY_TABLE.q(0)[pack[0]] ^ SUBRW_PARITY_TABLE.q(1)[pack[1]];
+  pack[2] = q & 0xff;
+  pack[3] = q >> 8;
+
+  for (i = 0; i < SUBRW_P_DATA_LEN; i++)
+    p ^= SUBRW_PARITY_TABLE.p(i)[pack[i]];
+
+  pack[20] = p & 0xff;
+  pack[21] = (p >> 8) & 0xff;
+  pack[22] = (p >> 16) & 0xff;
+  pack[23] = p >> 24;
+}
+
+void subrw_encode_sectors(u_int8_t *buf, long count, long stride,
+			  unsigned long *delayIndex,
+			  u_int8_t delayLine[SUBRW_DELAY_PACKS][SUBRW_PACK_LEN])
+{
+  u_int8_t *pack;
+  long n;
+  int k, i, idx;
+
+  for (n = 0; n < count; n++, buf += stride) {
+    for (k = 0, pack = buf; k < SUBRW_PACKS_PER_SECTOR;
+	 k++, pack += SUBRW_PACK_LEN) {
+      encode_pack(pack);
+      swap_symbols(pack);
+
+      /* symbol i is delayed by (i mod 8) packs */
+      idx = *delayIndex % SUBRW_DELAY_PACKS;
+      memcpy(delayLine[idx], pack, SUBRW_PACK_LEN);
+
+      for (i = 0; i < SUBRW_PACK_LEN; i++)
+	pack[i] = delayLine[(idx - i % SUBRW_DELAY_PACKS + SUBRW_DELAY_PACKS)
+			    % SUBRW_DELAY_PACKS][i];
+
+      (*delayIndex)++;
+    }
+  }
+}
+
+/* Calculates the syndromes of a code word of 'len' symbols with 'n'
+ * parity symbols, see 'solve_parity()'.
+ * Return: 1 if all syndromes are 0, else 0
+ */
+static int syndromes(const u_int8_t *word, int len, int n, gf6_t *s)
+{
+  int i, k;
+
+  for (k = 0; k < n; k++)
+    s[k] = 0;
+
+  for (i = 0; i < len; i++) {
+    if (word[i] == 0)
+      continue;
+
+    for (k = 0; k < n; k++)
+      s[k] ^= GF6_ILOG[(GF6_LOG[word[i]] + k * (len - 1 - i)) % 63];
+  }
+
+  for (k = 0; k < n; k++) {
+    if (s[k] != 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Corrects a single symbol error of a code word with given syndromes.
+ * Return: 1 if the error was corrected, 0 if it is not correctable
+ */
+static int correct_single(u_int8_t *word, int len, int n, const gf6_t *s)
+{
+  gf6_t x;
+  int pos, k;
+
+  if (s[0] == 0 || s[1] == 0)
+    return 0;
+
+  /* a single error with value e at position i gives s[k] = e * x^k with
+   * x = a^(len-1-i) */
+  x = gf6_div(s[1], s[0]);
+  pos = len - 1 - GF6_LOG[x];
+
+  if (pos < 0)
+    return 0;
+
+  for (k = 2; k < n; k++) {
+    if (s[k] != gf6_mult(s[k - 1], x))
+      return 0;
+  }
+
+  word[pos] ^= s[0];
+
+  return 1;
+}
+
+/* Checks the P and Q parity of a deinterleaved pack and corrects a single
+ * symbol error of each code.
+ * Return: 0: pack is valid, 1: pack was corrected, -1: uncorrectable
+ */
+static int decode_pack(u_int8_t *pack)
+{
+  gf6_t s[4];
+  int ret = 0;
+
+  if (!syndromes(pack, SUBRW_PACK_LEN, 4, s)) {
+    if (!correct_single(pack, SUBRW_PACK_LEN, 4, s))
+      return -1;
+    ret = 1;
+  }
+
+  if (!syndromes(pack, SUBRW_Q_LEN, 2, s)) {
+    if (!correct_single(pack, SUBRW_Q_LEN, 2, s))
+      return -1;
+    ret = 1;
+  }
+
+  return ret;
+}
+
+long subrw_decode_sectors(const u_int8_t *raw, long stride, u_int8_t *out,
+			  long outStride, long count, long *corrected)
+{
+  u_int8_t *pack;
+  long errors = 0;
+  long n, m, src;
+  int k, i;
+
+  for (n = 0; n < count; n++, out += outStride) {
+    for (k = 0, pack = out; k < SUBRW_PACKS_PER_SECTOR;
+	 k++, pack += SUBRW_PACK_LEN) {
+      m = n * SUBRW_PACKS_PER_SECTOR + k;
+
+      /* symbol i of pack m was delayed by (i mod 8) packs */
+      for (i = 0; i < SUBRW_PACK_LEN; i++) {
+	src = m + i % SUBRW_DELAY_PACKS;
+	pack[i] = raw[(src / SUBRW_PACKS_PER_SECTOR) * stride +
+		      (src % SUBRW_PACKS_PER_SECTOR) * SUBRW_PACK_LEN + i] &
+	  0x3f;
+      }
+
+      swap_symbols(pack);
+
+      switch (decode_pack(pack)) {
+      case 1:
+	if (corrected != NULL)
+	  (*corrected)++;
+	break;
+      case -1:
+	errors++;
+	break;
+      }
+    }
+  }
+
+  return errors;
+}
+
+int subrw_check(long count)
+{
+  long len = count + SUBRW_DECODE_LOOKAHEAD;
+  u_int8_t *plain = new u_int8_t[len * SUBRW_SECTOR_LEN];
+  u_int8_t *raw = new u_int8_t[len * SUBRW_SECTOR_LEN];
+  u_int8_t *out = new u_int8_t[count * SUBRW_SECTOR_LEN];
+  u_int8_t delayLine[SUBRW_DELAY_PACKS][SUBRW_PACK_LEN];
+  unsigned long delayIndex = 0;
+  unsigned int seed = 1;
+  long corrected, errors;
+  long i, pos;
+  int failed = 0;
+  int p;
+
+  assert(count > 2);
+
+  for (i = 0; i < len * SUBRW_SECTOR_LEN; i++) {
+    seed = seed * 1103515245 + 12345;
+    plain[i] = (seed >> 16) & 0x3f;
+  }
+
+  memcpy(raw, plain, len * SUBRW_SECTOR_LEN);
+  memset(delayLine, 0, sizeof(delayLine));
+  subrw_encode_sectors(raw, len, SUBRW_SECTOR_LEN, &delayIndex, delayLine);
+
+  /* plain data with valid parity */
+  for (i = 0; i < len * SUBRW_PACKS_PER_SECTOR; i++)
+    encode_pack(plain + i * SUBRW_PACK_LEN);
+
+  corrected = 0;
+  errors = subrw_decode_sectors(raw, SUBRW_SECTOR_LEN, out, SUBRW_SECTOR_LEN,
+				count, &corrected);
+
+  if (errors != 0 || corrected != 0 ||
+      memcmp(plain, out, count * SUBRW_SECTOR_LEN) != 0)
+    failed++;
+
+  /* single symbol errors must be corrected, every raw symbol belongs to
+   * exactly one pack; the first two sectors also contain symbols of the
+   * zeroed delay line that are not decoded */
+  for (i = 0; i < count - 2; i++) {
+    seed = seed * 1103515245 + 12345;
+    pos = 2 * SUBRW_SECTOR_LEN +
+      (seed >> 8) % ((count - 2) * SUBRW_SECTOR_LEN);
+    p = ((seed >> 24) % 63) + 1;
+
+    raw[pos] ^= p;
+
+    corrected = 0;
+    errors = subrw_decode_sectors(raw, SUBRW_SECTOR_LEN, out,
+				  SUBRW_SECTOR_LEN, count, &corrected);
+
+    if (errors != 0 || corrected != 1 ||
+	memcmp(plain, out, count * SUBRW_SECTOR_LEN) != 0)
+      failed++;
+
+    raw[pos] ^= p;
+  }
+
+  delete[] plain;
+  delete[] raw;
+  delete[] out;
+
+  return failed;
+}
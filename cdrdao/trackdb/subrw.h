@@ -0,0 +1,69 @@
+/*  cdrdao - write audio CD-Rs in disc-at-once mode
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __SUBRW_H__
+#define __SUBRW_H__
+
+#include <sys/types.h>
+#include "config.h"
+
+/* The R-W sub-channel data of a sector consists of 4 packs of 24 six bit
+ * symbols, each symbol is stored in bits 5-0 of a byte (R in bit 5).
+ * Plain (cooked) packs carry the Q parity in symbols 2-3 and the P parity
+ * in symbols 20-23. On disc the parity is calculated and the symbols of a
+ * pack are spread over 8 consecutive packs.
+ */
+#define SUBRW_PACK_LEN 24
+#define SUBRW_PACKS_PER_SECTOR 4
+#define SUBRW_SECTOR_LEN (SUBRW_PACK_LEN * SUBRW_PACKS_PER_SECTOR)
+#define SUBRW_DELAY_PACKS 8
+
+/* Number of sectors following the decoded sectors that must be passed to
+ * 'subrw_decode_sectors()' because of the interleaving.
+ */
+#define SUBRW_DECODE_LOOKAHEAD 2
+
+/* Calculates the Q and P parity of the plain R-W sub-channel data of
+ * 'count' sectors in place and interleaves the packs.
+ * 'buf': 96 bytes for each sector, consecutive sectors are 'stride' bytes
+ *        apart
+ * 'delayIndex', 'delayLine': state of the interleaver, must be zeroed at
+ *        the start of the sub-channel data stream
+ */
+void subrw_encode_sectors(u_int8_t *buf, long count, long stride,
+			  unsigned long *delayIndex,
+			  u_int8_t delayLine[SUBRW_DELAY_PACKS][SUBRW_PACK_LEN]);
+
+/* Deinterleaves the R-W sub-channel data of 'count' sectors read from disc
+ * and corrects single symbol errors of each pack with the P and Q parity.
+ * The data of 'count' + SUBRW_DECODE_LOOKAHEAD sectors must be available
+ * in 'raw', consecutive sectors are 'stride' bytes apart. Bits 7 and 6
+ * (P and Q sub-channel) are ignored. The plain data is written to 'out'
+ * with 'outStride' bytes per sector.
+ * 'corrected': if not NULL the number of corrected packs is added
+ * Return: number of packs with uncorrectable errors
+ */
+long subrw_decode_sectors(const u_int8_t *raw, long stride, u_int8_t *out,
+			  long outStride, long count, long *corrected);
+
+/* Encodes 'count' sectors of pseudo random data and checks that they are
+ * restored by 'subrw_decode_sectors()', with and without single symbol
+ * errors. Return: number of failed checks
+ */
+int subrw_check(long count);
+
+#endif
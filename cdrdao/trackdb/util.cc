@@ -29,8 +29,19 @@
 #include <fcntl.h>
 #include <stdarg.h>
 
+// SIMD variants of the sample byte swapping
+#if defined(HAVE_BUILTIN_CPU_SUPPORTS) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SWAP
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON_SWAP
+#include <arm_neon.h>
+#endif
+
 #include "util.h"
 #include "Sample.h"
+#include "stats.h"
 
 char *strdupCC(const char *s)
 {
@@ -185,13 +196,126 @@ short readShort(FILE *fp)
   return ((short)c2 << 8) | (short)c1;
 }
 
-void swapSamples(Sample *buf, unsigned long len)
+// Byte swapping of audio samples: the bytes of both 16 bit values of each
+// sample are exchanged. 'dst' and 'src' may be equal, 'len' is in bytes and
+// a multiple of 4. The fastest variant supported by the CPU is selected at
+// program start.
+
+typedef void (*SwapKernel)(unsigned char *dst, const unsigned char *src,
+			   unsigned long len);
+
+static void swapScalar(unsigned char *dst, const unsigned char *src,
+		       unsigned long len)
+{
+  unsigned long i;
+  unsigned int x;
+
+  for (i = 0; i < len; i += 4) {
+    memcpy(&x, src + i, 4);
+    x = ((x & 0x00ff00ffU) << 8) | ((x >> 8) & 0x00ff00ffU);
+    memcpy(dst + i, &x, 4);
+  }
+}
+
+#ifdef USE_X86_SWAP
+__attribute__((target("ssse3")))
+static void swapSsse3(unsigned char *dst, const unsigned char *src,
+		      unsigned long len)
 {
+  const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9,
+				    6, 7, 4, 5, 2, 3, 0, 1);
   unsigned long i;
 
-  for (i = 0; i < len; i++) {
-    buf[i].swap();
+  for (i = 0; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, mask));
   }
+
+  swapScalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void swapAvx2(unsigned char *dst, const unsigned char *src,
+		     unsigned long len)
+{
+  const __m256i mask = _mm256_set_epi8(14, 15, 12, 13, 10, 11, 8, 9,
+				       6, 7, 4, 5, 2, 3, 0, 1,
+				       14, 15, 12, 13, 10, 11, 8, 9,
+				       6, 7, 4, 5, 2, 3, 0, 1);
+  unsigned long i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i v2 = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v1, mask));
+    _mm256_storeu_si256((__m256i *)(dst + i + 32),
+			_mm256_shuffle_epi8(v2, mask));
+  }
+
+  swapSsse3(dst + i, src + i, len - i);
+}
+#endif
+
+#ifdef USE_NEON_SWAP
+static void swapNeon(unsigned char *dst, const unsigned char *src,
+		     unsigned long len)
+{
+  unsigned long i;
+
+  for (i = 0; i + 16 <= len; i += 16)
+    vst1q_u8(dst + i, vrev16q_u8(vld1q_u8(src + i)));
+
+  swapScalar(dst + i, src + i, len - i);
+}
+#endif
+
+// Selects the kernel once at program start so that the reader and
+// encoder threads never race on the selection.
+static const class SwapKernelSelector {
+private:
+  SwapKernel kernel_;
+public:
+  SwapKernelSelector();
+  ~SwapKernelSelector() {}
+  void operator()(unsigned char *dst, const unsigned char *src,
+		  unsigned long len) const { kernel_(dst, src, len); }
+} SWAP_KERNEL;
+
+SwapKernelSelector::SwapKernelSelector()
+{
+#if defined(USE_X86_SWAP)
+  // required when called before 'main()'
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    kernel_ = swapAvx2;
+  else if (__builtin_cpu_supports("ssse3"))
+    kernel_ = swapSsse3;
+  else
+    kernel_ = swapScalar;
+#elif defined(USE_NEON_SWAP)
+  kernel_ = swapNeon;
+#else
+  kernel_ = swapScalar;
+#endif
+}
+
+void swapSamples(Sample *buf, unsigned long len)
+{
+  long long t = stats_start();
+
+  SWAP_KERNEL((unsigned char *)buf, (const unsigned char *)buf,
+	      len * sizeof(Sample));
+
+  stats_end(STAT_SWAP, t, len * sizeof(Sample));
+}
+
+// Copies 'len' samples from 'src' to 'dst' and swaps them on the way. The
+// time is accounted to the caller, e.g. to reading the file.
+void copySwapSamples(Sample *dst, const Sample *src, unsigned long len)
+{
+  SWAP_KERNEL((unsigned char *)dst, (const unsigned char *)src,
+	      len * sizeof(Sample));
 }
 
 unsigned char int2bcd(int d)
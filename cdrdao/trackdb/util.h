@@ -37,6 +37,7 @@ long readLong(FILE *fp);
 short readShort(FILE *fp);
 
 void swapSamples(Sample *buf, unsigned long len);
+void copySwapSamples(Sample *dst, const Sample *src, unsigned long len);
 
 unsigned char int2bcd(int);
 int bcd2int(unsigned char);